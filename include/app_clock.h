@@ -0,0 +1,26 @@
+#ifndef APP_CLOCK_H
+#define APP_CLOCK_H
+
+#include <time.h>
+
+/*clock types*/
+#define APP_CLOCK_REAL 1 /*monotonic clock, sleeps wait*/
+#define APP_CLOCK_SIMULATED 2 /*starts at zero, sleeps advance it and return at once*/
+
+/*
+ * Time of the app. Every time query and sleep of the feedback path goes
+ * through it, so a session on a fake or recorded input can run faster than
+ * real time, with the same outputs. The clock is shared by the whole process,
+ * the simulated one only moves when a sleep or app_clock_advance_us asks it.
+ * It only times the session (task duration, latencies), the processing counts
+ * frames (hold time), so the batch tool runs without it.
+ * Waits on the producer or the hardware (semaphores) stay on real time.
+ */
+void app_clock_init(char type);
+char app_clock_type(void);
+void app_clock_now(struct timespec* now);
+void app_clock_sleep_us(long us);
+void app_clock_advance_us(long us);
+double app_clock_elapsed_ms(struct timespec* from);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef ARTIFACT_DETECTION_H
+#define ARTIFACT_DETECTION_H
+
+#include "feature_structure.h"
+
+#define ARTIFACT_MAX_CHANNELS 8
+#define ARTIFACT_WINDOW 32 /*nb of frames kept in the rolling statistics*/
+
+/*rejection reasons, also used to index the counters*/
+#define ARTIFACT_NONE 0
+#define ARTIFACT_EYE_BLINK 1
+#define ARTIFACT_AMPLITUDE 2
+#define ARTIFACT_FLAT_LINE 3
+#define ARTIFACT_LINE_NOISE 4
+#define ARTIFACT_MUSCLE 5
+#define ARTIFACT_OUT_OF_TOLERANCE 6
+#define NB_ARTIFACT_REASONS 7
+
+/*
+ * Rolling mean/variance over the last ARTIFACT_WINDOW values, updated in
+ * constant time (Welford over a circular buffer, recomputed each time the
+ * buffer wraps so the rounding doesn't build up)
+ */
+typedef struct rolling_stat_s{
+	double values[ARTIFACT_WINDOW];
+	double mean;
+	double m2; /*sum of the squared deviations from the mean*/
+	int idx;
+	int count;
+}rolling_stat_t;
+
+/*
+ * Power of a checked channel, from its fft bins or from the band power
+ */
+typedef struct channel_power_s{
+	double total; /*broadband, bins 1 and up*/
+	double line; /*mains frequency bin*/
+	double muscle; /*muscle band, without the mains bin*/
+}channel_power_t;
+
+typedef struct artifact_detect_s{
+
+	/*to be set before init*/
+	char enabled;
+	int nb_channels; /*nb of channels to check*/
+	int channels[ARTIFACT_MAX_CHANNELS]; /*index of the channels to check*/
+	int channel_width; /*nb of fft bins per channel*/
+	double bin_width; /*frequency resolution of a bin (Hz)*/
+	double line_freq; /*mains frequency (Hz)*/
+	double amplitude_z_max; /*broadband power z-score above which a frame is rejected*/
+	double flat_var_min; /*broadband power variance under which a channel is flat*/
+	double line_ratio_max; /*max fraction of the power at the mains frequency*/
+	double muscle_ratio_max; /*max fraction of the power in the muscle band*/
+
+	/*set during init*/
+	int line_bin;
+	int muscle_bin_start;
+	int muscle_bin_end;
+
+	/*rolling statistics, per channel*/
+	rolling_stat_t all_power[ARTIFACT_MAX_CHANNELS]; /*every frame, for flat-line*/
+	rolling_stat_t clean_power[ARTIFACT_MAX_CHANNELS]; /*accepted frames, for outliers*/
+	int nb_amplitude_run; /*amplitude rejections in a row*/
+
+	/*rejection counters, per reason*/
+	unsigned long nb_frames;
+	unsigned long counters[NB_ARTIFACT_REASONS];
+
+}artifact_detect_t;
+
+int init_artifact_detection(artifact_detect_t* artifact);
+int detect_artifact(artifact_detect_t* artifact, frame_info_t* frame_info, double* feature_array);
+int detect_artifact_power(artifact_detect_t* artifact, frame_info_t* frame_info, channel_power_t* power);
+void count_artifact(artifact_detect_t* artifact, int reason);
+const char* artifact_reason_str(int reason);
+void print_artifact_stats(artifact_detect_t* artifact);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef BAND_POWER_H
+#define BAND_POWER_H
+
+#include "artifact_detection.h"
+
+#define BAND_MAX_CHANNELS 4 /*nb of channels tracked*/
+#define BAND_MAX_WIDTH 1024 /*longest window (samples)*/
+#define BAND_MAX_BINS 48 /*nb of bins tracked per channel*/
+#define BAND_RESYNC_FRAMES 100 /*frames slid before the bins are computed again, bounds rounding drift*/
+
+/*
+ * Sliding DFT of a channel, on the bins tracked only
+ */
+typedef struct band_channel_s{
+	double window[BAND_MAX_WIDTH]; /*last window, oldest sample first*/
+	double sum; /*of the window samples*/
+	double sum_sq; /*of their squares*/
+	double re[BAND_MAX_BINS];
+	double im[BAND_MAX_BINS];
+	int nb_slid; /*frames slid since the last resync, -1 before the first window*/
+}band_channel_t;
+
+/*
+ * Band power computed in the app from the timeseries section. Each frame only
+ * brings hop new samples per channel, the tracked bins are slid over them
+ * (X = (X + x_new - x_old).e^(j.2pi.k/N)), at a cost proportional to the bins
+ * and not to the window. The bins are computed again with Goertzel when a
+ * window doesn't follow the previous one (frame lost, first frame).
+ */
+typedef struct band_power_s{
+
+	/*to be set before init*/
+	int nb_channels; /*nb of channels tracked*/
+	int channels[BAND_MAX_CHANNELS]; /*index of the channels in the timeseries section*/
+	int window_width; /*samples per channel and window*/
+	int hop; /*new samples per frame (sampling rate over frame rate)*/
+	int nb_bins;
+	int bins[BAND_MAX_BINS]; /*bins tracked, see track_band_bins*/
+
+	/*set during init*/
+	int slot[BAND_MAX_WIDTH/2+1]; /*position of a bin in bins, -1 if not tracked*/
+	double cos_w[BAND_MAX_BINS];
+	double sin_w[BAND_MAX_BINS];
+	band_channel_t channel[BAND_MAX_CHANNELS];
+	unsigned long nb_slides; /*frames updated incrementally*/
+	unsigned long nb_syncs; /*frames computed again*/
+
+}band_power_t;
+
+int track_band_bins(band_power_t* band, int first_bin, int last_bin);
+int init_band_power(band_power_t* band);
+void update_band_power(band_power_t* band, double* timeseries);
+double get_band_power(band_power_t* band, int channel, int first_bin, int last_bin);
+void get_band_artifact_power(band_power_t* band, artifact_detect_t* artifact, channel_power_t* power);
+
+#endif
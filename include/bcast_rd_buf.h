@@ -0,0 +1,17 @@
+#ifndef BCAST_RD_BUF_H
+#define BCAST_RD_BUF_H
+
+#include "feature_structure.h"
+#include "feature_input.h"
+
+#define BCAST_SHM_KEY 7806 /*key of the broadcast ring*/
+
+int bcast_rd_init(void *param);
+int bcast_rd_request(void *param);
+int bcast_rd_wait_for_request_completed(void *param);
+frame_info_t* bcast_get_frame_info_ref(void *param);
+double* bcast_get_feature_array_ref(void *param);
+int bcast_rd_get_batch(void *param, feature_page_view_t *views, int max_views);
+int bcast_rd_cleanup(void *param);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef BCAST_RING_H
+#define BCAST_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "feature_structure.h"
+
+#define BCAST_MAGIC 0x54534342 /*"BCST"*/
+#define BCAST_VERSION 1
+#define BCAST_MAX_READERS 8
+#define BCAST_MAX_DEPTH 256
+#define BCAST_ALIGNMENT 64
+
+/*read results, on top of EXIT_SUCCESS/EXIT_FAILURE*/
+#define BCAST_TIMEOUT 2 /*no page within the timeout*/
+#define BCAST_EMPTY 3 /*no page, non blocking read*/
+
+#define BCAST_WAIT_FOREVER -1
+#define BCAST_NO_WAIT 0
+
+/*
+ * Reader slot, one cache line each. Written by its reader only,
+ * the producer never looks at it: a slow reader can't hold it back.
+ */
+typedef struct bcast_reader_s{
+	int32_t pid; /*0 when free*/
+	uint32_t cursor; /*next page to read*/
+	uint32_t nb_read;
+	uint32_t nb_lost; /*pages overwritten before they were read*/
+}__attribute__((aligned(BCAST_ALIGNMENT))) bcast_reader_t;
+
+/*
+ * Broadcast ring, at the beginning of its own segment, the pages follow it.
+ * Page n goes in slot n%depth:
+ *  - the producer sets seq[slot] to 2n+1, writes the page, sets it to 2n+2,
+ *    then publishes head=n+1 and wakes the readers sleeping on head
+ *  - a reader copies page n out of the ring and keeps the copy only if the
+ *    slot still holds 2n+2 afterwards, otherwise it was overwritten
+ *  - a reader lapped by the producer skips to the oldest page left and
+ *    counts the pages lost
+ * A restarted producer keeps head going, the readers resync if it went back.
+ */
+typedef struct bcast_header_s{
+	uint32_t magic;
+	uint32_t version;
+	int32_t nb_features;
+	int32_t buffer_depth;
+	int32_t feat_offset; /*offset of the feature array in a page*/
+	int32_t page_stride; /*distance between two pages*/
+	int32_t producer_pid;
+
+	uint32_t head __attribute__((aligned(BCAST_ALIGNMENT))); /*pages published, futex word*/
+	uint32_t nb_waiters __attribute__((aligned(BCAST_ALIGNMENT))); /*readers sleeping on head*/
+
+	uint32_t seq[BCAST_MAX_DEPTH] __attribute__((aligned(BCAST_ALIGNMENT)));
+	bcast_reader_t readers[BCAST_MAX_READERS];
+}bcast_header_t;
+
+typedef struct bcast_s{
+
+	/*to be set before create (producer) or attach (reader)*/
+	int shm_key;
+	int nb_features; /*producer, readers get it from the ring*/
+	int buffer_depth; /*producer, readers get it from the ring*/
+
+	/*set during create/attach*/
+	int shmid;
+	bcast_header_t* header;
+	char* pages;
+	int feat_offset;
+	int page_stride;
+	int reader; /*reader slot, -1 for the producer*/
+	uint32_t cursor; /*next page to read, or to write for the producer*/
+
+}bcast_t;
+
+int bcast_create(bcast_t* bcast);
+char* bcast_begin_page(bcast_t* bcast);
+void bcast_publish_page(bcast_t* bcast);
+int bcast_attach(bcast_t* bcast);
+int bcast_read(bcast_t* bcast, frame_info_t* frame_info, double* feature_array, int timeout_ms);
+int bcast_available(bcast_t* bcast);
+int bcast_detach(bcast_t* bcast);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef BUZZER_OUTPUT_H
+#define BUZZER_OUTPUT_H
+
+/*
+ * Tone output of the app. buzzer_lib owns the buzzer pin (its soft tone is
+ * created by setup_buzzer_lib) and drives the beep modes. The feedback pitch
+ * comes from the app's pitch table, in Hz, and is written to the pin set up by
+ * buzzer_lib, so no other module touches the pin.
+ */
+void setup_buzzer(void);
+void set_buzzer_pitch(int pitch);
+void mute_buzzer(void);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CALIBRATION_STORE_H
+#define CALIBRATION_STORE_H
+
+#include <stdint.h>
+
+#define CALIB_STORE_MAGIC 0x4C414342 /*"BCAL"*/
+#define CALIB_STORE_VERSION 2 /*IAF added*/
+#define CALIB_STORE_MAX_RECORDS 16 /*the least recently updated record is replaced*/
+#define CALIB_ID_LENGTH 32
+
+/*
+ * Reference of a training, stored per user and device.
+ * A record is reused only on the same measurement: calibration mode,
+ * band source, fixed or IAF band and feature layout.
+ */
+typedef struct calib_record_s{
+
+	/*key*/
+	char user[CALIB_ID_LENGTH];
+	char device[CALIB_ID_LENGTH]; /*host name*/
+
+	/*measurement the reference was taken on*/
+	int32_t calibration; /*CALIBRATION_* mode*/
+	int32_t band_source; /*BAND_SOURCE_**/
+	int32_t nb_channels;
+	int32_t window_width;
+	int32_t iaf; /*band recentred on the IAF*/
+	int32_t reserved0;
+	double sampling_rate;
+
+	/*reference, left and right (median and scaled MAD in the robust calibration)*/
+	double mean[2];
+	double std_dev[2];
+	double iaf_freq; /*peak the band was centred on (Hz), 0 on the fixed band*/
+	int32_t nb_samples; /*training samples behind the reference, refinements included*/
+	int32_t nb_refinements; /*short trainings merged since the full one*/
+	int64_t trained_time; /*full training, seconds since epoch*/
+	int64_t update_time; /*last training or refinement*/
+
+	uint32_t checksum; /*of the record up to this field*/
+	uint32_t reserved;
+
+}calib_record_t;
+
+/*
+ * File: the header then nb_records records. It is written to a temporary
+ * file renamed over the store, so a power cut leaves the old or the new store.
+ */
+typedef struct calib_store_header_s{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nb_records;
+	uint32_t record_size;
+}calib_store_header_t;
+
+void init_calib_record(calib_record_t* record, const char* user);
+int calib_store_load(const char* path, calib_record_t* record);
+int calib_store_save(const char* path, calib_record_t* record);
+double calib_record_age(calib_record_t* record);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef CONFIG_WATCHER_H
+#define CONFIG_WATCHER_H
+
+#include <pthread.h>
+
+#include "xml.h"
+
+#define CONFIG_POLL_MS 500 /*how often the watcher checks if it must stop*/
+
+/*
+ * Watches the config file and re-parses it on change, off the
+ * processing path. A new config is handed over through a single
+ * pointer slot, exchanged atomically on both sides.
+ *
+ * What a new config changes, from the next session:
+ *  - pitch map and smoothing filter, rebuilt
+ *  - feature input, attached again if its geometry changed
+ *  - processing, calibration, recording and task elements, read per session
+ * The hardware, clock, live state, metrics and flight recorder elements are
+ * read at startup only, their changes are reported and wait for a restart.
+ */
+typedef struct config_watcher_s{
+
+	/*to be set before init*/
+	char* filename; /*config file to watch*/
+
+	/*set during init*/
+	int inotify_fd;
+	int watch_fd; /*the directory is watched, editors replace the file*/
+	char directory[MAX_PATH_LENGTH];
+	const char* basename; /*file name within the directory*/
+	pthread_t thread;
+	char running;
+
+	/*last parsed config, not taken yet (NULL if none)*/
+	appconfig_t* pending;
+	unsigned int nb_reloads;
+
+}config_watcher_t;
+
+int init_config_watcher(config_watcher_t* watcher);
+appconfig_t* take_new_config(config_watcher_t* watcher);
+char config_changes_geometry(appconfig_t* old_config, appconfig_t* new_config);
+void report_startup_only_changes(appconfig_t* old_config, appconfig_t* new_config);
+int stop_config_watcher(config_watcher_t* watcher);
+
+#endif
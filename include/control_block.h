@@ -0,0 +1,78 @@
+#ifndef CONTROL_BLOCK_H
+#define CONTROL_BLOCK_H
+
+#include <stdint.h>
+
+#define CONTROL_BLOCK_MAGIC 0x4C54434E /*"NCTL"*/
+#define CONTROL_BLOCK_VERSION 1
+
+/*state of each side*/
+#define PEER_ABSENT 0 /*never attached, or detached*/
+#define PEER_STARTING 1 /*attached, initializing*/
+#define PEER_READY 2 /*initialized, pages will be produced/consumed*/
+#define PEER_STOPPING 3 /*about to detach*/
+
+/*activity of the app, zero is what older apps leave in the block*/
+#define APP_ACTIVE 0 /*frames are consumed*/
+#define APP_IDLE 1 /*between sessions, no frame is wanted*/
+
+#define CONTROL_WAIT_SLICE_MS 10 /*polling period when the other side does not wake us*/
+#define CONTROL_BLOCK_SIZE 4096 /*segment size, the block only grows at its end*/
+
+/*
+ * Control block, a small segment of its own shared with the producer
+ * (data_preprocessing). It holds the readiness handshake:
+ *  - each side writes its pid then its state, state words are 32 bits,
+ *    written atomically (release) and the other side is woken with FUTEX_WAKE
+ *  - the producer sets PEER_READY once it is about to write its first page,
+ *    increments its heartbeat for each page written and its dropped count
+ *    for each frame it could not write (no free page)
+ *  - a producer that does not know the block never sets its state, the app
+ *    then falls back on its ready timeout. data_preprocessing does not set
+ *    PEER_READY yet, so for now the app always waits ready_timeout
+ *
+ * and the acquisition duty cycle:
+ *  - the app sets APP_IDLE while it waits for a session, the producer can
+ *    pause its fft until APP_ACTIVE (woken with FUTEX_WAKE on app_activity)
+ *  - the app declares the frame rate it wants, the producer can decimate
+ *    down to it and reports the rate it produces
+ *  - these fields were added at the end, zero keeps the behaviour of the
+ *    peers that don't know them (active, producer's own rate)
+ */
+typedef struct control_block_s{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t producer_state; /*PEER_* of data_preprocessing*/
+	uint32_t app_state; /*PEER_* of this app*/
+	int32_t producer_pid;
+	int32_t app_pid;
+	uint32_t producer_heartbeat; /*nb of pages written*/
+	uint32_t app_heartbeat; /*nb of pages read*/
+	uint32_t producer_dropped; /*nb of frames dropped, no free page*/
+	uint32_t app_activity; /*APP_ACTIVE or APP_IDLE*/
+	uint32_t app_frame_rate; /*frame rate wanted (mHz), 0 for the producer's own*/
+	uint32_t producer_frame_rate; /*frame rate produced (mHz), 0 if not reported*/
+}control_block_t;
+
+typedef struct control_s{
+
+	/*to be set before init*/
+	int shm_key;
+
+	/*set during init*/
+	int shmid;
+	control_block_t* block;
+
+}control_t;
+
+int control_init(control_t* control);
+void control_set_app_state(control_t* control, uint32_t state);
+uint32_t control_get_producer_state(control_t* control);
+uint32_t control_get_producer_dropped(control_t* control);
+void control_set_app_activity(control_t* control, uint32_t activity);
+void control_request_frame_rate(control_t* control, double frame_rate);
+double control_get_producer_frame_rate(control_t* control);
+int control_wait_producer_ready(control_t* control, int timeout_ms);
+int control_cleanup(control_t* control);
+
+#endif
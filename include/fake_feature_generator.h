@@ -15,6 +15,7 @@ int fake_feat_gen_request(void *param);
 int fake_feat_gen_wait_for_request_completed(void *param);
 frame_info_t* fake_feat_gen_frame_info_ref(void *param);
 double* fake_feat_gen_feature_array_ref(void *param);
+int fake_feat_gen_get_batch(void *param, feature_page_view_t *views, int max_views);
 int fake_feat_gen_cleanup(void *param);
 
 #endif
@@ -2,63 +2,169 @@
 #ifndef FEATURE_INPUT_H
 #define FEATURE_INPUT_H
 
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #include "feature_structure.h"
+#include "session_file.h"
+#include "bcast_ring.h"
 
+/*
+ * The interface functions are held by each feature input,
+ * so several inputs can be used at once (one per thread)
+ */
 #define INIT_FEAT_INPUT_FC(param) \
-		_INIT_FEAT_INPUT_FC(param)
-		
+		((param)->init_fc(param))
+
 #define REQUEST_FEAT_FC(param) \
-		_REQUEST_FEAT_FC(param)
-		
+		((param)->request_fc(param))
+
 #define WAIT_FEAT_FC(param) \
-		_WAIT_FEAT_FC(param)
-		
+		((param)->wait_fc(param))
+
 #define GET_FRAME_INFO_FC(param) \
-		_GET_FRAME_INFO_FC(param)
-		
+		((param)->get_frame_info_fc(param))
+
 #define GET_FVECT_INFO_FC(param) \
-		_GET_FVECT_INFO_FC(param)
-		
-#define TERMINATE_FEAT_INPUT_FC() \
-		_TERMINATE_FEAT_INPUT_FC(NULL)
-		
-typedef int (*functionPtr_t) (void *);
-functionPtr_t _INIT_FEAT_INPUT_FC;
-functionPtr_t _REQUEST_FEAT_FC;
-functionPtr_t _WAIT_FEAT_FC;
-functionPtr_t _TERMINATE_FEAT_INPUT_FC;
+		((param)->get_fvect_fc(param))
+
+#define TERMINATE_FEAT_INPUT_FC(param) \
+		((param)->terminate_fc(param))
 
+/*wait return value, on top of EXIT_SUCCESS/EXIT_FAILURE: no page within the stall timeout*/
+#define FEAT_INPUT_STALLED 2
+#define STALL_RETRY_MS 250 /*wait slices while the producer is silent*/
+
+/*non blocking, views on all the pages completed since the last call*/
+#define GET_FEAT_BATCH_FC(param, views, max_views) \
+		((param)->get_batch_fc(param, views, max_views))
+
+typedef int (*functionPtr_t) (void *);
 typedef frame_info_t* (*get_frame_ptr_t) (void *);
 typedef double* (*get_fvect_ptr_t) (void *);
 
-get_frame_ptr_t _GET_FRAME_INFO_FC;
-get_fvect_ptr_t _GET_FVECT_INFO_FC;
+/*
+ * View on a page handed out by the batch interface, valid
+ * until the next call to the batch interface
+ */
+typedef struct feature_page_view_s{
+	frame_info_t* frame_info;
+	double* feature_array;
+}feature_page_view_t;
+
+typedef int (*get_batch_ptr_t) (void *, feature_page_view_t *, int);
+
+/*page layouts*/
+#define LAYOUT_PACKED 1 /*frame info and features back to back, no header*/
+#define LAYOUT_ALIGNED 2 /*pages and feature arrays on cache lines, layout header*/
+#define PAGE_ALIGNMENT 64 /*cache line, also covers the widest vector load*/
+
+/*page formats, type of the features written by the producer*/
+#define PAGE_FLOAT64 1
+#define PAGE_FLOAT32 2 /*widened to doubles when handed out*/
 
-//frame_info_t* shm_get_frame_info_ref(void *param);
-//double* shm_get_feature_array_ref(void *param);
+/*shared segment backings*/
+#define SHM_BACKING_SYSV 1
+#define SHM_BACKING_POSIX 2
+#define HUGEPAGE_SIZE (2*1024*1024)
+#define HUGEPAGE_MOUNT "/dev/hugepages"
+
+#define SHM_LAYOUT_MAGIC 0x544C4E42 /*"BNLT"*/
+#define SHM_LAYOUT_VERSION 1 /*double features*/
+#define SHM_LAYOUT_VERSION_FORMAT 2 /*feature size in the header*/
+
+/*
+ * Header at the beginning of an aligned segment. The first side to attach
+ * writes its layout, the other one checks it and adopts the page geometry.
+ * It takes a full cache line, so the first page stays aligned. Version 1
+ * headers (doubles) are still written for float64 pages, for older producers.
+ */
+typedef struct shm_layout_s{
+	uint32_t magic;
+	uint32_t version;
+	int32_t nb_features;
+	int32_t buffer_depth;
+	int32_t feat_offset; /*offset of the feature array in a page*/
+	int32_t page_stride; /*distance between two pages*/
+	int32_t feature_size; /*bytes per feature, version 2 only*/
+}__attribute__((aligned(PAGE_ALIGNMENT))) shm_layout_t;
+
+/*reference to a page of the buffer*/
+#define PAGE_REF(input, page) \
+		(&((input)->shm_buf[(input)->pages_offset+(page)*(input)->page_stride]))
 
 
 typedef struct feature_input_s{
-	
+
+	/*interface functions, set by init_feature_input*/
+	functionPtr_t init_fc;
+	functionPtr_t request_fc;
+	functionPtr_t wait_fc;
+	functionPtr_t terminate_fc;
+	get_frame_ptr_t get_frame_info_fc;
+	get_fvect_ptr_t get_fvect_fc;
+	get_batch_ptr_t get_batch_fc;
+
 	/*options to be set for initialization*/
 	int shm_key;
 	int sem_key;
-	
+	int bcast_key; /*broadcast ring (BCAST input)*/
+	char* file_path; /*recorded session to read (FILE input)*/
+	double replay_start; /*time of the session to start from (s) (FILE input)*/
+	unsigned int seed; /*random generator state (FAKE input)*/
+	char layout; /*LAYOUT_PACKED or LAYOUT_ALIGNED*/
+	char page_format; /*PAGE_FLOAT64 or PAGE_FLOAT32, the aligned layout adopts the producer's*/
+	char shm_backing; /*SHM_BACKING_SYSV or SHM_BACKING_POSIX (SHM input)*/
+	char* shm_name; /*name of the POSIX segment*/
+	char* sock_path; /*producer socket (SOCK input)*/
+	char shm_hugepages; /*back the segment with huge pages*/
+	double stall_timeout; /*producer silence before a wait gives up (s), 0 waits forever*/
+
 	/*filled during initialization*/
 	int shmid; /*id of the shared memory array*/
+	int shm_fd; /*descriptor of the POSIX segment*/
+	size_t shm_size; /*mapped size of the segment*/
 	char* shm_buf; /*pointer to the beginning of the shared buffer*/
 	int semid; /*id of semaphore set*/
 	struct sembuf *sops; /* pointer to operations to perform */
-	
+	session_file_t session; /*recorded session (FILE input)*/
+	bcast_t bcast; /*broadcast ring (BCAST input)*/
+	int sock_fd; /*connection to the producer, -1 when not connected (SOCK input)*/
+	int done_fd; /*eventfd of the pages completed, epoll friendly*/
+	int request_fd; /*eventfd of the pages requested*/
+	int epoll_fd; /*done eventfd and connection*/
+	unsigned long nb_ready; /*pages signalled, not handed out yet*/
+
 	int current_page; /*identification of the current page*/
+	int nb_pending; /*pages handed out by the last batch, not released yet*/
+	char batch_armed; /*the producer was allowed to fill the whole buffer*/
+	struct timespec batch_time; /*time of the last batch (FAKE input)*/
+
+	/*producer stall detection (SHM input)*/
+	char stalled; /*the producer is silent, attach again when it is back*/
+	struct timespec stall_time; /*when the silence was detected*/
+	unsigned long nb_stalls;
+	double recovery_ms; /*time to recover from the last stall, set by the first page after it*/
 	
 	int nb_features; /*number of single features*/
-	int page_size; /*size of a single page*/
+	int page_size; /*size of a single page (frame info and features)*/
+	int feat_offset; /*offset of the feature array in a page*/
+	int page_stride; /*distance between two pages, page size plus padding*/
+	int pages_offset; /*offset of the first page in the buffer (layout header)*/
+	int feature_size; /*bytes per feature in the pages*/
+	double* widened; /*float32 pages widened, one feature array per page*/
 	int buffer_depth; /*nomber of page in the buffer*/
-	
+
 }feature_input_t;
 
 int init_feature_input(char input_type, feature_input_t* feature_input);
+int set_page_layout(feature_input_t* feature_input);
+void* alloc_pages(feature_input_t* feature_input);
+int alloc_widened(feature_input_t* feature_input);
+double* page_features(feature_input_t* feature_input, int page);
+int report_input_stall(feature_input_t* feature_input);
+void report_input_recovery(feature_input_t* feature_input);
 
 
 #endif
@@ -0,0 +1,13 @@
+#ifndef FEATURE_KERNELS_H
+#define FEATURE_KERNELS_H
+
+/*
+ * Conversions between float32 pages and the double feature arrays of the app,
+ * vectorized with SSE2 (x86) or NEON (aarch64, armv7 has no double vectors),
+ * scalar otherwise. Arrays don't need to be aligned.
+ */
+void widen_features(const float* src, double* dst, int nb_features);
+void narrow_features(const double* src, float* dst, int nb_features);
+const char* feature_kernels_path(void);
+
+#endif
@@ -1,28 +1,81 @@
 #ifndef TRAIN_SET_ACQ_H
 #define TRAIN_SET_ACQ_H
 
+#include <time.h>
+
 #include "feature_structure.h"
 #include "feature_input.h"
+#include "artifact_detection.h"
+#include "session_file.h"
+#include "metrics.h"
+#include "band_power.h"
+#include "live_state.h"
+#include "iaf_tracker.h"
 
+/*status of the sample returned by get_normalized_sample*/
+#define SAMPLE_VALID 0x00 /*computed from the current frame*/
+#define SAMPLE_HELD 0x01 /*frame rejected, filled in from the last valid sample*/
+#define SAMPLE_EXPIRED 0x02 /*frame rejected beyond the max hold time, neutral value*/
+#define SAMPLE_NO_FRAME 0x03 /*the input failed (end of a recorded session), no update*/
+#define SAMPLE_STALLED 0x04 /*the producer is silent, the input is looking for it, no update*/
 
 typedef struct feat_proc_s{
 	
 	/*to be set before init*/
 	int nb_train_samples;
 	feature_input_t* feature_input;
+	artifact_detect_t artifact; /*detectors settings, see artifact_detection.h*/
+	char hold_policy; /*HOLD_LAST_VALUE or HOLD_DECAY, see xml.h*/
+	double max_hold_time; /*seconds a rejected frame can be filled in*/
+	double frame_rate; /*frames per second, the hold time is counted in frames*/
+	char calibration; /*CALIBRATION_MEAN_STD or CALIBRATION_MEDIAN_MAD, see xml.h*/
+	char warm_start; /*mean, std_dev and the IAF peak hold a stored reference, refined by nb_train_samples (0 skips the training)*/
+	int nb_prior_samples; /*weight of the stored reference in the refinement*/
+	session_file_t* recorder; /*if set, every frame read is recorded*/
+	metrics_t* metrics; /*if set, frames and latencies are counted*/
+	live_state_t* live; /*if set, training progress and reference are published*/
+	int fft_offset; /*start of the fft section in the feature array*/
+	band_power_t* band_power; /*if set, band values are computed from the timeseries section*/
+	iaf_tracker_t* iaf; /*if set, the band is recentred on the individual alpha frequency*/
+	char verbose; /*training progress on console*/
 	
-	/*set during training*/
+	/*set during training (median and scaled MAD in the robust calibration)*/
 	double mean[2];
 	double std_dev[2];
 	
 	/*current sample value, set during get_normalized_sample*/
 	double sample;
+	char sample_status;
+	
+	/*last valid sample, used to fill in rejected frames*/
+	double last_valid_sample;
+	unsigned long nb_frames_held; /*frames rejected since the last valid one*/
+	unsigned long nb_held;
+	unsigned long nb_expired;
+	
+	/*last frame, kept for the flight recorder*/
+	double band_value[2]; /*band values of the last frame past the detectors (left, right)*/
+	int reject_reason; /*ARTIFACT_* reason*/
+	char eye_blink;
+	struct timespec request_time; /*frame requested*/
+	struct timespec frame_time; /*frame available*/
+	struct timespec processed_time; /*sample normalized*/
+	
+	/*bins of the last frame measured, when the band follows the IAF (left, right)*/
+	double iaf_bins[2][IAF_MAX_BINS];
+	
+	/*frames read since init, time the first one arrived*/
+	unsigned long nb_acquired;
+	struct timespec first_frame_time;
 		
 }feat_proc_t; 
 
 int init_feat_processing(feat_proc_t* feature_proc);
-void train_feat_processing(feat_proc_t* feature_proc);
+int train_feat_processing(feat_proc_t* feature_proc);
 int get_normalized_sample(feat_proc_t* feature_proc);
+int copy_next_frame(feat_proc_t* feature_proc, frame_info_t* frame_info, double* feature_array);
+int normalize_frame(feat_proc_t* feature_proc, frame_info_t* frame_info, double* feature_array);
+void print_feat_processing_stats(feat_proc_t* feature_proc);
 int clean_up_feat_processing(feat_proc_t* feature_proc);
 
 #endif
@@ -0,0 +1,16 @@
+
+#ifndef FILE_FEAT_READER_H
+#define FILE_FEAT_READER_H
+
+#include "feature_input.h"
+#include "feature_structure.h"
+
+int file_feat_rd_init(void *param);
+int file_feat_rd_request(void *param);
+int file_feat_rd_wait_for_request_completed(void *param);
+frame_info_t* file_feat_rd_frame_info_ref(void *param);
+double* file_feat_rd_feature_array_ref(void *param);
+int file_feat_rd_get_batch(void *param, feature_page_view_t *views, int max_views);
+int file_feat_rd_cleanup(void *param);
+
+#endif
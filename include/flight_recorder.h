@@ -0,0 +1,75 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define FLIGHT_DIR_LENGTH 256
+
+#define FLIGHT_MIN_RECORDS 64
+#define MAX_FLIGHT_PATH 320
+#define FLIGHT_DUMP_INTERVAL 10 /*min time between two automatic dumps (s)*/
+
+/*dump reasons*/
+#define FLIGHT_DUMP_LATENCY 1 /*loop latency above the threshold*/
+#define FLIGHT_DUMP_REJECTIONS 2 /*too many rejected frames in a row*/
+#define FLIGHT_DUMP_SIGNAL 3 /*SIGUSR2*/
+
+/*
+ * One task loop iteration. Times are relative to the start of the
+ * iteration, kept small so a record is a handful of stores.
+ */
+typedef struct flight_record_s{
+	unsigned long seq; /*index+1 once written, 0 while being written*/
+	uint64_t start_ns; /*monotonic time the iteration started*/
+	uint32_t acquire_us; /*frame available*/
+	uint32_t process_us; /*sample normalized*/
+	uint32_t feedback_us; /*buzzer updated*/
+	uint32_t loop_us; /*end of the iteration*/
+	float band[2]; /*band values extracted from the frame (left, right)*/
+	float sample; /*normalized sample*/
+	float smoothed; /*smoothed sample*/
+	int16_t pitch; /*buzzer command (Hz)*/
+	char eye_blink; /*from the frame info*/
+	char sample_status; /*SAMPLE_* status*/
+	char reject_reason; /*ARTIFACT_* reason*/
+}flight_record_t;
+
+/*
+ * The loop is the only writer, each slot is guarded by its sequence
+ * so the dumper thread can copy the ring without ever blocking it.
+ */
+typedef struct flight_recorder_s{
+
+	/*to be set before init*/
+	char dump_dir[FLIGHT_DIR_LENGTH]; /*copied, the config can be replaced*/
+	double duration; /*seconds kept*/
+	double frame_rate; /*Hz*/
+	double latency_threshold; /*loop latency that triggers a dump (ms), 0 disables*/
+	int reject_threshold; /*rejected frames in a row that trigger a dump, 0 disables*/
+
+	/*set during init*/
+	flight_record_t* records;
+	unsigned long nb_records; /*power of 2*/
+	unsigned long head; /*records written since init*/
+
+	/*triggers*/
+	int nb_rejected; /*rejected frames in a row*/
+	uint64_t last_dump_ns;
+	char dump_reason;
+	sem_t dump_request;
+	unsigned long nb_dumps;
+
+	/*dumper thread*/
+	pthread_t thread;
+	char running;
+
+}flight_recorder_t;
+
+int init_flight_recorder(flight_recorder_t* recorder);
+void flight_record(flight_recorder_t* recorder, flight_record_t* record);
+void flight_trigger(flight_recorder_t* recorder, char reason);
+int stop_flight_recorder(flight_recorder_t* recorder);
+
+#endif
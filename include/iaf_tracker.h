@@ -0,0 +1,60 @@
+#ifndef IAF_TRACKER_H
+#define IAF_TRACKER_H
+
+#define IAF_MAX_BINS 64 /*highest bin + 1 the tracker can read*/
+#define IAF_TRACK_RADIUS 2 /*bins smoothed on each side of the peak during the task*/
+
+/*
+ * Individual alpha frequency (IAF), peak of the alpha band of a user.
+ *  - calibration: the spectrum of the training frames (both channels summed)
+ *    is averaged over the search range, the peak is its highest bin, refined
+ *    by a parabola through the bin and its neighbours
+ *  - task: only the bins around the peak are smoothed, the peak moves to a
+ *    neighbour that gets higher, one bin per frame. A frame costs the same
+ *    whatever the search range, the spectrum is never scanned again
+ * The band measured is [peak - half_width, peak + half_width], the bins on its
+ * edges weighted by their overlap, so it moves smoothly with the peak and its
+ * width (the scale of the band values) stays the same.
+ *
+ * The bins are passed as arrays indexed by bin, only read_first to read_last
+ * need to be set (all bins up to last_bin before the calibration ends).
+ */
+typedef struct iaf_tracker_s{
+
+	/*to be set before init*/
+	double bin_width; /*Hz*/
+	double min_freq; /*search range of the peak (Hz)*/
+	double max_freq;
+	double half_width; /*of the band (Hz)*/
+	double tracking_rate; /*weight of a frame in the smoothed spectrum, 0 keeps the peak of the calibration*/
+
+	/*set during init*/
+	int min_bin; /*range of the peak bin*/
+	int max_bin;
+	int first_bin; /*bins read, whatever the peak*/
+	int last_bin;
+	char calibrated; /*peak found or set*/
+	double calib_sum[IAF_MAX_BINS]; /*spectrum summed over the training*/
+	unsigned long nb_calib;
+
+	/*peak and band, set at the end of the calibration and by the tracking*/
+	int peak_bin;
+	double peak_freq; /*interpolated (Hz)*/
+	double spectrum[IAF_MAX_BINS]; /*smoothed spectrum, up to date around the peak only*/
+	int band_first; /*bins of the band*/
+	int band_last;
+	double weight[IAF_MAX_BINS]; /*share of the bins in the band*/
+	int read_first; /*bins needed by the next frame*/
+	int read_last;
+	unsigned long nb_moves; /*peak moved to a neighbour bin*/
+
+}iaf_tracker_t;
+
+int init_iaf_tracker(iaf_tracker_t* iaf);
+void iaf_calibrate_frame(iaf_tracker_t* iaf, double* left, double* right);
+int iaf_end_calibration(iaf_tracker_t* iaf);
+void iaf_set_peak(iaf_tracker_t* iaf, double freq);
+void iaf_track_frame(iaf_tracker_t* iaf, double* left, double* right);
+double iaf_band_value(iaf_tracker_t* iaf, double* bins);
+
+#endif
@@ -16,9 +16,12 @@
 #define INTERFACE_CONNECTED 5 //sem posted when interface connection established
 /**/
 
+#define HW_WAIT_SLICE_S 1 /*the semaphore set is looked up again after each slice*/
+
 typedef struct ipc_comm_s{
 	/*to be set before initialization*/
 	int sem_key;
+	double hw_timeout; /*max wait for the hardware (s), 0 waits forever*/
 	/*will be set during initialization*/
 	int semid;
 	struct sembuf *sops;
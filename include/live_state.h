@@ -0,0 +1,86 @@
+#ifndef LIVE_STATE_H
+#define LIVE_STATE_H
+
+#include <stdint.h>
+
+#define LIVE_MAGIC 0x4556494C /*"LIVE"*/
+#define LIVE_VERSION 1
+#define LIVE_SHM_KEY 7807
+#define LIVE_PAGE_SIZE 4096
+#define LIVE_MAX_RETRIES 1000 /*reads torn in a row before a reader gives up*/
+
+/*session phases*/
+#define LIVE_STARTING 0 /*app initializing*/
+#define LIVE_IDLE 1 /*waiting for the start button*/
+#define LIVE_TRAINING 2
+#define LIVE_TASK 3
+#define LIVE_STOPPED 4 /*app exited*/
+
+/*
+ * State of the app seen by a dashboard. Values are the ones of the last
+ * sample output (smoothed value and pitch as played).
+ */
+typedef struct live_snapshot_s{
+	uint64_t update_ns; /*monotonic time of the last update*/
+	uint32_t phase; /*LIVE_* phase*/
+	uint32_t session; /*sessions started*/
+	uint32_t train_done; /*training samples taken*/
+	uint32_t train_total; /*training samples needed*/
+	uint32_t calibration; /*CALIBRATION_* mode of the reference*/
+	int32_t sample_status; /*SAMPLE_* status*/
+	int32_t pitch; /*buzzer command (Hz)*/
+	int32_t step; /*pitch step*/
+	double sample; /*normalized sample*/
+	double smoothed; /*smoothed sample*/
+	double mean[2]; /*reference (median in the robust calibration), left and right*/
+	double std_dev[2]; /*scale of the reference*/
+	uint64_t nb_frames; /*frames checked by the detectors, this session*/
+	uint64_t nb_rejected;
+	uint64_t nb_held;
+	uint64_t nb_expired;
+}live_snapshot_t;
+
+/*
+ * Page at the beginning of its own segment. Single writer seqlock:
+ *  - the app makes seq odd, writes the snapshot, makes seq even again
+ *  - a reader copies the snapshot between two reads of seq and keeps it only
+ *    if seq was even and didn't move
+ * The app never waits on a reader nor makes a system call to publish, a
+ * reader retries while the app writes (a snapshot is a few cache lines).
+ */
+typedef struct live_page_s{
+	uint32_t magic;
+	uint32_t version;
+	int32_t app_pid;
+	uint32_t seq __attribute__((aligned(64)));
+	live_snapshot_t snapshot;
+}live_page_t;
+
+typedef struct live_state_s{
+
+	/*to be set before init (app) or attach (reader)*/
+	int shm_key;
+
+	/*set during init/attach*/
+	int shmid;
+	live_page_t* page;
+	live_snapshot_t current; /*app, snapshot being built*/
+
+}live_state_t;
+
+/*app side, a single thread at a time. The setters publish at once, the
+  sample values are set in current and published with live_publish*/
+int live_state_init(live_state_t* live);
+void live_set_phase(live_state_t* live, uint32_t phase);
+void live_set_training(live_state_t* live, uint32_t done, uint32_t total);
+void live_set_calibration(live_state_t* live, uint32_t calibration, double* mean, double* std_dev);
+void live_publish(live_state_t* live);
+int live_state_cleanup(live_state_t* live);
+
+/*reader side*/
+int live_attach(live_state_t* live);
+int live_read(live_state_t* live, live_snapshot_t* snapshot);
+const char* live_phase_str(uint32_t phase);
+int live_detach(live_state_t* live);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+#include <pthread.h>
+
+#include "artifact_detection.h"
+#include "control_block.h"
+#include "spsc_queue.h"
+
+#define METRICS_PATH_LENGTH 256 /*checked against sun_path when the server starts*/
+
+/*latency stages*/
+#define STAGE_ACQUIRE 0 /*request to frame available*/
+#define STAGE_PROCESS 1 /*artifact detection and normalization*/
+#define STAGE_FEEDBACK 2 /*smoothing, pitch mapping and buzzer update*/
+#define STAGE_LOOP 3 /*whole task iteration*/
+#define NB_STAGES 4
+
+/*bucket i holds latencies below 2^i us, up to 2^23 us (8 s)*/
+#define METRICS_NB_BUCKETS 24
+
+#define METRICS_NB_QUEUES 2 /*queues between the task stages, see task_pipeline.h*/
+
+#define METRICS_POLL_MS 500 /*how often the server checks if it must stop*/
+#define METRICS_BUF_SIZE 8192 /*largest exposition*/
+
+/*
+ * All counters are words updated with relaxed atomics, so the server
+ * thread reads them without ever blocking the feedback loop. Sums are
+ * in microseconds and may wrap on 32 bits targets, which a scraper
+ * takes as a counter reset.
+ */
+typedef struct latency_hist_s{
+	unsigned long buckets[METRICS_NB_BUCKETS];
+	unsigned long count;
+	unsigned long sum_us;
+}latency_hist_t;
+
+typedef struct metrics_s{
+
+	/*to be set before starting the server*/
+	char socket_path[METRICS_PATH_LENGTH]; /*copied, the config can be replaced*/
+	control_t* control; /*producer counters, NULL if none*/
+
+	/*counters*/
+	unsigned long frames_received;
+	unsigned long frames_rejected[NB_ARTIFACT_REASONS];
+	unsigned long samples_held;
+	unsigned long samples_expired;
+	unsigned long sessions;
+	unsigned long recoveries; /*producer back after a stall*/
+
+	/*gauges*/
+	long z_micro; /*current z-score, in millionths*/
+	long pitch; /*current pitch (Hz)*/
+	long stalled; /*1 while the producer is silent*/
+	long recovery_ms; /*time to recover from the last stall*/
+
+	latency_hist_t latency[NB_STAGES];
+	
+	/*queues between the task stages, set by the first task (their counters are read in place,
+	  they start again at each task and are exported as gauges)*/
+	spsc_queue_t* queues[METRICS_NB_QUEUES];
+
+	/*server, set when started*/
+	int server_fd;
+	pthread_t thread;
+	char running;
+
+}metrics_t;
+
+void init_metrics(metrics_t* metrics);
+void metrics_count_frame(metrics_t* metrics);
+void metrics_count_rejection(metrics_t* metrics, int reason);
+void metrics_count_hold(metrics_t* metrics, char sample_status);
+void metrics_count_session(metrics_t* metrics);
+void metrics_set_stalled(metrics_t* metrics, char stalled);
+void metrics_count_recovery(metrics_t* metrics, double recovery_ms);
+void metrics_set_feedback(metrics_t* metrics, double z_score, int pitch);
+void metrics_add_latency(metrics_t* metrics, int stage, struct timespec* start);
+void metrics_set_queue(metrics_t* metrics, int index, spsc_queue_t* queue);
+int start_metrics_server(metrics_t* metrics);
+int stop_metrics_server(metrics_t* metrics);
+
+#endif
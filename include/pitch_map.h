@@ -0,0 +1,37 @@
+#ifndef PITCH_MAP_H
+#define PITCH_MAP_H
+
+#define PITCH_MAX_STEPS 512
+
+/*supported scales*/
+#define PITCH_SCALE_LINEAR 1
+#define PITCH_SCALE_LOG 2
+#define PITCH_SCALE_CHROMATIC 3
+#define PITCH_SCALE_MAJOR 4
+#define PITCH_SCALE_PENTATONIC 5
+
+typedef struct pitch_map_s{
+
+	/*to be set before init*/
+	char scale;
+	int nb_steps; /*nb of steps for linear and log scales*/
+	double z_min; /*normalized sample mapped to the lowest pitch*/
+	double z_max; /*normalized sample mapped to the highest pitch*/
+	double freq_min; /*lowest pitch (Hz)*/
+	double freq_max; /*highest pitch (Hz)*/
+	double hysteresis; /*fraction of a step to cross before changing pitch*/
+
+	/*set during init*/
+	int table[PITCH_MAX_STEPS]; /*pitch of each step (Hz)*/
+	int table_size;
+	double steps_per_unit; /*steps per normalized sample unit*/
+
+	/*current step, set during get_pitch*/
+	int current_step;
+
+}pitch_map_t;
+
+int init_pitch_map(pitch_map_t* pitch_map);
+int get_pitch(pitch_map_t* pitch_map, double sample);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef PROCESSING_CONFIG_H
+#define PROCESSING_CONFIG_H
+
+#include "xml.h"
+#include "feature_input.h"
+#include "feature_processing.h"
+#include "band_power.h"
+#include "iaf_tracker.h"
+#include "smoothing_filter.h"
+
+/*
+ * Processing stages set from the app config, shared by the app and the batch
+ * tool so a recorded session is replayed with the same settings as a live one.
+ * The geometry (window width, channels, sections, sampling and frame rates) is
+ * the config's, the batch tool passes a copy holding the recorded one.
+ */
+void configure_feature_processing(feat_proc_t* feature_proc, feature_input_t* feature_input, appconfig_t* app_config);
+band_power_t* configure_band_power(band_power_t* band_power, appconfig_t* app_config);
+iaf_tracker_t* configure_iaf_tracker(iaf_tracker_t* iaf, appconfig_t* app_config);
+int configure_smoothing_filter(smoothing_filter_t* filter, appconfig_t* app_config);
+
+#endif
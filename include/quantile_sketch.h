@@ -0,0 +1,44 @@
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#define P2_MARKERS 5
+#define MAD_TO_STD 1.4826 /*MAD of a normal distribution to its standard deviation*/
+#define ROBUST_EXACT_VALUES 64 /*values kept before switching to the estimators*/
+
+/*
+ * P-square estimator of a quantile (Jain and Chlamtac), five markers whose
+ * heights follow the quantile. Constant memory and time per value, exact
+ * up to the fifth value.
+ */
+typedef struct p2_quantile_s{
+	double p; /*quantile estimated*/
+	int count; /*nb of values seen*/
+	double height[P2_MARKERS];
+	double pos[P2_MARKERS]; /*actual marker positions*/
+	double desired[P2_MARKERS]; /*desired marker positions*/
+	double step[P2_MARKERS]; /*desired position increment per value*/
+}p2_quantile_t;
+
+/*
+ * Streaming median and median absolute deviation. P-square is poor on a few
+ * tens of values, the first ROBUST_EXACT_VALUES are kept sorted and give the
+ * exact statistics. The estimators then start from their quantiles, the
+ * deviations being taken from the median estimated so far.
+ */
+typedef struct robust_stat_s{
+	int count; /*nb of values seen*/
+	double sorted[ROBUST_EXACT_VALUES]; /*first values, sorted*/
+	p2_quantile_t median;
+	p2_quantile_t deviation; /*|value - median|*/
+}robust_stat_t;
+
+void init_p2_quantile(p2_quantile_t* est, double p);
+void update_p2_quantile(p2_quantile_t* est, double value);
+void seed_p2_quantile(p2_quantile_t* est, const double* sorted, int nb_values);
+double get_p2_quantile(p2_quantile_t* est);
+void init_robust_stat(robust_stat_t* stat);
+void update_robust_stat(robust_stat_t* stat, double value);
+double get_robust_median(robust_stat_t* stat);
+double get_robust_scale(robust_stat_t* stat);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SESSION_CODEC_H
+#define SESSION_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*page codings of a compressed session*/
+#define SESSION_RAW 0 /*pages as read, no blocks (version 1)*/
+#define SESSION_LOSSLESS 1 /*doubles, delta coded*/
+#define SESSION_FLOAT32 2 /*quantized to float, delta coded*/
+
+#define RICE_ESCAPE 24 /*longest unary part, the value is written as is after it*/
+#define RICE_RESCALE 64 /*the adaptation forgets past values every n values*/
+
+/*
+ * A block of pages, decoded. Only the eye blink flag of the frame info
+ * is kept, the rest of it is padding.
+ */
+typedef struct session_block_s{
+	uint32_t first_page;
+	int nb_pages;
+	char* eye_blinks; /*one per page*/
+	double* values; /*nb_features per page*/
+}session_block_t;
+
+/*
+ * Blocks are coded on their own, so any of them can be decoded without the
+ * others. In each bin, the bit pattern of a value (double, or float once
+ * quantized) minus the one of the previous page is zigzag mapped and Rice
+ * coded. The Rice parameter follows the mean of the bin (as in LOCO-I), the
+ * first page of a block is coded against zero and left out of the mean.
+ */
+size_t session_block_bound(int nb_pages, int nb_features);
+size_t encode_session_block(session_block_t* block, int nb_features, char codec, uint8_t* out);
+int decode_session_block(const uint8_t* in, size_t size, int nb_features, char codec, session_block_t* block);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "feature_structure.h"
+#include "session_codec.h"
+
+#define SESSION_FILE_MAGIC 0x53544E42 /*"BNTS"*/
+#define SESSION_FILE_VERSION 1 /*raw pages*/
+#define SESSION_FILE_VERSION_BLOCKS 2 /*compressed blocks and seek index*/
+#define SESSION_FILE_EXT ".bts"
+
+/*feature sections present in the pages*/
+#define SESSION_TIMESERIES 0x01
+#define SESSION_FFT 0x02
+#define SESSION_POWER_ALPHA 0x04
+#define SESSION_POWER_BETA 0x08
+#define SESSION_POWER_GAMMA 0x10
+
+/*compressed sessions*/
+#define SESSION_BLOCK_PAGES 64 /*pages per block*/
+#define SESSION_ENCODE_QUEUE 4 /*blocks filled or waiting for the encoder*/
+#define SESSION_BLOCK_MAGIC 0x4B4C4254 /*"TBLK"*/
+#define SESSION_INDEX_MAGIC 0x58444954 /*"TIDX"*/
+
+/*
+ * Header of a recorded session, followed by the pages
+ * exactly as they were read: frame info and feature array
+ */
+typedef struct session_header_s{
+	uint32_t magic;
+	uint32_t version;
+	int32_t nb_features; /*nb of doubles per page*/
+	int32_t nb_channels;
+	int32_t window_width;
+	uint32_t sections; /*SESSION_* flags*/
+	double sampling_rate; /*Hz*/
+	double frame_rate; /*Hz*/
+	int64_t start_time; /*seconds since epoch*/
+}session_header_t;
+
+/*
+ * Compressed session (version 2), after the header:
+ *  - the codec header
+ *  - the blocks, each a block header then its coded pages
+ *  - the index: SESSION_INDEX_MAGIC, one entry per block, then the trailer
+ * A session cut short (no index) can still be read block by block.
+ */
+typedef struct session_codec_header_s{
+	uint32_t codec; /*SESSION_LOSSLESS or SESSION_FLOAT32*/
+	uint32_t block_pages; /*pages per block, the last one may hold less*/
+}session_codec_header_t;
+
+typedef struct session_block_header_s{
+	uint32_t magic;
+	uint32_t first_page;
+	uint32_t nb_pages;
+	uint32_t size; /*coded bytes that follow*/
+}session_block_header_t;
+
+typedef struct session_index_entry_s{
+	int64_t offset; /*of the block header*/
+	uint32_t first_page;
+	uint32_t nb_pages;
+}session_index_entry_t;
+
+typedef struct session_trailer_s{
+	int64_t index_offset;
+	uint32_t nb_blocks;
+	uint32_t magic; /*SESSION_INDEX_MAGIC*/
+}session_trailer_t;
+
+typedef struct session_file_s{
+
+	/*to be set before create*/
+	char codec; /*SESSION_RAW, SESSION_LOSSLESS or SESSION_FLOAT32*/
+
+	FILE* file;
+	session_header_t header;
+	int nb_pages; /*pages written or read so far*/
+
+	/*compressed sessions*/
+	int block_pages; /*pages per block*/
+	session_block_t blocks[SESSION_ENCODE_QUEUE]; /*write: ring filled by the app, read: blocks[0]*/
+	int fill_block; /*block being filled*/
+	int encode_block; /*next block to encode*/
+	int nb_queued; /*blocks full, waiting for the encoder*/
+	int read_pos; /*next page of the decoded block*/
+	uint8_t* coded; /*coded block*/
+	session_index_entry_t* index;
+	uint32_t nb_blocks;
+	int64_t data_offset; /*first block*/
+	char encoder_running;
+	char write_error;
+	pthread_t encoder;
+	pthread_mutex_t lock;
+	pthread_cond_t queued; /*a block is waiting for the encoder*/
+	pthread_cond_t freed; /*the encoder is done with a block*/
+
+}session_file_t;
+
+int session_file_create(session_file_t* session, const char* path, session_header_t* header);
+int session_file_write_page(session_file_t* session, frame_info_t* frame_info, double* feature_array);
+int session_file_open(session_file_t* session, const char* path);
+int session_file_read_page(session_file_t* session, frame_info_t* frame_info, double* feature_array);
+int session_file_seek(session_file_t* session, int page);
+int session_file_close(session_file_t* session);
+
+#endif
@@ -16,6 +16,7 @@
  */
  
 #include "feature_structure.h"
+#include "feature_input.h"
 
 //#define NB_FEATURES 220
 //#define FEATURE_SIZE 8 
@@ -38,11 +39,14 @@
 #define INTERFACE_CONNECTED 5 //sem posted when interface connection established
 /**/
 
+#define MAX_SHM_PATH 256 /*hugetlbfs path of a POSIX segment*/
+
 int shm_rd_init(void *param);
 int shm_rd_request(void *param);
 int shm_rd_wait_for_request_completed(void *param);
 frame_info_t* shm_get_frame_info_ref(void *param);
 double* shm_get_feature_array_ref(void *param);
+int shm_rd_get_batch(void *param, feature_page_view_t *views, int max_views);
 int shm_rd_cleanup(void *param);
 
 
@@ -0,0 +1,45 @@
+#ifndef SMOOTHING_FILTER_H
+#define SMOOTHING_FILTER_H
+
+/*supported filters*/
+#define SMOOTH_ONE_POLE 1
+#define SMOOTH_BIQUAD 2
+#define SMOOTH_ONE_EURO 3
+#define SMOOTH_MEDIAN 4
+
+#define SMOOTH_MAX_MEDIAN 15 /*max median window, odd*/
+
+typedef struct smoothing_filter_s{
+
+	/*to be set before init*/
+	char type;
+	double frame_rate; /*nb of samples per second (Hz)*/
+	double kernel; /*one-pole: averaging kernel, in samples*/
+	double cutoff; /*biquad: cutoff frequency (Hz)*/
+	double min_cutoff; /*one-euro: cutoff at rest (Hz)*/
+	double beta; /*one-euro: cutoff increase with speed*/
+	double d_cutoff; /*one-euro: cutoff of the speed estimate (Hz)*/
+	int median_size; /*median: window size, in samples*/
+
+	/*set during init*/
+	double b[3]; /*biquad coefficients, a[0] normalized to 1*/
+	double a[3];
+	double group_delay; /*delay added at low frequency, in samples*/
+
+	/*filter state*/
+	char primed;
+	double value; /*last output*/
+	double last_input;
+	double speed; /*one-euro: filtered derivative*/
+	double z[2]; /*biquad: transposed direct form II state*/
+	double window[SMOOTH_MAX_MEDIAN]; /*median: samples, in arrival order*/
+	double sorted[SMOOTH_MAX_MEDIAN]; /*median: same samples, sorted*/
+	int idx;
+
+}smoothing_filter_t;
+
+int init_smoothing_filter(smoothing_filter_t* filter);
+double smooth_sample(smoothing_filter_t* filter, double sample);
+const char* smoothing_filter_str(char type);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SOCK_RD_BUF_H
+#define SOCK_RD_BUF_H
+
+#include <stdint.h>
+
+#include "feature_structure.h"
+#include "feature_input.h"
+
+#define SOCK_DEFAULT_PATH "/tmp/braintone_features.sock"
+#define SOCK_PROTO_MAGIC 0x4B534E42 /*"BNSK"*/
+#define SOCK_PROTO_VERSION 1
+#define SOCK_SETUP_TIMEOUT_MS 2000 /*producer answer to the hello*/
+
+/*descriptors passed with the setup (SCM_RIGHTS), in this order*/
+#define SOCK_FD_PAGES 0 /*memfd holding the pages*/
+#define SOCK_FD_DONE 1 /*eventfd, the producer adds 1 per page completed*/
+#define SOCK_FD_REQUEST 2 /*eventfd, the app adds 1 per page it lets the producer fill*/
+#define SOCK_NB_FDS 3
+
+/*
+ * Feature input without SysV objects (no key to collide on, only a socket path).
+ * The app connects to the producer's Unix socket (SOCK_SEQPACKET) and sends
+ * its page geometry (hello). The producer answers with the geometry it writes
+ * (setup) and passes the memfd of the pages and two eventfds. From then on, the
+ * socket stays silent, it only tells a producer gone (hang up) from a slow one:
+ *  - request: 1 added to the request eventfd, a page the producer may fill
+ *  - page completed: 1 added by the producer to the done eventfd
+ * The pages are filled in order, as in the SHM input. The done eventfd can be
+ * added to any epoll set (feature_input->done_fd), it is readable when pages
+ * are waiting, the wait and batch calls never block once it is.
+ */
+typedef struct sock_geometry_s{
+	uint32_t magic;
+	uint32_t version;
+	int32_t nb_features;
+	int32_t buffer_depth;
+	int32_t feature_size; /*bytes per feature, 4 or 8*/
+	int32_t feat_offset; /*offset of the feature array in a page*/
+	int32_t page_stride; /*distance between two pages*/
+	int32_t pages_offset; /*offset of the first page in the memfd*/
+	int32_t status; /*setup only, 0 accepted, an errno value otherwise (no descriptor passed)*/
+	int32_t reserved;
+}sock_geometry_t;
+
+int sock_rd_init(void *param);
+int sock_rd_request(void *param);
+int sock_rd_wait_for_request_completed(void *param);
+frame_info_t* sock_get_frame_info_ref(void *param);
+double* sock_get_feature_array_ref(void *param);
+int sock_rd_get_batch(void *param, feature_page_view_t *views, int max_views);
+int sock_rd_cleanup(void *param);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+
+#define SPSC_MAX_DEPTH 256 /*slots, power of 2*/
+#define SPSC_WAIT_SLICE_MS 10 /*longest sleep of a waiting stage, bounds a missed wake up*/
+#define SPSC_LINE 64 /*cache line, each side writes its own*/
+
+/*
+ * Bounded queue between two stages, one producer thread and one consumer
+ * thread. Slots have a fixed size and are filled in place: the producer
+ * claims the next free slot, fills it and pushes it, the consumer peeks the
+ * oldest one and pops it once done. Positions are free running 32 bits
+ * counters (release on write, acquire on read), no lock is taken.
+ *
+ * A side that finds the queue full (producer) or empty (consumer) flags
+ * itself waiting and sleeps on the other side's counter with a futex, so the
+ * other side only makes a system call when someone actually waits.
+ *
+ * Occupancy is counted by each side on its own line: slots used at each
+ * push, pushes that found the queue full, pops that found it empty. A full
+ * queue means the consumer limits the throughput, an empty one the producer.
+ */
+typedef struct spsc_queue_s{
+
+	/*to be set before init*/
+	int depth; /*nb of slots, power of 2*/
+	int slot_size; /*bytes per slot, rounded up to a cache line during init*/
+
+	/*set during init*/
+	char* slots;
+
+	/*producer side*/
+	uint32_t head __attribute__((aligned(SPSC_LINE))); /*slots pushed*/
+	uint32_t producer_waiting; /*the producer sleeps on tail*/
+	unsigned long nb_pushed;
+	unsigned long occupancy_sum; /*slots used after each push*/
+	unsigned long max_occupancy;
+	unsigned long nb_full; /*pushes that waited for a free slot*/
+
+	/*consumer side*/
+	uint32_t tail __attribute__((aligned(SPSC_LINE))); /*slots popped*/
+	uint32_t consumer_waiting; /*the consumer sleeps on head*/
+	unsigned long nb_empty; /*pops that waited for a slot*/
+
+}spsc_queue_t;
+
+int init_spsc_queue(spsc_queue_t* queue);
+void* spsc_claim(spsc_queue_t* queue);
+void spsc_push(spsc_queue_t* queue);
+void* spsc_peek(spsc_queue_t* queue);
+void spsc_pop(spsc_queue_t* queue);
+double spsc_mean_occupancy(spsc_queue_t* queue);
+int clean_up_spsc_queue(spsc_queue_t* queue);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef TASK_PIPELINE_H
+#define TASK_PIPELINE_H
+
+#include <time.h>
+#include <pthread.h>
+
+#include "feature_structure.h"
+#include "feature_processing.h"
+#include "smoothing_filter.h"
+#include "pitch_map.h"
+#include "metrics.h"
+#include "flight_recorder.h"
+#include "spsc_queue.h"
+#include "live_state.h"
+
+/*queues between the stages*/
+#define PIPELINE_FRAMES 0 /*acquire to process*/
+#define PIPELINE_SAMPLES 1 /*process to output*/
+#define NB_PIPELINE_QUEUES METRICS_NB_QUEUES
+
+/*
+ * Frame copied out of the input by the acquire stage
+ */
+typedef struct pipeline_frame_s{
+	char status; /*EXIT_SUCCESS, FEAT_INPUT_STALLED, EXIT_FAILURE for the last frame*/
+	struct timespec request_time; /*frame requested*/
+	struct timespec frame_time; /*frame available*/
+	frame_info_t frame_info;
+	double feature_array[]; /*nb_features of the input*/
+}pipeline_frame_t;
+
+/*
+ * Sample computed by the process stage, all the output stage needs so it
+ * never reads the feature processing
+ */
+typedef struct pipeline_sample_s{
+	char sample_status; /*SAMPLE_* status, SAMPLE_NO_FRAME for the last sample*/
+	char eye_blink;
+	char reject_reason;
+	struct timespec request_time;
+	struct timespec frame_time;
+	struct timespec processed_time; /*sample normalized*/
+	struct timespec feedback_time; /*smoothing started*/
+	double band_value[2];
+	double sample;
+	double smoothed;
+	int pitch;
+	int step; /*pitch step, shown on console*/
+	unsigned long nb_frames; /*counters of the feature processing, for the live state*/
+	unsigned long nb_rejected;
+	unsigned long nb_held;
+	unsigned long nb_expired;
+}pipeline_sample_t;
+
+/*
+ * The task loop split in three stages, each on its own thread:
+ *  - acquire, requests the frames and copies them out of the input
+ *  - process, artifact detection, normalization, smoothing and pitch mapping
+ *  - output, buzzer, console, metrics and flight recorder
+ * connected by bounded SPSC queues (see spsc_queue.h). A slow buzzer update or
+ * console write is absorbed by the queues instead of delaying the next request.
+ * The stages own their part of the state: the acquire stage the input and the
+ * recorder, the process stage the feature processing, the filter and the pitch map.
+ * On the simulated clock the stages take turns on the calling thread.
+ */
+typedef struct task_pipeline_s{
+
+	/*to be set before run*/
+	int depth; /*slots per queue, power of 2*/
+	feat_proc_t* feature_proc; /*trained*/
+	smoothing_filter_t* filter;
+	pitch_map_t* pitch_map;
+	metrics_t* metrics; /*NULL if disabled*/
+	flight_recorder_t* flight; /*NULL if disabled*/
+	live_state_t* live; /*NULL if disabled*/
+	double test_duration; /*s*/
+	struct timespec* session_time; /*start button, for the first feedback time*/
+	char* task_running; /*cleared at the end of the task, or by the signal handler*/
+
+	/*set during run*/
+	spsc_queue_t queue[NB_PIPELINE_QUEUES];
+	struct timespec task_time;
+	char first_feedback;
+	pthread_t acquire_thread;
+	pthread_t process_thread;
+
+}task_pipeline_t;
+
+int run_task_pipeline(task_pipeline_t* pipeline);
+void print_pipeline_stats(task_pipeline_t* pipeline);
+
+#endif
@@ -11,11 +11,24 @@
 
 #define SHM_INPUT 1    
 #define FAKE_INPUT 2
+#define FILE_INPUT 3
+#define BCAST_INPUT 4
+#define SOCK_INPUT 5
+
+#define HOLD_LAST_VALUE 1
+#define HOLD_DECAY 2
+
+#define BAND_SOURCE_FFT 0
+#define BAND_SOURCE_TIMESERIES 1
+
+#define CALIBRATION_MEAN_STD 1
+#define CALIBRATION_MEDIAN_MAD 2
 
 #define COMMAND_LINE_OUTPUT 1  
 #define WIRING_OUTPUT 2  
 
 #define MAX_CHAR_FIELD_LENGTH 18
+#define MAX_PATH_LENGTH 256
 
 typedef struct appconfig_s {
 	
@@ -42,6 +55,100 @@ typedef struct appconfig_s {
 	double test_duration;
 	double avg_kernel;
 	
+	/*artifact rejection (optional elements)*/
+	char artifact_rejection;
+	double sampling_rate;
+	double line_freq;
+	double artifact_amplitude_z;
+	double artifact_flat_var;
+	double artifact_line_ratio;
+	double artifact_muscle_ratio;
+	
+	/*rejected frames policy (optional elements)*/
+	char hold_policy; /*HOLD_LAST_VALUE ("HOLD") or HOLD_DECAY ("DECAY", last valid value decaying to neutral)*/
+	double max_hold_time;
+	
+	/*training statistics (optional element)*/
+	char calibration; /*CALIBRATION_MEAN_STD or CALIBRATION_MEDIAN_MAD*/
+	
+	/*stored training references (optional elements)*/
+	char calibration_store[MAX_PATH_LENGTH]; /*store file (absolute path), empty to disable*/
+	char user_id[MAX_CHAR_FIELD_LENGTH]; /*references are stored per user and device, required with a store*/
+	double warm_start_age; /*max age of a reference reused (h), 0 always trains*/
+	int refine_set_size; /*training samples refining a reference reused, 0 skips the training*/
+	
+	/*band values from the fft section or computed from the timeseries (optional element)*/
+	char band_source;
+	
+	/*band recentred on the individual alpha frequency (optional elements)*/
+	char iaf;
+	double iaf_min_freq; /*search range of the peak (Hz)*/
+	double iaf_max_freq;
+	double iaf_half_width; /*of the band (Hz)*/
+	double iaf_tracking_time; /*time constant of the tracking (s), 0 keeps the peak of the training*/
+	
+	/*pitch mapping (optional elements)*/
+	char pitch_scale;
+	int pitch_steps;
+	double pitch_z_min;
+	double pitch_z_max;
+	double pitch_freq_min;
+	double pitch_freq_max;
+	double pitch_hysteresis;
+	
+	/*smoothing filter (optional elements)*/
+	char smoothing_filter;
+	double frame_rate;
+	double smoothing_cutoff;
+	double one_euro_min_cutoff;
+	double one_euro_beta;
+	double one_euro_d_cutoff;
+	int median_size;
+	
+	/*recorded sessions (optional elements)*/
+	char session_file[MAX_PATH_LENGTH]; /*session to replay, FILE source*/
+	char record_dir[MAX_PATH_LENGTH]; /*where to record sessions, empty to disable*/
+	char record_codec; /*SESSION_RAW, SESSION_LOSSLESS or SESSION_FLOAT32*/
+	double replay_start; /*replay from this time in the session (s)*/
+	
+	/*feature pages and shared segment (optional elements)*/
+	char page_layout; /*must match the producer*/
+	char page_format; /*features type of the pages, the aligned layout adopts the producer's*/
+	char shm_backing;
+	char shm_name[MAX_PATH_LENGTH]; /*POSIX segment name*/
+	char shm_hugepages;
+	char feature_socket[MAX_PATH_LENGTH]; /*producer socket, SOCK source*/
+	
+	/*live state page for the displays (optional element)*/
+	char live_state;
+	
+	/*slots of the queues between the task stages (optional element)*/
+	int pipeline_depth;
+	
+	/*producer told no frame is wanted between sessions (optional element)*/
+	char producer_idle;
+	
+	/*apply changes of the config file between sessions (optional element)*/
+	char hot_reload;
+	
+	/*clock of the sessions, read at startup (optional element)*/
+	char clock; /*APP_CLOCK_REAL or APP_CLOCK_SIMULATED*/
+	
+	/*startup (optional elements)*/
+	double ready_timeout; /*max wait for the producer to report ready (s)*/
+	double task_pause; /*pause between training and task (s)*/
+	double hw_timeout; /*max wait for the eeg hardware (s), 0 waits forever*/
+	double stall_timeout; /*producer silence before the feedback stops (s), 0 waits forever*/
+	
+	/*metrics endpoint, empty to disable (optional element)*/
+	char metrics_socket[MAX_PATH_LENGTH];
+	
+	/*flight recorder (optional elements)*/
+	double flight_duration; /*seconds of the task loop kept, 0 to disable*/
+	char flight_dir[MAX_PATH_LENGTH]; /*where the dumps are written*/
+	double flight_latency; /*loop latency that triggers a dump (ms), 0 disables*/
+	int flight_rejections; /*rejected frames in a row that trigger a dump, 0 disables*/
+	
 } appconfig_t;
 
 appconfig_t *xml_initialize(char *filename);
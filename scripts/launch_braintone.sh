@@ -11,16 +11,18 @@ start() {
 		sleep 1
 	done
 
-	sleep 10
-
 	echo "hci0 is present"
 	
-	hciconfig hci0 sspmode 1
+	# retry until the adapter accepts the setting, instead of a fixed delay
+	while ! hciconfig hci0 sspmode 1 2> /dev/null; do
+		sleep 1
+	done
 
+	# data_preprocessing reads from data_interface, give it time to start
 	/intelli/data/data_interface /intelli/data/config/data_config.xml &
 	sleep 2
+	# the app waits for the producer to report ready, or ready_timeout
 	/intelli/data/data_preprocessing /intelli/data/config/preprocess_config.xml &
-	sleep 2
 	/intelli/app/braintone_app /intelli/app/config/braintone_app_config.xml &
 }
 
@@ -38,17 +40,17 @@ boot() {
 		sleep 1
 	done
 
-	sleep 10
-
 	echo "hci0 is present"
 	
-	
-	hciconfig hci0 sspmode 1
+	# retry until the adapter accepts the setting, instead of a fixed delay
+	while ! hciconfig hci0 sspmode 1 2> /dev/null; do
+		sleep 1
+	done
 
+	# data_preprocessing reads from data_interface, give it time to start
 	/intelli/data/data_interface /intelli/data/config/data_config.xml &
 	sleep 2
+	# the app waits for the producer to report ready, or ready_timeout
 	/intelli/data/data_preprocessing /intelli/data/config/preprocess_config.xml &
-	sleep 2
 	/intelli/app/braintone_app /intelli/app/config/braintone_app_config.xml &
-
 }
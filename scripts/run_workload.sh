@@ -0,0 +1,61 @@
+#!/bin/bash
+# Runs the optimization workload through app binaries, headless, and reports
+# the cpu time per frame of each (best of a few runs).
+#
+# The workload config (config/pgo_workload.xml) uses the FAKE input on the
+# simulated clock, so the main loop, the feature input and the processing run
+# back to back at full rate. Each run is stopped with SIGINT, the app then
+# finishes its session and exits normally (profiles are written at exit).
+#
+# usage: run_workload.sh <config> <seconds> <runs> <binary> [binary...]
+
+config=$1
+seconds=$2
+runs=$3
+shift 3
+
+if [ -z "$config" ] || [ -z "$seconds" ] || [ -z "$runs" ] || [ $# -lt 1 ]; then
+	echo "usage: $0 <config> <seconds> <runs> <binary> [binary...]"
+	exit 1
+fi
+
+out=$(mktemp)
+trap 'rm -f $out' EXIT
+TIMEFORMAT='%3U %3S'
+
+printf "\n%-28s %10s %10s %12s %8s\n" "binary" "frames" "cpu (s)" "us/frame" "vs first"
+baseline=""
+
+for binary in "$@"; do
+
+	best=""
+	for run in $(seq $runs); do
+
+		# cpu time of the app (user and system), reaped in the group
+		cpu=$( { time { "$binary" "$config" > $out 2>&1 & pid=$!
+						sleep $seconds
+						kill -INT $pid
+						wait $pid; } ; } 2>&1 | tail -1 )
+
+		# every session reports its frames when it finishes
+		frames=$(awk '/^Frames processed:/ {n += $3} END {print n+0}' $out)
+		if [ "$frames" -eq 0 ]; then
+			echo "$binary: no frame processed"
+			tail -5 $out
+			exit 1
+		fi
+
+		us=$(echo "$cpu" | awk -v f=$frames '{printf "%.2f", ($1+$2)*1e6/f}')
+		if [ -z "$best" ] || awk -v a=$us -v b=$best 'BEGIN {exit !(a < b)}'; then
+			best=$us
+			best_frames=$frames
+			best_cpu=$(echo "$cpu" | awk '{printf "%.2f", $1+$2}')
+		fi
+	done
+
+	if [ -z "$baseline" ]; then
+		baseline=$best
+	fi
+	printf "%-28s %10s %10s %12s %7s%%\n" "$(basename $binary)" $best_frames $best_cpu $best \
+		   $(awk -v a=$best -v b=$baseline 'BEGIN {printf "%+.1f", (a-b)*100/b}')
+done
@@ -0,0 +1,107 @@
+/**
+ * @file app_clock.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Clock of the app, real or simulated (see app_clock.h). The simulated
+ * time is a count of nanoseconds, atomic since the training and sample threads
+ * read it while the main thread may sleep.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "app_clock.h"
+
+static char clock_type = APP_CLOCK_REAL;
+static uint64_t simulated_ns = 0;
+
+/**
+ * void app_clock_init(char type)
+ * @brief select the clock, before any time is taken. The simulated one starts at zero.
+ * @param type, APP_CLOCK_REAL or APP_CLOCK_SIMULATED
+ */
+void app_clock_init(char type){
+
+	clock_type = (type == APP_CLOCK_SIMULATED)?APP_CLOCK_SIMULATED:APP_CLOCK_REAL;
+	__atomic_store_n(&simulated_ns, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * char app_clock_type(void)
+ * @brief clock in use
+ * @return APP_CLOCK_REAL or APP_CLOCK_SIMULATED
+ */
+char app_clock_type(void){
+	return clock_type;
+}
+
+/**
+ * void app_clock_now(struct timespec* now)
+ * @brief current time, monotonic
+ * @param now(out), current time
+ */
+void app_clock_now(struct timespec* now){
+
+	uint64_t ns;
+
+	if(clock_type == APP_CLOCK_REAL){
+		clock_gettime(CLOCK_MONOTONIC, now);
+		return;
+	}
+
+	ns = __atomic_load_n(&simulated_ns, __ATOMIC_ACQUIRE);
+	now->tv_sec = ns/1000000000ULL;
+	now->tv_nsec = ns%1000000000ULL;
+}
+
+/**
+ * void app_clock_sleep_us(long us)
+ * @brief sleep, the simulated clock is advanced instead
+ * @param us, duration (us)
+ */
+void app_clock_sleep_us(long us){
+
+	struct timespec duration;
+
+	if(us <= 0){
+		return;
+	}
+
+	if(clock_type == APP_CLOCK_SIMULATED){
+		app_clock_advance_us(us);
+		return;
+	}
+
+	duration.tv_sec = us/1000000L;
+	duration.tv_nsec = (us%1000000L)*1000L;
+	/*a signal cuts it short, as usleep*/
+	nanosleep(&duration, NULL);
+}
+
+/**
+ * void app_clock_advance_us(long us)
+ * @brief move the simulated clock forward, no effect on the real one
+ * @param us, duration (us)
+ */
+void app_clock_advance_us(long us){
+
+	if(clock_type == APP_CLOCK_SIMULATED && us > 0){
+		__atomic_fetch_add(&simulated_ns, (uint64_t)us*1000ULL, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * double app_clock_elapsed_ms(struct timespec* from)
+ * @brief time elapsed since an instant of the app clock
+ * @param from, instant
+ * @return elapsed time (ms)
+ */
+double app_clock_elapsed_ms(struct timespec* from){
+
+	struct timespec now;
+
+	app_clock_now(&now);
+	return (now.tv_sec-from->tv_sec)*1000.0 + (now.tv_nsec-from->tv_nsec)/1000000.0;
+}
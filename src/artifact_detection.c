@@ -0,0 +1,303 @@
+/**
+ * @file artifact_detection.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Streaming artifact rejection, run on the raw feature vector before
+ * any normalization takes place. Each checked channel keeps rolling statistics
+ * of its broadband power (constant time update) and the frame is rejected for:
+ *  - amplitude outliers (broadband power far above the recent clean frames,
+ *    a level that lasts a whole window becomes the reference)
+ *  - flat line (broadband power not moving at all, electrode off)
+ *  - line noise dominance (too much power in the mains frequency bin)
+ *  - muscle bursts (too much power in the high frequency band)
+ * A counter is kept for every rejection reason.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "artifact_detection.h"
+
+/*muscle activity band (Hz)*/
+#define MUSCLE_BAND_START 20.0
+#define MUSCLE_BAND_END 45.0
+
+static void rolling_stat_push(rolling_stat_t* stat, double value);
+static double rolling_stat_mean(rolling_stat_t* stat);
+static double rolling_stat_var(rolling_stat_t* stat);
+
+static const char* reason_str[NB_ARTIFACT_REASONS] = {
+	"none", "eye_blink", "amplitude", "flat_line", "line_noise", "muscle", "out_of_tolerance"
+};
+
+/**
+ * int init_artifact_detection(artifact_detect_t* artifact)
+ * @brief initialize the detectors, compute the bins of interest and reset the counters
+ * @param artifact, pointer to artifact detection
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_artifact_detection(artifact_detect_t* artifact){
+
+	if(artifact->nb_channels > ARTIFACT_MAX_CHANNELS || artifact->bin_width <= 0){
+		fprintf(stderr, "Invalid artifact detection configuration\n");
+		artifact->enabled = 0x00;
+		return EXIT_FAILURE;
+	}
+
+	/*locate the mains frequency bin*/
+	artifact->line_bin = (int)(artifact->line_freq/artifact->bin_width+0.5);
+	if(artifact->line_bin >= artifact->channel_width){
+		artifact->line_bin = -1;
+	}
+
+	/*locate the muscle band, clipped to the channel*/
+	artifact->muscle_bin_start = (int)ceil(MUSCLE_BAND_START/artifact->bin_width);
+	artifact->muscle_bin_end = (int)(MUSCLE_BAND_END/artifact->bin_width);
+	if(artifact->muscle_bin_end >= artifact->channel_width){
+		artifact->muscle_bin_end = artifact->channel_width-1;
+	}
+
+	/*reset statistics and counters*/
+	memset(artifact->all_power, 0, sizeof(artifact->all_power));
+	memset(artifact->clean_power, 0, sizeof(artifact->clean_power));
+	memset(artifact->counters, 0, sizeof(artifact->counters));
+	artifact->nb_amplitude_run = 0;
+	artifact->nb_frames = 0;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int detect_artifact(artifact_detect_t* artifact, frame_info_t* frame_info, double* feature_array)
+ * @brief run all detectors on the current frame and count the rejection
+ * @param artifact, pointer to artifact detection
+ * @param frame_info, frame info of the current page
+ * @param feature_array, feature array of the current page (fft bins, channel after channel)
+ * @return ARTIFACT_NONE if the frame is clean, the rejection reason otherwise
+ */
+int detect_artifact(artifact_detect_t* artifact, frame_info_t* frame_info, double* feature_array){
+
+	int i, k;
+	double *channel;
+	channel_power_t power[ARTIFACT_MAX_CHANNELS];
+
+	/*the spectrum is only parsed if the detectors will look at it*/
+	for(i=0;i<artifact->nb_channels && artifact->enabled && !frame_info->eye_blink_detected;i++){
+
+		channel = &(feature_array[artifact->channels[i]*artifact->channel_width]);
+
+		/*single pass over the channel bins*/
+		power[i].total = 0;
+		power[i].muscle = 0;
+		for(k=1;k<artifact->channel_width;k++){
+			power[i].total += channel[k];
+			if(k>=artifact->muscle_bin_start && k<=artifact->muscle_bin_end && k!=artifact->line_bin){
+				power[i].muscle += channel[k];
+			}
+		}
+		power[i].line = (artifact->line_bin>0)?channel[artifact->line_bin]:0;
+	}
+
+	return detect_artifact_power(artifact, frame_info, power);
+}
+
+/**
+ * int detect_artifact_power(artifact_detect_t* artifact, frame_info_t* frame_info, channel_power_t* power)
+ * @brief run all detectors on the power of the checked channels and count the rejection
+ * @param artifact, pointer to artifact detection
+ * @param frame_info, frame info of the current page
+ * @param power, power of each checked channel
+ * @return ARTIFACT_NONE if the frame is clean, the rejection reason otherwise
+ */
+int detect_artifact_power(artifact_detect_t* artifact, frame_info_t* frame_info, channel_power_t* power){
+
+	int i;
+	int reason = ARTIFACT_NONE;
+	double total, mean, var;
+
+	artifact->nb_frames++;
+
+	/*producer flag, cheapest check first*/
+	if(frame_info->eye_blink_detected){
+		artifact->counters[ARTIFACT_EYE_BLINK]++;
+		return ARTIFACT_EYE_BLINK;
+	}
+
+	if(!artifact->enabled){
+		return ARTIFACT_NONE;
+	}
+
+	/*every channel sees every frame, whichever detector stops the checks*/
+	for(i=0;i<artifact->nb_channels;i++){
+		rolling_stat_push(&(artifact->all_power[i]), power[i].total);
+	}
+
+	for(i=0;i<artifact->nb_channels && reason==ARTIFACT_NONE;i++){
+
+		total = power[i].total;
+
+		/*flat line, over every frame seen*/
+		if(total <= 0 || (artifact->all_power[i].count == ARTIFACT_WINDOW &&
+						  rolling_stat_var(&(artifact->all_power[i])) < artifact->flat_var_min)){
+			reason = ARTIFACT_FLAT_LINE;
+			break;
+		}
+
+		/*line noise dominance*/
+		if(power[i].line > artifact->line_ratio_max*total){
+			reason = ARTIFACT_LINE_NOISE;
+			break;
+		}
+
+		/*muscle burst*/
+		if(power[i].muscle > artifact->muscle_ratio_max*total){
+			reason = ARTIFACT_MUSCLE;
+			break;
+		}
+
+		/*amplitude outlier, against the clean frames (once enough were seen)*/
+		if(artifact->clean_power[i].count >= ARTIFACT_WINDOW/2){
+			mean = rolling_stat_mean(&(artifact->clean_power[i]));
+			var = rolling_stat_var(&(artifact->clean_power[i]));
+			if(var > 0 && (total-mean) > artifact->amplitude_z_max*sqrt(var)){
+				reason = ARTIFACT_AMPLITUDE;
+				break;
+			}
+		}
+	}
+
+	if(reason != ARTIFACT_NONE){
+		artifact->counters[reason]++;
+
+		/*a level held for a whole window is the new reference (new contact, gain change),
+		  otherwise the outliers would be rejected for the rest of the session*/
+		if(reason == ARTIFACT_AMPLITUDE && ++artifact->nb_amplitude_run >= ARTIFACT_WINDOW){
+			memcpy(artifact->clean_power, artifact->all_power, sizeof(artifact->clean_power));
+			artifact->nb_amplitude_run = 0;
+		}
+		return reason;
+	}
+	artifact->nb_amplitude_run = 0;
+
+	/*clean frame, update the reference*/
+	for(i=0;i<artifact->nb_channels;i++){
+		rolling_stat_push(&(artifact->clean_power[i]), power[i].total);
+	}
+
+	return ARTIFACT_NONE;
+}
+
+/**
+ * void count_artifact(artifact_detect_t* artifact, int reason)
+ * @brief count a rejection decided outside of the detectors (ie. after normalization)
+ * @param artifact, pointer to artifact detection
+ * @param reason, rejection reason
+ */
+void count_artifact(artifact_detect_t* artifact, int reason){
+
+	if(reason > ARTIFACT_NONE && reason < NB_ARTIFACT_REASONS){
+		artifact->counters[reason]++;
+	}
+}
+
+/**
+ * const char* artifact_reason_str(int reason)
+ * @brief get a printable name for a rejection reason
+ * @param reason, rejection reason
+ * @return reason name
+ */
+const char* artifact_reason_str(int reason){
+
+	if(reason < 0 || reason >= NB_ARTIFACT_REASONS){
+		return "unknown";
+	}
+	return reason_str[reason];
+}
+
+/**
+ * void print_artifact_stats(artifact_detect_t* artifact)
+ * @brief show the rejection counters on console
+ * @param artifact, pointer to artifact detection
+ */
+void print_artifact_stats(artifact_detect_t* artifact){
+
+	int i;
+
+	printf("Frames processed: %lu\n", artifact->nb_frames);
+	for(i=ARTIFACT_NONE+1;i<NB_ARTIFACT_REASONS;i++){
+		printf("  rejected (%s): %lu\n", reason_str[i], artifact->counters[i]);
+	}
+	fflush(stdout);
+}
+
+/**
+ * void rolling_stat_push(rolling_stat_t* stat, double value)
+ * @brief add a value to the rolling window, removing the oldest one if full
+ * @param stat, rolling statistics
+ * @param value, new value
+ */
+static void rolling_stat_push(rolling_stat_t* stat, double value){
+
+	int i;
+	double old, old_mean;
+
+	old_mean = stat->mean;
+	if(stat->count == ARTIFACT_WINDOW){
+		/*the new value replaces the oldest one*/
+		old = stat->values[stat->idx];
+		stat->mean += (value-old)/stat->count;
+		stat->m2 += (value-old)*(value-stat->mean+old-old_mean);
+	}else{
+		stat->count++;
+		stat->mean += (value-old_mean)/stat->count;
+		stat->m2 += (value-old_mean)*(value-stat->mean);
+	}
+
+	stat->values[stat->idx] = value;
+	stat->idx = (stat->idx+1)%ARTIFACT_WINDOW;
+
+	/*exact again once per window, a steady signal must give a null variance*/
+	if(stat->idx == 0){
+		stat->mean = 0;
+		for(i=0;i<stat->count;i++){
+			stat->mean += stat->values[i];
+		}
+		stat->mean /= stat->count;
+		stat->m2 = 0;
+		for(i=0;i<stat->count;i++){
+			stat->m2 += (stat->values[i]-stat->mean)*(stat->values[i]-stat->mean);
+		}
+	}
+}
+
+/**
+ * double rolling_stat_mean(rolling_stat_t* stat)
+ * @brief mean of the rolling window
+ * @param stat, rolling statistics
+ * @return mean
+ */
+static double rolling_stat_mean(rolling_stat_t* stat){
+
+	if(stat->count == 0){
+		return 0;
+	}
+	return stat->mean;
+}
+
+/**
+ * double rolling_stat_var(rolling_stat_t* stat)
+ * @brief variance of the rolling window
+ * @param stat, rolling statistics
+ * @return variance
+ */
+static double rolling_stat_var(rolling_stat_t* stat){
+
+	if(stat->count == 0){
+		return 0;
+	}
+
+	/*rounding between two recomputations can leave it slightly negative*/
+	return (stat->m2>0)?stat->m2/stat->count:0;
+}
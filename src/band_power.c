@@ -0,0 +1,251 @@
+/**
+ * @file band_power.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Band power computed from the raw timeseries, in place of the fft of the
+ * preprocessor. Only the bins used by the feature processing and the artifact
+ * detectors are tracked, with a sliding DFT updated for each new sample. The
+ * broadband power comes from the window variance (Parseval), so it doesn't
+ * need the other bins either.
+ *
+ * Bin powers are one-sided, 2.|X|^2/N^2 (the mean square of the bin sinusoid),
+ * the broadband power is their sum over bins 1 and up, ie. the window variance.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "band_power.h"
+
+static void sync_channel(band_power_t* band, band_channel_t* channel, double* samples);
+static void slide_channel(band_power_t* band, band_channel_t* channel, double* samples);
+
+/**
+ * int track_band_bins(band_power_t* band, int first_bin, int last_bin)
+ * @brief add a range of bins to the bins tracked, before init
+ * @param band, pointer to band power
+ * @param first_bin, first bin of the range
+ * @param last_bin, last bin of the range (included)
+ * @return EXIT_SUCCESS, EXIT_FAILURE if there are too many bins
+ */
+int track_band_bins(band_power_t* band, int first_bin, int last_bin){
+
+	int bin, i;
+
+	for(bin=first_bin;bin<=last_bin;bin++){
+
+		/*ranges may overlap*/
+		for(i=0;i<band->nb_bins && band->bins[i]!=bin;i++);
+		if(i < band->nb_bins){
+			continue;
+		}
+
+		if(band->nb_bins == BAND_MAX_BINS){
+			fprintf(stderr, "Band power: more than %i bins to track\n", BAND_MAX_BINS);
+			return EXIT_FAILURE;
+		}
+		band->bins[band->nb_bins++] = bin;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int init_band_power(band_power_t* band)
+ * @brief initialize the band power, twiddle factors of the bins tracked
+ * @param band, pointer to band power
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_band_power(band_power_t* band){
+
+	int i;
+	double w;
+
+	if(band->nb_channels < 1 || band->nb_channels > BAND_MAX_CHANNELS ||
+	   band->window_width < 2 || band->window_width > BAND_MAX_WIDTH){
+		fprintf(stderr, "Invalid band power configuration\n");
+		return EXIT_FAILURE;
+	}
+
+	for(i=0;i<=band->window_width/2;i++){
+		band->slot[i] = -1;
+	}
+	for(i=0;i<band->nb_bins;i++){
+		if(band->bins[i] < 0 || band->bins[i] > band->window_width/2){
+			fprintf(stderr, "Band power: bin %i out of the window\n", band->bins[i]);
+			return EXIT_FAILURE;
+		}
+		band->slot[band->bins[i]] = i;
+
+		w = 2*M_PI*band->bins[i]/band->window_width;
+		band->cos_w[i] = cos(w);
+		band->sin_w[i] = sin(w);
+	}
+
+	for(i=0;i<band->nb_channels;i++){
+		band->channel[i].nb_slid = -1;
+	}
+	band->nb_slides = 0;
+	band->nb_syncs = 0;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void update_band_power(band_power_t* band, double* timeseries)
+ * @brief update the bins tracked from the timeseries section of a frame
+ * @param band, pointer to band power
+ * @param timeseries, timeseries section (window_width samples per channel, channel after channel)
+ */
+void update_band_power(band_power_t* band, double* timeseries){
+
+	int i, hop = band->hop, width = band->window_width;
+	double* samples;
+	band_channel_t* channel;
+
+	for(i=0;i<band->nb_channels;i++){
+
+		samples = &(timeseries[band->channels[i]*width]);
+		channel = &(band->channel[i]);
+
+		/*slide only if the window follows the last one by hop samples*/
+		if(channel->nb_slid >= 0 && channel->nb_slid < BAND_RESYNC_FRAMES &&
+		   hop > 0 && hop < width &&
+		   samples[0] == channel->window[hop] && samples[width-hop-1] == channel->window[width-1]){
+			slide_channel(band, channel, samples);
+			channel->nb_slid++;
+			band->nb_slides++;
+		}else{
+			sync_channel(band, channel, samples);
+			channel->nb_slid = 0;
+			band->nb_syncs++;
+		}
+
+		memcpy(channel->window, samples, width*sizeof(double));
+	}
+}
+
+/**
+ * double get_band_power(band_power_t* band, int channel, int first_bin, int last_bin)
+ * @brief power of a channel over a range of bins, the bins not tracked are left out
+ * @param band, pointer to band power
+ * @param channel, channel (position in channels)
+ * @param first_bin, first bin of the range
+ * @param last_bin, last bin of the range (included)
+ * @return power
+ */
+double get_band_power(band_power_t* band, int channel, int first_bin, int last_bin){
+
+	band_channel_t* pchannel = &(band->channel[channel]);
+	double n2 = (double)band->window_width*band->window_width;
+	double power = 0;
+	int bin, slot;
+
+	for(bin=first_bin;bin<=last_bin && bin<=band->window_width/2;bin++){
+		slot = band->slot[bin];
+		if(slot >= 0){
+			power += 2*(pchannel->re[slot]*pchannel->re[slot]+pchannel->im[slot]*pchannel->im[slot])/n2;
+		}
+	}
+
+	return power;
+}
+
+/**
+ * void get_band_artifact_power(band_power_t* band, artifact_detect_t* artifact, channel_power_t* power)
+ * @brief power of the channels checked by the artifact detectors (same order as the channels tracked)
+ * @param band, pointer to band power
+ * @param artifact, pointer to artifact detection (initialized)
+ * @param power(out), power of each checked channel
+ */
+void get_band_artifact_power(band_power_t* band, artifact_detect_t* artifact, channel_power_t* power){
+
+	int i;
+	double width = band->window_width;
+	band_channel_t* channel;
+
+	for(i=0;i<artifact->nb_channels && i<band->nb_channels;i++){
+
+		channel = &(band->channel[i]);
+
+		/*window variance, rounding can take it under zero*/
+		power[i].total = (channel->sum_sq-channel->sum*channel->sum/width)/width;
+		if(power[i].total < 0){
+			power[i].total = 0;
+		}
+
+		power[i].line = (artifact->line_bin > 0)?get_band_power(band, i, artifact->line_bin, artifact->line_bin):0;
+		power[i].muscle = get_band_power(band, i, artifact->muscle_bin_start, artifact->muscle_bin_end);
+		if(artifact->line_bin >= artifact->muscle_bin_start && artifact->line_bin <= artifact->muscle_bin_end){
+			power[i].muscle -= power[i].line;
+		}
+	}
+}
+
+/**
+ * void sync_channel(band_power_t* band, band_channel_t* channel, double* samples)
+ * @brief compute the bins tracked over a whole window (Goertzel) and its sums
+ * @param band, pointer to band power
+ * @param channel, channel state
+ * @param samples, window of the channel
+ */
+static void sync_channel(band_power_t* band, band_channel_t* channel, double* samples){
+
+	int i, n;
+	double coeff, s0, s1, s2;
+
+	for(i=0;i<band->nb_bins;i++){
+
+		coeff = 2*band->cos_w[i];
+		s1 = 0;
+		s2 = 0;
+		for(n=0;n<band->window_width;n++){
+			s0 = samples[n]+coeff*s1-s2;
+			s2 = s1;
+			s1 = s0;
+		}
+
+		/*X = e^(jw).s[N-1] - s[N-2], phase of the DFT so the slide can go on from it*/
+		channel->re[i] = band->cos_w[i]*s1-s2;
+		channel->im[i] = band->sin_w[i]*s1;
+	}
+
+	channel->sum = 0;
+	channel->sum_sq = 0;
+	for(n=0;n<band->window_width;n++){
+		channel->sum += samples[n];
+		channel->sum_sq += samples[n]*samples[n];
+	}
+}
+
+/**
+ * void slide_channel(band_power_t* band, band_channel_t* channel, double* samples)
+ * @brief slide the bins tracked and the sums over the hop new samples
+ * @param band, pointer to band power
+ * @param channel, channel state (window is the last one)
+ * @param samples, window of the channel, the hop last samples are new
+ */
+static void slide_channel(band_power_t* band, band_channel_t* channel, double* samples){
+
+	int i, n;
+	int width = band->window_width;
+	double x_new, x_old, delta, re;
+
+	for(n=0;n<band->hop;n++){
+
+		x_new = samples[width-band->hop+n];
+		x_old = channel->window[n];
+		delta = x_new-x_old;
+
+		for(i=0;i<band->nb_bins;i++){
+			re = channel->re[i]+delta;
+			channel->re[i] = re*band->cos_w[i]-channel->im[i]*band->sin_w[i];
+			channel->im[i] = re*band->sin_w[i]+channel->im[i]*band->cos_w[i];
+		}
+
+		channel->sum += delta;
+		channel->sum_sq += x_new*x_new-x_old*x_old;
+	}
+}
@@ -0,0 +1,358 @@
+/**
+ * @file bcast_ring.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Broadcast ring of feature pages, one producer and up to BCAST_MAX_READERS
+ * readers in other processes (the app, a session recorder, a display...). Unlike
+ * the semaphore protocol of shm_rd_buf.c, the producer never waits for a reader:
+ * each reader keeps its own cursor and copies the pages out of the ring, checking
+ * the page sequence afterwards, so a slow reader loses pages instead of stalling
+ * the others (see bcast_ring.h for the protocol). Readers sleep on the head with a
+ * futex, the producer only makes the wake up call when one of them sleeps.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "bcast_ring.h"
+
+#define BCAST_ROUND_UP(x) (((x)+BCAST_ALIGNMENT-1)/BCAST_ALIGNMENT*BCAST_ALIGNMENT)
+
+static int attach_segment(bcast_t* bcast, size_t size, int flags);
+static int claim_reader_slot(bcast_t* bcast);
+
+/**
+ * int bcast_create(bcast_t* bcast)
+ * @brief producer side, create the ring (or take it over after a restart)
+ * @param bcast, broadcast ring (shm_key, nb_features and buffer_depth set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int bcast_create(bcast_t* bcast){
+
+	bcast_header_t* header;
+	int shmid;
+	size_t size;
+
+	if(bcast->buffer_depth < 1 || bcast->buffer_depth > BCAST_MAX_DEPTH || bcast->nb_features < 1){
+		fprintf(stderr, "Invalid broadcast ring geometry\n");
+		return EXIT_FAILURE;
+	}
+
+	bcast->feat_offset = BCAST_ROUND_UP(sizeof(frame_info_t));
+	bcast->page_stride = BCAST_ROUND_UP(bcast->feat_offset+bcast->nb_features*sizeof(double));
+	size = sizeof(bcast_header_t)+(size_t)bcast->buffer_depth*bcast->page_stride;
+
+	/*a smaller ring from an older run is removed, its readers will attach again*/
+	if(attach_segment(bcast, size, IPC_CREAT | 0666) == EXIT_FAILURE){
+		if(errno != EINVAL || (shmid = shmget(bcast->shm_key, 0, 0)) < 0 ||
+		   shmctl(shmid, IPC_RMID, NULL) != 0 ||
+		   attach_segment(bcast, size, IPC_CREAT | 0666) == EXIT_FAILURE){
+			perror("bcast_create");
+			return EXIT_FAILURE;
+		}
+	}
+	header = bcast->header;
+
+	/*same ring, keep the head going so the readers keep their cursors*/
+	if(__atomic_load_n(&(header->magic), __ATOMIC_ACQUIRE) != BCAST_MAGIC ||
+	   header->version != BCAST_VERSION || header->nb_features != bcast->nb_features ||
+	   header->buffer_depth != bcast->buffer_depth || header->page_stride != bcast->page_stride){
+
+		memset(header, 0, sizeof(bcast_header_t));
+		header->version = BCAST_VERSION;
+		header->nb_features = bcast->nb_features;
+		header->buffer_depth = bcast->buffer_depth;
+		header->feat_offset = bcast->feat_offset;
+		header->page_stride = bcast->page_stride;
+		__atomic_store_n(&(header->magic), BCAST_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	header->producer_pid = getpid();
+	bcast->cursor = __atomic_load_n(&(header->head), __ATOMIC_ACQUIRE);
+	bcast->reader = -1;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * char* bcast_begin_page(bcast_t* bcast)
+ * @brief producer side, get the next page to write, the readers see it as being written
+ * @param bcast, broadcast ring
+ * @return the page (frame info, feature array at feat_offset)
+ */
+char* bcast_begin_page(bcast_t* bcast){
+
+	int slot = bcast->cursor%bcast->buffer_depth;
+
+	__atomic_store_n(&(bcast->header->seq[slot]), 2*bcast->cursor+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	return &(bcast->pages[slot*bcast->page_stride]);
+}
+
+/**
+ * void bcast_publish_page(bcast_t* bcast)
+ * @brief producer side, publish the page written and wake the readers sleeping on it
+ * @param bcast, broadcast ring
+ */
+void bcast_publish_page(bcast_t* bcast){
+
+	bcast_header_t* header = bcast->header;
+	int slot = bcast->cursor%bcast->buffer_depth;
+
+	__atomic_store_n(&(header->seq[slot]), 2*bcast->cursor+2, __ATOMIC_RELEASE);
+	bcast->cursor++;
+	__atomic_store_n(&(header->head), bcast->cursor, __ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&(header->nb_waiters), __ATOMIC_SEQ_CST) > 0){
+		syscall(SYS_futex, &(header->head), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/**
+ * int bcast_attach(bcast_t* bcast)
+ * @brief reader side, attach the ring created by the producer and take a reader slot,
+ *        reading starts with the next page published
+ * @param bcast, broadcast ring (shm_key set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int bcast_attach(bcast_t* bcast){
+
+	bcast_header_t* header;
+	bcast_reader_t* reader;
+
+	if(attach_segment(bcast, 0, 0) == EXIT_FAILURE){
+		perror("bcast_attach");
+		return EXIT_FAILURE;
+	}
+	header = bcast->header;
+
+	if(__atomic_load_n(&(header->magic), __ATOMIC_ACQUIRE) != BCAST_MAGIC ||
+	   header->version != BCAST_VERSION){
+		fprintf(stderr, "Not a broadcast ring (version %u, expected %u)\n", header->version, BCAST_VERSION);
+		shmdt(header);
+		bcast->header = NULL;
+		return EXIT_FAILURE;
+	}
+
+	bcast->nb_features = header->nb_features;
+	bcast->buffer_depth = header->buffer_depth;
+	bcast->feat_offset = header->feat_offset;
+	bcast->page_stride = header->page_stride;
+
+	if(claim_reader_slot(bcast) == EXIT_FAILURE){
+		fprintf(stderr, "All %i broadcast reader slots are taken\n", BCAST_MAX_READERS);
+		shmdt(header);
+		bcast->header = NULL;
+		return EXIT_FAILURE;
+	}
+
+	bcast->cursor = __atomic_load_n(&(header->head), __ATOMIC_ACQUIRE);
+	reader = &(header->readers[bcast->reader]);
+	reader->nb_read = 0;
+	reader->nb_lost = 0;
+	__atomic_store_n(&(reader->cursor), bcast->cursor, __ATOMIC_RELAXED);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int bcast_read(bcast_t* bcast, frame_info_t* frame_info, double* feature_array, int timeout_ms)
+ * @brief reader side, copy the next page out of the ring. Pages overwritten before
+ *        they could be read are counted as lost and skipped.
+ * @param bcast, broadcast ring
+ * @param frame_info(out), frame info of the page
+ * @param feature_array(out), feature array of the page
+ * @param timeout_ms, max wait (ms), BCAST_NO_WAIT or BCAST_WAIT_FOREVER
+ * @return EXIT_SUCCESS, BCAST_TIMEOUT or BCAST_EMPTY (BCAST_NO_WAIT)
+ */
+int bcast_read(bcast_t* bcast, frame_info_t* frame_info, double* feature_array, int timeout_ms){
+
+	bcast_header_t* header = bcast->header;
+	bcast_reader_t* reader = &(header->readers[bcast->reader]);
+	struct timespec deadline, now, remaining;
+	uint32_t head, expected;
+	int32_t lag;
+	char* page;
+	int slot;
+
+	if(timeout_ms > 0){
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms/1000;
+		deadline.tv_nsec += (timeout_ms%1000)*1000000L;
+		if(deadline.tv_nsec >= 1000000000L){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	while(1){
+
+		head = __atomic_load_n(&(header->head), __ATOMIC_ACQUIRE);
+
+		/*nothing new, sleep on the head*/
+		if(head == bcast->cursor){
+
+			if(timeout_ms == BCAST_NO_WAIT){
+				return BCAST_EMPTY;
+			}
+			if(timeout_ms > 0){
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				remaining.tv_sec = deadline.tv_sec-now.tv_sec;
+				remaining.tv_nsec = deadline.tv_nsec-now.tv_nsec;
+				if(remaining.tv_nsec < 0){
+					remaining.tv_sec--;
+					remaining.tv_nsec += 1000000000L;
+				}
+				if(remaining.tv_sec < 0){
+					return BCAST_TIMEOUT;
+				}
+			}
+
+			__atomic_fetch_add(&(header->nb_waiters), 1, __ATOMIC_SEQ_CST);
+			if(__atomic_load_n(&(header->head), __ATOMIC_SEQ_CST) == bcast->cursor){
+				syscall(SYS_futex, &(header->head), FUTEX_WAIT, bcast->cursor,
+						timeout_ms > 0 ? &remaining : NULL, NULL, 0);
+			}
+			__atomic_fetch_sub(&(header->nb_waiters), 1, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		/*the ring was created again, start over from its head*/
+		lag = (int32_t)(head-bcast->cursor);
+		if(lag < 0){
+			bcast->cursor = head;
+			continue;
+		}
+
+		/*lapped, skip to the oldest page left*/
+		if(lag > bcast->buffer_depth){
+			reader->nb_lost += lag-bcast->buffer_depth;
+			bcast->cursor = head-bcast->buffer_depth;
+		}
+
+		slot = bcast->cursor%bcast->buffer_depth;
+		expected = 2*bcast->cursor+2;
+		page = &(bcast->pages[slot*bcast->page_stride]);
+
+		/*copy, then make sure the producer did not write over it meanwhile*/
+		if(__atomic_load_n(&(header->seq[slot]), __ATOMIC_ACQUIRE) == expected){
+			memcpy(frame_info, page, sizeof(frame_info_t));
+			memcpy(feature_array, &(page[bcast->feat_offset]), bcast->nb_features*sizeof(double));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&(header->seq[slot]), __ATOMIC_RELAXED) == expected){
+				bcast->cursor++;
+				reader->nb_read++;
+				__atomic_store_n(&(reader->cursor), bcast->cursor, __ATOMIC_RELAXED);
+				return EXIT_SUCCESS;
+			}
+		}
+
+		reader->nb_lost++;
+		bcast->cursor++;
+	}
+}
+
+/**
+ * int bcast_available(bcast_t* bcast)
+ * @brief reader side, nb of pages that can be read without waiting
+ * @param bcast, broadcast ring
+ * @return nb of pages, up to the ring depth
+ */
+int bcast_available(bcast_t* bcast){
+
+	int32_t lag = (int32_t)(__atomic_load_n(&(bcast->header->head), __ATOMIC_ACQUIRE)-bcast->cursor);
+
+	if(lag < 0){
+		return 0;
+	}
+	return (lag > bcast->buffer_depth)?bcast->buffer_depth:lag;
+}
+
+/**
+ * int bcast_detach(bcast_t* bcast)
+ * @brief release the reader slot and detach, the ring stays for the others
+ * @param bcast, broadcast ring
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int bcast_detach(bcast_t* bcast){
+
+	if(bcast->header == NULL){
+		return EXIT_SUCCESS;
+	}
+
+	if(bcast->reader >= 0){
+		__atomic_store_n(&(bcast->header->readers[bcast->reader].pid), 0, __ATOMIC_RELEASE);
+	}
+
+	if(shmdt(bcast->header) != 0){
+		perror("bcast_detach");
+		return EXIT_FAILURE;
+	}
+	bcast->header = NULL;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int attach_segment(bcast_t* bcast, size_t size, int flags)
+ * @brief get and map the segment of the ring
+ * @param bcast, broadcast ring (shm_key set)
+ * @param size, size of the segment, 0 to take it as it is
+ * @param flags, shmget flags
+ * @return EXIT_SUCCESS, EXIT_FAILURE (errno set)
+ */
+static int attach_segment(bcast_t* bcast, size_t size, int flags){
+
+	void* addr;
+
+	if((bcast->shmid = shmget(bcast->shm_key, size, flags)) < 0){
+		return EXIT_FAILURE;
+	}
+	if((addr = shmat(bcast->shmid, NULL, 0)) == (void*)-1){
+		return EXIT_FAILURE;
+	}
+
+	bcast->header = addr;
+	bcast->pages = (char*)addr+sizeof(bcast_header_t);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int claim_reader_slot(bcast_t* bcast)
+ * @brief take a free reader slot, or one left by a reader that died
+ * @param bcast, broadcast ring
+ * @return EXIT_SUCCESS, EXIT_FAILURE if they are all taken
+ */
+static int claim_reader_slot(bcast_t* bcast){
+
+	int32_t pid, self = getpid();
+	int i;
+
+	for(i=0;i<BCAST_MAX_READERS;i++){
+
+		pid = __atomic_load_n(&(bcast->header->readers[i].pid), __ATOMIC_ACQUIRE);
+		if(pid != 0 && (kill(pid, 0) == 0 || errno != ESRCH)){
+			continue;
+		}
+		if(__atomic_compare_exchange_n(&(bcast->header->readers[i].pid), &pid, self, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+			bcast->reader = i;
+			return EXIT_SUCCESS;
+		}
+	}
+
+	return EXIT_FAILURE;
+}
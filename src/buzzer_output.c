@@ -0,0 +1,43 @@
+/**
+ * @file buzzer_output.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Tone output of the app, on the buzzer set up by buzzer_lib. The
+ * pitches come from the pitch table (see pitch_map.h), set_buzzer_state()
+ * maps its own steps and is not used for the feedback.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <softTone.h>
+#include <buzzer_lib.h>
+
+#include "buzzer_output.h"
+
+/**
+ * void setup_buzzer(void)
+ * @brief set up buzzer_lib on the buzzer pin, with its soft tone
+ */
+void setup_buzzer(void){
+
+	setup_buzzer_lib(DEFAULT_PIN);
+}
+
+/**
+ * void set_buzzer_pitch(int pitch)
+ * @brief emit a feedback pitch on the buzzer
+ * @param pitch, pitch from the pitch table (Hz), 0 mutes the buzzer
+ */
+void set_buzzer_pitch(int pitch){
+
+	softToneWrite(DEFAULT_PIN, pitch);
+}
+
+/**
+ * void mute_buzzer(void)
+ * @brief no tone while there is no feedback to give
+ */
+void mute_buzzer(void){
+
+	set_buzzer_pitch(0);
+}
@@ -0,0 +1,220 @@
+/**
+ * @file calibration_store.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Small binary store of the training references, one record per user,
+ * device and measurement. A session can start from a recent reference instead
+ * of a full training, see train_feat_processing.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "calibration_store.h"
+
+#define CALIB_PATH_LENGTH 512
+
+static int read_store(const char* path, calib_record_t* records);
+static int find_record(calib_record_t* records, int nb_records, calib_record_t* record);
+static uint32_t record_checksum(calib_record_t* record);
+
+/**
+ * void init_calib_record(calib_record_t* record, const char* user)
+ * @brief clear a record and set its key, the measurement is set by the caller
+ * @param record, record to initialize
+ * @param user, user id, truncated to CALIB_ID_LENGTH-1
+ */
+void init_calib_record(calib_record_t* record, const char* user){
+
+	/*padding included, the checksum covers the raw bytes*/
+	memset(record, 0, sizeof(calib_record_t));
+	strncpy(record->user, user, CALIB_ID_LENGTH-1);
+	if(gethostname(record->device, CALIB_ID_LENGTH) != 0){
+		strcpy(record->device, "unknown");
+	}
+	record->device[CALIB_ID_LENGTH-1] = '\0';
+}
+
+/**
+ * int calib_store_load(const char* path, calib_record_t* record)
+ * @brief find the reference of the record key and measurement
+ * @param path, store file
+ * @param record(in/out), key and measurement set, reference filled in when found
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the store has no such record
+ */
+int calib_store_load(const char* path, calib_record_t* record){
+
+	calib_record_t records[CALIB_STORE_MAX_RECORDS];
+	int nb_records = read_store(path, records);
+	int idx = find_record(records, nb_records, record);
+
+	if(idx < 0){
+		return EXIT_FAILURE;
+	}
+
+	memcpy(record, &(records[idx]), sizeof(calib_record_t));
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int calib_store_save(const char* path, calib_record_t* record)
+ * @brief add or replace the record, the store is rewritten as a whole
+ * @param path, store file
+ * @param record, complete record, its checksum is set
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the store can't be written
+ */
+int calib_store_save(const char* path, calib_record_t* record){
+
+	calib_record_t records[CALIB_STORE_MAX_RECORDS];
+	calib_store_header_t header;
+	char tmp_path[CALIB_PATH_LENGTH];
+	FILE* file;
+	int nb_records = read_store(path, records);
+	int idx = find_record(records, nb_records, record);
+	int i;
+
+	/*a new record takes a free slot or the least recently updated one*/
+	if(idx < 0 && nb_records < CALIB_STORE_MAX_RECORDS){
+		idx = nb_records++;
+	}else if(idx < 0){
+		idx = 0;
+		for(i=1;i<nb_records;i++){
+			if(records[i].update_time < records[idx].update_time){
+				idx = i;
+			}
+		}
+	}
+
+	record->checksum = record_checksum(record);
+	memcpy(&(records[idx]), record, sizeof(calib_record_t));
+
+	header.magic = CALIB_STORE_MAGIC;
+	header.version = CALIB_STORE_VERSION;
+	header.nb_records = nb_records;
+	header.record_size = sizeof(calib_record_t);
+
+	/*written aside and renamed, the store is never seen half written*/
+	snprintf(tmp_path, CALIB_PATH_LENGTH, "%s.tmp", path);
+	file = fopen(tmp_path, "wb");
+	if(file == NULL){
+		perror("calibration store");
+		return EXIT_FAILURE;
+	}
+	if(fwrite(&header, sizeof(calib_store_header_t), 1, file) != 1 ||
+	   fwrite(records, sizeof(calib_record_t), nb_records, file) != (size_t)nb_records ||
+	   fflush(file) != 0 || fsync(fileno(file)) != 0){
+		perror("calibration store");
+		fclose(file);
+		unlink(tmp_path);
+		return EXIT_FAILURE;
+	}
+	fclose(file);
+
+	if(rename(tmp_path, path) != 0){
+		perror("calibration store");
+		unlink(tmp_path);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * double calib_record_age(calib_record_t* record)
+ * @brief time since the full training of the reference
+ * @param record, record loaded
+ * @return age in hours
+ */
+double calib_record_age(calib_record_t* record){
+	return (double)(time(NULL)-record->trained_time)/3600.0;
+}
+
+/**
+ * static int read_store(const char* path, calib_record_t* records)
+ * @brief read the records of the store, the damaged ones are dropped
+ * @param path, store file
+ * @param records(out), CALIB_STORE_MAX_RECORDS records
+ * @return nb of records, 0 if the store is missing or unreadable
+ */
+static int read_store(const char* path, calib_record_t* records){
+
+	calib_store_header_t header;
+	FILE* file = fopen(path, "rb");
+	int nb_records = 0;
+	int i;
+
+	if(file == NULL){
+		return 0;
+	}
+
+	if(fread(&header, sizeof(calib_store_header_t), 1, file) != 1 ||
+	   header.magic != CALIB_STORE_MAGIC || header.version != CALIB_STORE_VERSION ||
+	   header.record_size != sizeof(calib_record_t) || header.nb_records > CALIB_STORE_MAX_RECORDS){
+		fprintf(stderr, "Calibration store %s not recognized, starting a new one\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	for(i=0;i<(int)header.nb_records;i++){
+		if(fread(&(records[nb_records]), sizeof(calib_record_t), 1, file) != 1){
+			break;
+		}
+		if(records[nb_records].checksum == record_checksum(&(records[nb_records]))){
+			nb_records++;
+		}
+	}
+	fclose(file);
+
+	return nb_records;
+}
+
+/**
+ * static int find_record(calib_record_t* records, int nb_records, calib_record_t* record)
+ * @brief look for the record of the same key and measurement
+ * @param records, records of the store
+ * @param nb_records, nb of records
+ * @param record, record looked for
+ * @return index, -1 if not found
+ */
+static int find_record(calib_record_t* records, int nb_records, calib_record_t* record){
+
+	int i;
+
+	for(i=0;i<nb_records;i++){
+		if(strncmp(records[i].user, record->user, CALIB_ID_LENGTH) == 0 &&
+		   strncmp(records[i].device, record->device, CALIB_ID_LENGTH) == 0 &&
+		   records[i].calibration == record->calibration &&
+		   records[i].band_source == record->band_source &&
+		   records[i].nb_channels == record->nb_channels &&
+		   records[i].window_width == record->window_width &&
+		   records[i].iaf == record->iaf &&
+		   records[i].sampling_rate == record->sampling_rate){
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * static uint32_t record_checksum(calib_record_t* record)
+ * @brief FNV-1a of the record up to its checksum
+ * @param record, record
+ * @return checksum
+ */
+static uint32_t record_checksum(calib_record_t* record){
+
+	const unsigned char* bytes = (const unsigned char*)record;
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for(i=0;i<offsetof(calib_record_t, checksum);i++){
+		hash = (hash ^ bytes[i])*16777619u;
+	}
+
+	return hash;
+}
@@ -0,0 +1,242 @@
+/**
+ * @file config_watcher.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Hot reload of the app config. A thread waits for inotify events on the
+ * config file, re-parses it with xml_initialize and publishes the result. The
+ * main loop takes the new config between sessions, so a change never lands in
+ * the middle of a training or a task.
+ *
+ * The hand over is a single pointer slot. The watcher exchanges its new config
+ * in (a config nobody took yet is freed), the main loop exchanges NULL in and
+ * owns what it gets, so no config is ever freed while in use.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "config_watcher.h"
+
+static void* watch_config(void* param);
+static char config_event(config_watcher_t* watcher, char* buf, ssize_t len);
+
+/**
+ * int init_config_watcher(config_watcher_t* watcher)
+ * @brief watch the directory of the config file and start the watcher thread
+ * @param watcher, config watcher (filename set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_config_watcher(config_watcher_t* watcher){
+
+	char* slash;
+
+	watcher->pending = NULL;
+	watcher->nb_reloads = 0;
+
+	/*split the path, the directory is watched*/
+	strncpy(watcher->directory, watcher->filename, MAX_PATH_LENGTH-1);
+	watcher->directory[MAX_PATH_LENGTH-1] = '\0';
+	slash = strrchr(watcher->directory, '/');
+	if(slash == NULL){
+		strcpy(watcher->directory, ".");
+		watcher->basename = watcher->filename;
+	}else{
+		*slash = '\0';
+		watcher->basename = strrchr(watcher->filename, '/')+1;
+		if(watcher->directory[0] == '\0'){
+			strcpy(watcher->directory, "/");
+		}
+	}
+
+	if((watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0){
+		perror("inotify_init");
+		return EXIT_FAILURE;
+	}
+
+	/*written in place, or replaced by a rename*/
+	watcher->watch_fd = inotify_add_watch(watcher->inotify_fd, watcher->directory,
+										  IN_CLOSE_WRITE | IN_MOVED_TO);
+	if(watcher->watch_fd < 0){
+		perror("inotify_add_watch");
+		close(watcher->inotify_fd);
+		return EXIT_FAILURE;
+	}
+
+	watcher->running = 0x01;
+	if(pthread_create(&(watcher->thread), NULL, watch_config, watcher) != 0){
+		close(watcher->inotify_fd);
+		return EXIT_FAILURE;
+	}
+
+	printf("Watching %s for changes\n", watcher->filename);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * appconfig_t* take_new_config(config_watcher_t* watcher)
+ * @brief take the last config parsed since the previous call, the caller owns it
+ * @param watcher, config watcher
+ * @return the new config, NULL if the file did not change
+ */
+appconfig_t* take_new_config(config_watcher_t* watcher){
+
+	return __atomic_exchange_n(&(watcher->pending), NULL, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * char config_changes_geometry(appconfig_t* old_config, appconfig_t* new_config)
+ * @brief check if the new config changes the feature input (source, vector or pages),
+ *        in which case the input must be attached again
+ * @param old_config, config in use
+ * @param new_config, config to apply
+ * @return 1 if the input must be attached again, 0 otherwise
+ */
+char config_changes_geometry(appconfig_t* old_config, appconfig_t* new_config){
+
+	return old_config->feature_source != new_config->feature_source ||
+		   old_config->nb_channels != new_config->nb_channels ||
+		   old_config->window_width != new_config->window_width ||
+		   old_config->timeseries != new_config->timeseries ||
+		   old_config->fft != new_config->fft ||
+		   old_config->power_alpha != new_config->power_alpha ||
+		   old_config->power_beta != new_config->power_beta ||
+		   old_config->power_gamma != new_config->power_gamma ||
+		   old_config->buffer_depth != new_config->buffer_depth ||
+		   old_config->page_layout != new_config->page_layout ||
+		   old_config->page_format != new_config->page_format ||
+		   old_config->shm_backing != new_config->shm_backing ||
+		   old_config->shm_hugepages != new_config->shm_hugepages ||
+		   strcmp(old_config->shm_name, new_config->shm_name) != 0 ||
+		   strcmp(old_config->feature_socket, new_config->feature_socket) != 0 ||
+		   old_config->replay_start != new_config->replay_start ||
+		   strcmp(old_config->session_file, new_config->session_file) != 0;
+}
+
+/**
+ * void report_startup_only_changes(appconfig_t* old_config, appconfig_t* new_config)
+ * @brief warn about the elements changed in the new config that are only read at
+ *        startup (hardware, clock, displays, metrics, flight recorder). They keep
+ *        their current value until the app is restarted.
+ * @param old_config, config in use
+ * @param new_config, config to apply
+ */
+void report_startup_only_changes(appconfig_t* old_config, appconfig_t* new_config){
+
+	if(old_config->eeg_hardware_required != new_config->eeg_hardware_required ||
+	   old_config->hw_timeout != new_config->hw_timeout){
+		printf("Config: eeg hardware settings are applied at the next start\n");
+	}
+	if(old_config->clock != new_config->clock){
+		printf("Config: clock is applied at the next start\n");
+	}
+	if(old_config->ready_timeout != new_config->ready_timeout){
+		printf("Config: ready_timeout is applied at the next start\n");
+	}
+	if(old_config->live_state != new_config->live_state){
+		printf("Config: live_state is applied at the next start\n");
+	}
+	if(strcmp(old_config->metrics_socket, new_config->metrics_socket) != 0){
+		printf("Config: metrics_socket is applied at the next start\n");
+	}
+	if(old_config->flight_duration != new_config->flight_duration ||
+	   strcmp(old_config->flight_dir, new_config->flight_dir) != 0 ||
+	   old_config->flight_latency != new_config->flight_latency ||
+	   old_config->flight_rejections != new_config->flight_rejections){
+		printf("Config: flight recorder settings are applied at the next start\n");
+	}
+}
+
+/**
+ * int stop_config_watcher(config_watcher_t* watcher)
+ * @brief stop the watcher thread and free the config nobody took
+ * @param watcher, config watcher
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int stop_config_watcher(config_watcher_t* watcher){
+
+	watcher->running = 0x00;
+	pthread_join(watcher->thread, NULL);
+	close(watcher->inotify_fd);
+
+	free(take_new_config(watcher));
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void* watch_config(void* param)
+ * @brief watcher thread, re-parse the config each time it is written and publish it
+ * @param param, (config_watcher_t*) config watcher
+ * @return NULL
+ */
+static void* watch_config(void* param){
+
+	config_watcher_t* watcher = param;
+	struct pollfd pfd;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	char changed;
+	appconfig_t* new_config;
+
+	pfd.fd = watcher->inotify_fd;
+	pfd.events = POLLIN;
+
+	while(watcher->running){
+
+		if(poll(&pfd, 1, CONFIG_POLL_MS) <= 0){
+			continue;
+		}
+
+		/*drain the events, an editor may emit several for one save*/
+		changed = 0x00;
+		while((len = read(watcher->inotify_fd, buf, sizeof(buf))) > 0){
+			changed |= config_event(watcher, buf, len);
+		}
+		if(!changed){
+			continue;
+		}
+
+		/*a bad file is reported and the current config kept*/
+		new_config = xml_initialize(watcher->filename);
+		if(new_config == NULL){
+			fprintf(stderr, "Config reload failed, keeping the current config\n");
+			continue;
+		}
+
+		/*replaces a config that was not taken yet*/
+		free(__atomic_exchange_n(&(watcher->pending), new_config, __ATOMIC_ACQ_REL));
+		watcher->nb_reloads++;
+		printf("Config reloaded, applied at the next session\n");
+		fflush(stdout);
+	}
+
+	return NULL;
+}
+
+/**
+ * char config_event(config_watcher_t* watcher, char* buf, ssize_t len)
+ * @brief check if a buffer of inotify events concerns the config file
+ * @param watcher, config watcher
+ * @param buf, events read
+ * @param len, nb of bytes read
+ * @return 1 if the config file changed, 0 otherwise
+ */
+static char config_event(config_watcher_t* watcher, char* buf, ssize_t len){
+
+	char* ptr;
+	struct inotify_event* event;
+	char changed = 0x00;
+
+	for(ptr=buf;ptr<buf+len;ptr+=sizeof(struct inotify_event)+event->len){
+		event = (struct inotify_event*)ptr;
+		if(event->len > 0 && strcmp(event->name, watcher->basename) == 0){
+			changed = 0x01;
+		}
+	}
+
+	return changed;
+}
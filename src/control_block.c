@@ -0,0 +1,211 @@
+/**
+ * @file control_block.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Control block shared with the producer, replaces the fixed delays of the
+ * startup with an explicit readiness handshake (see control_block.h for the protocol).
+ * State words are waited on with a futex, so a producer that wakes us is seen at once
+ * and one that doesn't is still seen within a polling period.
+ * The app also tells the producer when frames are wanted and at which rate, so
+ * an idle unit doesn't keep the fft running.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "control_block.h"
+
+/**
+ * int control_init(control_t* control)
+ * @brief attach the control block (created if we are first) and announce the app
+ * @param control, control block link (shm_key set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int control_init(control_t* control){
+
+	control_block_t* block;
+
+	if((control->shmid = shmget(control->shm_key, CONTROL_BLOCK_SIZE, IPC_CREAT | 0666)) < 0){
+		perror("control shmget");
+		return EXIT_FAILURE;
+	}
+
+	if((control->block = shmat(control->shmid, NULL, 0)) == (void*)-1){
+		perror("control shmat");
+		control->block = NULL;
+		return EXIT_FAILURE;
+	}
+	block = control->block;
+
+	/*first to attach, describe the block*/
+	if(__atomic_load_n(&(block->magic), __ATOMIC_ACQUIRE) != CONTROL_BLOCK_MAGIC){
+		block->version = CONTROL_BLOCK_VERSION;
+		__atomic_store_n(&(block->magic), CONTROL_BLOCK_MAGIC, __ATOMIC_RELEASE);
+	}
+	else if(block->version != CONTROL_BLOCK_VERSION){
+		fprintf(stderr, "control block version %u, expected %u\n", block->version, CONTROL_BLOCK_VERSION);
+		shmdt(block);
+		control->block = NULL;
+		return EXIT_FAILURE;
+	}
+
+	block->app_pid = getpid();
+	__atomic_store_n(&(block->app_heartbeat), 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&(block->app_frame_rate), 0, __ATOMIC_RELAXED);
+	control_set_app_activity(control, APP_ACTIVE);
+	control_set_app_state(control, PEER_STARTING);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void control_set_app_state(control_t* control, uint32_t state)
+ * @brief publish the app state and wake the producer if it waits on it
+ * @param control, control block link
+ * @param state, PEER_* state
+ */
+void control_set_app_state(control_t* control, uint32_t state){
+
+	if(control->block == NULL){
+		return;
+	}
+
+	__atomic_store_n(&(control->block->app_state), state, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &(control->block->app_state), FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * uint32_t control_get_producer_state(control_t* control)
+ * @brief read the producer state
+ * @param control, control block link
+ * @return PEER_* state
+ */
+uint32_t control_get_producer_state(control_t* control){
+
+	if(control->block == NULL){
+		return PEER_ABSENT;
+	}
+
+	return __atomic_load_n(&(control->block->producer_state), __ATOMIC_ACQUIRE);
+}
+
+/**
+ * uint32_t control_get_producer_dropped(control_t* control)
+ * @brief read the nb of frames the producer dropped
+ * @param control, control block link
+ * @return nb of frames dropped
+ */
+uint32_t control_get_producer_dropped(control_t* control){
+
+	if(control->block == NULL){
+		return 0;
+	}
+
+	return __atomic_load_n(&(control->block->producer_dropped), __ATOMIC_RELAXED);
+}
+
+/**
+ * void control_set_app_activity(control_t* control, uint32_t activity)
+ * @brief publish whether frames are wanted and wake the producer if it waits on it
+ * @param control, control block link
+ * @param activity, APP_ACTIVE or APP_IDLE
+ */
+void control_set_app_activity(control_t* control, uint32_t activity){
+
+	if(control->block == NULL){
+		return;
+	}
+
+	__atomic_store_n(&(control->block->app_activity), activity, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &(control->block->app_activity), FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * void control_request_frame_rate(control_t* control, double frame_rate)
+ * @brief declare the frame rate the app wants, the producer may decimate to it
+ * @param control, control block link
+ * @param frame_rate, frame rate (Hz), 0 for the producer's own
+ */
+void control_request_frame_rate(control_t* control, double frame_rate){
+
+	if(control->block == NULL){
+		return;
+	}
+
+	__atomic_store_n(&(control->block->app_frame_rate), (uint32_t)(frame_rate*1000+0.5), __ATOMIC_RELAXED);
+}
+
+/**
+ * double control_get_producer_frame_rate(control_t* control)
+ * @brief read the frame rate the producer reports
+ * @param control, control block link
+ * @return frame rate (Hz), 0 if not reported
+ */
+double control_get_producer_frame_rate(control_t* control){
+
+	if(control->block == NULL){
+		return 0;
+	}
+
+	return __atomic_load_n(&(control->block->producer_frame_rate), __ATOMIC_RELAXED)/1000.0;
+}
+
+/**
+ * int control_wait_producer_ready(control_t* control, int timeout_ms)
+ * @brief blocking call, until the producer is ready or the timeout expires
+ * @param control, control block link
+ * @param timeout_ms, max wait (ms)
+ * @return EXIT_SUCCESS if the producer is ready, EXIT_FAILURE on timeout
+ */
+int control_wait_producer_ready(control_t* control, int timeout_ms){
+
+	struct timespec slice = {0, CONTROL_WAIT_SLICE_MS*1000000L};
+	struct timespec start, now;
+	uint32_t state;
+
+	if(control->block == NULL){
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while((state = control_get_producer_state(control)) != PEER_READY){
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if((now.tv_sec-start.tv_sec)*1000L+(now.tv_nsec-start.tv_nsec)/1000000L >= timeout_ms){
+			return EXIT_FAILURE;
+		}
+
+		/*returns when woken, when the state changed or after a slice*/
+		syscall(SYS_futex, &(control->block->producer_state), FUTEX_WAIT, state, &slice, NULL, 0);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int control_cleanup(control_t* control)
+ * @brief announce the app is gone and detach the control block
+ * @param control, control block link
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int control_cleanup(control_t* control){
+
+	if(control->block == NULL){
+		return EXIT_SUCCESS;
+	}
+
+	/*a producer waiting for frames to be wanted goes back to its own behaviour*/
+	control_set_app_activity(control, APP_ACTIVE);
+	control_set_app_state(control, PEER_ABSENT);
+	shmdt(control->block);
+	control->block = NULL;
+
+	return EXIT_SUCCESS;
+}
@@ -13,45 +13,93 @@
 #include "feature_input.h"
 #include "fake_feature_generator.h"
 #include "shm_rd_buf.h"
+#include "file_feat_reader.h"
+#include "bcast_rd_buf.h"
+#include "sock_rd_buf.h"
 #include "xml.h"
+#include "feature_kernels.h"
+#include "app_clock.h"
 
 /**
- * int init_feature_input(char input_type)
+ * int init_feature_input(char input_type, feature_input_t* feature_input)
  * 
  * @brief Setup function pointers for the data input based on the type
- * of data source which could be shared memory (SHM) or a fake signal generator
- * (FAKE).
+ * of data source which could be shared memory (SHM), a fake signal generator
+ * (FAKE), a recorded session (FILE), the broadcast ring shared with other
+ * readers (BCAST) or pages passed over a Unix socket (SOCK). The functions
+ * are held by the feature input.
  * @param input_type, string identifying the type of input to init
+ * @param feature_input, feature input to setup
  * @return EXIT_FAILURE for unknown type, EXIT_SUCCESS for known/success
  */
 int init_feature_input(char input_type, feature_input_t* feature_input){
 
 	/*default values*/
-	_INIT_FEAT_INPUT_FC = NULL;
-	_REQUEST_FEAT_FC = NULL;
-	_WAIT_FEAT_FC = NULL;
-	_TERMINATE_FEAT_INPUT_FC = NULL;
+	feature_input->init_fc = NULL;
+	feature_input->request_fc = NULL;
+	feature_input->wait_fc = NULL;
+	feature_input->terminate_fc = NULL;
+	feature_input->get_batch_fc = NULL;
+	feature_input->stalled = 0x00;
+	feature_input->nb_stalls = 0;
+	feature_input->recovery_ms = 0;
+	feature_input->widened = NULL;
 
 	/*shared memory interface*/
 	if(input_type == SHM_INPUT) {
 		
 		printf("Input source: SHM\n");
-		_INIT_FEAT_INPUT_FC = &shm_rd_init;
-		_REQUEST_FEAT_FC = &shm_rd_request;
-		_WAIT_FEAT_FC = &shm_rd_wait_for_request_completed;
-		_GET_FRAME_INFO_FC = &shm_get_frame_info_ref;
-		_GET_FVECT_INFO_FC = &shm_get_feature_array_ref;
-		_TERMINATE_FEAT_INPUT_FC = &shm_rd_cleanup;
+		feature_input->init_fc = &shm_rd_init;
+		feature_input->request_fc = &shm_rd_request;
+		feature_input->wait_fc = &shm_rd_wait_for_request_completed;
+		feature_input->get_frame_info_fc = &shm_get_frame_info_ref;
+		feature_input->get_fvect_fc = &shm_get_feature_array_ref;
+		feature_input->get_batch_fc = &shm_rd_get_batch;
+		feature_input->terminate_fc = &shm_rd_cleanup;
 	}
 	/*fake input interface*/
 	else if(input_type == FAKE_INPUT){
 		printf("Input source: FAKE\n");
-		_INIT_FEAT_INPUT_FC = &fake_feat_gen_init;
-		_REQUEST_FEAT_FC = &fake_feat_gen_request;
-		_WAIT_FEAT_FC = &fake_feat_gen_wait_for_request_completed;
-		_GET_FRAME_INFO_FC = &fake_feat_gen_frame_info_ref;
-		_GET_FVECT_INFO_FC = &fake_feat_gen_feature_array_ref;
-		_TERMINATE_FEAT_INPUT_FC = &fake_feat_gen_cleanup;
+		feature_input->init_fc = &fake_feat_gen_init;
+		feature_input->request_fc = &fake_feat_gen_request;
+		feature_input->wait_fc = &fake_feat_gen_wait_for_request_completed;
+		feature_input->get_frame_info_fc = &fake_feat_gen_frame_info_ref;
+		feature_input->get_fvect_fc = &fake_feat_gen_feature_array_ref;
+		feature_input->get_batch_fc = &fake_feat_gen_get_batch;
+		feature_input->terminate_fc = &fake_feat_gen_cleanup;
+	}
+	/*recorded session interface*/
+	else if(input_type == FILE_INPUT){
+		printf("Input source: FILE\n");
+		feature_input->init_fc = &file_feat_rd_init;
+		feature_input->request_fc = &file_feat_rd_request;
+		feature_input->wait_fc = &file_feat_rd_wait_for_request_completed;
+		feature_input->get_frame_info_fc = &file_feat_rd_frame_info_ref;
+		feature_input->get_fvect_fc = &file_feat_rd_feature_array_ref;
+		feature_input->get_batch_fc = &file_feat_rd_get_batch;
+		feature_input->terminate_fc = &file_feat_rd_cleanup;
+	}
+	/*broadcast ring interface*/
+	else if(input_type == BCAST_INPUT){
+		printf("Input source: BCAST\n");
+		feature_input->init_fc = &bcast_rd_init;
+		feature_input->request_fc = &bcast_rd_request;
+		feature_input->wait_fc = &bcast_rd_wait_for_request_completed;
+		feature_input->get_frame_info_fc = &bcast_get_frame_info_ref;
+		feature_input->get_fvect_fc = &bcast_get_feature_array_ref;
+		feature_input->get_batch_fc = &bcast_rd_get_batch;
+		feature_input->terminate_fc = &bcast_rd_cleanup;
+	}
+	/*Unix socket interface*/
+	else if(input_type == SOCK_INPUT){
+		printf("Input source: SOCK\n");
+		feature_input->init_fc = &sock_rd_init;
+		feature_input->request_fc = &sock_rd_request;
+		feature_input->wait_fc = &sock_rd_wait_for_request_completed;
+		feature_input->get_frame_info_fc = &sock_get_frame_info_ref;
+		feature_input->get_fvect_fc = &sock_get_feature_array_ref;
+		feature_input->get_batch_fc = &sock_rd_get_batch;
+		feature_input->terminate_fc = &sock_rd_cleanup;
 	}
 	else{
 		fprintf(stderr, "Unknown input type\n");
@@ -61,3 +109,147 @@ int init_feature_input(char input_type, feature_input_t* feature_input){
 	
 }
 
+/**
+ * int set_page_layout(feature_input_t* feature_input)
+ * 
+ * @brief Compute the page geometry from the number of features and the layout.
+ * Packed pages are the frame info followed by the features. Aligned pages start
+ * the feature array on a cache line and pad each page to a multiple of it, so the
+ * arrays can be loaded with aligned vector loads and pages never share a line.
+ * Float32 pages hold 4 bytes features, doubles otherwise.
+ * @param feature_input, feature input (nb_features, layout and page format set)
+ * @return EXIT_FAILURE for unknown layout, EXIT_SUCCESS otherwise
+ */
+int set_page_layout(feature_input_t* feature_input){
+
+	int align;
+
+	if(feature_input->layout == LAYOUT_ALIGNED){
+		align = PAGE_ALIGNMENT;
+		/*room for the layout header*/
+		feature_input->pages_offset = sizeof(shm_layout_t);
+	}
+	else if(feature_input->layout == LAYOUT_PACKED){
+		align = 1;
+		feature_input->pages_offset = 0;
+	}
+	else{
+		fprintf(stderr, "Unknown page layout\n");
+		return EXIT_FAILURE;
+	}
+
+	feature_input->feature_size = (feature_input->page_format == PAGE_FLOAT32)?sizeof(float):sizeof(double);
+	feature_input->page_size = sizeof(frame_info_t)+feature_input->nb_features*feature_input->feature_size;
+	feature_input->feat_offset = (sizeof(frame_info_t)+align-1)/align*align;
+	feature_input->page_stride = (feature_input->feat_offset+
+								  feature_input->nb_features*feature_input->feature_size+align-1)/align*align;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void* alloc_pages(feature_input_t* feature_input)
+ * 
+ * @brief Allocate a private page buffer with the feature input layout
+ * (inputs that do not share their pages)
+ * @param feature_input, feature input (layout and buffer depth set)
+ * @return the buffer, NULL on failure
+ */
+void* alloc_pages(feature_input_t* feature_input){
+
+	void* buf;
+	size_t size = feature_input->pages_offset+
+				  (size_t)feature_input->buffer_depth*feature_input->page_stride;
+
+	if(posix_memalign(&buf, PAGE_ALIGNMENT, size) != 0){
+		return NULL;
+	}
+	memset(buf, 0, size);
+
+	return buf;
+}
+
+/**
+ * int alloc_widened(feature_input_t* feature_input)
+ * 
+ * @brief Allocate the feature arrays float32 pages are widened to, one per page
+ * of the buffer (nothing for float64 pages). Any previous allocation is freed.
+ * @param feature_input, feature input (geometry set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int alloc_widened(feature_input_t* feature_input){
+
+	void* buf = NULL;
+
+	free(feature_input->widened);
+	feature_input->widened = NULL;
+
+	if(feature_input->page_format != PAGE_FLOAT32){
+		return EXIT_SUCCESS;
+	}
+
+	if(posix_memalign(&buf, PAGE_ALIGNMENT,
+					  (size_t)feature_input->buffer_depth*feature_input->nb_features*sizeof(double)) != 0){
+		perror("alloc_widened");
+		return EXIT_FAILURE;
+	}
+	feature_input->widened = buf;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * double* page_features(feature_input_t* feature_input, int page)
+ * 
+ * @brief Feature array of a page as doubles. Float32 pages are widened in
+ * the array of the page, each call converts them again.
+ * @param feature_input, feature input
+ * @param page, page of the buffer
+ * @return feature array
+ */
+double* page_features(feature_input_t* feature_input, int page){
+
+	char* features = &(PAGE_REF(feature_input, page)[feature_input->feat_offset]);
+	double* widened;
+
+	if(feature_input->page_format != PAGE_FLOAT32){
+		return (double*)features;
+	}
+
+	widened = &(feature_input->widened[(size_t)page*feature_input->nb_features]);
+	widen_features((float*)features, widened, feature_input->nb_features);
+	return widened;
+}
+
+/**
+ * int report_input_stall(feature_input_t* feature_input)
+ * 
+ * @brief A wait gave up, note when the producer went silent (first time only)
+ * @param feature_input, feature input
+ * @return FEAT_INPUT_STALLED
+ */
+int report_input_stall(feature_input_t* feature_input){
+
+	if(!feature_input->stalled){
+		feature_input->stalled = 0x01;
+		feature_input->nb_stalls++;
+		app_clock_now(&(feature_input->stall_time));
+		fprintf(stderr, "Producer silent for %.1f s, waiting for it\n", feature_input->stall_timeout);
+	}
+
+	return FEAT_INPUT_STALLED;
+}
+
+/**
+ * void report_input_recovery(feature_input_t* feature_input)
+ * 
+ * @brief First page after a stall, measure the time to recover
+ * @param feature_input, feature input
+ */
+void report_input_recovery(feature_input_t* feature_input){
+
+	feature_input->recovery_ms = app_clock_elapsed_ms(&(feature_input->stall_time));
+	feature_input->stalled = 0x00;
+	printf("Producer back, recovered in %.0f ms\n", feature_input->recovery_ms);
+	fflush(stdout);
+}
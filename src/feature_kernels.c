@@ -0,0 +1,94 @@
+/**
+ * @file feature_kernels.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Vector kernels of the float32 pages. A float32 page is widened once,
+ * when it is handed out, the processing keeps working on doubles so its sums
+ * and statistics don't lose precision (see tools/float_bench.c).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "feature_kernels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define KERNELS_PATH "SSE2"
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNELS_PATH "NEON"
+#else
+#define KERNELS_PATH "scalar"
+#endif
+
+/**
+ * void widen_features(const float* src, double* dst, int nb_features)
+ * @brief convert a float32 feature array to doubles
+ * @param src, float32 features
+ * @param dst(out), double features
+ * @param nb_features, nb of features
+ */
+void widen_features(const float* src, double* dst, int nb_features){
+
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 in;
+
+	for(;i+4<=nb_features;i+=4){
+		in = _mm_loadu_ps(&(src[i]));
+		_mm_storeu_pd(&(dst[i]), _mm_cvtps_pd(in));
+		_mm_storeu_pd(&(dst[i+2]), _mm_cvtps_pd(_mm_movehl_ps(in, in)));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	float32x4_t in;
+
+	for(;i+4<=nb_features;i+=4){
+		in = vld1q_f32(&(src[i]));
+		vst1q_f64(&(dst[i]), vcvt_f64_f32(vget_low_f32(in)));
+		vst1q_f64(&(dst[i+2]), vcvt_high_f64_f32(in));
+	}
+#endif
+
+	/*what is left over*/
+	for(;i<nb_features;i++){
+		dst[i] = src[i];
+	}
+}
+
+/**
+ * void narrow_features(const double* src, float* dst, int nb_features)
+ * @brief convert a double feature array to float32 (producer side, fake input)
+ * @param src, double features
+ * @param dst(out), float32 features
+ * @param nb_features, nb of features
+ */
+void narrow_features(const double* src, float* dst, int nb_features){
+
+	int i = 0;
+
+#if defined(__SSE2__)
+	for(;i+4<=nb_features;i+=4){
+		_mm_storeu_ps(&(dst[i]), _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(&(src[i]))),
+											   _mm_cvtpd_ps(_mm_loadu_pd(&(src[i+2])))));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for(;i+4<=nb_features;i+=4){
+		vst1q_f32(&(dst[i]), vcvt_high_f32_f64(vcvt_f32_f64(vld1q_f64(&(src[i]))), vld1q_f64(&(src[i+2]))));
+	}
+#endif
+
+	for(;i<nb_features;i++){
+		dst[i] = (float)src[i];
+	}
+}
+
+/**
+ * const char* feature_kernels_path(void)
+ * @brief name of the vector path compiled in
+ * @return "SSE2", "NEON" or "scalar"
+ */
+const char* feature_kernels_path(void){
+	return KERNELS_PATH;
+}
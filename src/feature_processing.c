@@ -13,9 +13,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include "feature_processing.h"
 #include "feature_input.h"
+#include "xml.h"
+#include "app_clock.h"
+#include "quantile_sketch.h"
 
 #include <stats.h>
 
@@ -32,26 +36,105 @@
 
 void get_peak_from_channels(double *max_left, double *max_right, double *feature_array);
 void get_mean_from_channels(double *mean_left, double *mean_right, double *feature_array);
+static void hold_sample(feat_proc_t * feature_proc);
+static int measure_frame(feat_proc_t * feature_proc, frame_info_t * frame_info, double *feature_array,
+			 double *left, double *right);
+static int acquire_frame(feat_proc_t * feature_proc, frame_info_t ** frame_info, double **feature_array);
+static void merge_reference(feat_proc_t * feature_proc, double *prior_mean, double *prior_std);
+static void measure_band(feat_proc_t * feature_proc, double *fft, double *left, double *right);
+static void read_bins(feat_proc_t * feature_proc, double *fft, int first_bin, int last_bin);
+static void add_training_value(double *training_set, robust_stat_t * robust, int i, double left, double right);
 
 /**
  * int init_feat_processing(feat_proc_t* feature_proc)
  * @brief initialize the feature processing 
  * @param feature_proc, pointer to feature processing
- * @return EXIT_SUCCESS, EXIT_FAILURE
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the frame rate is not set, the band power can't be computed
+ * or the IAF range is out of reach
  */
-int init_feat_processing(feat_proc_t * feature_proc __attribute__ ((unused)))
+int init_feat_processing(feat_proc_t * feature_proc)
 {
 
+	int first_bin = FEAT_IDX_START;
+	int last_bin = FEAT_IDX_END - 1;
+
+	/*the hold time is counted in frames */
+	if (feature_proc->frame_rate <= 0) {
+		fprintf(stderr, "Invalid frame rate\n");
+		return EXIT_FAILURE;
+	}
+
+	/*check the artifacts on the channels used*/
+	feature_proc->artifact.nb_channels = NB_CHANNELS_USED;
+	feature_proc->artifact.channels[0] = 0;
+	feature_proc->artifact.channels[1] = SECOND_CHANNEL_OFFSET/CHANNEL_WIDTH;
+	feature_proc->artifact.channel_width = CHANNEL_WIDTH;
+
+	/*start from neutral, as if a valid sample was just received*/
+	feature_proc->sample = 0;
+	feature_proc->last_valid_sample = 0;
+	feature_proc->sample_status = SAMPLE_VALID;
+	feature_proc->nb_held = 0;
+	feature_proc->nb_expired = 0;
+	feature_proc->nb_acquired = 0;
+	feature_proc->band_value[0] = 0;
+	feature_proc->band_value[1] = 0;
+	feature_proc->reject_reason = ARTIFACT_NONE;
+	feature_proc->eye_blink = 0;
+	feature_proc->nb_frames_held = 0;
+
+	/*a bad config only disables the detectors, the processing goes on */
+	init_artifact_detection(&(feature_proc->artifact));
+
+	/*the band follows the IAF, at the resolution of the detectors */
+	if (feature_proc->iaf != NULL) {
+		feature_proc->iaf->bin_width = feature_proc->artifact.bin_width;
+		if (init_iaf_tracker(feature_proc->iaf) == EXIT_FAILURE) {
+			return EXIT_FAILURE;
+		}
+		first_bin = feature_proc->iaf->first_bin;
+		last_bin = feature_proc->iaf->last_bin;
+		if (feature_proc->band_power == NULL && last_bin >= CHANNEL_WIDTH) {
+			fprintf(stderr, "IAF range needs bin %i, the fft section has %i\n", last_bin, CHANNEL_WIDTH);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/*band values from the timeseries, only the bins looked at are tracked */
+	if (feature_proc->band_power != NULL) {
+		band_power_t *band = feature_proc->band_power;
+		band->nb_channels = NB_CHANNELS_USED;
+		band->channels[0] = feature_proc->artifact.channels[0];
+		band->channels[1] = feature_proc->artifact.channels[1];
+		band->nb_bins = 0;
+		if (track_band_bins(band, first_bin, last_bin) == EXIT_FAILURE) {
+			return EXIT_FAILURE;
+		}
+		if (feature_proc->artifact.enabled &&
+		    track_band_bins(band, feature_proc->artifact.muscle_bin_start,
+				    feature_proc->artifact.muscle_bin_end) == EXIT_FAILURE) {
+			return EXIT_FAILURE;
+		}
+		if (feature_proc->artifact.enabled && feature_proc->artifact.line_bin > 0 &&
+		    track_band_bins(band, feature_proc->artifact.line_bin,
+				    feature_proc->artifact.line_bin) == EXIT_FAILURE) {
+			return EXIT_FAILURE;
+		}
+		return init_band_power(band);
+	}
+
 	return EXIT_SUCCESS;
 }
 
 /**
- * void train_feat_processing(feat_proc_t* feature_proc)
- * @brief train the feature processing, by recording a series of samples
+ * int train_feat_processing(feat_proc_t* feature_proc)
+ * @brief train the feature processing, by recording a series of samples. On a warm
+ * start the stored reference in mean and std_dev is used as is or refined by the samples.
+ * When the band follows the IAF, it is measured once the training found the peak.
  * @param feature_proc, pointer to feature processing
- * @return EXIT_SUCCESS, EXIT_FAILURE
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the input stopped before the end of training
  */
-void train_feat_processing(feat_proc_t * feature_proc)
+int train_feat_processing(feat_proc_t * feature_proc)
 {
 
 	int i = 0;
@@ -60,20 +143,76 @@ void train_feat_processing(feat_proc_t * feature_proc)
 	frame_info_t *frame_info;
 	double *feature_array;
 
-	double *training_set = (double *)malloc(feature_proc->nb_train_samples * NB_CHANNELS_USED * sizeof(double));
+	double *training_set = NULL;
+	robust_stat_t robust[NB_CHANNELS_USED];
+	double prior_mean[NB_CHANNELS_USED];
+	double prior_std[NB_CHANNELS_USED];
+	double prior_iaf = 0;
+
+	/*bins of the IAF range of each training frame, measured once the IAF is known */
+	iaf_tracker_t *iaf = feature_proc->iaf;
+	double *iaf_set = NULL;
+	int nb_iaf_bins = 0;
+
+	/*warm start, the stored reference is used as is or refined */
+	if (feature_proc->warm_start) {
+		if (iaf != NULL) {
+			prior_iaf = iaf->peak_freq;
+		}
+		if (feature_proc->nb_train_samples <= 0) {
+			if (iaf != NULL) {
+				iaf_set_peak(iaf, prior_iaf);
+			}
+			live_set_calibration(feature_proc->live, feature_proc->calibration, feature_proc->mean, feature_proc->std_dev);
+			if (feature_proc->verbose) {
+				printf("Training skipped, stored reference\n");
+				fflush(stdout);
+			}
+			return EXIT_SUCCESS;
+		}
+		memcpy(prior_mean, feature_proc->mean, sizeof(prior_mean));
+		memcpy(prior_std, feature_proc->std_dev, sizeof(prior_std));
+	}
 
-	if (training_set == NULL) {
-		printf("Training_set malloc() may have failed OR is NULL\n - may function not as intented\n");
+	/*median and MAD are streamed, constant memory whatever the training length */
+	if (feature_proc->calibration == CALIBRATION_MEDIAN_MAD) {
+		init_robust_stat(&robust[0]);
+		init_robust_stat(&robust[1]);
+	} else {
+		training_set = (double *)malloc(feature_proc->nb_train_samples * NB_CHANNELS_USED * sizeof(double));
+		if (training_set == NULL) {
+			printf("Training_set malloc() failed\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (iaf != NULL) {
+		nb_iaf_bins = iaf->last_bin - iaf->first_bin + 1;
+		iaf_set = (double *)malloc(feature_proc->nb_train_samples * NB_CHANNELS_USED * nb_iaf_bins * sizeof(double));
+		if (iaf_set == NULL) {
+			printf("IAF training set malloc() failed\n");
+			free(training_set);
+			return EXIT_FAILURE;
+		}
 	}
 
 	double mean_left = 0.0;
 	double mean_right = 0.0;
+	int reason;
+	int res;
 
 	/*drop first NB_PACKETS_DROPPED packets to prevent errors */
 	/*(empirical observation, should be fixed in data_interface in a later release) */
 	for (i = 0; i < NB_PACKETS_DROPPED; i++) {
-		REQUEST_FEAT_FC(feature_proc->feature_input);
-		WAIT_FEAT_FC(feature_proc->feature_input);
+		res = acquire_frame(feature_proc, &frame_info, &feature_array);
+		if (res == EXIT_FAILURE) {
+			free(training_set);
+			free(iaf_set);
+			return EXIT_FAILURE;
+		}
+		/*no feedback during training, wait for the producer to come back */
+		if (res == FEAT_INPUT_STALLED) {
+			i--;
+		}
 	}
 
 	/*start acquisition */
@@ -81,66 +220,120 @@ void train_feat_processing(feat_proc_t * feature_proc)
 	while (i < feature_proc->nb_train_samples) {
 
 		/*log the next sequence of samples */
-		REQUEST_FEAT_FC(feature_proc->feature_input);
-		WAIT_FEAT_FC(feature_proc->feature_input);
-
-		/*get reference on current frame info */
-		frame_info = GET_FRAME_INFO_FC(feature_proc->feature_input);
-		/*get reference on current feature array */
-		feature_array = GET_FVECT_INFO_FC(feature_proc->feature_input);
-
-		/*check if there is an eye blink in the sample */
-		if (!frame_info->eye_blink_detected) {
-			/*parse feature array to find peak values around 10Hz */
-			get_mean_from_channels(&mean_left, &mean_right, feature_array);
+		res = acquire_frame(feature_proc, &frame_info, &feature_array);
+		if (res == EXIT_FAILURE) {
+			free(training_set);
+			free(iaf_set);
+			return EXIT_FAILURE;
+		}
+		if (res == FEAT_INPUT_STALLED) {
+			continue;
+		}
 
+		/*reject artifacts (eye blink and others) and measure the band */
+		reason = measure_frame(feature_proc, frame_info, feature_array, &mean_left, &mean_right);
+		if (reason == ARTIFACT_NONE) {
 			/*pick the two alpha wave samples */
-			training_set[i * 2] = mean_left;
-			training_set[i * 2 + 1] = mean_right;
+			if (iaf_set != NULL) {
+				iaf_calibrate_frame(iaf, feature_proc->iaf_bins[0], feature_proc->iaf_bins[1]);
+				memcpy(&iaf_set[(i * 2) * nb_iaf_bins], &(feature_proc->iaf_bins[0][iaf->first_bin]),
+				       nb_iaf_bins * sizeof(double));
+				memcpy(&iaf_set[(i * 2 + 1) * nb_iaf_bins], &(feature_proc->iaf_bins[1][iaf->first_bin]),
+				       nb_iaf_bins * sizeof(double));
+			} else {
+				add_training_value(training_set, robust, i, mean_left, mean_right);
+			}
 
-			if (i % 5 == 0) {
+			if (feature_proc->verbose && i % 5 == 0) {
 				printf("training progress: %.1f\n",
 				       (float)i / (float)feature_proc->nb_train_samples * 100);
 				fflush(stdout);
 			}
 			i++;
+			live_set_training(feature_proc->live, i, feature_proc->nb_train_samples);
 		} else {
-			printf("Frame invalid: ");
-			if (frame_info->eye_blink_detected) {
-				printf("Eye blink detected\n");
+			metrics_count_rejection(feature_proc->metrics, reason);
+			if (feature_proc->verbose) {
+				printf("Frame invalid: %s\n", artifact_reason_str(reason));
 			}
 		}
 	}
 
-	/*Show the training set on console */
-	printf("left\tright\n");
-	for (i = 0; i < feature_proc->nb_train_samples; i++) {
-		printf("[%i]:\t%lf\t%lf\n", i, training_set[i * 2], training_set[i * 2 + 1]);
+	/*the band is recentred on the peak of the training (pooled with the stored one), then measured */
+	if (iaf_set != NULL) {
+		iaf_end_calibration(iaf);
+		if (feature_proc->warm_start) {
+			iaf_set_peak(iaf, (feature_proc->nb_prior_samples * prior_iaf +
+					   feature_proc->nb_train_samples * iaf->peak_freq) /
+				     (feature_proc->nb_prior_samples + feature_proc->nb_train_samples));
+		}
+		for (i = 0; i < feature_proc->nb_train_samples; i++) {
+			memcpy(&(feature_proc->iaf_bins[0][iaf->first_bin]), &iaf_set[(i * 2) * nb_iaf_bins],
+			       nb_iaf_bins * sizeof(double));
+			memcpy(&(feature_proc->iaf_bins[1][iaf->first_bin]), &iaf_set[(i * 2 + 1) * nb_iaf_bins],
+			       nb_iaf_bins * sizeof(double));
+			add_training_value(training_set, robust, i, iaf_band_value(iaf, feature_proc->iaf_bins[0]),
+					   iaf_band_value(iaf, feature_proc->iaf_bins[1]));
+		}
+		free(iaf_set);
+		if (feature_proc->verbose) {
+			printf("IAF:\t%.2f Hz, band %.2f to %.2f Hz\n", iaf->peak_freq,
+			       iaf->peak_freq - iaf->half_width, iaf->peak_freq + iaf->half_width);
+		}
 	}
 
-	/*extract the training set parameters: */
-	/* -compute the mean */
-	printf("Computing the mean\n");
-	stat_mean(training_set, feature_proc->mean, feature_proc->nb_train_samples, 2);
-	printf("mean[%i]:\t%lf\t%lf\n", i, feature_proc->mean[0], feature_proc->mean[1]);
+	/*the robust statistics stand for the mean and standard deviation */
+	if (training_set == NULL) {
+		for (i = 0; i < NB_CHANNELS_USED; i++) {
+			feature_proc->mean[i] = get_robust_median(&robust[i]);
+			feature_proc->std_dev[i] = get_robust_scale(&robust[i]);
+		}
+	} else {
+		/*Show the training set on console */
+		if (feature_proc->verbose) {
+			printf("left\tright\n");
+			for (i = 0; i < feature_proc->nb_train_samples; i++) {
+				printf("[%i]:\t%lf\t%lf\n", i, training_set[i * 2], training_set[i * 2 + 1]);
+			}
+		}
 
-	/* -compute the standard deviation */
-	printf("Computing the std\n");
-	stat_std(training_set, feature_proc->mean, feature_proc->std_dev, feature_proc->nb_train_samples, 2);
-	printf("std[%i]:\t%lf\t%lf\n", i, feature_proc->std_dev[0], feature_proc->std_dev[1]);
-	fflush(stdout);
+		/*extract the training set parameters: */
+		/* -compute the mean */
+		stat_mean(training_set, feature_proc->mean, feature_proc->nb_train_samples, 2);
 
-	printf("Training completed\n");
-	free(training_set);
+		/* -compute the standard deviation */
+		stat_std(training_set, feature_proc->mean, feature_proc->std_dev, feature_proc->nb_train_samples, 2);
+		free(training_set);
+	}
 
+	if (feature_proc->warm_start) {
+		merge_reference(feature_proc, prior_mean, prior_std);
+	}
+	live_set_calibration(feature_proc->live, feature_proc->calibration, feature_proc->mean, feature_proc->std_dev);
+
+	if (feature_proc->verbose) {
+		if (feature_proc->calibration == CALIBRATION_MEDIAN_MAD) {
+			printf("median:\t%lf\t%lf\n", feature_proc->mean[0], feature_proc->mean[1]);
+			printf("scale:\t%lf\t%lf\n", feature_proc->std_dev[0], feature_proc->std_dev[1]);
+		} else {
+			printf("mean:\t%lf\t%lf\n", feature_proc->mean[0], feature_proc->mean[1]);
+			printf("std:\t%lf\t%lf\n", feature_proc->std_dev[0], feature_proc->std_dev[1]);
+		}
+		printf("Training completed\n");
+		fflush(stdout);
+	}
+
+	return EXIT_SUCCESS;
 }
 
 /**
  * int get_normalized_sample(feat_proc_t* feature_proc)
  * 
- * @brief parse and z-score the newly acquired sample
+ * @brief acquire the next frame and normalize it (see normalize_frame).
+ * Exactly one frame is consumed per call.
  * @param feature_proc, pointer to feature processing
- * @return EXIT_SUCCESS, EXIT_FAILURE
+ * @return SAMPLE_VALID, SAMPLE_HELD, SAMPLE_EXPIRED, SAMPLE_STALLED if the producer is silent
+ * or SAMPLE_NO_FRAME if the input failed
  */
 int get_normalized_sample(feat_proc_t * feature_proc)
 {
@@ -148,54 +341,377 @@ int get_normalized_sample(feat_proc_t * feature_proc)
 	/*pointers to the feature array */
 	frame_info_t *frame_info;
 	double *feature_array;
+	struct timespec start;
+	int status;
+
+	/*request and wait for a sample */
+	status = acquire_frame(feature_proc, &frame_info, &feature_array);
+	if (status == EXIT_FAILURE) {
+		feature_proc->sample_status = SAMPLE_NO_FRAME;
+		return SAMPLE_NO_FRAME;
+	}
+	if (status == FEAT_INPUT_STALLED) {
+		feature_proc->sample_status = SAMPLE_STALLED;
+		return SAMPLE_STALLED;
+	}
+
+	app_clock_now(&start);
+	status = normalize_frame(feature_proc, frame_info, feature_array);
+	metrics_add_latency(feature_proc->metrics, STAGE_PROCESS, &start);
+	app_clock_now(&(feature_proc->processed_time));
+
+	return status;
+}
+
+/**
+ * int copy_next_frame(feat_proc_t* feature_proc, frame_info_t* frame_info, double* feature_array)
+ * 
+ * @brief acquire the next frame and copy it out of the input, for a stage that
+ * normalizes it on its own thread (see normalize_frame). The input can then be
+ * asked for the following frame at once.
+ * @param feature_proc, pointer to feature processing
+ * @param frame_info(out), frame info of the frame
+ * @param feature_array(out), feature array of the frame (nb_features of the input)
+ * @return EXIT_SUCCESS, FEAT_INPUT_STALLED if the producer is silent, EXIT_FAILURE if the input failed
+ */
+int copy_next_frame(feat_proc_t * feature_proc, frame_info_t * frame_info, double *feature_array)
+{
+
+	frame_info_t *page_info;
+	double *page_array;
+	int status;
+
+	status = acquire_frame(feature_proc, &page_info, &page_array);
+	if (status != EXIT_SUCCESS) {
+		return status;
+	}
+
+	*frame_info = *page_info;
+	memcpy(feature_array, page_array, feature_proc->feature_input->nb_features * sizeof(double));
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int normalize_frame(feat_proc_t* feature_proc, frame_info_t* frame_info, double* feature_array)
+ * 
+ * @brief parse and z-score a frame, obtained from get_normalized_sample or from
+ * the batch interface of the feature input. A rejected frame is replaced according
+ * to the hold policy (last valid value, or last valid value decaying to neutral)
+ * until the maximum hold time is reached, after which the neutral value is returned.
+ * @param feature_proc, pointer to feature processing
+ * @param frame_info, frame info of the frame
+ * @param feature_array, feature array of the frame
+ * @return SAMPLE_VALID, SAMPLE_HELD or SAMPLE_EXPIRED
+ */
+int normalize_frame(feat_proc_t * feature_proc, frame_info_t * frame_info, double *feature_array)
+{
+
 	double features[2];
-	char frame_valid = 0x00;
+	double sample;
 	double mean_left = 0;
 	double mean_right = 0;
+	int reason;
+
+	/*reject artifacts before spending time on normalization */
+	reason = measure_frame(feature_proc, frame_info, feature_array, &mean_left, &mean_right);
+	feature_proc->eye_blink = frame_info->eye_blink_detected;
+	if (reason == ARTIFACT_NONE) {
+		feature_proc->band_value[0] = mean_left;
+		feature_proc->band_value[1] = mean_right;
+
+		/*get the samples */
+		features[0] = (mean_left - feature_proc->mean[0]) / feature_proc->std_dev[0];
+		features[1] = (mean_right - feature_proc->mean[1]) / feature_proc->std_dev[1];
 
-	/*make sure to return a valid sample */
-	while (!frame_valid) {
+		/*get the normalized average */
+		sample = (features[0] + features[1]) / 2;
 
-		/*request and... */
-		REQUEST_FEAT_FC(feature_proc->feature_input);
-		/*wait for a sample */
-		WAIT_FEAT_FC(feature_proc->feature_input);
+		if (fabs(sample) > 7) {
+			reason = ARTIFACT_OUT_OF_TOLERANCE;
+			count_artifact(&(feature_proc->artifact), reason);
+		} else {
+			feature_proc->sample = sample;
+			feature_proc->last_valid_sample = sample;
+			feature_proc->nb_frames_held = 0;
+			feature_proc->sample_status = SAMPLE_VALID;
+			feature_proc->reject_reason = ARTIFACT_NONE;
+			return SAMPLE_VALID;
+		}
+	}
+	feature_proc->reject_reason = reason;
 
-		/*get reference on current frame info */
-		frame_info = GET_FRAME_INFO_FC(feature_proc->feature_input);
-		/*get reference on current feature array */
-		feature_array = GET_FVECT_INFO_FC(feature_proc->feature_input);
+	/*frame rejected, fill in from the last valid sample */
+	metrics_count_rejection(feature_proc->metrics, reason);
+	hold_sample(feature_proc);
+	metrics_count_hold(feature_proc->metrics, feature_proc->sample_status);
+	return feature_proc->sample_status;
+}
 
-		if (!frame_info->eye_blink_detected) {
+/**
+ * int measure_frame(feat_proc_t* feature_proc, frame_info_t* frame_info, double* feature_array,
+ *                   double* left, double* right)
+ * @brief run the artifact detectors on a frame and, if it is clean, get the band values
+ * from the fft section or from the band power
+ * @param feature_proc, pointer to feature processing
+ * @param frame_info, frame info of the frame
+ * @param feature_array, feature array of the frame
+ * @param left(out), band value left channel, set if the frame is clean
+ * @param right(out), band value right channel, set if the frame is clean
+ * @return ARTIFACT_NONE if the frame is clean, the rejection reason otherwise
+ */
+static int measure_frame(feat_proc_t * feature_proc, frame_info_t * frame_info, double *feature_array,
+			 double *left, double *right)
+{
+
+	band_power_t *band = feature_proc->band_power;
+	channel_power_t power[ARTIFACT_MAX_CHANNELS];
+	int reason;
+
+	if (band == NULL) {
+		reason = detect_artifact(&(feature_proc->artifact), frame_info, &(feature_array[feature_proc->fft_offset]));
+		if (reason == ARTIFACT_NONE) {
+			measure_band(feature_proc, &(feature_array[feature_proc->fft_offset]), left, right);
+		}
+		return reason;
+	}
+
+	/*every frame slides the bins, rejected or not (the timeseries section comes first) */
+	update_band_power(band, feature_array);
+	if (feature_proc->artifact.enabled && !frame_info->eye_blink_detected) {
+		get_band_artifact_power(band, &(feature_proc->artifact), power);
+	}
+	reason = detect_artifact_power(&(feature_proc->artifact), frame_info, power);
+	if (reason == ARTIFACT_NONE) {
+		measure_band(feature_proc, NULL, left, right);
+	}
+	return reason;
+}
+
+/**
+ * void measure_band(feat_proc_t* feature_proc, double* fft, double* left, double* right)
+ * @brief band values of a clean frame, on the fixed band or around the IAF.
+ * Until the IAF is calibrated all the bins of its range are read, for the training.
+ * @param feature_proc, pointer to feature processing
+ * @param fft, fft section of the frame, NULL with the band power
+ * @param left(out), band value left channel
+ * @param right(out), band value right channel
+ */
+static void measure_band(feat_proc_t * feature_proc, double *fft, double *left, double *right)
+{
+
+	iaf_tracker_t *iaf = feature_proc->iaf;
+
+	if (iaf == NULL) {
+		if (fft != NULL) {
 			/*parse feature array to find peak values around 10Hz */
-			get_mean_from_channels(&mean_left, &mean_right, feature_array);
+			get_mean_from_channels(left, right, fft);
+		} else {
+			*left = get_band_power(feature_proc->band_power, 0, FEAT_IDX_START, FEAT_IDX_END - 1);
+			*right = get_band_power(feature_proc->band_power, 1, FEAT_IDX_START, FEAT_IDX_END - 1);
+		}
+		return;
+	}
 
-			/*get the samples */
-			features[0] = (mean_left - feature_proc->mean[0]) / feature_proc->std_dev[0];
-			features[1] = (mean_right - feature_proc->mean[1]) / feature_proc->std_dev[1];
+	/*the band of this frame, then the peak follows it */
+	if (iaf->calibrated) {
+		read_bins(feature_proc, fft, iaf->read_first, iaf->read_last);
+	} else {
+		read_bins(feature_proc, fft, iaf->first_bin, iaf->last_bin);
+	}
+	*left = iaf_band_value(iaf, feature_proc->iaf_bins[0]);
+	*right = iaf_band_value(iaf, feature_proc->iaf_bins[1]);
+	iaf_track_frame(iaf, feature_proc->iaf_bins[0], feature_proc->iaf_bins[1]);
+}
 
-			/*get the normalized average */
-			feature_proc->sample = (features[0] + features[1]) / 2;
+/**
+ * void read_bins(feat_proc_t* feature_proc, double* fft, int first_bin, int last_bin)
+ * @brief copy a range of bins of both channels to iaf_bins
+ * @param feature_proc, pointer to feature processing
+ * @param fft, fft section of the frame, NULL with the band power
+ * @param first_bin, first bin
+ * @param last_bin, last bin (included)
+ */
+static void read_bins(feat_proc_t * feature_proc, double *fft, int first_bin, int last_bin)
+{
 
-			if(abs(feature_proc->sample)>7){
-				printf("Frame invalid: ");
-				printf("Exceeding tolerances\n");
-			}else{
-				frame_valid = 0x01;
-			}
-			
+	int k;
 
+	for (k = first_bin; k <= last_bin; k++) {
+		if (fft != NULL) {
+			feature_proc->iaf_bins[0][k] = fft[k];
+			feature_proc->iaf_bins[1][k] = fft[k + SECOND_CHANNEL_OFFSET];
 		} else {
-			printf("Frame invalid: ");
-			if (frame_info->eye_blink_detected) {
-				printf("Eye blink detected\n");
-			}
+			feature_proc->iaf_bins[0][k] = get_band_power(feature_proc->band_power, 0, k, k);
+			feature_proc->iaf_bins[1][k] = get_band_power(feature_proc->band_power, 1, k, k);
 		}
 	}
+}
+
+/**
+ * int acquire_frame(feat_proc_t* feature_proc, frame_info_t** frame_info, double** feature_array)
+ * @brief request and wait for the next frame, get references on it and record it
+ * @param feature_proc, pointer to feature processing
+ * @param frame_info(out), reference on the frame info
+ * @param feature_array(out), reference on the feature array
+ * @return EXIT_SUCCESS, FEAT_INPUT_STALLED if the producer is silent, EXIT_FAILURE if the input failed
+ */
+static int acquire_frame(feat_proc_t * feature_proc, frame_info_t ** frame_info, double **feature_array)
+{
+
+	feature_input_t *feature_input = feature_proc->feature_input;
+	struct timespec start;
+	int res;
+
+	app_clock_now(&start);
+
+	/*request and..., a stalled input keeps the last request */
+	if (!feature_input->stalled) {
+		REQUEST_FEAT_FC(feature_input);
+	}
+	/*wait for a sample */
+	res = WAIT_FEAT_FC(feature_input);
+	if (res == FEAT_INPUT_STALLED) {
+		metrics_set_stalled(feature_proc->metrics, 0x01);
+		return FEAT_INPUT_STALLED;
+	}
+	if (res != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	metrics_add_latency(feature_proc->metrics, STAGE_ACQUIRE, &start);
+	metrics_count_frame(feature_proc->metrics);
+	feature_proc->request_time = start;
+	app_clock_now(&(feature_proc->frame_time));
+
+	/*the producer came back */
+	if (feature_input->recovery_ms > 0) {
+		metrics_set_stalled(feature_proc->metrics, 0x00);
+		metrics_count_recovery(feature_proc->metrics, feature_input->recovery_ms);
+		feature_input->recovery_ms = 0;
+	}
+
+	/*get reference on current frame info */
+	*frame_info = GET_FRAME_INFO_FC(feature_input);
+	/*get reference on current feature array */
+	*feature_array = GET_FVECT_INFO_FC(feature_input);
+
+	/*startup latency is measured up to the first frame */
+	if (feature_proc->nb_acquired++ == 0) {
+		app_clock_now(&(feature_proc->first_frame_time));
+	}
+
+	/*keep a copy of the session, if requested */
+	if (feature_proc->recorder != NULL) {
+		session_file_write_page(feature_proc->recorder, *frame_info, *feature_array);
+	}
 
 	return EXIT_SUCCESS;
 }
 
+/**
+ * static void add_training_value(double* training_set, robust_stat_t* robust, int i, double left, double right)
+ * @brief add the band values of a training frame to the training set, or to the robust statistics
+ * @param training_set, training set, NULL in the robust calibration
+ * @param robust, robust statistics, left and right
+ * @param i, frame of the training
+ * @param left, band value left channel
+ * @param right, band value right channel
+ */
+static void add_training_value(double *training_set, robust_stat_t * robust, int i, double left, double right)
+{
+
+	if (training_set == NULL) {
+		update_robust_stat(&robust[0], left);
+		update_robust_stat(&robust[1], right);
+	} else {
+		training_set[i * 2] = left;
+		training_set[i * 2 + 1] = right;
+	}
+}
+
+/**
+ * static void merge_reference(feat_proc_t* feature_proc, double* prior_mean, double* prior_std)
+ * @brief pool the stored reference and the short training, weighted by their samples.
+ * A shift of the reference since it was stored widens the pooled spread.
+ * The robust calibration is pooled the same way, median and scale standing for mean and std.
+ * @param feature_proc, pointer to feature processing, reference of the short training
+ * @param prior_mean, stored reference
+ * @param prior_std, stored spread
+ */
+static void merge_reference(feat_proc_t * feature_proc, double *prior_mean, double *prior_std)
+{
+
+	double prior_weight = feature_proc->nb_prior_samples;
+	double weight = feature_proc->nb_train_samples;
+	double total = prior_weight + weight;
+	double delta;
+	double variance;
+	int i;
+
+	for (i = 0; i < NB_CHANNELS_USED; i++) {
+		delta = feature_proc->mean[i] - prior_mean[i];
+		variance = (prior_weight * prior_std[i] * prior_std[i] +
+			    weight * feature_proc->std_dev[i] * feature_proc->std_dev[i]) / total +
+		    prior_weight * weight * delta * delta / (total * total);
+		feature_proc->mean[i] = prior_mean[i] + weight * delta / total;
+		feature_proc->std_dev[i] = sqrt(variance);
+	}
+}
+
+/**
+ * void hold_sample(feat_proc_t* feature_proc)
+ * @brief set the current sample in place of a rejected frame. The time held is
+ * counted in frames, so a replay gives the same samples as the live session
+ * whatever the clock and the speed it runs at.
+ * @param feature_proc, pointer to feature processing
+ */
+static void hold_sample(feat_proc_t * feature_proc)
+{
+
+	double held_time;
+
+	feature_proc->nb_frames_held++;
+	held_time = feature_proc->nb_frames_held / feature_proc->frame_rate;
+
+	/*held for too long, go back to neutral */
+	if (held_time >= feature_proc->max_hold_time) {
+		feature_proc->sample = 0;
+		feature_proc->nb_expired++;
+		feature_proc->sample_status = SAMPLE_EXPIRED;
+		return;
+	}
+
+	if (feature_proc->hold_policy == HOLD_DECAY) {
+		/*linear decay from the last valid value to neutral over the max hold time */
+		feature_proc->sample = feature_proc->last_valid_sample * (1.0 - held_time / feature_proc->max_hold_time);
+	} else {
+		feature_proc->sample = feature_proc->last_valid_sample;
+	}
+	feature_proc->nb_held++;
+	feature_proc->sample_status = SAMPLE_HELD;
+}
+
+/**
+ * void print_feat_processing_stats(feat_proc_t* feature_proc)
+ * @brief show the rejection statistics on console, not meant for the task loop
+ * @param feature_proc, pointer to feature processing
+ */
+void print_feat_processing_stats(feat_proc_t * feature_proc)
+{
+
+	print_artifact_stats(&(feature_proc->artifact));
+	printf("Samples held: %lu\n", feature_proc->nb_held);
+	printf("Samples expired: %lu\n", feature_proc->nb_expired);
+	if (feature_proc->band_power != NULL) {
+		printf("Band power: %lu frames slid, %lu computed again\n",
+		       feature_proc->band_power->nb_slides, feature_proc->band_power->nb_syncs);
+	}
+	if (feature_proc->iaf != NULL) {
+		printf("IAF: %.2f Hz, moved %lu bins\n", feature_proc->iaf->peak_freq, feature_proc->iaf->nb_moves);
+	}
+	fflush(stdout);
+}
+
 /**
  * void get_peak_from_channels(double* max_left, double* max_right, double* feature_array)
  * @brief parse newly acquired sample to return the peak value within the defined range
@@ -0,0 +1,313 @@
+/**
+ * @file flight_recorder.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Flight recorder of the task loop. The last seconds of iterations (frame
+ * info, band values, samples, buzzer command and stage latencies) are kept in a
+ * fixed ring, written by the loop without locks. When the loop latency or the
+ * rejected frames cross a threshold, or on SIGUSR2, a dumper thread copies the
+ * ring and writes it as a CSV file, so a stuttering tone can be looked at after
+ * the fact. Every function accepts a NULL recorder.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "flight_recorder.h"
+#include "artifact_detection.h"
+#include "app_clock.h"
+
+static const char* dump_reason_str[] = {"none", "latency", "rejections", "signal"};
+
+/*recorder dumped on SIGUSR2*/
+static flight_recorder_t* signal_recorder = NULL;
+
+static void* dump_flight(void* param);
+static unsigned long copy_records(flight_recorder_t* recorder, flight_record_t* copy);
+static int write_records(flight_recorder_t* recorder, flight_record_t* copy, unsigned long nb_copied);
+static void sigusr2_handler(int signal);
+
+/**
+ * int init_flight_recorder(flight_recorder_t* recorder)
+ * @brief allocate the ring, start the dumper thread and catch SIGUSR2
+ * @param recorder, flight recorder
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_flight_recorder(flight_recorder_t* recorder){
+
+	struct sigaction action;
+	unsigned long needed = recorder->duration*recorder->frame_rate;
+
+	/*power of 2, the slot is the index masked*/
+	recorder->nb_records = FLIGHT_MIN_RECORDS;
+	while(recorder->nb_records < needed){
+		recorder->nb_records <<= 1;
+	}
+
+	if((recorder->records = calloc(recorder->nb_records, sizeof(flight_record_t))) == NULL){
+		perror("init_flight_recorder");
+		return EXIT_FAILURE;
+	}
+	recorder->head = 0;
+	recorder->nb_rejected = 0;
+	recorder->last_dump_ns = 0;
+	recorder->dump_reason = 0;
+	recorder->nb_dumps = 0;
+
+	if(sem_init(&(recorder->dump_request), 0, 0) != 0){
+		perror("init_flight_recorder");
+		free(recorder->records);
+		return EXIT_FAILURE;
+	}
+
+	recorder->running = 0x01;
+	if(pthread_create(&(recorder->thread), NULL, dump_flight, recorder) != 0){
+		fprintf(stderr, "init_flight_recorder: can't start the dumper\n");
+		sem_destroy(&(recorder->dump_request));
+		free(recorder->records);
+		return EXIT_FAILURE;
+	}
+
+	/*dump on demand*/
+	signal_recorder = recorder;
+	memset(&action, 0, sizeof(struct sigaction));
+	action.sa_handler = sigusr2_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &action, NULL);
+
+	printf("Flight recorder: %lu iterations, dumps in %s\n", recorder->nb_records, recorder->dump_dir);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void flight_record(flight_recorder_t* recorder, flight_record_t* record)
+ * @brief keep an iteration of the loop and check the triggers, loop thread only
+ * @param recorder, flight recorder
+ * @param record, iteration (its seq is ignored)
+ */
+void flight_record(flight_recorder_t* recorder, flight_record_t* record){
+
+	flight_record_t* slot;
+	unsigned long head;
+
+	if(recorder == NULL){
+		return;
+	}
+
+	/*invalidate the slot, fill it, then publish it*/
+	head = recorder->head;
+	slot = &(recorder->records[head&(recorder->nb_records-1)]);
+	__atomic_store_n(&(slot->seq), 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->start_ns = record->start_ns;
+	slot->acquire_us = record->acquire_us;
+	slot->process_us = record->process_us;
+	slot->feedback_us = record->feedback_us;
+	slot->loop_us = record->loop_us;
+	slot->band[0] = record->band[0];
+	slot->band[1] = record->band[1];
+	slot->sample = record->sample;
+	slot->smoothed = record->smoothed;
+	slot->pitch = record->pitch;
+	slot->eye_blink = record->eye_blink;
+	slot->sample_status = record->sample_status;
+	slot->reject_reason = record->reject_reason;
+	__atomic_store_n(&(slot->seq), head+1, __ATOMIC_RELEASE);
+	__atomic_store_n(&(recorder->head), head+1, __ATOMIC_RELEASE);
+
+	/*anomalies*/
+	if(recorder->latency_threshold > 0 && record->loop_us > recorder->latency_threshold*1000){
+		flight_trigger(recorder, FLIGHT_DUMP_LATENCY);
+	}
+	if(record->reject_reason != ARTIFACT_NONE){
+		if(++recorder->nb_rejected == recorder->reject_threshold){
+			flight_trigger(recorder, FLIGHT_DUMP_REJECTIONS);
+		}
+	}else{
+		recorder->nb_rejected = 0;
+	}
+}
+
+/**
+ * void flight_trigger(flight_recorder_t* recorder, char reason)
+ * @brief ask for a dump, automatic dumps are spaced by FLIGHT_DUMP_INTERVAL
+ * @param recorder, flight recorder
+ * @param reason, FLIGHT_DUMP_* reason
+ */
+void flight_trigger(flight_recorder_t* recorder, char reason){
+
+	struct timespec now;
+	uint64_t now_ns;
+
+	if(recorder == NULL){
+		return;
+	}
+
+	app_clock_now(&now);
+	now_ns = (uint64_t)now.tv_sec*1000000000ULL+now.tv_nsec;
+	if(recorder->last_dump_ns != 0 && now_ns-recorder->last_dump_ns < FLIGHT_DUMP_INTERVAL*1000000000ULL){
+		return;
+	}
+	recorder->last_dump_ns = now_ns;
+
+	recorder->dump_reason = reason;
+	sem_post(&(recorder->dump_request));
+}
+
+/**
+ * int stop_flight_recorder(flight_recorder_t* recorder)
+ * @brief stop the dumper thread and release the ring
+ * @param recorder, flight recorder
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int stop_flight_recorder(flight_recorder_t* recorder){
+
+	if(recorder == NULL || !recorder->running){
+		return EXIT_SUCCESS;
+	}
+
+	signal(SIGUSR2, SIG_DFL);
+	signal_recorder = NULL;
+
+	recorder->running = 0x00;
+	sem_post(&(recorder->dump_request));
+	pthread_join(recorder->thread, NULL);
+
+	sem_destroy(&(recorder->dump_request));
+	free(recorder->records);
+	recorder->records = NULL;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void* dump_flight(void* param)
+ * @brief dumper thread, copies the ring and writes it on each request
+ * @param param, (flight_recorder_t*) flight recorder
+ * @return NULL
+ */
+static void* dump_flight(void* param){
+
+	flight_recorder_t* recorder = param;
+	flight_record_t* copy;
+	unsigned long nb_copied;
+
+	if((copy = malloc(recorder->nb_records*sizeof(flight_record_t))) == NULL){
+		perror("dump_flight");
+		return NULL;
+	}
+
+	while(1){
+
+		while(sem_wait(&(recorder->dump_request)) != 0);
+		if(!recorder->running){
+			break;
+		}
+
+		nb_copied = copy_records(recorder, copy);
+		if(nb_copied > 0){
+			write_records(recorder, copy, nb_copied);
+		}
+	}
+
+	free(copy);
+	return NULL;
+}
+
+/**
+ * unsigned long copy_records(flight_recorder_t* recorder, flight_record_t* copy)
+ * @brief copy the ring, oldest first, skipping the slots overwritten during the copy
+ * @param recorder, flight recorder
+ * @param copy(out), nb_records slots
+ * @return nb of records copied
+ */
+static unsigned long copy_records(flight_recorder_t* recorder, flight_record_t* copy){
+
+	unsigned long head = __atomic_load_n(&(recorder->head), __ATOMIC_ACQUIRE);
+	unsigned long first = head > recorder->nb_records ? head-recorder->nb_records : 0;
+	unsigned long i, nb_copied = 0;
+	flight_record_t* slot;
+
+	for(i=first;i<head;i++){
+
+		slot = &(recorder->records[i&(recorder->nb_records-1)]);
+		if(__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != i+1){
+			continue;
+		}
+		copy[nb_copied] = *slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&(slot->seq), __ATOMIC_RELAXED) == i+1){
+			nb_copied++;
+		}
+	}
+
+	return nb_copied;
+}
+
+/**
+ * int write_records(flight_recorder_t* recorder, flight_record_t* copy, unsigned long nb_copied)
+ * @brief write a dump, one line per iteration, times relative to the last one
+ * @param recorder, flight recorder
+ * @param copy, records copied from the ring
+ * @param nb_copied, nb of records
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int write_records(flight_recorder_t* recorder, flight_record_t* copy, unsigned long nb_copied){
+
+	char path[MAX_FLIGHT_PATH];
+	char stamp[32];
+	time_t now = time(NULL);
+	uint64_t last_ns = copy[nb_copied-1].start_ns;
+	int reason = recorder->dump_reason;
+	unsigned long i;
+	FILE* file;
+
+	strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&now));
+	snprintf(path, sizeof(path), "%s/flight_%s_%lu_%s.csv", recorder->dump_dir, stamp,
+			 recorder->nb_dumps, dump_reason_str[reason]);
+
+	if((file = fopen(path, "w")) == NULL){
+		perror("flight recorder");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(file, "# reason: %s, %lu iterations\n", dump_reason_str[reason], nb_copied);
+	fprintf(file, "t_ms,acquire_us,process_us,feedback_us,loop_us,eye_blink,band_left,band_right,"
+				  "rejected,sample,status,smoothed,pitch\n");
+	for(i=0;i<nb_copied;i++){
+		fprintf(file, "%.3f,%u,%u,%u,%u,%i,%g,%g,%s,%.4f,%i,%.4f,%i\n",
+				-(double)(last_ns-copy[i].start_ns)/1000000.0,
+				copy[i].acquire_us, copy[i].process_us, copy[i].feedback_us, copy[i].loop_us,
+				copy[i].eye_blink, copy[i].band[0], copy[i].band[1],
+				artifact_reason_str(copy[i].reject_reason), copy[i].sample, copy[i].sample_status,
+				copy[i].smoothed, copy[i].pitch);
+	}
+
+	if(fclose(file) != 0){
+		perror("flight recorder");
+		return EXIT_FAILURE;
+	}
+
+	recorder->nb_dumps++;
+	printf("Flight recorder: %s, %lu iterations in %s\n", dump_reason_str[reason], nb_copied, path);
+	fflush(stdout);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void sigusr2_handler(int signal)
+ * @brief dump the recorder on demand
+ * @param signal
+ */
+static void sigusr2_handler(int signal __attribute__ ((unused))){
+
+	if(signal_recorder != NULL){
+		signal_recorder->dump_reason = FLIGHT_DUMP_SIGNAL;
+		sem_post(&(signal_recorder->dump_request));
+	}
+}
@@ -6,6 +6,7 @@
 #include <pthread.h>
 
 #include "gpio_wrapper.h"
+#include "app_clock.h"
 
 
 #define	START_DEMO 0
@@ -35,11 +36,11 @@ void wait_for_start_demo(void)
 	  
 	  /*wait for start button to be pressed*/
 	  while (digitalRead(START_DEMO)==HIGH)
-		delay(50);
+		app_clock_sleep_us(50000);
 		
 	  /*wait for start button to be released*/
 	  while (digitalRead(START_DEMO)==LOW)
-		delay(50);
+		app_clock_sleep_us(50000);
 	  
 	  /*inform user*/
 	  printf("Starting!\n");
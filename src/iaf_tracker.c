@@ -0,0 +1,259 @@
+/**
+ * @file iaf_tracker.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Individual alpha frequency, found during the calibration and tracked
+ * during the task (see iaf_tracker.h). The band measured for the feedback is
+ * recentred on it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "iaf_tracker.h"
+
+static void interpolate_peak(iaf_tracker_t* iaf);
+static void set_band(iaf_tracker_t* iaf);
+
+/**
+ * int init_iaf_tracker(iaf_tracker_t* iaf)
+ * @brief check the search range and start with the band centred on it
+ * @param iaf, tracker
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the range has no bin or needs bins out of reach
+ */
+int init_iaf_tracker(iaf_tracker_t* iaf){
+
+	double half_bins;
+
+	if(iaf->bin_width <= 0 || iaf->half_width <= 0 || iaf->min_freq >= iaf->max_freq){
+		fprintf(stderr, "IAF tracker: bad search range or band\n");
+		return EXIT_FAILURE;
+	}
+
+	iaf->min_bin = (int)ceil(iaf->min_freq/iaf->bin_width);
+	iaf->max_bin = (int)floor(iaf->max_freq/iaf->bin_width);
+	half_bins = iaf->half_width/iaf->bin_width;
+
+	/*the band of a peak anywhere in the range, and the neighbours of the peak*/
+	iaf->first_bin = (int)floor(iaf->min_bin-half_bins);
+	if(iaf->first_bin > iaf->min_bin-IAF_TRACK_RADIUS){
+		iaf->first_bin = iaf->min_bin-IAF_TRACK_RADIUS;
+	}
+	iaf->last_bin = (int)floor(iaf->max_bin+1+half_bins);
+	if(iaf->last_bin < iaf->max_bin+IAF_TRACK_RADIUS){
+		iaf->last_bin = iaf->max_bin+IAF_TRACK_RADIUS;
+	}
+
+	if(iaf->max_bin < iaf->min_bin || iaf->first_bin < 0 || iaf->last_bin >= IAF_MAX_BINS){
+		fprintf(stderr, "IAF tracker: %.1f to %.1f Hz has no bin or is out of reach at %.2f Hz per bin\n",
+				iaf->min_freq, iaf->max_freq, iaf->bin_width);
+		return EXIT_FAILURE;
+	}
+
+	memset(iaf->calib_sum, 0, sizeof(iaf->calib_sum));
+	iaf->nb_calib = 0;
+	iaf->nb_moves = 0;
+	iaf->calibrated = 0x00;
+
+	/*until the calibration ends, the band is centred on the search range*/
+	iaf->peak_bin = (iaf->min_bin+iaf->max_bin)/2;
+	iaf->peak_freq = (iaf->min_freq+iaf->max_freq)/2;
+	set_band(iaf);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void iaf_calibrate_frame(iaf_tracker_t* iaf, double* left, double* right)
+ * @brief add the spectrum of a training frame
+ * @param iaf, tracker
+ * @param left, bins of the left channel, first_bin to last_bin set
+ * @param right, bins of the right channel
+ */
+void iaf_calibrate_frame(iaf_tracker_t* iaf, double* left, double* right){
+
+	int k;
+
+	for(k=iaf->first_bin;k<=iaf->last_bin;k++){
+		iaf->calib_sum[k] += left[k]+right[k];
+	}
+	iaf->nb_calib++;
+}
+
+/**
+ * int iaf_end_calibration(iaf_tracker_t* iaf)
+ * @brief find the peak of the mean spectrum of the training, the tracking starts from it
+ * @param iaf, tracker
+ * @return EXIT_SUCCESS, EXIT_FAILURE if no frame was added (the band stays where it is)
+ */
+int iaf_end_calibration(iaf_tracker_t* iaf){
+
+	int k;
+
+	if(iaf->nb_calib == 0){
+		return EXIT_FAILURE;
+	}
+
+	for(k=iaf->first_bin;k<=iaf->last_bin;k++){
+		iaf->spectrum[k] = iaf->calib_sum[k]/iaf->nb_calib;
+	}
+
+	iaf->peak_bin = iaf->min_bin;
+	for(k=iaf->min_bin+1;k<=iaf->max_bin;k++){
+		if(iaf->spectrum[k] > iaf->spectrum[iaf->peak_bin]){
+			iaf->peak_bin = k;
+		}
+	}
+
+	interpolate_peak(iaf);
+	set_band(iaf);
+	iaf->calibrated = 0x01;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void iaf_set_peak(iaf_tracker_t* iaf, double freq)
+ * @brief move the peak to a known IAF (stored reference). Without calibration,
+ * the spectrum around the peak is taken from the first frame tracked.
+ * @param iaf, tracker
+ * @param freq, IAF (Hz), kept in the search range
+ */
+void iaf_set_peak(iaf_tracker_t* iaf, double freq){
+
+	int k;
+
+	if(!iaf->calibrated){
+		for(k=iaf->first_bin;k<=iaf->last_bin;k++){
+			iaf->spectrum[k] = -1;
+		}
+	}
+
+	/*interpolated peaks of the bins in range*/
+	if(freq < (iaf->min_bin-0.5)*iaf->bin_width){
+		freq = (iaf->min_bin-0.5)*iaf->bin_width;
+	}else if(freq > (iaf->max_bin+0.5)*iaf->bin_width){
+		freq = (iaf->max_bin+0.5)*iaf->bin_width;
+	}
+
+	iaf->peak_freq = freq;
+	iaf->peak_bin = (int)floor(freq/iaf->bin_width+0.5);
+	if(iaf->peak_bin > iaf->max_bin){
+		iaf->peak_bin = iaf->max_bin;
+	}
+	set_band(iaf);
+	iaf->calibrated = 0x01;
+}
+
+/**
+ * void iaf_track_frame(iaf_tracker_t* iaf, double* left, double* right)
+ * @brief smooth the bins around the peak with a task frame and follow the peak
+ * @param iaf, tracker
+ * @param left, bins of the left channel, read_first to read_last set
+ * @param right, bins of the right channel
+ */
+void iaf_track_frame(iaf_tracker_t* iaf, double* left, double* right){
+
+	double value;
+	int k;
+
+	if(!iaf->calibrated || iaf->tracking_rate <= 0){
+		return;
+	}
+
+	for(k=iaf->peak_bin-IAF_TRACK_RADIUS;k<=iaf->peak_bin+IAF_TRACK_RADIUS;k++){
+		value = left[k]+right[k];
+		if(iaf->spectrum[k] < 0){
+			iaf->spectrum[k] = value;
+		}else{
+			iaf->spectrum[k] += iaf->tracking_rate*(value-iaf->spectrum[k]);
+		}
+	}
+
+	/*climb to a higher neighbour, its own neighbours are already smoothed*/
+	if(iaf->peak_bin < iaf->max_bin && iaf->spectrum[iaf->peak_bin+1] > iaf->spectrum[iaf->peak_bin]){
+		iaf->peak_bin++;
+		iaf->nb_moves++;
+	}else if(iaf->peak_bin > iaf->min_bin && iaf->spectrum[iaf->peak_bin-1] > iaf->spectrum[iaf->peak_bin]){
+		iaf->peak_bin--;
+		iaf->nb_moves++;
+	}
+
+	interpolate_peak(iaf);
+	set_band(iaf);
+}
+
+/**
+ * double iaf_band_value(iaf_tracker_t* iaf, double* bins)
+ * @brief band value of a channel around the peak
+ * @param iaf, tracker
+ * @param bins, bins of the channel, read_first to read_last set
+ * @return band value
+ */
+double iaf_band_value(iaf_tracker_t* iaf, double* bins){
+
+	double value = 0;
+	int k;
+
+	for(k=iaf->band_first;k<=iaf->band_last;k++){
+		value += iaf->weight[k]*bins[k];
+	}
+
+	return value;
+}
+
+/**
+ * static void interpolate_peak(iaf_tracker_t* iaf)
+ * @brief vertex of the parabola through the peak bin and its neighbours
+ * @param iaf, tracker
+ */
+static void interpolate_peak(iaf_tracker_t* iaf){
+
+	double before = iaf->spectrum[iaf->peak_bin-1];
+	double peak = iaf->spectrum[iaf->peak_bin];
+	double after = iaf->spectrum[iaf->peak_bin+1];
+	double curvature = before-2*peak+after;
+	double offset = 0;
+
+	/*on a flat or hollow spectrum, the bin itself*/
+	if(curvature < 0){
+		offset = 0.5*(before-after)/curvature;
+		if(offset > 0.5){
+			offset = 0.5;
+		}else if(offset < -0.5){
+			offset = -0.5;
+		}
+	}
+
+	iaf->peak_freq = (iaf->peak_bin+offset)*iaf->bin_width;
+}
+
+/**
+ * static void set_band(iaf_tracker_t* iaf)
+ * @brief band around the peak, a bin k covers [k-0.5, k+0.5[
+ * @param iaf, tracker
+ */
+static void set_band(iaf_tracker_t* iaf){
+
+	double center = iaf->peak_freq/iaf->bin_width;
+	double low = center-iaf->half_width/iaf->bin_width;
+	double high = center+iaf->half_width/iaf->bin_width;
+	int k;
+
+	iaf->band_first = (int)floor(low+0.5);
+	iaf->band_last = (int)floor(high+0.5);
+	for(k=iaf->band_first;k<=iaf->band_last;k++){
+		iaf->weight[k] = fmin(high, k+0.5)-fmax(low, k-0.5);
+	}
+
+	iaf->read_first = iaf->peak_bin-IAF_TRACK_RADIUS;
+	if(iaf->band_first < iaf->read_first){
+		iaf->read_first = iaf->band_first;
+	}
+	iaf->read_last = iaf->peak_bin+IAF_TRACK_RADIUS;
+	if(iaf->band_last > iaf->read_last){
+		iaf->read_last = iaf->band_last;
+	}
+}
@@ -9,9 +9,12 @@
  * be removed and replace by a socket-based communication.
 */
 
+#define _GNU_SOURCE /*semtimedop*/
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -50,19 +53,40 @@ int ipc_comm_init(ipc_comm_t* ipc_comm){
 
 /**
  * int ipc_wait_for_harware()
- * @brief 
- * @return EXIT_FAILURE for unknown type, EXIT_SUCCESS for known/success
+ * @brief wait for the interface to report the hardware connected. The wait is
+ *        done in slices, the semaphore set is looked up again after each one in
+ *        case the interface created it again (restart).
+ * @return 0x01 when connected, 0x00 on timeout or interruption
  */
 int ipc_wait_for_harware(ipc_comm_t* ipc_comm){
 	
+	struct timespec slice = {HW_WAIT_SLICE_S, 0};
+	double waited = 0;
+	int semid;
+	
 	/*check if the current page is available (semaphore)*/
 	ipc_comm->sops->sem_num = INTERFACE_CONNECTED; /*sem that indicates that a page is free to write to*/
 	ipc_comm->sops->sem_op = -1; /*decrement semaphore*/
 	ipc_comm->sops->sem_flg = 0; /*undo if fails and blocking call*/	
 	
-	if(semop(ipc_comm->semid, ipc_comm->sops, 1) == 0){
-		/*yes, move on*/
-		return 0x01;
+	while(ipc_comm->hw_timeout <= 0 || waited < ipc_comm->hw_timeout){
+		
+		if(semtimedop(ipc_comm->semid, ipc_comm->sops, 1, &slice) == 0){
+			/*yes, move on*/
+			return 0x01;
+		}
+		
+		/*interrupted (ctrl-c)*/
+		if(errno == EINTR){
+			break;
+		}
+		
+		/*the set was removed, find the new one*/
+		if((errno == EIDRM || errno == EINVAL) &&
+		   (semid = semget(ipc_comm->sem_key, NB_SEM, IPC_CREAT | 0666)) != -1){
+			ipc_comm->semid = semid;
+		}
+		waited += HW_WAIT_SLICE_S;
 	}
 	
 	/*something went wrong*/
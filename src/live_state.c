@@ -0,0 +1,261 @@
+/**
+ * @file live_state.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Live state of the app, published in a page of shared memory for the
+ * displays (see live_state.h for the seqlock). The app side only stores to the
+ * page, a reader attaches read only and copies the snapshot out, so the displays
+ * no longer parse the console.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "live_state.h"
+
+static const char* phase_str[] = {"starting", "idle", "training", "task", "stopped"};
+
+/**
+ * int live_state_init(live_state_t* live)
+ * @brief app side, attach the page (created if needed) and publish the starting phase
+ * @param live, live state (shm_key set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int live_state_init(live_state_t* live){
+
+	live_page_t* page;
+	uint32_t seq;
+
+	if((live->shmid = shmget(live->shm_key, LIVE_PAGE_SIZE, IPC_CREAT | 0644)) < 0){
+		perror("live state shmget");
+		return EXIT_FAILURE;
+	}
+
+	if((live->page = shmat(live->shmid, NULL, 0)) == (void*)-1){
+		perror("live state shmat");
+		live->page = NULL;
+		return EXIT_FAILURE;
+	}
+	page = live->page;
+
+	/*a previous app may have died while writing, seq goes on from the next even value*/
+	seq = __atomic_load_n(&(page->seq), __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->seq), (seq+1) & ~1u, __ATOMIC_RELEASE);
+
+	page->version = LIVE_VERSION;
+	page->app_pid = getpid();
+	__atomic_store_n(&(page->magic), LIVE_MAGIC, __ATOMIC_RELEASE);
+
+	memset(&(live->current), 0, sizeof(live_snapshot_t));
+	live_set_phase(live, LIVE_STARTING);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void live_set_phase(live_state_t* live, uint32_t phase)
+ * @brief app side, publish the session phase, a new training restarts the session values
+ * @param live, live state, NULL if disabled
+ * @param phase, LIVE_* phase
+ */
+void live_set_phase(live_state_t* live, uint32_t phase){
+
+	if(live == NULL){
+		return;
+	}
+
+	if(phase == LIVE_TRAINING){
+		live->current.session++;
+		live->current.train_done = 0;
+		live->current.nb_frames = 0;
+		live->current.nb_rejected = 0;
+		live->current.nb_held = 0;
+		live->current.nb_expired = 0;
+	}
+	live->current.phase = phase;
+	live_publish(live);
+}
+
+/**
+ * void live_set_training(live_state_t* live, uint32_t done, uint32_t total)
+ * @brief app side, publish the training progress
+ * @param live, live state, NULL if disabled
+ * @param done, training samples taken
+ * @param total, training samples needed
+ */
+void live_set_training(live_state_t* live, uint32_t done, uint32_t total){
+
+	if(live == NULL){
+		return;
+	}
+
+	live->current.train_done = done;
+	live->current.train_total = total;
+	live_publish(live);
+}
+
+/**
+ * void live_set_calibration(live_state_t* live, uint32_t calibration, double* mean, double* std_dev)
+ * @brief app side, publish the reference of the normalization
+ * @param live, live state, NULL if disabled
+ * @param calibration, CALIBRATION_* mode
+ * @param mean, reference, left and right
+ * @param std_dev, scale, left and right
+ */
+void live_set_calibration(live_state_t* live, uint32_t calibration, double* mean, double* std_dev){
+
+	if(live == NULL){
+		return;
+	}
+
+	live->current.calibration = calibration;
+	live->current.mean[0] = mean[0];
+	live->current.mean[1] = mean[1];
+	live->current.std_dev[0] = std_dev[0];
+	live->current.std_dev[1] = std_dev[1];
+	live_publish(live);
+}
+
+/**
+ * void live_publish(live_state_t* live)
+ * @brief app side, copy the current snapshot to the page, never waits
+ * @param live, live state, NULL if disabled
+ */
+void live_publish(live_state_t* live){
+
+	live_page_t* page;
+	uint32_t seq;
+	struct timespec now;
+
+	if(live == NULL){
+		return;
+	}
+	page = live->page;
+
+	/*vdso, no system call*/
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	live->current.update_ns = (uint64_t)now.tv_sec*1000000000ULL+now.tv_nsec;
+
+	/*odd while the snapshot is written, the fence keeps the snapshot stores after it*/
+	seq = __atomic_load_n(&(page->seq), __ATOMIC_RELAXED);
+	__atomic_store_n(&(page->seq), seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(&(page->snapshot), &(live->current), sizeof(live_snapshot_t));
+
+	__atomic_store_n(&(page->seq), seq+2, __ATOMIC_RELEASE);
+}
+
+/**
+ * int live_state_cleanup(live_state_t* live)
+ * @brief app side, publish the stopped phase and detach, the page stays for the readers
+ * @param live, live state, NULL if disabled
+ * @return EXIT_SUCCESS
+ */
+int live_state_cleanup(live_state_t* live){
+
+	if(live == NULL){
+		return EXIT_SUCCESS;
+	}
+
+	live_set_phase(live, LIVE_STOPPED);
+	shmdt(live->page);
+	live->page = NULL;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int live_attach(live_state_t* live)
+ * @brief reader side, attach the page read only
+ * @param live, live state (shm_key set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the app never ran
+ */
+int live_attach(live_state_t* live){
+
+	if((live->shmid = shmget(live->shm_key, LIVE_PAGE_SIZE, 0)) < 0){
+		perror("live state shmget");
+		return EXIT_FAILURE;
+	}
+
+	if((live->page = shmat(live->shmid, NULL, SHM_RDONLY)) == (void*)-1){
+		perror("live state shmat");
+		live->page = NULL;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int live_read(live_state_t* live, live_snapshot_t* snapshot)
+ * @brief reader side, copy a consistent snapshot, retried while the app writes
+ * @param live, live state (attached)
+ * @param snapshot(out), snapshot
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the page is not initialized or always torn
+ */
+int live_read(live_state_t* live, live_snapshot_t* snapshot){
+
+	live_page_t* page = live->page;
+	uint32_t seq_before, seq_after;
+	int i;
+
+	if(__atomic_load_n(&(page->magic), __ATOMIC_ACQUIRE) != LIVE_MAGIC || page->version != LIVE_VERSION){
+		return EXIT_FAILURE;
+	}
+
+	for(i=0;i<LIVE_MAX_RETRIES;i++){
+
+		seq_before = __atomic_load_n(&(page->seq), __ATOMIC_ACQUIRE);
+		if(seq_before & 1){
+			continue;
+		}
+
+		memcpy(snapshot, &(page->snapshot), sizeof(live_snapshot_t));
+
+		/*the copy is done before seq is read again*/
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq_after = __atomic_load_n(&(page->seq), __ATOMIC_RELAXED);
+		if(seq_before == seq_after){
+			return EXIT_SUCCESS;
+		}
+	}
+
+	return EXIT_FAILURE;
+}
+
+/**
+ * const char* live_phase_str(uint32_t phase)
+ * @brief name of a phase
+ * @param phase, LIVE_* phase
+ * @return name, "unknown" if out of range
+ */
+const char* live_phase_str(uint32_t phase){
+
+	if(phase > LIVE_STOPPED){
+		return "unknown";
+	}
+	return phase_str[phase];
+}
+
+/**
+ * int live_detach(live_state_t* live)
+ * @brief reader side, detach the page
+ * @param live, live state
+ * @return EXIT_SUCCESS
+ */
+int live_detach(live_state_t* live){
+
+	if(live->page != NULL){
+		shmdt(live->page);
+		live->page = NULL;
+	}
+
+	return EXIT_SUCCESS;
+}
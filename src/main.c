@@ -21,30 +21,50 @@
 #include <signal.h>
 
 #include <wiringPi.h>
-#include <softTone.h>
 #include <buzzer_lib.h>
 
 #include "app_signal.h"
 #include "feature_processing.h"
 #include "ipc_status_comm.h"
 #include "feature_input.h"
+#include "bcast_rd_buf.h"
 #include "xml.h"
 #include "gpio_wrapper.h"
+#include "buzzer_output.h"
+#include "pitch_map.h"
+#include "smoothing_filter.h"
+#include "processing_config.h"
+#include "config_watcher.h"
+#include "control_block.h"
+#include "metrics.h"
+#include "flight_recorder.h"
+#include "app_clock.h"
+#include "task_pipeline.h"
+#include "live_state.h"
+#include "calibration_store.h"
 
-/*defines the frequency scale*/
-#define NB_STEPS 100
 #define NB_PLAYERS 1
 #define PLAYER_1 0
 
 /*function prototypes*/
 static void print_banner();
+static void print_smoothing_filter(smoothing_filter_t* filter);
 char *which_config(int argc, char **argv);
 char task_running = 0x01;
 char program_running = 0x01;
+static char input_attached = 0x00; /*the feature input is to be terminated on exit*/
 
 int configure_feature_input(feature_input_t* feature_input, appconfig_t* app_config);
+int configure_pitch_map(pitch_map_t* pitch_map, appconfig_t* app_config);
+session_file_t* start_recording(session_file_t* recorder, feature_input_t* feature_input, appconfig_t* app_config);
+void load_calibration(feat_proc_t* feature_proc, calib_record_t* record, appconfig_t* app_config);
+void save_calibration(feat_proc_t* feature_proc, calib_record_t* record, appconfig_t* app_config);
+appconfig_t* apply_new_config(appconfig_t* app_config, config_watcher_t* watcher, feature_input_t* feature_input,
+							  pitch_map_t* pitch_map, smoothing_filter_t* smoothing_filter);
 void* train_player(void* param);
-void* get_sample(void* param);
+void* setup_hardware(void* param);
+static double elapsed_ms(struct timespec* from);
+static double interval_ms(struct timespec* from, struct timespec* to);
 
 /*default xml file path/name*/
 #define CONFIG_NAME "config/braintone_app_config.xml"
@@ -60,41 +80,120 @@ int main(int argc, char *argv[])
 {	
 	/*freq index*/
 	char res;
-	double cpu_time_used;
-	double running_avg = 0;
-	double adjusted_sample = 0;
-	clock_t start, end;
+	void* train_res;
+	struct timespec boot_time, session_time;
+	double hardware_ms, input_ms;
+	double producer_rate;
 	feature_input_t feature_input[NB_PLAYERS];
 	ipc_comm_t ipc_comm[NB_PLAYERS];
 	feat_proc_t feature_proc[NB_PLAYERS];
+	pitch_map_t pitch_map[NB_PLAYERS];
+	smoothing_filter_t smoothing_filter[NB_PLAYERS];
+	session_file_t recorder[NB_PLAYERS];
+	band_power_t band_power[NB_PLAYERS];
+	iaf_tracker_t iaf_tracker[NB_PLAYERS];
+	calib_record_t calib_record;
+	task_pipeline_t pipeline;
+	config_watcher_t config_watcher;
+	control_t control;
+	metrics_t metrics;
+	metrics_t* pmetrics = NULL;
+	flight_recorder_t flight;
+	flight_recorder_t* pflight = NULL;
+	live_state_t live;
+	live_state_t* plive = NULL;
 	
 	pthread_attr_t attr;
 	pthread_t threads_array[NB_PLAYERS];
+	pthread_t hardware_thread;
 	
 	/*configuration structure*/
 	appconfig_t* app_config;
 	
+	clock_gettime(CLOCK_MONOTONIC, &boot_time);
+	
 	/*Set up ctrl c signal handler*/
 	(void)signal(SIGINT, ctrl_c_handler);
 
 	/*Show program banner on stdout*/
 	print_banner();
-	/*setup gpios*/
-	setup_gpios();
+	
+	/*gpios and buzzer are set up while the config is read and the input attached*/
+	if(pthread_create(&hardware_thread, NULL, setup_hardware, &hardware_ms) != 0){
+		return EXIT_FAILURE;
+	}
 	
 	/*read the xml*/
 	app_config = xml_initialize(which_config(argc, argv));
+	if(app_config == NULL){
+		return EXIT_FAILURE;
+	}
+	
+	/*sessions run on the configured clock, the startup times stay real*/
+	app_clock_init(app_config->clock);
+	
+	/*build the pitch table*/
+	if(configure_pitch_map(pitch_map, app_config) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
 	
-	/*setup the buzzer*/
-	setup_buzzer_lib(DEFAULT_PIN);
+	/*setup the smoothing stage*/
+	if(configure_smoothing_filter(&(smoothing_filter[PLAYER_1]), app_config) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+	print_smoothing_filter(&(smoothing_filter[PLAYER_1]));
 	
 	/*configure the feature input*/
 	if(configure_feature_input(feature_input, app_config) == EXIT_FAILURE){
 		return EXIT_FAILURE;
 	}
+	input_attached = 0x01;
+	
+	/*readiness handshake with the producer*/
+	control.shm_key = 7805;
+	if(control_init(&control) == EXIT_FAILURE){
+		control.block = NULL;
+	}
+	input_ms = elapsed_ms(&boot_time);
+	
+	/*live state for the displays*/
+	live.shm_key = LIVE_SHM_KEY;
+	if(app_config->live_state && live_state_init(&live) == EXIT_SUCCESS){
+		plive = &live;
+	}
+	
+	/*counters for a local scraper*/
+	strncpy(metrics.socket_path, app_config->metrics_socket, METRICS_PATH_LENGTH-1);
+	metrics.socket_path[METRICS_PATH_LENGTH-1] = '\0';
+	metrics.control = &control;
+	init_metrics(&metrics);
+	if(app_config->metrics_socket[0] != '\0' && start_metrics_server(&metrics) == EXIT_SUCCESS){
+		pmetrics = &metrics;
+	}
+	
+	/*last seconds of the task loop, dumped on anomalies*/
+	strncpy(flight.dump_dir, app_config->flight_dir, FLIGHT_DIR_LENGTH-1);
+	flight.dump_dir[FLIGHT_DIR_LENGTH-1] = '\0';
+	flight.duration = app_config->flight_duration;
+	flight.frame_rate = app_config->frame_rate;
+	flight.latency_threshold = app_config->flight_latency;
+	flight.reject_threshold = app_config->flight_rejections;
+	if(app_config->flight_duration > 0 && init_flight_recorder(&flight) == EXIT_SUCCESS){
+		pflight = &flight;
+	}
+	
+	pthread_join(hardware_thread, NULL);
+	printf("Startup: hardware %.0f ms, config and input %.0f ms\n", hardware_ms, input_ms);
+	
+	/*watch the config, changes are applied between sessions*/
+	config_watcher.filename = which_config(argc, argv);
+	if(app_config->hot_reload && init_config_watcher(&config_watcher) == EXIT_FAILURE){
+		app_config->hot_reload = 0x00;
+	}
 	
 	/*configure the inter-process communication channel*/
 	ipc_comm[PLAYER_1].sem_key=1234;
+	ipc_comm[PLAYER_1].hw_timeout = app_config->hw_timeout;
 	ipc_comm_init(&(ipc_comm[PLAYER_1]));
 	
 	/*configure threads*/
@@ -114,7 +213,21 @@ int main(int argc, char *argv[])
 	
 	/*stop beep mode*/
 	turn_off_beeper();	
-	sleep(2);
+	
+	/*wait for the producer to report ready, older producers are given the timeout*/
+	if(app_config->feature_source == SHM_INPUT || app_config->feature_source == BCAST_INPUT){
+		if(control_wait_producer_ready(&control, app_config->ready_timeout*1000) == EXIT_SUCCESS){
+			printf("Producer ready\n");
+		}else{
+			printf("Producer did not report ready, starting anyway\n");
+		}
+	}
+	control_set_app_state(&control, PEER_READY);
+	if(app_config->producer_idle){
+		control_set_app_activity(&control, APP_IDLE);
+	}
+	printf("Ready in %.0f ms\n", elapsed_ms(&boot_time));
+	fflush(stdout);
 	
 	
 	while(program_running){
@@ -123,72 +236,118 @@ int main(int argc, char *argv[])
 		set_beep_mode(25, 0, 500);
 		
 		/*wait for button pressed*/
+		live_set_phase(plive, LIVE_IDLE);
 		wait_for_start_demo();
+		app_clock_now(&session_time);
 		
 		turn_off_beeper();
+		
+		/*take the config file changes made since the last session*/
+		if(app_config->hot_reload){
+			app_config = apply_new_config(app_config, &config_watcher, feature_input,
+										  pitch_map, smoothing_filter);
+			if(!program_running){
+				break;
+			}
+		}
+	
+		/*frames are wanted again, at the rate the filters are tuned for*/
+		control_request_frame_rate(&control, app_config->frame_rate);
+		control_set_app_activity(&control, APP_ACTIVE);
 	
 		printf("About to begin training\n");
 		fflush(stdout);
 		
 		/*initialize feature processing*/
-		feature_proc[PLAYER_1].nb_train_samples = app_config->training_set_size;
-		feature_proc[PLAYER_1].feature_input = &(feature_input[PLAYER_1]);
-		init_feat_processing(&(feature_proc[PLAYER_1]));
+		configure_feature_processing(&(feature_proc[PLAYER_1]), &(feature_input[PLAYER_1]), app_config);
+		feature_proc[PLAYER_1].metrics = pmetrics;
+		feature_proc[PLAYER_1].live = plive;
+		feature_proc[PLAYER_1].band_power = configure_band_power(&(band_power[PLAYER_1]), app_config);
+		feature_proc[PLAYER_1].iaf = configure_iaf_tracker(&(iaf_tracker[PLAYER_1]), app_config);
+		if(init_feat_processing(&(feature_proc[PLAYER_1])) == EXIT_FAILURE){
+			printf("Feature processing can't be initialized\n");
+			program_running = 0x00;
+			break;
+		}
+		load_calibration(feature_proc, &calib_record, app_config);
+		metrics_count_session(pmetrics);
+		live_set_phase(plive, LIVE_TRAINING);
+		feature_proc[PLAYER_1].recorder = start_recording(recorder, feature_input, app_config);
 			
 		/*start training*/	
 		//train_feat_processing(&(feature_proc[PLAYER_1]));
 		pthread_create(&(threads_array[PLAYER_1]), &attr,
 					   train_player, (void*)&(feature_proc[PLAYER_1]));
-		pthread_join(threads_array[PLAYER_1], NULL);			   
+		pthread_join(threads_array[PLAYER_1], &train_res);
 		
-		/*little pause between training and testing*/	
+		/*the input stopped (end of recorded session or producer gone)*/
+		if(train_res != (void*)EXIT_SUCCESS){
+			printf("Training interrupted, input failed\n");
+			if(feature_proc[PLAYER_1].recorder != NULL){
+				session_file_close(feature_proc[PLAYER_1].recorder);
+			}
+			program_running = 0x00;
+			break;
+		}
+		save_calibration(feature_proc, &calib_record, app_config);
+		
+		/*the producer had the training to settle on the rate asked*/
+		producer_rate = control_get_producer_frame_rate(&control);
+		if(producer_rate > 0 && fabs(producer_rate-app_config->frame_rate) > 0.01*app_config->frame_rate){
+			printf("Producer runs at %.2f Hz, %.2f Hz requested\n", producer_rate, app_config->frame_rate);
+		}
+		
+		/*optional pause between training and testing*/	
 		printf("About to start task\n");
 		fflush(stdout);	
-		sleep(3);	
-			
-		start = clock();
-		task_running = 0x01;
-			
-		/*run the test*/
-		while(task_running){
-		
-			/*get a normalized sample*/
-			pthread_create(&(threads_array[PLAYER_1]), &attr,
-						   get_sample, (void*)&(feature_proc[PLAYER_1]));
-			pthread_join(threads_array[PLAYER_1], NULL);		
-			
-			/*adjust the sample value to the pitch scale*/
-			adjusted_sample = ((float)feature_proc[PLAYER_1].sample*100/4);
-			/*compute the running average, using the defined kernel*/
-			running_avg += (adjusted_sample-running_avg)/app_config->avg_kernel;
-			
-			if(running_avg<-4){
-				running_avg = -4;
-			}
-			
-			/*update buzzer state*/
-			set_buzzer_state(running_avg);
-			
-			/*show sample value on console*/
-			printf("sample value: %i\n",(int)running_avg);
-			
-			/*get current time*/
-			end = clock();
-			cpu_time_used = ((double) (end - start)) / (double)CLOCKS_PER_SEC * 100;
-			
-			/*check if one of the stop conditions is met*/
-			if(app_config->test_duration < cpu_time_used){
-				task_running = 0x00;
-			}
+		if(app_config->task_pause > 0){
+			app_clock_sleep_us((long)(app_config->task_pause*1000000));
+		}
 			
+		/*run the test, acquisition, processing and output on their own threads*/
+		pipeline.depth = app_config->pipeline_depth;
+		pipeline.feature_proc = &(feature_proc[PLAYER_1]);
+		pipeline.filter = &(smoothing_filter[PLAYER_1]);
+		pipeline.pitch_map = &(pitch_map[PLAYER_1]);
+		pipeline.metrics = pmetrics;
+		pipeline.flight = pflight;
+		pipeline.live = plive;
+		pipeline.test_duration = app_config->test_duration;
+		pipeline.session_time = &session_time;
+		pipeline.task_running = &task_running;
+		live_set_phase(plive, LIVE_TASK);
+		if(run_task_pipeline(&pipeline) == EXIT_FAILURE){
+			printf("Task can't be started\n");
+			program_running = 0x00;
 		}
 		
 		printf("Finished\n");
+		print_feat_processing_stats(&(feature_proc[PLAYER_1]));
+		print_pipeline_stats(&pipeline);
+		
+		if(feature_proc[PLAYER_1].recorder != NULL){
+			session_file_close(feature_proc[PLAYER_1].recorder);
+		}
+		
+		/*no frame is wanted until the next session*/
+		if(app_config->producer_idle){
+			control_set_app_activity(&control, APP_IDLE);
+		}
 	}
 	
 	/*clean up app*/	
+	stop_flight_recorder(pflight);
+	stop_metrics_server(&metrics);
+	control_cleanup(&control);
+	live_state_cleanup(plive);
+	if(app_config->hot_reload){
+		stop_config_watcher(&config_watcher);
+	}
 	ipc_comm_cleanup(&(ipc_comm[PLAYER_1]));
 	clean_up_feat_processing(&(feature_proc[PLAYER_1]));
+	if(input_attached){
+		TERMINATE_FEAT_INPUT_FC(&(feature_input[PLAYER_1]));
+	}
 	
 	return EXIT_SUCCESS;
 }
@@ -202,6 +361,21 @@ int configure_feature_input(feature_input_t* feature_input, appconfig_t* app_con
 	/*set the keys*/
 	feature_input[PLAYER_1].shm_key=7804;
 	feature_input[PLAYER_1].sem_key=1234;
+	feature_input[PLAYER_1].bcast_key=BCAST_SHM_KEY;
+	
+	/*recorded session and fake generator options*/
+	feature_input[PLAYER_1].file_path = app_config->session_file;
+	feature_input[PLAYER_1].replay_start = app_config->replay_start;
+	feature_input[PLAYER_1].seed = 1;
+	
+	/*page layout and shared segment backing*/
+	feature_input[PLAYER_1].layout = app_config->page_layout;
+	feature_input[PLAYER_1].page_format = app_config->page_format;
+	feature_input[PLAYER_1].shm_backing = app_config->shm_backing;
+	feature_input[PLAYER_1].shm_name = app_config->shm_name;
+	feature_input[PLAYER_1].sock_path = app_config->feature_socket;
+	feature_input[PLAYER_1].shm_hugepages = app_config->shm_hugepages;
+	feature_input[PLAYER_1].stall_timeout = app_config->stall_timeout;
 	
 	/*compute the page size from the selected features*/
 	
@@ -234,12 +408,246 @@ int configure_feature_input(feature_input_t* feature_input, appconfig_t* app_con
 	
 	/*set buffer size related fields*/
 	feature_input[PLAYER_1].nb_features = nb_features;
-	feature_input[PLAYER_1].page_size = sizeof(frame_info_t)+nb_features*sizeof(double); 
 	feature_input[PLAYER_1].buffer_depth = app_config->buffer_depth;
+	if(set_page_layout(&(feature_input[PLAYER_1])) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
 	
-	init_feature_input(app_config->feature_source, &(feature_input[PLAYER_1]));
+	return init_feature_input(app_config->feature_source, &(feature_input[PLAYER_1]));
+}
 
-	return EXIT_SUCCESS;
+
+/**
+ * int configure_pitch_map(pitch_map_t* pitch_map, appconfig_t* app_config)
+ * @brief set the pitch map from the app config and build the pitch table
+ * @param pitch_map, pitch map to configure
+ * @param app_config, app configuration
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int configure_pitch_map(pitch_map_t* pitch_map, appconfig_t* app_config){
+	
+	pitch_map[PLAYER_1].scale = app_config->pitch_scale;
+	pitch_map[PLAYER_1].nb_steps = app_config->pitch_steps;
+	pitch_map[PLAYER_1].z_min = app_config->pitch_z_min;
+	pitch_map[PLAYER_1].z_max = app_config->pitch_z_max;
+	pitch_map[PLAYER_1].freq_min = app_config->pitch_freq_min;
+	pitch_map[PLAYER_1].freq_max = app_config->pitch_freq_max;
+	pitch_map[PLAYER_1].hysteresis = app_config->pitch_hysteresis;
+	
+	return init_pitch_map(&(pitch_map[PLAYER_1]));
+}
+
+
+/**
+ * void load_calibration(feat_proc_t* feature_proc, calib_record_t* record, appconfig_t* app_config)
+ * @brief start from the stored reference of the user, if recent enough. The training
+ * is then replaced by a short refinement, the reference never weighs more than a full training.
+ * @param feature_proc, feature processing, initialized
+ * @param record(out), record of the user and measurement
+ * @param app_config, app configuration
+ */
+void load_calibration(feat_proc_t* feature_proc, calib_record_t* record, appconfig_t* app_config){
+	
+	char stamp[32];
+	time_t trained_time;
+	
+	if(app_config->calibration_store[0] == '\0'){
+		return;
+	}
+	
+	/*only a reference measured the same way is reused*/
+	init_calib_record(record, app_config->user_id);
+	record->calibration = app_config->calibration;
+	record->band_source = app_config->band_source;
+	record->nb_channels = app_config->nb_channels;
+	record->window_width = app_config->window_width;
+	record->iaf = app_config->iaf;
+	record->sampling_rate = app_config->sampling_rate;
+	
+	if(app_config->warm_start_age <= 0 || calib_store_load(app_config->calibration_store, record) == EXIT_FAILURE ||
+	   calib_record_age(record) > app_config->warm_start_age){
+		return;
+	}
+	
+	feature_proc[PLAYER_1].warm_start = 0x01;
+	feature_proc[PLAYER_1].mean[0] = record->mean[0];
+	feature_proc[PLAYER_1].mean[1] = record->mean[1];
+	feature_proc[PLAYER_1].std_dev[0] = record->std_dev[0];
+	feature_proc[PLAYER_1].std_dev[1] = record->std_dev[1];
+	feature_proc[PLAYER_1].nb_prior_samples = record->nb_samples < app_config->training_set_size?
+											  record->nb_samples:app_config->training_set_size;
+	feature_proc[PLAYER_1].nb_train_samples = app_config->refine_set_size;
+	
+	/*the training starts from the stored peak as from the stored reference*/
+	if(feature_proc[PLAYER_1].iaf != NULL){
+		feature_proc[PLAYER_1].iaf->peak_freq = record->iaf_freq;
+	}
+	
+	trained_time = (time_t)record->trained_time;
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", localtime(&trained_time));
+	printf("Warm start from the training of %s (%.1f h, %i refinements), refined with %i samples\n",
+		   stamp, calib_record_age(record), record->nb_refinements, app_config->refine_set_size);
+	fflush(stdout);
+}
+
+/**
+ * void save_calibration(feat_proc_t* feature_proc, calib_record_t* record, appconfig_t* app_config)
+ * @brief store the reference of the training, or of the refinement
+ * @param feature_proc, feature processing, trained
+ * @param record, record set by load_calibration
+ * @param app_config, app configuration
+ */
+void save_calibration(feat_proc_t* feature_proc, calib_record_t* record, appconfig_t* app_config){
+	
+	time_t now = time(NULL);
+	
+	if(app_config->calibration_store[0] == '\0'){
+		return;
+	}
+	
+	/*a refinement keeps the time of the full training, the reference expires from it*/
+	if(feature_proc[PLAYER_1].warm_start){
+		if(feature_proc[PLAYER_1].nb_train_samples <= 0){
+			return;
+		}
+		record->nb_samples = feature_proc[PLAYER_1].nb_prior_samples+feature_proc[PLAYER_1].nb_train_samples;
+		record->nb_refinements++;
+	}else{
+		record->nb_samples = feature_proc[PLAYER_1].nb_train_samples;
+		record->nb_refinements = 0;
+		record->trained_time = (int64_t)now;
+	}
+	record->update_time = (int64_t)now;
+	record->mean[0] = feature_proc[PLAYER_1].mean[0];
+	record->mean[1] = feature_proc[PLAYER_1].mean[1];
+	record->std_dev[0] = feature_proc[PLAYER_1].std_dev[0];
+	record->std_dev[1] = feature_proc[PLAYER_1].std_dev[1];
+	record->iaf_freq = (feature_proc[PLAYER_1].iaf != NULL)?feature_proc[PLAYER_1].iaf->peak_freq:0;
+	
+	if(calib_store_save(app_config->calibration_store, record) == EXIT_FAILURE){
+		fprintf(stderr, "Reference not stored, the next session trains again\n");
+	}
+}
+
+/**
+ * session_file_t* start_recording(session_file_t* recorder, feature_input_t* feature_input, appconfig_t* app_config)
+ * @brief create the session file of the session about to start, if recording is enabled
+ * @param recorder, session file to create
+ * @param feature_input, feature input to record
+ * @param app_config, app configuration
+ * @return the session file, NULL if not recording
+ */
+session_file_t* start_recording(session_file_t* recorder, feature_input_t* feature_input, appconfig_t* app_config){
+	
+	char path[MAX_PATH_LENGTH+64];
+	char stamp[32];
+	time_t now = time(NULL);
+	session_header_t header;
+	
+	if(app_config->record_dir[0] == '\0'){
+		return NULL;
+	}
+	
+	/*describe the feature vector*/
+	memset(&header, 0, sizeof(session_header_t));
+	header.nb_features = feature_input[PLAYER_1].nb_features;
+	header.nb_channels = app_config->nb_channels;
+	header.window_width = app_config->window_width;
+	header.sections = (app_config->timeseries?SESSION_TIMESERIES:0) | (app_config->fft?SESSION_FFT:0) |
+					  (app_config->power_alpha?SESSION_POWER_ALPHA:0) | (app_config->power_beta?SESSION_POWER_BETA:0) |
+					  (app_config->power_gamma?SESSION_POWER_GAMMA:0);
+	header.sampling_rate = app_config->sampling_rate;
+	header.frame_rate = app_config->frame_rate;
+	header.start_time = (int64_t)now;
+	
+	/*one file per session, named after its start time*/
+	strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&now));
+	snprintf(path, sizeof(path), "%s/session_%s%s", app_config->record_dir, stamp, SESSION_FILE_EXT);
+	
+	recorder[PLAYER_1].codec = app_config->record_codec;
+	if(session_file_create(&(recorder[PLAYER_1]), path, &header) == EXIT_FAILURE){
+		return NULL;
+	}
+	
+	printf("Recording session: %s\n", path);
+	return &(recorder[PLAYER_1]);
+}
+
+
+/**
+ * appconfig_t* apply_new_config(appconfig_t* app_config, config_watcher_t* watcher, feature_input_t* feature_input,
+ *							  pitch_map_t* pitch_map, smoothing_filter_t* smoothing_filter)
+ * @brief apply the config reloaded since the last session, between sessions only.
+ *        The pitch map and smoothing filter are rebuilt, the feature input is attached
+ *        again only if its geometry changed, the other session elements are read from
+ *        the config at each session. The elements read at startup only are reported
+ *        as waiting for a restart. A config that can't be applied is dropped.
+ * @param app_config, config in use
+ * @param watcher, config watcher
+ * @param feature_input, feature input to attach again
+ * @param pitch_map, pitch map to rebuild
+ * @param smoothing_filter, smoothing filter to rebuild
+ * @return the config to use from now on
+ */
+appconfig_t* apply_new_config(appconfig_t* app_config, config_watcher_t* watcher, feature_input_t* feature_input,
+							  pitch_map_t* pitch_map, smoothing_filter_t* smoothing_filter){
+	
+	appconfig_t* new_config = take_new_config(watcher);
+	
+	if(new_config == NULL){
+		return app_config;
+	}
+	
+	if(configure_pitch_map(pitch_map, new_config) == EXIT_FAILURE ||
+	   configure_smoothing_filter(&(smoothing_filter[PLAYER_1]), new_config) == EXIT_FAILURE){
+		fprintf(stderr, "New config rejected, keeping the current one\n");
+		configure_pitch_map(pitch_map, app_config);
+		configure_smoothing_filter(&(smoothing_filter[PLAYER_1]), app_config);
+		free(new_config);
+		return app_config;
+	}
+	
+	if(config_changes_geometry(app_config, new_config)){
+		
+		printf("Feature input changed, attaching again\n");
+		TERMINATE_FEAT_INPUT_FC(&(feature_input[PLAYER_1]));
+		input_attached = 0x00;
+		
+		if(configure_feature_input(feature_input, new_config) == EXIT_FAILURE){
+			fprintf(stderr, "New feature input failed, keeping the current config\n");
+			configure_pitch_map(pitch_map, app_config);
+			configure_smoothing_filter(&(smoothing_filter[PLAYER_1]), app_config);
+			free(new_config);
+			if(configure_feature_input(feature_input, app_config) == EXIT_FAILURE){
+				fprintf(stderr, "Feature input can't be attached again\n");
+				program_running = 0x00;
+			}else{
+				input_attached = 0x01;
+			}
+			return app_config;
+		}
+		input_attached = 0x01;
+	}
+	else{
+		/*same values, but the strings belong to the config*/
+		feature_input[PLAYER_1].file_path = new_config->session_file;
+		feature_input[PLAYER_1].shm_name = new_config->shm_name;
+		feature_input[PLAYER_1].sock_path = new_config->feature_socket;
+		feature_input[PLAYER_1].stall_timeout = new_config->stall_timeout;
+	}
+	
+	/*the elements read at startup keep their value*/
+	report_startup_only_changes(app_config, new_config);
+	
+	print_smoothing_filter(&(smoothing_filter[PLAYER_1]));
+	
+	/*reload turned off from the file itself*/
+	if(!new_config->hot_reload){
+		stop_config_watcher(watcher);
+	}
+	
+	free(app_config);
+	return new_config;
 }
 
 
@@ -256,6 +664,19 @@ static void print_banner()
 
 
 
+/**
+ * void print_smoothing_filter(smoothing_filter_t* filter)
+ * @brief report the smoothing filter in use and the delay it adds
+ * @param filter, smoothing filter, initialized
+ */
+static void print_smoothing_filter(smoothing_filter_t* filter)
+{
+	printf("Smoothing: %s, group delay %.2f frames (%.0f ms)\n",
+		   smoothing_filter_str(filter->type), filter->group_delay,
+		   filter->group_delay/filter->frame_rate*1000);
+}
+
+
 /**
  * which_config(int argc, char **argv)
  * @brief return which config to use
@@ -275,23 +696,55 @@ char *which_config(int argc, char **argv)
 
 
 /**
- * void* train_player(void* param)
- * @brief thread that trains a player
- * @param param, (feat_proc_t*) player to train
+ * void* setup_hardware(void* param)
+ * @brief thread that sets up the gpios and the buzzer
+ * @param param, (double*) time it took (ms)
  * @return NULL
  */
-void* train_player(void* param){
-	train_feat_processing((feat_proc_t*)param);
+void* setup_hardware(void* param){
+	
+	struct timespec start;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	setup_gpios();
+	setup_buzzer();
+	*(double*)param = elapsed_ms(&start);
+	
 	return NULL;
 }
 
+/**
+ * double interval_ms(struct timespec* from, struct timespec* to)
+ * @brief time between two instants
+ * @param from, first instant
+ * @param to, second instant
+ * @return interval (ms)
+ */
+static double interval_ms(struct timespec* from, struct timespec* to){
+	return (to->tv_sec-from->tv_sec)*1000.0 + (to->tv_nsec-from->tv_nsec)/1000000.0;
+}
+
+/**
+ * double elapsed_ms(struct timespec* from)
+ * @brief time elapsed since an instant (monotonic clock), startup times only,
+ * the session ones are on the app clock
+ * @param from, instant
+ * @return elapsed time (ms)
+ */
+static double elapsed_ms(struct timespec* from){
+	
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return interval_ms(from, &now);
+}
+
 /**
  * void* train_player(void* param)
- * @brief thread that gets a sample for a player
+ * @brief thread that trains a player
  * @param param, (feat_proc_t*) player to train
- * @return NULL
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the input failed
  */
-void* get_sample(void* param){
-	get_normalized_sample((feat_proc_t*)param);
-	return NULL;
+void* train_player(void* param){
+	return (void*)(long)train_feat_processing((feat_proc_t*)param);
 }
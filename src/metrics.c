@@ -0,0 +1,462 @@
+/**
+ * @file metrics.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Loop counters and per-stage latency histograms, served in the Prometheus
+ * text format over a Unix domain socket. The loop only does relaxed atomic adds,
+ * the server thread formats a snapshot for each connection. A plain connection
+ * gets the exposition, an HTTP request gets it behind a minimal response header.
+ * Every function accepts a NULL metrics, so the processing can run without them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "feature_processing.h"
+#include "app_clock.h"
+
+static const char* stage_str[NB_STAGES] = {"acquire", "process", "feedback", "loop"};
+static const double quantiles[] = {0.5, 0.9, 0.99};
+static const char* queue_str[METRICS_NB_QUEUES] = {"acquire_process", "process_output"};
+
+static void* serve_metrics(void* param);
+static int format_metrics(metrics_t* metrics, char* buf, int size);
+static double latency_quantile(unsigned long* buckets, unsigned long count, double quantile);
+
+/**
+ * void init_metrics(metrics_t* metrics)
+ * @brief reset all the counters
+ * @param metrics, metrics (socket path and control set)
+ */
+void init_metrics(metrics_t* metrics){
+
+	char socket_path[METRICS_PATH_LENGTH];
+	control_t* control = metrics->control;
+
+	memcpy(socket_path, metrics->socket_path, METRICS_PATH_LENGTH);
+	memset(metrics, 0, sizeof(metrics_t));
+	memcpy(metrics->socket_path, socket_path, METRICS_PATH_LENGTH);
+	metrics->control = control;
+	metrics->server_fd = -1;
+}
+
+/**
+ * void metrics_count_frame(metrics_t* metrics)
+ * @brief count a frame read from the feature input
+ * @param metrics, metrics
+ */
+void metrics_count_frame(metrics_t* metrics){
+
+	if(metrics != NULL){
+		__atomic_fetch_add(&(metrics->frames_received), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_count_rejection(metrics_t* metrics, int reason)
+ * @brief count a rejected frame
+ * @param metrics, metrics
+ * @param reason, ARTIFACT_* rejection reason
+ */
+void metrics_count_rejection(metrics_t* metrics, int reason){
+
+	if(metrics != NULL && reason > ARTIFACT_NONE && reason < NB_ARTIFACT_REASONS){
+		__atomic_fetch_add(&(metrics->frames_rejected[reason]), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_count_hold(metrics_t* metrics, char sample_status)
+ * @brief count a sample filled in for a rejected frame
+ * @param metrics, metrics
+ * @param sample_status, SAMPLE_HELD or SAMPLE_EXPIRED
+ */
+void metrics_count_hold(metrics_t* metrics, char sample_status){
+
+	if(metrics == NULL){
+		return;
+	}
+
+	if(sample_status == SAMPLE_HELD){
+		__atomic_fetch_add(&(metrics->samples_held), 1, __ATOMIC_RELAXED);
+	}else if(sample_status == SAMPLE_EXPIRED){
+		__atomic_fetch_add(&(metrics->samples_expired), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_count_session(metrics_t* metrics)
+ * @brief count a session started
+ * @param metrics, metrics
+ */
+void metrics_count_session(metrics_t* metrics){
+
+	if(metrics != NULL){
+		__atomic_fetch_add(&(metrics->sessions), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_set_stalled(metrics_t* metrics, char stalled)
+ * @brief publish if the producer is silent
+ * @param metrics, metrics
+ * @param stalled, 1 while silent
+ */
+void metrics_set_stalled(metrics_t* metrics, char stalled){
+
+	if(metrics != NULL){
+		__atomic_store_n(&(metrics->stalled), (long)stalled, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_count_recovery(metrics_t* metrics, double recovery_ms)
+ * @brief count a recovery from a stall and publish the time it took
+ * @param metrics, metrics
+ * @param recovery_ms, time from the stall detection to the first page (ms)
+ */
+void metrics_count_recovery(metrics_t* metrics, double recovery_ms){
+
+	if(metrics != NULL){
+		__atomic_store_n(&(metrics->recovery_ms), (long)recovery_ms, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&(metrics->recoveries), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_set_feedback(metrics_t* metrics, double z_score, int pitch)
+ * @brief publish the current feedback
+ * @param metrics, metrics
+ * @param z_score, current smoothed z-score
+ * @param pitch, current pitch (Hz)
+ */
+void metrics_set_feedback(metrics_t* metrics, double z_score, int pitch){
+
+	if(metrics != NULL){
+		__atomic_store_n(&(metrics->z_micro), (long)(z_score*1e6), __ATOMIC_RELAXED);
+		__atomic_store_n(&(metrics->pitch), (long)pitch, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void metrics_add_latency(metrics_t* metrics, int stage, struct timespec* start)
+ * @brief add the time elapsed since the start of a stage to its histogram
+ * @param metrics, metrics
+ * @param stage, STAGE_* stage
+ * @param start, start of the stage (monotonic clock)
+ */
+void metrics_add_latency(metrics_t* metrics, int stage, struct timespec* start){
+
+	struct timespec now;
+	unsigned long us;
+	int bucket = 0;
+	latency_hist_t* hist;
+
+	if(metrics == NULL){
+		return;
+	}
+
+	app_clock_now(&now);
+	us = (now.tv_sec-start->tv_sec)*1000000L + (now.tv_nsec-start->tv_nsec)/1000L;
+
+	/*smallest power of 2 above the latency*/
+	while(bucket < METRICS_NB_BUCKETS-1 && (1UL<<bucket) <= us){
+		bucket++;
+	}
+
+	hist = &(metrics->latency[stage]);
+	__atomic_fetch_add(&(hist->buckets[bucket]), 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&(hist->sum_us), us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&(hist->count), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * void metrics_set_queue(metrics_t* metrics, int index, spsc_queue_t* queue)
+ * @brief export the occupancy of a queue between two task stages
+ * @param metrics, metrics
+ * @param index, queue (PIPELINE_* of task_pipeline.h)
+ * @param queue, queue, must stay valid until the server is stopped
+ */
+void metrics_set_queue(metrics_t* metrics, int index, spsc_queue_t* queue){
+
+	if(metrics != NULL){
+		__atomic_store_n(&(metrics->queues[index]), queue, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * int start_metrics_server(metrics_t* metrics)
+ * @brief bind the Unix socket (a stale one is replaced) and start the server thread
+ * @param metrics, metrics (socket path set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int start_metrics_server(metrics_t* metrics){
+
+	struct sockaddr_un addr;
+
+	if(metrics->socket_path[0] == '\0' || strnlen(metrics->socket_path, METRICS_PATH_LENGTH) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "metrics: invalid socket path\n");
+		return EXIT_FAILURE;
+	}
+
+	if((metrics->server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0){
+		perror("metrics socket");
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, metrics->socket_path);
+	unlink(metrics->socket_path);
+
+	if(bind(metrics->server_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	   listen(metrics->server_fd, 4) != 0){
+		perror("metrics bind");
+		close(metrics->server_fd);
+		metrics->server_fd = -1;
+		return EXIT_FAILURE;
+	}
+
+	metrics->running = 0x01;
+	if(pthread_create(&(metrics->thread), NULL, serve_metrics, metrics) != 0){
+		close(metrics->server_fd);
+		metrics->server_fd = -1;
+		return EXIT_FAILURE;
+	}
+
+	printf("Metrics on %s\n", metrics->socket_path);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int stop_metrics_server(metrics_t* metrics)
+ * @brief stop the server thread and remove the socket
+ * @param metrics, metrics
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int stop_metrics_server(metrics_t* metrics){
+
+	if(metrics->server_fd < 0){
+		return EXIT_SUCCESS;
+	}
+
+	metrics->running = 0x00;
+	pthread_join(metrics->thread, NULL);
+	close(metrics->server_fd);
+	unlink(metrics->socket_path);
+	metrics->server_fd = -1;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void* serve_metrics(void* param)
+ * @brief server thread, one snapshot per connection
+ * @param param, (metrics_t*) metrics
+ * @return NULL
+ */
+static void* serve_metrics(void* param){
+
+	metrics_t* metrics = param;
+	struct pollfd pfd;
+	char request[256];
+	char buf[METRICS_BUF_SIZE];
+	char header[128];
+	int client, len, header_len;
+
+	pfd.fd = metrics->server_fd;
+	pfd.events = POLLIN;
+
+	while(metrics->running){
+
+		if(poll(&pfd, 1, METRICS_POLL_MS) <= 0){
+			continue;
+		}
+
+		if((client = accept(metrics->server_fd, NULL, NULL)) < 0){
+			continue;
+		}
+
+		len = format_metrics(metrics, buf, sizeof(buf));
+
+		/*an HTTP client sends its request first, a plain one may send nothing*/
+		pfd.fd = client;
+		header_len = 0;
+		if(poll(&pfd, 1, 100) > 0 && recv(client, request, sizeof(request)-1, 0) > 3 &&
+		   strncmp(request, "GET", 3) == 0){
+			header_len = snprintf(header, sizeof(header),
+								  "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+								  "Content-Length: %i\r\n\r\n", len);
+		}
+		pfd.fd = metrics->server_fd;
+
+		if(header_len > 0){
+			send(client, header, header_len, MSG_NOSIGNAL);
+		}
+		send(client, buf, len, MSG_NOSIGNAL);
+		close(client);
+	}
+
+	return NULL;
+}
+
+/**
+ * int format_metrics(metrics_t* metrics, char* buf, int size)
+ * @brief write a snapshot of the metrics in the Prometheus text format
+ * @param metrics, metrics
+ * @param buf(out), exposition
+ * @param size, size of buf
+ * @return length of the exposition
+ */
+static int format_metrics(metrics_t* metrics, char* buf, int size){
+
+	int len = 0;
+	int i, j;
+	unsigned long buckets[METRICS_NB_BUCKETS];
+	unsigned long count, sum_us;
+
+/*append to the buffer, the snapshot is cut if it doesn't fit*/
+#define METRICS_PRINT(...) \
+		if(len < size){ len += snprintf(buf+len, size-len, __VA_ARGS__); }
+
+	METRICS_PRINT("# HELP braintone_frames_received_total Frames read from the feature input.\n"
+				  "# TYPE braintone_frames_received_total counter\n"
+				  "braintone_frames_received_total %lu\n",
+				  __atomic_load_n(&(metrics->frames_received), __ATOMIC_RELAXED));
+
+	METRICS_PRINT("# HELP braintone_frames_rejected_total Frames rejected, by reason.\n"
+				  "# TYPE braintone_frames_rejected_total counter\n");
+	for(i=ARTIFACT_NONE+1;i<NB_ARTIFACT_REASONS;i++){
+		METRICS_PRINT("braintone_frames_rejected_total{reason=\"%s\"} %lu\n", artifact_reason_str(i),
+					  __atomic_load_n(&(metrics->frames_rejected[i]), __ATOMIC_RELAXED));
+	}
+
+	METRICS_PRINT("# HELP braintone_samples_held_total Samples filled in for a rejected frame.\n"
+				  "# TYPE braintone_samples_held_total counter\n"
+				  "braintone_samples_held_total %lu\n"
+				  "# HELP braintone_samples_expired_total Samples set neutral after the max hold time.\n"
+				  "# TYPE braintone_samples_expired_total counter\n"
+				  "braintone_samples_expired_total %lu\n",
+				  __atomic_load_n(&(metrics->samples_held), __ATOMIC_RELAXED),
+				  __atomic_load_n(&(metrics->samples_expired), __ATOMIC_RELAXED));
+
+	/*only producers using the control block count their drops*/
+	if(metrics->control != NULL && control_get_producer_state(metrics->control) != PEER_ABSENT){
+		METRICS_PRINT("# HELP braintone_pages_skipped_total Frames the producer dropped, no free page.\n"
+					  "# TYPE braintone_pages_skipped_total counter\n"
+					  "braintone_pages_skipped_total %u\n",
+					  control_get_producer_dropped(metrics->control));
+		METRICS_PRINT("# HELP braintone_producer_frame_rate Frame rate the producer reports (Hz), 0 if it doesn't.\n"
+					  "# TYPE braintone_producer_frame_rate gauge\n"
+					  "braintone_producer_frame_rate %.3f\n",
+					  control_get_producer_frame_rate(metrics->control));
+	}
+
+	METRICS_PRINT("# HELP braintone_producer_stalled 1 while the producer is silent.\n"
+				  "# TYPE braintone_producer_stalled gauge\n"
+				  "braintone_producer_stalled %li\n"
+				  "# HELP braintone_producer_recoveries_total Producer back after a stall.\n"
+				  "# TYPE braintone_producer_recoveries_total counter\n"
+				  "braintone_producer_recoveries_total %lu\n"
+				  "# HELP braintone_last_recovery_seconds Time to recover from the last stall.\n"
+				  "# TYPE braintone_last_recovery_seconds gauge\n"
+				  "braintone_last_recovery_seconds %.3f\n",
+				  __atomic_load_n(&(metrics->stalled), __ATOMIC_RELAXED),
+				  __atomic_load_n(&(metrics->recoveries), __ATOMIC_RELAXED),
+				  __atomic_load_n(&(metrics->recovery_ms), __ATOMIC_RELAXED)/1e3);
+
+	METRICS_PRINT("# HELP braintone_sessions_total Sessions started.\n"
+				  "# TYPE braintone_sessions_total counter\n"
+				  "braintone_sessions_total %lu\n"
+				  "# HELP braintone_zscore Current smoothed z-score.\n"
+				  "# TYPE braintone_zscore gauge\n"
+				  "braintone_zscore %.6f\n"
+				  "# HELP braintone_pitch_hz Current pitch.\n"
+				  "# TYPE braintone_pitch_hz gauge\n"
+				  "braintone_pitch_hz %li\n",
+				  __atomic_load_n(&(metrics->sessions), __ATOMIC_RELAXED),
+				  __atomic_load_n(&(metrics->z_micro), __ATOMIC_RELAXED)/1e6,
+				  __atomic_load_n(&(metrics->pitch), __ATOMIC_RELAXED));
+
+	METRICS_PRINT("# HELP braintone_stage_latency_seconds Latency of each stage of the loop.\n"
+				  "# TYPE braintone_stage_latency_seconds summary\n");
+	for(i=0;i<NB_STAGES;i++){
+
+		for(j=0;j<METRICS_NB_BUCKETS;j++){
+			buckets[j] = __atomic_load_n(&(metrics->latency[i].buckets[j]), __ATOMIC_RELAXED);
+		}
+		count = __atomic_load_n(&(metrics->latency[i].count), __ATOMIC_RELAXED);
+		sum_us = __atomic_load_n(&(metrics->latency[i].sum_us), __ATOMIC_RELAXED);
+
+		for(j=0;j<(int)(sizeof(quantiles)/sizeof(quantiles[0]));j++){
+			METRICS_PRINT("braintone_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n",
+						  stage_str[i], quantiles[j],
+						  latency_quantile(buckets, count, quantiles[j])/1e6);
+		}
+		METRICS_PRINT("braintone_stage_latency_seconds_sum{stage=\"%s\"} %.6f\n"
+					  "braintone_stage_latency_seconds_count{stage=\"%s\"} %lu\n",
+					  stage_str[i], sum_us/1e6, stage_str[i], count);
+	}
+
+	/*queues, once a task ran*/
+	if(__atomic_load_n(&(metrics->queues[0]), __ATOMIC_ACQUIRE) != NULL){
+		METRICS_PRINT("# HELP braintone_queue_occupancy Mean slots used between two stages (last task).\n"
+					  "# TYPE braintone_queue_occupancy gauge\n");
+		for(i=0;i<METRICS_NB_QUEUES;i++){
+			METRICS_PRINT("braintone_queue_occupancy{queue=\"%s\"} %.3f\n",
+						  queue_str[i], spsc_mean_occupancy(metrics->queues[i]));
+		}
+		METRICS_PRINT("# HELP braintone_queue_full_waits Pushes that waited, the next stage limits the throughput (last task).\n"
+					  "# TYPE braintone_queue_full_waits gauge\n");
+		for(i=0;i<METRICS_NB_QUEUES;i++){
+			METRICS_PRINT("braintone_queue_full_waits{queue=\"%s\"} %lu\n",
+						  queue_str[i], __atomic_load_n(&(metrics->queues[i]->nb_full), __ATOMIC_RELAXED));
+		}
+		METRICS_PRINT("# HELP braintone_queue_empty_waits Pops that waited, the previous stage limits the throughput (last task).\n"
+					  "# TYPE braintone_queue_empty_waits gauge\n");
+		for(i=0;i<METRICS_NB_QUEUES;i++){
+			METRICS_PRINT("braintone_queue_empty_waits{queue=\"%s\"} %lu\n",
+						  queue_str[i], __atomic_load_n(&(metrics->queues[i]->nb_empty), __ATOMIC_RELAXED));
+		}
+	}
+
+#undef METRICS_PRINT
+
+	return (len < size)?len:size-1;
+}
+
+/**
+ * double latency_quantile(unsigned long* buckets, unsigned long count, double quantile)
+ * @brief estimate a quantile from a histogram, linear within the bucket
+ * @param buckets, histogram (bucket i below 2^i us)
+ * @param count, nb of samples (the buckets may be slightly ahead, read after)
+ * @param quantile, quantile to estimate (0 to 1)
+ * @return quantile (us), 0 if no sample
+ */
+static double latency_quantile(unsigned long* buckets, unsigned long count, double quantile){
+
+	double rank = quantile*count;
+	double cumulated = 0;
+	double low;
+	int i;
+
+	if(count == 0){
+		return 0;
+	}
+
+	for(i=0;i<METRICS_NB_BUCKETS;i++){
+		if(buckets[i] > 0 && cumulated+buckets[i] >= rank){
+			low = (i == 0)?0:(double)(1UL<<(i-1));
+			return low + ((double)(1UL<<i)-low)*(rank-cumulated)/buckets[i];
+		}
+		cumulated += buckets[i];
+	}
+
+	return (double)(1UL<<(METRICS_NB_BUCKETS-1));
+}
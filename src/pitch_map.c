@@ -0,0 +1,144 @@
+/**
+ * @file pitch_map.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Maps the normalized sample to the buzzer pitch. The table of pitches
+ * is computed once at startup from the configured range and scale, so each
+ * update is a single lookup. A hysteresis keeps the pitch from flickering
+ * when the sample sits on the boundary between two steps.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "pitch_map.h"
+
+/*intervals between the notes of the musical scales (semitones)*/
+static const int chromatic_intervals[] = {1};
+static const int major_intervals[] = {2, 2, 1, 2, 2, 2, 1};
+static const int pentatonic_intervals[] = {2, 2, 3, 2, 3};
+
+static int fill_musical_table(pitch_map_t* pitch_map, const int* intervals, int nb_intervals);
+
+/**
+ * int init_pitch_map(pitch_map_t* pitch_map)
+ * @brief compute the table of pitches
+ * @param pitch_map, pointer to pitch map
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_pitch_map(pitch_map_t* pitch_map){
+
+	int i;
+
+	if(pitch_map->freq_min <= 0 || pitch_map->freq_max <= pitch_map->freq_min ||
+	   pitch_map->z_max <= pitch_map->z_min){
+		fprintf(stderr, "Invalid pitch range\n");
+		return EXIT_FAILURE;
+	}
+
+	switch(pitch_map->scale){
+
+		case PITCH_SCALE_CHROMATIC:
+			fill_musical_table(pitch_map, chromatic_intervals, 1);
+			break;
+
+		case PITCH_SCALE_MAJOR:
+			fill_musical_table(pitch_map, major_intervals, 7);
+			break;
+
+		case PITCH_SCALE_PENTATONIC:
+			fill_musical_table(pitch_map, pentatonic_intervals, 5);
+			break;
+
+		case PITCH_SCALE_LOG:
+		case PITCH_SCALE_LINEAR:
+			if(pitch_map->nb_steps < 2 || pitch_map->nb_steps > PITCH_MAX_STEPS){
+				fprintf(stderr, "Invalid number of pitch steps\n");
+				return EXIT_FAILURE;
+			}
+			pitch_map->table_size = pitch_map->nb_steps;
+			for(i=0;i<pitch_map->table_size;i++){
+				if(pitch_map->scale == PITCH_SCALE_LOG){
+					/*equal ratio between steps*/
+					pitch_map->table[i] = (int)(pitch_map->freq_min*
+						pow(pitch_map->freq_max/pitch_map->freq_min, (double)i/(pitch_map->table_size-1))+0.5);
+				}else{
+					/*equal distance between steps*/
+					pitch_map->table[i] = (int)(pitch_map->freq_min+
+						(pitch_map->freq_max-pitch_map->freq_min)*i/(pitch_map->table_size-1)+0.5);
+				}
+			}
+			break;
+
+		default:
+			fprintf(stderr, "Unknown pitch scale\n");
+			return EXIT_FAILURE;
+	}
+
+	/*steps covered by one unit of normalized sample*/
+	pitch_map->steps_per_unit = pitch_map->table_size/(pitch_map->z_max-pitch_map->z_min);
+	pitch_map->current_step = 0;
+
+	printf("Pitch map: %i steps, %i Hz to %i Hz\n", pitch_map->table_size,
+		   pitch_map->table[0], pitch_map->table[pitch_map->table_size-1]);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int get_pitch(pitch_map_t* pitch_map, double sample)
+ * @brief get the pitch for a normalized sample, one table lookup
+ * @param pitch_map, pointer to pitch map
+ * @param sample, normalized sample
+ * @return pitch (Hz)
+ */
+int get_pitch(pitch_map_t* pitch_map, double sample){
+
+	/*continuous position in the table*/
+	double position = (sample-pitch_map->z_min)*pitch_map->steps_per_unit;
+	double distance = position-(pitch_map->current_step+0.5);
+	int step;
+
+	/*move only when far enough from the current step*/
+	if(fabs(distance) > 0.5+pitch_map->hysteresis){
+
+		step = (int)floor(position);
+		if(step < 0){
+			step = 0;
+		}else if(step >= pitch_map->table_size){
+			step = pitch_map->table_size-1;
+		}
+		pitch_map->current_step = step;
+	}
+
+	return pitch_map->table[pitch_map->current_step];
+}
+
+/**
+ * int fill_musical_table(pitch_map_t* pitch_map, const int* intervals, int nb_intervals)
+ * @brief fill the table with the notes of a scale, from the lowest pitch up to the highest
+ * @param pitch_map, pointer to pitch map
+ * @param intervals, semitones between consecutive notes of the scale
+ * @param nb_intervals, nb of intervals in the scale
+ * @return nb of notes in the table
+ */
+static int fill_musical_table(pitch_map_t* pitch_map, const int* intervals, int nb_intervals){
+
+	int semitones = 0;
+	int i = 0;
+	double freq = pitch_map->freq_min;
+
+	pitch_map->table_size = 0;
+	while(freq <= pitch_map->freq_max && pitch_map->table_size < PITCH_MAX_STEPS){
+
+		pitch_map->table[pitch_map->table_size++] = (int)(freq+0.5);
+
+		/*next note, equal temperament*/
+		semitones += intervals[i];
+		i = (i+1)%nb_intervals;
+		freq = pitch_map->freq_min*pow(2.0, semitones/12.0);
+	}
+
+	return pitch_map->table_size;
+}
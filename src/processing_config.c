@@ -0,0 +1,116 @@
+/**
+ * @file processing_config.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Sets the processing stages from the app config, for the app and the
+ * batch tool (see processing_config.h).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "processing_config.h"
+
+/**
+ * void configure_feature_processing(feat_proc_t* feature_proc, feature_input_t* feature_input, appconfig_t* app_config)
+ * @brief set the feature processing fields from the app config, before init
+ * @param feature_proc, feature processing to configure
+ * @param feature_input, feature input to read from
+ * @param app_config, app configuration
+ */
+void configure_feature_processing(feat_proc_t* feature_proc, feature_input_t* feature_input, appconfig_t* app_config){
+	
+	feature_proc->nb_train_samples = app_config->training_set_size;
+	feature_proc->feature_input = feature_input;
+	feature_proc->recorder = NULL;
+	feature_proc->band_power = NULL;
+	feature_proc->verbose = 0x01;
+	
+	/*the fft section follows the timeseries, when both are present*/
+	feature_proc->fft_offset = app_config->timeseries?app_config->window_width*app_config->nb_channels:0;
+	
+	/*rejected frames are filled in, so each frame updates the buzzer*/
+	feature_proc->hold_policy = app_config->hold_policy;
+	feature_proc->max_hold_time = app_config->max_hold_time;
+	feature_proc->frame_rate = app_config->frame_rate;
+	feature_proc->calibration = app_config->calibration;
+	feature_proc->warm_start = 0x00;
+	feature_proc->nb_prior_samples = 0;
+	
+	/*artifact rejection, fft resolution is sampling rate over window width*/
+	feature_proc->artifact.enabled = app_config->artifact_rejection;
+	feature_proc->artifact.bin_width = app_config->sampling_rate/app_config->window_width;
+	feature_proc->artifact.line_freq = app_config->line_freq;
+	feature_proc->artifact.amplitude_z_max = app_config->artifact_amplitude_z;
+	feature_proc->artifact.flat_var_min = app_config->artifact_flat_var;
+	feature_proc->artifact.line_ratio_max = app_config->artifact_line_ratio;
+	feature_proc->artifact.muscle_ratio_max = app_config->artifact_muscle_ratio;
+}
+
+/**
+ * band_power_t* configure_band_power(band_power_t* band_power, appconfig_t* app_config)
+ * @brief set the band power from the app config, if the band values come from the timeseries
+ * @param band_power, band power to configure
+ * @param app_config, app configuration
+ * @return the band power, NULL if the band values come from the fft section
+ */
+band_power_t* configure_band_power(band_power_t* band_power, appconfig_t* app_config){
+	
+	if(app_config->band_source != BAND_SOURCE_TIMESERIES){
+		return NULL;
+	}
+	
+	/*consecutive windows overlap but for the samples of a frame period*/
+	band_power->window_width = app_config->window_width;
+	band_power->hop = (int)(app_config->sampling_rate/app_config->frame_rate+0.5);
+	
+	return band_power;
+}
+
+/**
+ * int configure_smoothing_filter(smoothing_filter_t* filter, appconfig_t* app_config)
+ * @brief set the smoothing filter from the app config and init it
+ * @param filter, smoothing filter to configure
+ * @param app_config, app configuration
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int configure_smoothing_filter(smoothing_filter_t* filter, appconfig_t* app_config){
+	
+	filter->type = app_config->smoothing_filter;
+	filter->frame_rate = app_config->frame_rate;
+	filter->kernel = app_config->avg_kernel;
+	filter->cutoff = app_config->smoothing_cutoff;
+	filter->min_cutoff = app_config->one_euro_min_cutoff;
+	filter->beta = app_config->one_euro_beta;
+	filter->d_cutoff = app_config->one_euro_d_cutoff;
+	filter->median_size = app_config->median_size;
+	
+	return init_smoothing_filter(filter);
+}
+
+/**
+ * iaf_tracker_t* configure_iaf_tracker(iaf_tracker_t* iaf, appconfig_t* app_config)
+ * @brief set the IAF tracker from the app config, before the feature processing init
+ * @param iaf, tracker to configure
+ * @param app_config, app configuration
+ * @return tracker, NULL if the band is fixed
+ */
+iaf_tracker_t* configure_iaf_tracker(iaf_tracker_t* iaf, appconfig_t* app_config){
+	
+	if(!app_config->iaf){
+		return NULL;
+	}
+	
+	iaf->min_freq = app_config->iaf_min_freq;
+	iaf->max_freq = app_config->iaf_max_freq;
+	iaf->half_width = app_config->iaf_half_width;
+	
+	/*one pole at the frame rate, for the time constant asked*/
+	iaf->tracking_rate = 0;
+	if(app_config->iaf_tracking_time > 0){
+		iaf->tracking_rate = 1.0-exp(-1.0/(app_config->iaf_tracking_time*app_config->frame_rate));
+	}
+	
+	return iaf;
+}
@@ -0,0 +1,300 @@
+/**
+ * @file quantile_sketch.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Streaming quantiles for the robust calibration (see quantile_sketch.h).
+ * The P-square markers are moved by at most one position per value, their
+ * height adjusted with a piecewise-parabolic prediction (linear if the
+ * parabola leaves the neighbouring markers).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "quantile_sketch.h"
+
+static void insert_sorted(double* sorted, int nb_values, double value);
+static double sorted_quantile(const double* sorted, int nb_values, double p);
+static double parabolic(p2_quantile_t* est, int i, double d);
+static double linear(p2_quantile_t* est, int i, double d);
+
+/**
+ * void init_p2_quantile(p2_quantile_t* est, double p)
+ * @brief reset an estimator
+ * @param est, estimator
+ * @param p, quantile to estimate (0 to 1)
+ */
+void init_p2_quantile(p2_quantile_t* est, double p){
+
+	est->p = p;
+	est->count = 0;
+
+	est->step[0] = 0;
+	est->step[1] = p/2;
+	est->step[2] = p;
+	est->step[3] = (1+p)/2;
+	est->step[4] = 1;
+}
+
+/**
+ * void update_p2_quantile(p2_quantile_t* est, double value)
+ * @brief add a value
+ * @param est, estimator
+ * @param value, value
+ */
+void update_p2_quantile(p2_quantile_t* est, double value){
+
+	int i, k;
+	double d, height;
+
+	/*the first values are the markers, kept sorted*/
+	if(est->count < P2_MARKERS){
+		insert_sorted(est->height, est->count, value);
+
+		if(++est->count == P2_MARKERS){
+			for(i=0;i<P2_MARKERS;i++){
+				est->pos[i] = i+1;
+			}
+			est->desired[0] = 1;
+			est->desired[1] = 1+2*est->p;
+			est->desired[2] = 1+4*est->p;
+			est->desired[3] = 3+2*est->p;
+			est->desired[4] = 5;
+		}
+		return;
+	}
+
+	/*cell of the value, the extreme markers follow the min and max*/
+	if(value < est->height[0]){
+		est->height[0] = value;
+		k = 0;
+	}else if(value >= est->height[P2_MARKERS-1]){
+		est->height[P2_MARKERS-1] = value;
+		k = P2_MARKERS-2;
+	}else{
+		for(k=0;k<P2_MARKERS-2 && value>=est->height[k+1];k++);
+	}
+
+	for(i=k+1;i<P2_MARKERS;i++){
+		est->pos[i]++;
+	}
+	for(i=0;i<P2_MARKERS;i++){
+		est->desired[i] += est->step[i];
+	}
+	est->count++;
+
+	/*move the middle markers toward their desired position*/
+	for(i=1;i<P2_MARKERS-1;i++){
+
+		d = est->desired[i]-est->pos[i];
+		if((d >= 1 && est->pos[i+1]-est->pos[i] > 1) ||
+		   (d <= -1 && est->pos[i-1]-est->pos[i] < -1)){
+
+			d = (d > 0)?1:-1;
+			height = parabolic(est, i, d);
+			if(height <= est->height[i-1] || height >= est->height[i+1]){
+				height = linear(est, i, d);
+			}
+			est->height[i] = height;
+			est->pos[i] += d;
+		}
+	}
+}
+
+/**
+ * void seed_p2_quantile(p2_quantile_t* est, const double* sorted, int nb_values)
+ * @brief start an estimator from values already seen, markers on their quantiles
+ * @param est, estimator (initialized)
+ * @param sorted, values, sorted
+ * @param nb_values, nb of values, at least P2_MARKERS
+ */
+void seed_p2_quantile(p2_quantile_t* est, const double* sorted, int nb_values){
+
+	int i;
+
+	for(i=0;i<P2_MARKERS;i++){
+		est->desired[i] = 1+(nb_values-1)*est->step[i];
+		est->pos[i] = floor(est->desired[i]+0.5);
+		if(i > 0 && est->pos[i] <= est->pos[i-1]){
+			est->pos[i] = est->pos[i-1]+1;
+		}
+	}
+	/*markers stay distinct, the last one on the max*/
+	for(i=P2_MARKERS-1;i>=0;i--){
+		if(est->pos[i] > nb_values-(P2_MARKERS-1-i)){
+			est->pos[i] = nb_values-(P2_MARKERS-1-i);
+		}
+		est->height[i] = sorted[(int)est->pos[i]-1];
+	}
+	est->count = nb_values;
+}
+
+/**
+ * double get_p2_quantile(p2_quantile_t* est)
+ * @brief current estimate, exact before the fifth value
+ * @param est, estimator
+ * @return quantile, 0 if no value was added
+ */
+double get_p2_quantile(p2_quantile_t* est){
+
+	if(est->count < P2_MARKERS){
+		return sorted_quantile(est->height, est->count, est->p);
+	}
+	return est->height[2];
+}
+
+/**
+ * void init_robust_stat(robust_stat_t* stat)
+ * @brief reset the statistics
+ * @param stat, robust statistics
+ */
+void init_robust_stat(robust_stat_t* stat){
+
+	stat->count = 0;
+	init_p2_quantile(&(stat->median), 0.5);
+	init_p2_quantile(&(stat->deviation), 0.5);
+}
+
+/**
+ * void update_robust_stat(robust_stat_t* stat, double value)
+ * @brief add a value, bounded time (insertion among the first values, then constant)
+ * @param stat, robust statistics
+ * @param value, value
+ */
+void update_robust_stat(robust_stat_t* stat, double value){
+
+	double deviations[ROBUST_EXACT_VALUES];
+	double median;
+	int i;
+
+	if(stat->count < ROBUST_EXACT_VALUES){
+		insert_sorted(stat->sorted, stat->count++, value);
+
+		/*last exact value, the estimators take over from the quantiles*/
+		if(stat->count == ROBUST_EXACT_VALUES){
+			seed_p2_quantile(&(stat->median), stat->sorted, ROBUST_EXACT_VALUES);
+			median = sorted_quantile(stat->sorted, ROBUST_EXACT_VALUES, 0.5);
+			for(i=0;i<ROBUST_EXACT_VALUES;i++){
+				insert_sorted(deviations, i, fabs(stat->sorted[i]-median));
+			}
+			seed_p2_quantile(&(stat->deviation), deviations, ROBUST_EXACT_VALUES);
+		}
+		return;
+	}
+
+	stat->count++;
+	update_p2_quantile(&(stat->median), value);
+	update_p2_quantile(&(stat->deviation), fabs(value-get_p2_quantile(&(stat->median))));
+}
+
+/**
+ * double get_robust_median(robust_stat_t* stat)
+ * @brief median of the values
+ * @param stat, robust statistics
+ * @return median, 0 if no value was added
+ */
+double get_robust_median(robust_stat_t* stat){
+
+	if(stat->count <= ROBUST_EXACT_VALUES){
+		return sorted_quantile(stat->sorted, stat->count, 0.5);
+	}
+	return get_p2_quantile(&(stat->median));
+}
+
+/**
+ * double get_robust_scale(robust_stat_t* stat)
+ * @brief median absolute deviation, scaled to a standard deviation
+ * @param stat, robust statistics
+ * @return scale, 0 if no value was added
+ */
+double get_robust_scale(robust_stat_t* stat){
+
+	double deviations[ROBUST_EXACT_VALUES];
+	double median;
+	int i;
+
+	if(stat->count <= ROBUST_EXACT_VALUES){
+		median = sorted_quantile(stat->sorted, stat->count, 0.5);
+		for(i=0;i<stat->count;i++){
+			insert_sorted(deviations, i, fabs(stat->sorted[i]-median));
+		}
+		return MAD_TO_STD*sorted_quantile(deviations, stat->count, 0.5);
+	}
+
+	return MAD_TO_STD*get_p2_quantile(&(stat->deviation));
+}
+
+/**
+ * void insert_sorted(double* sorted, int nb_values, double value)
+ * @brief insert a value in a sorted array
+ * @param sorted, sorted values, room for one more
+ * @param nb_values, nb of values before the insertion
+ * @param value, value
+ */
+static void insert_sorted(double* sorted, int nb_values, double value){
+
+	int i;
+
+	for(i=nb_values;i>0 && sorted[i-1]>value;i--){
+		sorted[i] = sorted[i-1];
+	}
+	sorted[i] = value;
+}
+
+/**
+ * double sorted_quantile(const double* sorted, int nb_values, double p)
+ * @brief quantile of sorted values, interpolated between ranks
+ * @param sorted, sorted values
+ * @param nb_values, nb of values
+ * @param p, quantile (0 to 1)
+ * @return quantile, 0 if there is no value
+ */
+static double sorted_quantile(const double* sorted, int nb_values, double p){
+
+	double rank;
+	int i;
+
+	if(nb_values < 1){
+		return 0;
+	}
+
+	rank = p*(nb_values-1);
+	i = (int)rank;
+	if(i >= nb_values-1){
+		return sorted[nb_values-1];
+	}
+	return sorted[i]+(rank-i)*(sorted[i+1]-sorted[i]);
+}
+
+/**
+ * double parabolic(p2_quantile_t* est, int i, double d)
+ * @brief piecewise-parabolic prediction of a marker height moved by d
+ * @param est, estimator
+ * @param i, marker
+ * @param d, move (+1 or -1)
+ * @return height
+ */
+static double parabolic(p2_quantile_t* est, int i, double d){
+
+	double* q = est->height;
+	double* n = est->pos;
+
+	return q[i]+d/(n[i+1]-n[i-1])*((n[i]-n[i-1]+d)*(q[i+1]-q[i])/(n[i+1]-n[i]) +
+								   (n[i+1]-n[i]-d)*(q[i]-q[i-1])/(n[i]-n[i-1]));
+}
+
+/**
+ * double linear(p2_quantile_t* est, int i, double d)
+ * @brief linear prediction of a marker height moved by d
+ * @param est, estimator
+ * @param i, marker
+ * @param d, move (+1 or -1)
+ * @return height
+ */
+static double linear(p2_quantile_t* est, int i, double d){
+
+	int j = i+(int)d;
+
+	return est->height[i]+d*(est->height[j]-est->height[i])/(est->pos[j]-est->pos[i]);
+}
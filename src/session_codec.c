@@ -0,0 +1,347 @@
+/**
+ * @file session_codec.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Coding of the blocks of a compressed session (see session_codec.h).
+ * Consecutive frames of a bin are close, so the difference of their bit patterns
+ * is small and gets a short Rice code. Bits are packed LSB first in a 64 bits
+ * accumulator, the decoder counts the unary part with a single ctz.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "session_codec.h"
+
+/*per bin coding state*/
+typedef struct bin_state_s{
+	uint64_t prev; /*bit pattern of the previous page*/
+	uint64_t sum; /*recent values, sets the Rice parameter*/
+	uint32_t count;
+}bin_state_t;
+
+typedef struct bit_writer_s{
+	uint8_t* out;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+}bit_writer_t;
+
+typedef struct bit_reader_s{
+	const uint8_t* in;
+	size_t size;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+}bit_reader_t;
+
+#define LOW_BITS(v, n) ((n) >= 64 ? (v) : (v)&((1ULL<<(n))-1))
+#define SUM_MAX_ADD (1ULL<<48) /*keeps the Rice parameter search from overflowing*/
+
+static bin_state_t* init_bin_states(int nb_features);
+static int rice_parameter(bin_state_t* state, int width);
+static void update_bin_state(bin_state_t* state, uint64_t value);
+static void put_bits(bit_writer_t* writer, uint64_t value, int nbits);
+static void put_rice(bit_writer_t* writer, uint64_t value, int k, int width);
+static void refill(bit_reader_t* reader);
+static uint64_t get_bits(bit_reader_t* reader, int nbits);
+static uint64_t get_rice(bit_reader_t* reader, int k, int width);
+
+/**
+ * size_t session_block_bound(int nb_pages, int nb_features)
+ * @brief largest coded size of a block, every value escaped
+ * @param nb_pages, nb of pages in the block
+ * @param nb_features, nb of features per page
+ * @return size (bytes)
+ */
+size_t session_block_bound(int nb_pages, int nb_features){
+	return (size_t)nb_pages*(1+(size_t)nb_features*((RICE_ESCAPE+64+7)/8))+16;
+}
+
+/**
+ * size_t encode_session_block(session_block_t* block, int nb_features, char codec, uint8_t* out)
+ * @brief code a block of pages
+ * @param block, pages to code
+ * @param nb_features, nb of features per page
+ * @param codec, SESSION_LOSSLESS or SESSION_FLOAT32
+ * @param out(out), coded block, session_block_bound() bytes
+ * @return coded size (bytes), 0 on failure
+ */
+size_t encode_session_block(session_block_t* block, int nb_features, char codec, uint8_t* out){
+
+	bit_writer_t writer = {out, 0, 0, 0};
+	bin_state_t* states;
+	double* values = block->values;
+	int width = (codec == SESSION_FLOAT32)?32:64;
+	uint64_t bits, zigzag;
+	int64_t delta;
+	float single;
+	int i, j;
+
+	if((states = init_bin_states(nb_features)) == NULL){
+		return 0;
+	}
+
+	for(i=0;i<block->nb_pages;i++){
+
+		put_bits(&writer, (uint8_t)block->eye_blinks[i], 8);
+
+		for(j=0;j<nb_features;j++, values++){
+
+			if(codec == SESSION_FLOAT32){
+				single = (float)*values;
+				bits = 0;
+				memcpy(&bits, &single, sizeof(float));
+				delta = (int32_t)((uint32_t)bits-(uint32_t)states[j].prev);
+				zigzag = (uint32_t)(((uint32_t)delta<<1)^(uint32_t)(delta>>31));
+			}else{
+				memcpy(&bits, values, sizeof(double));
+				delta = (int64_t)(bits-states[j].prev);
+				zigzag = ((uint64_t)delta<<1)^(uint64_t)(delta>>63);
+			}
+			states[j].prev = bits;
+
+			put_rice(&writer, zigzag, rice_parameter(&(states[j]), width), width);
+			if(i > 0){
+				update_bin_state(&(states[j]), zigzag);
+			}
+		}
+	}
+
+	/*last bits*/
+	if(writer.nbits > 0){
+		out[writer.pos++] = (uint8_t)writer.acc;
+	}
+
+	free(states);
+	return writer.pos;
+}
+
+/**
+ * int decode_session_block(const uint8_t* in, size_t size, int nb_features, char codec, session_block_t* block)
+ * @brief decode a block of pages
+ * @param in, coded block
+ * @param size, coded size (bytes)
+ * @param nb_features, nb of features per page
+ * @param codec, SESSION_LOSSLESS or SESSION_FLOAT32
+ * @param block(out), decoded pages (first_page and nb_pages set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the block is corrupted
+ */
+int decode_session_block(const uint8_t* in, size_t size, int nb_features, char codec, session_block_t* block){
+
+	bit_reader_t reader = {in, size, 0, 0, 0};
+	bin_state_t* states;
+	double* values = block->values;
+	int width = (codec == SESSION_FLOAT32)?32:64;
+	uint64_t bits, zigzag;
+	float single;
+	int i, j;
+
+	if((states = init_bin_states(nb_features)) == NULL){
+		return EXIT_FAILURE;
+	}
+
+	for(i=0;i<block->nb_pages;i++){
+
+		block->eye_blinks[i] = (char)get_bits(&reader, 8);
+
+		for(j=0;j<nb_features;j++, values++){
+
+			zigzag = get_rice(&reader, rice_parameter(&(states[j]), width), width);
+			if(i > 0){
+				update_bin_state(&(states[j]), zigzag);
+			}
+
+			if(codec == SESSION_FLOAT32){
+				bits = (uint32_t)((uint32_t)states[j].prev+(uint32_t)((zigzag>>1)^(0-(zigzag&1))));
+				memcpy(&single, &bits, sizeof(float));
+				*values = single;
+			}else{
+				bits = states[j].prev+((zigzag>>1)^(0-(zigzag&1)));
+				memcpy(values, &bits, sizeof(double));
+			}
+			states[j].prev = bits;
+		}
+	}
+
+	free(states);
+
+	/*the refill reads at most 8 bytes ahead*/
+	if(reader.pos > size+8){
+		fprintf(stderr, "Corrupted session block (page %u)\n", block->first_page);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * bin_state_t* init_bin_states(int nb_features)
+ * @brief coding state of a block start, previous page at zero
+ * @param nb_features, nb of bins
+ * @return states, NULL on failure
+ */
+static bin_state_t* init_bin_states(int nb_features){
+
+	bin_state_t* states = malloc(nb_features*sizeof(bin_state_t));
+	int j;
+
+	if(states == NULL){
+		perror("session codec");
+		return NULL;
+	}
+
+	for(j=0;j<nb_features;j++){
+		states[j].prev = 0;
+		states[j].sum = 4;
+		states[j].count = 1;
+	}
+
+	return states;
+}
+
+/**
+ * int rice_parameter(bin_state_t* state, int width)
+ * @brief smallest k with count*2^k >= sum, about log2 of the mean
+ * @param state, bin state
+ * @param width, value width (bits)
+ * @return Rice parameter
+ */
+static int rice_parameter(bin_state_t* state, int width){
+
+	int k = 0;
+
+	while(k < width-1 && ((uint64_t)state->count<<k) < state->sum){
+		k++;
+	}
+	return k;
+}
+
+/**
+ * void update_bin_state(bin_state_t* state, uint64_t value)
+ * @brief add a value to the bin mean, halve it every RICE_RESCALE values
+ * @param state, bin state
+ * @param value, value coded
+ */
+static void update_bin_state(bin_state_t* state, uint64_t value){
+
+	state->sum += (value < SUM_MAX_ADD)?value:SUM_MAX_ADD;
+	if(++state->count == RICE_RESCALE){
+		state->sum >>= 1;
+		state->count >>= 1;
+	}
+}
+
+/**
+ * void put_bits(bit_writer_t* writer, uint64_t value, int nbits)
+ * @brief append bits, LSB first
+ * @param writer, bit writer
+ * @param value, bits (nothing above nbits)
+ * @param nbits, nb of bits, up to 64
+ */
+static void put_bits(bit_writer_t* writer, uint64_t value, int nbits){
+
+	/*the accumulator holds less than 8 bits, 32 more always fit*/
+	if(nbits > 32){
+		put_bits(writer, value&0xFFFFFFFFULL, 32);
+		value >>= 32;
+		nbits -= 32;
+	}
+
+	writer->acc |= value<<writer->nbits;
+	writer->nbits += nbits;
+	while(writer->nbits >= 8){
+		writer->out[writer->pos++] = (uint8_t)writer->acc;
+		writer->acc >>= 8;
+		writer->nbits -= 8;
+	}
+}
+
+/**
+ * void put_rice(bit_writer_t* writer, uint64_t value, int k, int width)
+ * @brief Rice code a value, escaped if its unary part is too long
+ * @param writer, bit writer
+ * @param value, value
+ * @param k, Rice parameter
+ * @param width, value width (bits)
+ */
+static void put_rice(bit_writer_t* writer, uint64_t value, int k, int width){
+
+	uint64_t quotient = value>>k;
+
+	if(quotient < RICE_ESCAPE){
+		/*unary, ones then a zero*/
+		put_bits(writer, (1ULL<<quotient)-1, quotient+1);
+		put_bits(writer, LOW_BITS(value, k), k);
+	}else{
+		put_bits(writer, (1ULL<<RICE_ESCAPE)-1, RICE_ESCAPE);
+		put_bits(writer, value, width);
+	}
+}
+
+/**
+ * void refill(bit_reader_t* reader)
+ * @brief load bytes until the accumulator holds at least 57 bits (zeros past the end)
+ * @param reader, bit reader
+ */
+static void refill(bit_reader_t* reader){
+
+	while(reader->nbits <= 56){
+		if(reader->pos < reader->size){
+			reader->acc |= (uint64_t)reader->in[reader->pos]<<reader->nbits;
+		}
+		reader->pos++;
+		reader->nbits += 8;
+	}
+}
+
+/**
+ * uint64_t get_bits(bit_reader_t* reader, int nbits)
+ * @brief read bits, LSB first
+ * @param reader, bit reader
+ * @param nbits, nb of bits, up to 64
+ * @return bits
+ */
+static uint64_t get_bits(bit_reader_t* reader, int nbits){
+
+	uint64_t value;
+
+	if(nbits > 32){
+		value = get_bits(reader, 32);
+		return value|(get_bits(reader, nbits-32)<<32);
+	}
+
+	refill(reader);
+	value = LOW_BITS(reader->acc, nbits);
+	reader->acc = (nbits == 64)?0:reader->acc>>nbits;
+	reader->nbits -= nbits;
+
+	return value;
+}
+
+/**
+ * uint64_t get_rice(bit_reader_t* reader, int k, int width)
+ * @brief read a Rice coded value
+ * @param reader, bit reader
+ * @param k, Rice parameter
+ * @param width, value width (bits)
+ * @return value
+ */
+static uint64_t get_rice(bit_reader_t* reader, int k, int width){
+
+	int quotient;
+
+	refill(reader);
+	quotient = (~reader->acc == 0)?64:__builtin_ctzll(~reader->acc);
+
+	if(quotient < RICE_ESCAPE){
+		reader->acc >>= quotient+1;
+		reader->nbits -= quotient+1;
+		return ((uint64_t)quotient<<k)|get_bits(reader, k);
+	}
+
+	reader->acc >>= RICE_ESCAPE;
+	reader->nbits -= RICE_ESCAPE;
+	return get_bits(reader, width);
+}
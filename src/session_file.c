@@ -0,0 +1,618 @@
+/**
+ * @file session_file.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Recorded session files. A session is a header describing the feature
+ * vector followed by every page consumed by the app, as it was read. They are
+ * written during the sessions and replayed by the FILE feature input.
+ *
+ * Sessions can also be compressed (version 2, see session_file.h). The app only
+ * copies each page in a block, full blocks are coded and written by an encoder
+ * thread. Blocks are decoded on their own and listed in an index at the end of
+ * the file, so a replay can start anywhere.
+*/
+
+#define _FILE_OFFSET_BITS 64 /*ftello/fseeko past 2 GB*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "session_file.h"
+
+#define INDEX_GROWTH 64 /*index entries allocated at once*/
+
+static int alloc_blocks(session_file_t* session, int nb_blocks);
+static void free_blocks(session_file_t* session);
+static void queue_block(session_file_t* session, char wait_free);
+static void* encode_blocks(void* param);
+static int write_block(session_file_t* session, session_block_t* block);
+static int add_index_entry(session_file_t* session, int64_t offset, uint32_t first_page, uint32_t nb_pages);
+static int write_index(session_file_t* session);
+static int load_index(session_file_t* session);
+static int scan_blocks(session_file_t* session);
+static int read_block(session_file_t* session);
+
+/**
+ * int session_file_create(session_file_t* session, const char* path, session_header_t* header)
+ * @brief create a session file and write its header, compressed sessions start the encoder
+ * @param session, session file (codec set)
+ * @param path, file to create
+ * @param header, description of the session (magic and version are set here)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int session_file_create(session_file_t* session, const char* path, session_header_t* header){
+
+	session_codec_header_t codec_header;
+
+	session->header = *header;
+	session->header.magic = SESSION_FILE_MAGIC;
+	session->header.version = (session->codec == SESSION_RAW)?SESSION_FILE_VERSION:SESSION_FILE_VERSION_BLOCKS;
+	session->nb_pages = 0;
+	session->encoder_running = 0x00;
+
+	if((session->file = fopen(path, "wb")) == NULL){
+		perror("session_file_create");
+		return EXIT_FAILURE;
+	}
+
+	if(fwrite(&(session->header), sizeof(session_header_t), 1, session->file) != 1){
+		perror("session_file_create");
+		fclose(session->file);
+		session->file = NULL;
+		return EXIT_FAILURE;
+	}
+
+	if(session->codec == SESSION_RAW){
+		return EXIT_SUCCESS;
+	}
+
+	/*compressed, pages go through the blocks*/
+	codec_header.codec = session->codec;
+	codec_header.block_pages = SESSION_BLOCK_PAGES;
+	session->block_pages = SESSION_BLOCK_PAGES;
+	if(fwrite(&codec_header, sizeof(session_codec_header_t), 1, session->file) != 1 ||
+	   alloc_blocks(session, SESSION_ENCODE_QUEUE) == EXIT_FAILURE){
+		perror("session_file_create");
+		fclose(session->file);
+		session->file = NULL;
+		return EXIT_FAILURE;
+	}
+	session->data_offset = ftello(session->file);
+	session->index = NULL;
+	session->nb_blocks = 0;
+	session->fill_block = 0;
+	session->encode_block = 0;
+	session->nb_queued = 0;
+	session->write_error = 0x00;
+	session->blocks[0].first_page = 0;
+
+	pthread_mutex_init(&(session->lock), NULL);
+	pthread_cond_init(&(session->queued), NULL);
+	pthread_cond_init(&(session->freed), NULL);
+	session->encoder_running = 0x01;
+	if(pthread_create(&(session->encoder), NULL, encode_blocks, session) != 0){
+		fprintf(stderr, "session_file_create: can't start the encoder\n");
+		session->encoder_running = 0x00;
+		free_blocks(session);
+		fclose(session->file);
+		session->file = NULL;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int session_file_write_page(session_file_t* session, frame_info_t* frame_info, double* feature_array)
+ * @brief append a page to the session, a compressed session only copies it in the block
+ * @param session, session file
+ * @param frame_info, frame info of the page
+ * @param feature_array, feature array of the page
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int session_file_write_page(session_file_t* session, frame_info_t* frame_info, double* feature_array){
+
+	session_block_t* block;
+
+	if(session->codec == SESSION_RAW){
+		if(fwrite(frame_info, sizeof(frame_info_t), 1, session->file) != 1 ||
+		   fwrite(feature_array, sizeof(double), session->header.nb_features, session->file) !=
+		   (size_t)session->header.nb_features){
+			return EXIT_FAILURE;
+		}
+		session->nb_pages++;
+		return EXIT_SUCCESS;
+	}
+
+	block = &(session->blocks[session->fill_block]);
+	block->eye_blinks[block->nb_pages] = frame_info->eye_blink_detected;
+	memcpy(&(block->values[block->nb_pages*session->header.nb_features]), feature_array,
+		   session->header.nb_features*sizeof(double));
+	block->nb_pages++;
+	session->nb_pages++;
+
+	if(block->nb_pages == session->block_pages){
+		queue_block(session, 0x01);
+		block = &(session->blocks[session->fill_block]);
+		block->nb_pages = 0;
+		block->first_page = session->nb_pages;
+	}
+
+	return session->write_error?EXIT_FAILURE:EXIT_SUCCESS;
+}
+
+/**
+ * int session_file_open(session_file_t* session, const char* path)
+ * @brief open a session file and read its header (and index, if compressed)
+ * @param session, session file
+ * @param path, file to open
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int session_file_open(session_file_t* session, const char* path){
+
+	session_codec_header_t codec_header;
+
+	session->nb_pages = 0;
+	session->codec = SESSION_RAW;
+	session->encoder_running = 0x00;
+
+	if((session->file = fopen(path, "rb")) == NULL){
+		perror("session_file_open");
+		return EXIT_FAILURE;
+	}
+
+	if(fread(&(session->header), sizeof(session_header_t), 1, session->file) != 1 ||
+	   session->header.magic != SESSION_FILE_MAGIC ||
+	   (session->header.version != SESSION_FILE_VERSION &&
+	    session->header.version != SESSION_FILE_VERSION_BLOCKS) ||
+	   session->header.nb_features <= 0){
+		fprintf(stderr, "%s: not a session file\n", path);
+		fclose(session->file);
+		session->file = NULL;
+		return EXIT_FAILURE;
+	}
+
+	if(session->header.version == SESSION_FILE_VERSION){
+		return EXIT_SUCCESS;
+	}
+
+	/*compressed, one block decoded at a time*/
+	if(fread(&codec_header, sizeof(session_codec_header_t), 1, session->file) != 1 ||
+	   (codec_header.codec != SESSION_LOSSLESS && codec_header.codec != SESSION_FLOAT32) ||
+	   codec_header.block_pages < 1 || codec_header.block_pages > 4096){
+		fprintf(stderr, "%s: unknown session coding\n", path);
+		fclose(session->file);
+		session->file = NULL;
+		return EXIT_FAILURE;
+	}
+	session->codec = codec_header.codec;
+	session->block_pages = codec_header.block_pages;
+	if(alloc_blocks(session, 1) == EXIT_FAILURE){
+		fclose(session->file);
+		session->file = NULL;
+		return EXIT_FAILURE;
+	}
+	session->data_offset = ftello(session->file);
+	session->blocks[0].nb_pages = 0;
+	session->read_pos = 0;
+
+	/*a session cut short has no index, it is rebuilt on the first seek*/
+	session->index = NULL;
+	session->nb_blocks = 0;
+	load_index(session);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int session_file_read_page(session_file_t* session, frame_info_t* frame_info, double* feature_array)
+ * @brief read the next page of the session
+ * @param session, session file
+ * @param frame_info(out), frame info of the page
+ * @param feature_array(out), feature array of the page
+ * @return EXIT_SUCCESS, EXIT_FAILURE at the end of the session
+ */
+int session_file_read_page(session_file_t* session, frame_info_t* frame_info, double* feature_array){
+
+	session_block_t* block = &(session->blocks[0]);
+
+	if(session->codec == SESSION_RAW){
+		if(fread(frame_info, sizeof(frame_info_t), 1, session->file) != 1 ||
+		   fread(feature_array, sizeof(double), session->header.nb_features, session->file) !=
+		   (size_t)session->header.nb_features){
+			return EXIT_FAILURE;
+		}
+		session->nb_pages++;
+		return EXIT_SUCCESS;
+	}
+
+	if(session->read_pos == block->nb_pages && read_block(session) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	memset(frame_info, 0, sizeof(frame_info_t));
+	frame_info->eye_blink_detected = block->eye_blinks[session->read_pos];
+	memcpy(feature_array, &(block->values[session->read_pos*session->header.nb_features]),
+		   session->header.nb_features*sizeof(double));
+	session->read_pos++;
+	session->nb_pages++;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int session_file_seek(session_file_t* session, int page)
+ * @brief move to a page, the next read returns it
+ * @param session, session file (opened for reading)
+ * @param page, page index
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the session is shorter
+ */
+int session_file_seek(session_file_t* session, int page){
+
+	int64_t page_size = sizeof(frame_info_t)+session->header.nb_features*sizeof(double);
+	uint32_t lo = 0, hi, mid;
+
+	if(page < 0){
+		return EXIT_FAILURE;
+	}
+
+	if(session->codec == SESSION_RAW){
+		if(fseeko(session->file, 0, SEEK_END) != 0 ||
+		   ftello(session->file) < (off_t)(sizeof(session_header_t)+(page+1)*page_size) ||
+		   fseeko(session->file, sizeof(session_header_t)+page*page_size, SEEK_SET) != 0){
+			fseeko(session->file, sizeof(session_header_t)+session->nb_pages*page_size, SEEK_SET);
+			return EXIT_FAILURE;
+		}
+		session->nb_pages = page;
+		return EXIT_SUCCESS;
+	}
+
+	if(session->index == NULL && scan_blocks(session) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	/*last block starting at or before the page*/
+	hi = session->nb_blocks;
+	while(hi-lo > 1){
+		mid = (lo+hi)/2;
+		if(session->index[mid].first_page <= (uint32_t)page){
+			lo = mid;
+		}else{
+			hi = mid;
+		}
+	}
+	if(session->nb_blocks == 0 || (uint32_t)page >= session->index[lo].first_page+session->index[lo].nb_pages){
+		return EXIT_FAILURE;
+	}
+
+	if(fseeko(session->file, session->index[lo].offset, SEEK_SET) != 0 ||
+	   read_block(session) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+	session->read_pos = page-session->index[lo].first_page;
+	session->nb_pages = page;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int session_file_close(session_file_t* session)
+ * @brief close the session file, a compressed session being written is flushed
+ *        by the encoder and gets its index
+ * @param session, session file
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int session_file_close(session_file_t* session){
+
+	int res = EXIT_SUCCESS;
+
+	if(session->file == NULL){
+		return EXIT_SUCCESS;
+	}
+
+	if(session->encoder_running){
+
+		/*last block, even partial, then let the encoder drain the queue*/
+		if(session->blocks[session->fill_block].nb_pages > 0){
+			queue_block(session, 0x00);
+		}
+		pthread_mutex_lock(&(session->lock));
+		session->encoder_running = 0x00;
+		pthread_cond_signal(&(session->queued));
+		pthread_mutex_unlock(&(session->lock));
+		pthread_join(session->encoder, NULL);
+
+		if(session->write_error || write_index(session) == EXIT_FAILURE){
+			res = EXIT_FAILURE;
+		}
+		pthread_mutex_destroy(&(session->lock));
+		pthread_cond_destroy(&(session->queued));
+		pthread_cond_destroy(&(session->freed));
+	}
+
+	if(session->codec != SESSION_RAW){
+		free_blocks(session);
+		free(session->index);
+		session->index = NULL;
+	}
+
+	if(fclose(session->file) != 0){
+		res = EXIT_FAILURE;
+	}
+	session->file = NULL;
+
+	return res;
+}
+
+/**
+ * int alloc_blocks(session_file_t* session, int nb_blocks)
+ * @brief allocate the block buffers and the coded block
+ * @param session, session file (block_pages set)
+ * @param nb_blocks, nb of blocks
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int alloc_blocks(session_file_t* session, int nb_blocks){
+
+	int i;
+
+	memset(session->blocks, 0, sizeof(session->blocks));
+	session->coded = malloc(session_block_bound(session->block_pages, session->header.nb_features));
+
+	for(i=0;i<nb_blocks;i++){
+		session->blocks[i].eye_blinks = malloc(session->block_pages);
+		session->blocks[i].values = malloc((size_t)session->block_pages*session->header.nb_features*sizeof(double));
+		if(session->blocks[i].eye_blinks == NULL || session->blocks[i].values == NULL){
+			free_blocks(session);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(session->coded == NULL){
+		free_blocks(session);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void free_blocks(session_file_t* session)
+ * @brief free the block buffers and the coded block
+ * @param session, session file
+ */
+static void free_blocks(session_file_t* session){
+
+	int i;
+
+	for(i=0;i<SESSION_ENCODE_QUEUE;i++){
+		free(session->blocks[i].eye_blinks);
+		free(session->blocks[i].values);
+		session->blocks[i].eye_blinks = NULL;
+		session->blocks[i].values = NULL;
+	}
+	free(session->coded);
+	session->coded = NULL;
+}
+
+/**
+ * void queue_block(session_file_t* session, char wait_free)
+ * @brief hand the block filled to the encoder and move on to the next one
+ * @param session, session file
+ * @param wait_free, wait for the next block to be free (the encoder fell behind),
+ *        the last block of the session doesn't
+ */
+static void queue_block(session_file_t* session, char wait_free){
+
+	pthread_mutex_lock(&(session->lock));
+	session->nb_queued++;
+	pthread_cond_signal(&(session->queued));
+	session->fill_block = (session->fill_block+1)%SESSION_ENCODE_QUEUE;
+	while(wait_free && session->nb_queued == SESSION_ENCODE_QUEUE){
+		pthread_cond_wait(&(session->freed), &(session->lock));
+	}
+	pthread_mutex_unlock(&(session->lock));
+}
+
+/**
+ * void* encode_blocks(void* param)
+ * @brief encoder thread, codes and writes the queued blocks until stopped and drained
+ * @param param, (session_file_t*) session file
+ * @return NULL
+ */
+static void* encode_blocks(void* param){
+
+	session_file_t* session = param;
+
+	pthread_mutex_lock(&(session->lock));
+	while(1){
+
+		while(session->nb_queued == 0 && session->encoder_running){
+			pthread_cond_wait(&(session->queued), &(session->lock));
+		}
+		if(session->nb_queued == 0){
+			break;
+		}
+		pthread_mutex_unlock(&(session->lock));
+
+		if(write_block(session, &(session->blocks[session->encode_block])) == EXIT_FAILURE){
+			session->write_error = 0x01;
+		}
+
+		pthread_mutex_lock(&(session->lock));
+		session->encode_block = (session->encode_block+1)%SESSION_ENCODE_QUEUE;
+		session->nb_queued--;
+		pthread_cond_signal(&(session->freed));
+	}
+	pthread_mutex_unlock(&(session->lock));
+
+	return NULL;
+}
+
+/**
+ * int write_block(session_file_t* session, session_block_t* block)
+ * @brief code a block, write it and add it to the index
+ * @param session, session file
+ * @param block, block to write
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int write_block(session_file_t* session, session_block_t* block){
+
+	session_block_header_t header;
+	int64_t offset = ftello(session->file);
+
+	header.magic = SESSION_BLOCK_MAGIC;
+	header.first_page = block->first_page;
+	header.nb_pages = block->nb_pages;
+	header.size = encode_session_block(block, session->header.nb_features, session->codec, session->coded);
+
+	if(header.size == 0 ||
+	   fwrite(&header, sizeof(session_block_header_t), 1, session->file) != 1 ||
+	   fwrite(session->coded, 1, header.size, session->file) != header.size){
+		return EXIT_FAILURE;
+	}
+
+	return add_index_entry(session, offset, header.first_page, header.nb_pages);
+}
+
+/**
+ * int add_index_entry(session_file_t* session, int64_t offset, uint32_t first_page, uint32_t nb_pages)
+ * @brief add a block to the index
+ * @param session, session file
+ * @param offset, offset of the block header
+ * @param first_page, first page of the block
+ * @param nb_pages, nb of pages of the block
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int add_index_entry(session_file_t* session, int64_t offset, uint32_t first_page, uint32_t nb_pages){
+
+	session_index_entry_t* index;
+
+	if(session->nb_blocks%INDEX_GROWTH == 0){
+		index = realloc(session->index, (session->nb_blocks+INDEX_GROWTH)*sizeof(session_index_entry_t));
+		if(index == NULL){
+			return EXIT_FAILURE;
+		}
+		session->index = index;
+	}
+
+	session->index[session->nb_blocks].offset = offset;
+	session->index[session->nb_blocks].first_page = first_page;
+	session->index[session->nb_blocks].nb_pages = nb_pages;
+	session->nb_blocks++;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int write_index(session_file_t* session)
+ * @brief write the index and the trailer at the end of the session
+ * @param session, session file
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int write_index(session_file_t* session){
+
+	session_trailer_t trailer;
+	uint32_t magic = SESSION_INDEX_MAGIC;
+
+	trailer.index_offset = ftello(session->file);
+	trailer.nb_blocks = session->nb_blocks;
+	trailer.magic = SESSION_INDEX_MAGIC;
+
+	if(fwrite(&magic, sizeof(uint32_t), 1, session->file) != 1 ||
+	   fwrite(session->index, sizeof(session_index_entry_t), session->nb_blocks, session->file) != session->nb_blocks ||
+	   fwrite(&trailer, sizeof(session_trailer_t), 1, session->file) != 1){
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int load_index(session_file_t* session)
+ * @brief read the index from the trailer, the file is left at the first block
+ * @param session, session file
+ * @return EXIT_SUCCESS, EXIT_FAILURE if there is none
+ */
+static int load_index(session_file_t* session){
+
+	session_trailer_t trailer;
+	uint32_t magic;
+	int res = EXIT_FAILURE;
+
+	if(fseeko(session->file, -(off_t)sizeof(session_trailer_t), SEEK_END) == 0 &&
+	   fread(&trailer, sizeof(session_trailer_t), 1, session->file) == 1 &&
+	   trailer.magic == SESSION_INDEX_MAGIC && trailer.index_offset >= session->data_offset &&
+	   fseeko(session->file, trailer.index_offset, SEEK_SET) == 0 &&
+	   fread(&magic, sizeof(uint32_t), 1, session->file) == 1 && magic == SESSION_INDEX_MAGIC &&
+	   (session->index = malloc((trailer.nb_blocks+1)*sizeof(session_index_entry_t))) != NULL){
+
+		if(fread(session->index, sizeof(session_index_entry_t), trailer.nb_blocks, session->file) == trailer.nb_blocks){
+			session->nb_blocks = trailer.nb_blocks;
+			res = EXIT_SUCCESS;
+		}else{
+			free(session->index);
+			session->index = NULL;
+		}
+	}
+
+	fseeko(session->file, session->data_offset, SEEK_SET);
+	return res;
+}
+
+/**
+ * int scan_blocks(session_file_t* session)
+ * @brief rebuild the index of a session cut short, from the block headers
+ * @param session, session file
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int scan_blocks(session_file_t* session){
+
+	session_block_header_t header;
+	int64_t offset = session->data_offset;
+
+	session->nb_blocks = 0;
+	while(fseeko(session->file, offset, SEEK_SET) == 0 &&
+		  fread(&header, sizeof(session_block_header_t), 1, session->file) == 1 &&
+		  header.magic == SESSION_BLOCK_MAGIC){
+
+		if(add_index_entry(session, offset, header.first_page, header.nb_pages) == EXIT_FAILURE){
+			return EXIT_FAILURE;
+		}
+		offset += sizeof(session_block_header_t)+header.size;
+	}
+
+	return (session->index != NULL)?EXIT_SUCCESS:EXIT_FAILURE;
+}
+
+/**
+ * int read_block(session_file_t* session)
+ * @brief read and decode the block at the current position
+ * @param session, session file
+ * @return EXIT_SUCCESS, EXIT_FAILURE at the end of the session
+ */
+static int read_block(session_file_t* session){
+
+	session_block_header_t header;
+	session_block_t* block = &(session->blocks[0]);
+
+	/*the index follows the last block*/
+	if(fread(&header, sizeof(session_block_header_t), 1, session->file) != 1 ||
+	   header.magic != SESSION_BLOCK_MAGIC){
+		return EXIT_FAILURE;
+	}
+
+	if(header.nb_pages < 1 || header.nb_pages > (uint32_t)session->block_pages ||
+	   header.size > session_block_bound(session->block_pages, session->header.nb_features) ||
+	   fread(session->coded, 1, header.size, session->file) != header.size){
+		fprintf(stderr, "Corrupted session block (page %u)\n", header.first_page);
+		return EXIT_FAILURE;
+	}
+
+	block->first_page = header.first_page;
+	block->nb_pages = header.nb_pages;
+	session->read_pos = 0;
+
+	return decode_session_block(session->coded, header.size, session->header.nb_features,
+								session->codec, block);
+}
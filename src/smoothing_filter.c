@@ -0,0 +1,246 @@
+/**
+ * @file smoothing_filter.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Smoothing stage applied to the normalized sample before the pitch mapping.
+ * Offers a one-pole running average, a biquad low-pass (Butterworth), the One-Euro
+ * adaptive filter and a median of N. All states are fixed size, nothing is allocated.
+ *
+ * The delay each configuration adds at low frequency is computed during init, so
+ * the lowest latency filter that still gives a stable tone can be picked.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "smoothing_filter.h"
+
+static double one_euro_alpha(double cutoff, double frame_rate);
+static double median_push(smoothing_filter_t* filter, double sample);
+static void prime_filter(smoothing_filter_t* filter, double sample);
+
+/**
+ * int init_smoothing_filter(smoothing_filter_t* filter)
+ * @brief compute the filter coefficients and its group delay, reset the state
+ * @param filter, pointer to the smoothing filter
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_smoothing_filter(smoothing_filter_t* filter){
+
+	double w0, cos_w0, alpha, a0;
+	double sum_b, sum_a;
+
+	if(filter->frame_rate <= 0){
+		fprintf(stderr, "Invalid smoothing frame rate\n");
+		return EXIT_FAILURE;
+	}
+
+	switch(filter->type){
+
+		case SMOOTH_ONE_POLE:
+			if(filter->kernel < 1){
+				fprintf(stderr, "Invalid smoothing kernel\n");
+				return EXIT_FAILURE;
+			}
+			/*y += (x-y)/k, delay of (1-a)/a with a=1/k*/
+			filter->group_delay = filter->kernel-1;
+			break;
+
+		case SMOOTH_BIQUAD:
+			if(filter->cutoff <= 0 || filter->cutoff >= filter->frame_rate/2){
+				fprintf(stderr, "Invalid smoothing cutoff\n");
+				return EXIT_FAILURE;
+			}
+			/*butterworth low-pass (Q=1/sqrt(2)), bilinear transform*/
+			w0 = 2*M_PI*filter->cutoff/filter->frame_rate;
+			cos_w0 = cos(w0);
+			alpha = sin(w0)/(2*M_SQRT1_2);
+			a0 = 1+alpha;
+			filter->b[0] = (1-cos_w0)/2/a0;
+			filter->b[1] = (1-cos_w0)/a0;
+			filter->b[2] = (1-cos_w0)/2/a0;
+			filter->a[0] = 1;
+			filter->a[1] = -2*cos_w0/a0;
+			filter->a[2] = (1-alpha)/a0;
+			/*group delay at DC: sum(k*b[k])/sum(b[k]) - sum(k*a[k])/sum(a[k])*/
+			sum_b = filter->b[0]+filter->b[1]+filter->b[2];
+			sum_a = filter->a[0]+filter->a[1]+filter->a[2];
+			filter->group_delay = (filter->b[1]+2*filter->b[2])/sum_b -
+								  (filter->a[1]+2*filter->a[2])/sum_a;
+			break;
+
+		case SMOOTH_ONE_EURO:
+			if(filter->min_cutoff <= 0 || filter->d_cutoff <= 0){
+				fprintf(stderr, "Invalid smoothing cutoff\n");
+				return EXIT_FAILURE;
+			}
+			/*at rest, it behaves like a one-pole at the minimum cutoff*/
+			alpha = one_euro_alpha(filter->min_cutoff, filter->frame_rate);
+			filter->group_delay = (1-alpha)/alpha;
+			break;
+
+		case SMOOTH_MEDIAN:
+			if(filter->median_size < 1 || filter->median_size > SMOOTH_MAX_MEDIAN ||
+			   filter->median_size%2 == 0){
+				fprintf(stderr, "Invalid median size (odd, up to %i)\n", SMOOTH_MAX_MEDIAN);
+				return EXIT_FAILURE;
+			}
+			filter->group_delay = (filter->median_size-1)/2.0;
+			break;
+
+		default:
+			fprintf(stderr, "Unknown smoothing filter\n");
+			return EXIT_FAILURE;
+	}
+
+	/*state is set on the first sample*/
+	filter->primed = 0x00;
+	filter->value = 0;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * double smooth_sample(smoothing_filter_t* filter, double sample)
+ * @brief filter a new sample
+ * @param filter, pointer to the smoothing filter
+ * @param sample, new sample
+ * @return filtered value
+ */
+double smooth_sample(smoothing_filter_t* filter, double sample){
+
+	double speed, alpha;
+
+	/*start in steady state on the first sample, no start up transient*/
+	if(!filter->primed){
+		prime_filter(filter, sample);
+		return filter->value;
+	}
+
+	switch(filter->type){
+
+		case SMOOTH_ONE_POLE:
+			filter->value += (sample-filter->value)/filter->kernel;
+			break;
+
+		case SMOOTH_BIQUAD:
+			/*transposed direct form II*/
+			filter->value = filter->b[0]*sample + filter->z[0];
+			filter->z[0] = filter->b[1]*sample - filter->a[1]*filter->value + filter->z[1];
+			filter->z[1] = filter->b[2]*sample - filter->a[2]*filter->value;
+			break;
+
+		case SMOOTH_ONE_EURO:
+			/*filtered speed sets the cutoff*/
+			speed = (sample-filter->last_input)*filter->frame_rate;
+			alpha = one_euro_alpha(filter->d_cutoff, filter->frame_rate);
+			filter->speed += alpha*(speed-filter->speed);
+			alpha = one_euro_alpha(filter->min_cutoff+filter->beta*fabs(filter->speed), filter->frame_rate);
+			filter->value += alpha*(sample-filter->value);
+			break;
+
+		case SMOOTH_MEDIAN:
+			filter->value = median_push(filter, sample);
+			break;
+	}
+
+	filter->last_input = sample;
+	return filter->value;
+}
+
+/**
+ * const char* smoothing_filter_str(char type)
+ * @brief get a printable name for a filter type
+ * @param type, filter type
+ * @return filter name
+ */
+const char* smoothing_filter_str(char type){
+
+	switch(type){
+		case SMOOTH_ONE_POLE: return "one-pole";
+		case SMOOTH_BIQUAD: return "biquad";
+		case SMOOTH_ONE_EURO: return "one-euro";
+		case SMOOTH_MEDIAN: return "median";
+	}
+	return "unknown";
+}
+
+/**
+ * void prime_filter(smoothing_filter_t* filter, double sample)
+ * @brief set the filter state as if the sample had always been the input
+ * @param filter, pointer to the smoothing filter
+ * @param sample, first sample
+ */
+static void prime_filter(smoothing_filter_t* filter, double sample){
+
+	int i;
+
+	filter->value = sample;
+	filter->last_input = sample;
+	filter->speed = 0;
+
+	/*biquad steady state, unity gain at DC*/
+	if(filter->type == SMOOTH_BIQUAD){
+		filter->z[1] = (filter->b[2]-filter->a[2])*sample;
+		filter->z[0] = (filter->b[1]-filter->a[1])*sample + filter->z[1];
+	}
+
+	/*median window full of the first sample*/
+	if(filter->type == SMOOTH_MEDIAN){
+		for(i=0;i<filter->median_size;i++){
+			filter->window[i] = sample;
+			filter->sorted[i] = sample;
+		}
+		filter->idx = 0;
+	}
+
+	filter->primed = 0x01;
+}
+
+/**
+ * double one_euro_alpha(double cutoff, double frame_rate)
+ * @brief smoothing factor of a one-pole low-pass at a given cutoff
+ * @param cutoff, cutoff frequency (Hz)
+ * @param frame_rate, sampling rate (Hz)
+ * @return smoothing factor
+ */
+static double one_euro_alpha(double cutoff, double frame_rate){
+
+	double tau = 1.0/(2*M_PI*cutoff);
+	return 1.0/(1.0+tau*frame_rate);
+}
+
+/**
+ * double median_push(smoothing_filter_t* filter, double sample)
+ * @brief replace the oldest sample of the window and return the median,
+ * the sorted copy is updated by shifting, no full sort
+ * @param filter, pointer to the smoothing filter
+ * @param sample, new sample
+ * @return median of the window
+ */
+static double median_push(smoothing_filter_t* filter, double sample){
+
+	int i;
+	int n = filter->median_size;
+	double oldest = filter->window[filter->idx];
+
+	/*replace the oldest in the arrival order*/
+	filter->window[filter->idx] = sample;
+	filter->idx = (filter->idx+1)%n;
+
+	/*remove the oldest from the sorted copy*/
+	for(i=0;i<n-1 && filter->sorted[i]!=oldest;i++);
+	for(;i<n-1;i++){
+		filter->sorted[i] = filter->sorted[i+1];
+	}
+
+	/*insert the new one in place*/
+	for(i=n-1;i>0 && filter->sorted[i-1]>sample;i--){
+		filter->sorted[i] = filter->sorted[i-1];
+	}
+	filter->sorted[i] = sample;
+
+	return filter->sorted[n/2];
+}
@@ -0,0 +1,188 @@
+/**
+ * @file spsc_queue.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Bounded single producer, single consumer queue between two stages of
+ * the task (see spsc_queue.h). The fast path is a load of the other side's
+ * counter and a store of its own, a stage only sleeps on a full or empty queue
+ * and is woken by the other side's next push or pop.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "spsc_queue.h"
+
+#define SPSC_ROUND_UP(x) (((x)+SPSC_LINE-1)/SPSC_LINE*SPSC_LINE)
+
+static void wait_counter(uint32_t* counter, uint32_t* waiting, uint32_t seen);
+
+/**
+ * int init_spsc_queue(spsc_queue_t* queue)
+ * @brief allocate the slots and reset the counters
+ * @param queue, queue (depth and slot_size set)
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int init_spsc_queue(spsc_queue_t* queue){
+
+	if(queue->depth < 2 || queue->depth > SPSC_MAX_DEPTH || (queue->depth & (queue->depth-1)) != 0 ||
+	   queue->slot_size < 1){
+		fprintf(stderr, "Invalid queue configuration\n");
+		return EXIT_FAILURE;
+	}
+
+	queue->slot_size = SPSC_ROUND_UP(queue->slot_size);
+	if(posix_memalign((void**)&(queue->slots), SPSC_LINE, (size_t)queue->depth*queue->slot_size) != 0){
+		perror("queue slots");
+		queue->slots = NULL;
+		return EXIT_FAILURE;
+	}
+	memset(queue->slots, 0, (size_t)queue->depth*queue->slot_size);
+
+	queue->head = 0;
+	queue->producer_waiting = 0;
+	queue->nb_pushed = 0;
+	queue->occupancy_sum = 0;
+	queue->max_occupancy = 0;
+	queue->nb_full = 0;
+	queue->tail = 0;
+	queue->consumer_waiting = 0;
+	queue->nb_empty = 0;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void* spsc_claim(spsc_queue_t* queue)
+ * @brief producer side, blocking call, until a slot is free
+ * @param queue, queue
+ * @return the slot to fill, pushed with spsc_push
+ */
+void* spsc_claim(spsc_queue_t* queue){
+
+	uint32_t head = queue->head;
+	uint32_t tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+
+	if(head-tail == (uint32_t)queue->depth){
+		__atomic_fetch_add(&(queue->nb_full), 1, __ATOMIC_RELAXED);
+		do{
+			wait_counter(&(queue->tail), &(queue->producer_waiting), tail);
+			tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+		}while(head-tail == (uint32_t)queue->depth);
+	}
+
+	return &(queue->slots[(head & (queue->depth-1))*queue->slot_size]);
+}
+
+/**
+ * void spsc_push(spsc_queue_t* queue)
+ * @brief producer side, hand the claimed slot to the consumer
+ * @param queue, queue
+ */
+void spsc_push(spsc_queue_t* queue){
+
+	uint32_t head = queue->head+1;
+	unsigned long occupancy;
+
+	__atomic_store_n(&(queue->head), head, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&(queue->consumer_waiting), __ATOMIC_SEQ_CST)){
+		syscall(SYS_futex, &(queue->head), FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+
+	/*slots used, the consumer may have popped some since*/
+	occupancy = head-__atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+	__atomic_fetch_add(&(queue->nb_pushed), 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&(queue->occupancy_sum), occupancy, __ATOMIC_RELAXED);
+	if(occupancy > queue->max_occupancy){
+		__atomic_store_n(&(queue->max_occupancy), occupancy, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * void* spsc_peek(spsc_queue_t* queue)
+ * @brief consumer side, blocking call, until a slot was pushed
+ * @param queue, queue
+ * @return the oldest slot, released with spsc_pop
+ */
+void* spsc_peek(spsc_queue_t* queue){
+
+	uint32_t tail = queue->tail;
+	uint32_t head = __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE);
+
+	if(head == tail){
+		__atomic_fetch_add(&(queue->nb_empty), 1, __ATOMIC_RELAXED);
+		do{
+			wait_counter(&(queue->head), &(queue->consumer_waiting), head);
+			head = __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE);
+		}while(head == tail);
+	}
+
+	return &(queue->slots[(tail & (queue->depth-1))*queue->slot_size]);
+}
+
+/**
+ * void spsc_pop(spsc_queue_t* queue)
+ * @brief consumer side, give the oldest slot back to the producer
+ * @param queue, queue
+ */
+void spsc_pop(spsc_queue_t* queue){
+
+	__atomic_store_n(&(queue->tail), queue->tail+1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&(queue->producer_waiting), __ATOMIC_SEQ_CST)){
+		syscall(SYS_futex, &(queue->tail), FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+/**
+ * double spsc_mean_occupancy(spsc_queue_t* queue)
+ * @brief mean nb of slots used after a push
+ * @param queue, queue
+ * @return mean occupancy, 0 if nothing was pushed
+ */
+double spsc_mean_occupancy(spsc_queue_t* queue){
+
+	unsigned long nb_pushed = __atomic_load_n(&(queue->nb_pushed), __ATOMIC_RELAXED);
+
+	if(nb_pushed == 0){
+		return 0;
+	}
+	return (double)__atomic_load_n(&(queue->occupancy_sum), __ATOMIC_RELAXED)/nb_pushed;
+}
+
+/**
+ * int clean_up_spsc_queue(spsc_queue_t* queue)
+ * @brief free the slots
+ * @param queue, queue
+ * @return EXIT_SUCCESS
+ */
+int clean_up_spsc_queue(spsc_queue_t* queue){
+
+	free(queue->slots);
+	queue->slots = NULL;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void wait_counter(uint32_t* counter, uint32_t* waiting, uint32_t seen)
+ * @brief sleep until the other side moves its counter (or a slice passed)
+ * @param counter, counter of the other side
+ * @param waiting, flag of this side, read by the other one after it moves its counter
+ * @param seen, counter value that made us wait
+ */
+static void wait_counter(uint32_t* counter, uint32_t* waiting, uint32_t seen){
+
+	struct timespec slice = {0, SPSC_WAIT_SLICE_MS*1000000L};
+
+	/*flag first, then check again, so a move between the two is never missed*/
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(counter, __ATOMIC_SEQ_CST) == seen){
+		syscall(SYS_futex, counter, FUTEX_WAIT, seen, &slice, NULL, 0);
+	}
+	__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,233 @@
+/**
+ * @file bcast_rd_buf.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Feature input reading the broadcast ring (bcast_ring.c). The app is one
+ *        reader among others, pages are copied out of the ring into private pages,
+ *        so processing a page never holds the producer. If the app falls behind,
+ *        pages are lost instead of delaying the other readers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "bcast_rd_buf.h"
+#include "feature_input.h"
+
+static int bcast_reattach(feature_input_t* pfeature_input);
+
+/**
+ * int bcast_rd_init(void *param)
+ * @brief attach the broadcast ring as a reader and allocate the private pages
+ * @param param, reference to the feature input struct
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int bcast_rd_init(void *param){
+	
+	feature_input_t* pfeature_input = param;
+	
+	pfeature_input->bcast.shm_key = pfeature_input->bcast_key;
+	if(bcast_attach(&(pfeature_input->bcast)) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+	
+	if(pfeature_input->bcast.nb_features != pfeature_input->nb_features){
+		fprintf(stderr, "Broadcast ring holds %i features, expected %i\n",
+				pfeature_input->bcast.nb_features, pfeature_input->nb_features);
+		bcast_detach(&(pfeature_input->bcast));
+		return EXIT_FAILURE;
+	}
+	
+	/*private copies of the ring doubles, one per page of a batch*/
+	if(pfeature_input->buffer_depth < 1){
+		pfeature_input->buffer_depth = 1;
+	}
+	pfeature_input->page_format = PAGE_FLOAT64;
+	if(set_page_layout(pfeature_input) == EXIT_FAILURE){
+		bcast_detach(&(pfeature_input->bcast));
+		return EXIT_FAILURE;
+	}
+	pfeature_input->shm_buf = alloc_pages(pfeature_input);
+	if(pfeature_input->shm_buf == NULL){
+		bcast_detach(&(pfeature_input->bcast));
+		return EXIT_FAILURE;
+	}
+	pfeature_input->current_page = 0;
+	
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int bcast_rd_request(void *param)
+ * @brief request a new page (do nothing, the producer never waits for a reader)
+ * @param param, reference to the feature input struct
+ * @return EXIT_SUCCESS
+ */
+int bcast_rd_request(void *param __attribute__((unused))){
+	
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int bcast_rd_wait_for_request_completed(void *param)
+ * @brief blocking call, copy the next page of the ring. After the stall timeout,
+ *        the ring is looked up again by key in case the producer created it again.
+ * @param param, reference to the feature input struct
+ * @return EXIT_SUCCESS, FEAT_INPUT_STALLED if the producer is silent
+ */
+int bcast_rd_wait_for_request_completed(void *param){
+	
+	feature_input_t* pfeature_input = param;
+	struct timespec retry = {0, STALL_RETRY_MS*1000000L};
+	int timeout_ms = BCAST_WAIT_FOREVER;
+	int res;
+	
+	if(pfeature_input->stall_timeout > 0){
+		timeout_ms = pfeature_input->stalled?STALL_RETRY_MS:(int)(pfeature_input->stall_timeout*1000);
+	}
+	
+	/*the producer went silent, look for it again*/
+	if(pfeature_input->stalled && bcast_reattach(pfeature_input) == EXIT_FAILURE){
+		nanosleep(&retry, NULL);
+		return FEAT_INPUT_STALLED;
+	}
+	
+	res = bcast_read(&(pfeature_input->bcast), bcast_get_frame_info_ref(pfeature_input),
+					 bcast_get_feature_array_ref(pfeature_input), timeout_ms);
+	if(res == BCAST_TIMEOUT){
+		return report_input_stall(pfeature_input);
+	}
+	
+	/*first page after a stall*/
+	if(pfeature_input->stalled){
+		report_input_recovery(pfeature_input);
+	}
+	
+	return res;
+}
+
+/**
+ * frame_info_t* bcast_get_frame_info_ref(void *param)
+ * @brief Call to get a reference to the frame info of the current page
+ * @param param, reference to the feature input struct
+ * @return references to the frame info
+ */
+frame_info_t* bcast_get_frame_info_ref(void *param){
+	
+	feature_input_t* pfeature_input = param;
+	return (frame_info_t*)PAGE_REF(pfeature_input, pfeature_input->current_page);
+}
+
+/**
+ * double* bcast_get_feature_array_ref(void *param)
+ * @brief Call to get a reference to the feature vector of the current page
+ * @param param, reference to the feature input struct
+ * @return reference to the feature vector
+ */
+double* bcast_get_feature_array_ref(void *param){
+	
+	feature_input_t* pfeature_input = param;
+	return (double*)&(PAGE_REF(pfeature_input, pfeature_input->current_page)[pfeature_input->feat_offset]);
+}
+
+/**
+ * int bcast_rd_get_batch(void *param, feature_page_view_t *views, int max_views)
+ * @brief Non blocking call, copies out all the pages published since the last call
+ *        (up to the ring depth, the older ones are lost)
+ * @param param, reference to the feature input struct
+ * @param views(out), views on the pages, oldest first
+ * @param max_views, size of views
+ * @return nb of pages handed out, 0 while the ring is gone
+ */
+int bcast_rd_get_batch(void *param, feature_page_view_t *views, int max_views){
+	
+	feature_input_t* pfeature_input = param;
+	int nb_pages;
+	int i;
+	char* page;
+	
+	/*a reattach after a stall can leave the ring detached, look for it again*/
+	if(pfeature_input->bcast.header == NULL && bcast_reattach(pfeature_input) == EXIT_FAILURE){
+		return 0;
+	}
+	
+	nb_pages = bcast_available(&(pfeature_input->bcast));
+	if(nb_pages > max_views){
+		nb_pages = max_views;
+	}
+	if(nb_pages > pfeature_input->buffer_depth){
+		nb_pages = pfeature_input->buffer_depth;
+	}
+	
+	for(i=0;i<nb_pages;i++){
+		page = PAGE_REF(pfeature_input, i);
+		views[i].frame_info = (frame_info_t*)page;
+		views[i].feature_array = (double*)&(page[pfeature_input->feat_offset]);
+		if(bcast_read(&(pfeature_input->bcast), views[i].frame_info, views[i].feature_array,
+					  BCAST_NO_WAIT) != EXIT_SUCCESS){
+			break;
+		}
+	}
+	
+	return i;
+}
+
+/**
+ * int bcast_rd_cleanup(void *param)
+ * @brief report the pages lost, release the reader slot and the private pages
+ * @param param, reference to the feature input struct
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int bcast_rd_cleanup(void *param){
+	
+	feature_input_t* pfeature_input = param;
+	bcast_reader_t* reader;
+	
+	if(pfeature_input->bcast.header != NULL){
+		reader = &(pfeature_input->bcast.header->readers[pfeature_input->bcast.reader]);
+		printf("Broadcast reader: %u pages read, %u lost\n", reader->nb_read, reader->nb_lost);
+	}
+	
+	free(pfeature_input->shm_buf);
+	pfeature_input->shm_buf = NULL;
+	
+	return bcast_detach(&(pfeature_input->bcast));
+}
+
+/**
+ * int bcast_reattach(feature_input_t* pfeature_input)
+ * @brief Look for the producer after a stall, attach again if it created a new ring
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_SUCCESS if attached, EXIT_FAILURE if there is no ring yet
+ */
+static int bcast_reattach(feature_input_t* pfeature_input){
+	
+	int shmid = shmget(pfeature_input->bcast_key, 0, 0);
+	
+	if(shmid < 0){
+		return EXIT_FAILURE;
+	}
+	
+	/*same ring, it may only be slow*/
+	if(shmid == pfeature_input->bcast.shmid && pfeature_input->bcast.header != NULL){
+		return EXIT_SUCCESS;
+	}
+	
+	bcast_detach(&(pfeature_input->bcast));
+	if(bcast_attach(&(pfeature_input->bcast)) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+	if(pfeature_input->bcast.nb_features != pfeature_input->nb_features){
+		bcast_detach(&(pfeature_input->bcast));
+		return EXIT_FAILURE;
+	}
+	
+	printf("Attached to the producer again\n");
+	fflush(stdout);
+	
+	return EXIT_SUCCESS;
+}
@@ -11,15 +11,21 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include "feature_structure.h"
 #include "fake_feature_generator.h"
 #include "feature_input.h"
+#include "app_clock.h"
 
 #define SAMPLE_LENGTH 220
+#define FAKE_FRAME_PERIOD_US 500000 /*simulated delay between frames*/
 
 extern double randn();
 
+static void generate_frame_info(feature_input_t* pfeature_input, frame_info_t* frame_info);
+static void generate_features(feature_input_t* pfeature_input, int page);
+
 /**
  * int fake_feat_gen_init(void *param)
  * @brief init fake feature generator memory
@@ -29,8 +35,21 @@ extern double randn();
 int fake_feat_gen_init(void *param){
 	
 	feature_input_t* pfeature_input = param;
-	pfeature_input->shm_buf = malloc(pfeature_input->page_size);
-	/*nothing to do*/
+	
+	/*one page per frame, the batch interface uses the whole buffer*/
+	if(pfeature_input->buffer_depth < 1){
+		pfeature_input->buffer_depth = 1;
+	}
+	pfeature_input->shm_buf = alloc_pages(pfeature_input);
+	if(pfeature_input->shm_buf == NULL){
+		return EXIT_FAILURE;
+	}
+	if(alloc_widened(pfeature_input) == EXIT_FAILURE){
+		free(pfeature_input->shm_buf);
+		return EXIT_FAILURE;
+	}
+	pfeature_input->batch_armed = 0x00;
+	
 	return EXIT_SUCCESS;
 }
 
@@ -54,7 +73,7 @@ int fake_feat_gen_request(void *param __attribute__((unused))){
 int fake_feat_gen_wait_for_request_completed(void *param __attribute__((unused))){
 	
 	/*wait to simulate a delay*/
-	usleep(500000);
+	app_clock_sleep_us(FAKE_FRAME_PERIOD_US);
 	
 	return EXIT_SUCCESS;
 }
@@ -69,14 +88,9 @@ int fake_feat_gen_wait_for_request_completed(void *param __attribute__((unused))
 frame_info_t* fake_feat_gen_frame_info_ref(void *param){
 	
 	feature_input_t* pfeature_input = param;
-	frame_info_t* frame_info = (frame_info_t*)pfeature_input->shm_buf;
+	frame_info_t* frame_info = (frame_info_t*)PAGE_REF(pfeature_input, 0);
 	
-	/*randomly generate 10% of blinks*/
-	if((double)rand()/(double)RAND_MAX < 0.1){
-		frame_info->eye_blink_detected = 0x01;
-	}else{
-		frame_info->eye_blink_detected = 0x00;
-	}
+	generate_frame_info(pfeature_input, frame_info);
 	
 	return frame_info;
 }
@@ -90,16 +104,105 @@ frame_info_t* fake_feat_gen_frame_info_ref(void *param){
  */
 double* fake_feat_gen_feature_array_ref(void *param){
 	
-	int i=0;
 	feature_input_t* pfeature_input = param;
-	double* feature_array = (double*)&(pfeature_input->shm_buf[sizeof(frame_info_t)]);
 	
-	/*file the buffer with random values*/
-	for(i=0;i<pfeature_input->nb_features;i++){
-		feature_array[i] = (double)rand()/(double)RAND_MAX;
+	generate_features(pfeature_input, 0);
+
+	return page_features(pfeature_input, 0);
+}
+
+
+/**
+ * int fake_feat_gen_get_batch(void *param, feature_page_view_t *views, int max_views)
+ * @brief non blocking, generates the pages that would have been produced since
+ *        the last call at the simulated frame rate (the first call only starts the clock)
+ * @param reference to the feature input
+ * @param views(out), views on the generated pages
+ * @param max_views, size of views
+ * @return nb of pages generated
+ */
+int fake_feat_gen_get_batch(void *param, feature_page_view_t *views, int max_views){
+	
+	feature_input_t* pfeature_input = param;
+	struct timespec now;
+	long elapsed_us;
+	int nb_pages, i;
+	char* page;
+	
+	app_clock_now(&now);
+	if(!pfeature_input->batch_armed){
+		pfeature_input->batch_time = now;
+		pfeature_input->batch_armed = 0x01;
+		return 0;
+	}
+	
+	/*frames elapsed since the last call*/
+	elapsed_us = (now.tv_sec-pfeature_input->batch_time.tv_sec)*1000000L +
+				 (now.tv_nsec-pfeature_input->batch_time.tv_nsec)/1000L;
+	nb_pages = elapsed_us/FAKE_FRAME_PERIOD_US;
+	
+	/*as a real producer, drop what does not fit in the buffer*/
+	if(nb_pages > max_views || nb_pages > pfeature_input->buffer_depth){
+		nb_pages = (max_views<pfeature_input->buffer_depth)?max_views:pfeature_input->buffer_depth;
+		pfeature_input->batch_time = now;
+	}else{
+		elapsed_us = (long)nb_pages*FAKE_FRAME_PERIOD_US;
+		pfeature_input->batch_time.tv_sec += elapsed_us/1000000L;
+		pfeature_input->batch_time.tv_nsec += (elapsed_us%1000000L)*1000L;
+		if(pfeature_input->batch_time.tv_nsec >= 1000000000L){
+			pfeature_input->batch_time.tv_sec++;
+			pfeature_input->batch_time.tv_nsec -= 1000000000L;
+		}
+	}
+	
+	for(i=0;i<nb_pages;i++){
+		page = PAGE_REF(pfeature_input, i);
+		views[i].frame_info = (frame_info_t*)page;
+		generate_frame_info(pfeature_input, views[i].frame_info);
+		generate_features(pfeature_input, i);
+		views[i].feature_array = page_features(pfeature_input, i);
+	}
+	
+	return nb_pages;
+}
+
+
+/**
+ * void generate_frame_info(feature_input_t* pfeature_input, frame_info_t* frame_info)
+ * @brief randomly flag 10% of the frames as blinks
+ * @param reference to the feature input
+ * @param frame_info(out), frame info to fill
+ */
+static void generate_frame_info(feature_input_t* pfeature_input, frame_info_t* frame_info){
+	
+	if((double)rand_r(&(pfeature_input->seed))/(double)RAND_MAX < 0.1){
+		frame_info->eye_blink_detected = 0x01;
+	}else{
+		frame_info->eye_blink_detected = 0x00;
 	}
+}
+
 
-	return feature_array;
+/**
+ * void generate_features(feature_input_t* pfeature_input, int page)
+ * @brief fill the feature array of a page with random values, in the page format
+ * @param reference to the feature input
+ * @param page, page to fill
+ */
+static void generate_features(feature_input_t* pfeature_input, int page){
+	
+	char* features = &(PAGE_REF(pfeature_input, page)[pfeature_input->feat_offset]);
+	double value;
+	int i;
+	
+	for(i=0;i<pfeature_input->nb_features;i++){
+		value = (double)rand_r(&(pfeature_input->seed))/(double)RAND_MAX;
+		if(pfeature_input->page_format == PAGE_FLOAT32){
+			((float*)features)[i] = (float)value;
+		}else{
+			((double*)features)[i] = value;
+		}
+	}
 }
 
 
@@ -114,6 +217,8 @@ int fake_feat_gen_cleanup(void *param){
 	feature_input_t* pfeature_input = param;
 	
 	free(pfeature_input->shm_buf);
+	free(pfeature_input->widened);
+	pfeature_input->widened = NULL;
 	
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,167 @@
+/**
+ * @file file_feat_reader.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief This file implements the recorded session feature input.
+ *        Pages are read in sequence from a session file, as fast as
+ *        they are requested. The wait fails at the end of the session.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "feature_structure.h"
+#include "feature_input.h"
+#include "file_feat_reader.h"
+#include "session_file.h"
+#include "app_clock.h"
+
+/**
+ * int file_feat_rd_init(void *param)
+ * @brief open the session file, the feature vector size is taken from its header
+ * @param reference to the feature input
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int file_feat_rd_init(void *param){
+
+	feature_input_t* pfeature_input = param;
+
+	if(pfeature_input->file_path == NULL ||
+	   session_file_open(&(pfeature_input->session), pfeature_input->file_path) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	/*the recorded layout has precedence over the configured one, pages hold doubles*/
+	pfeature_input->nb_features = pfeature_input->session.header.nb_features;
+	pfeature_input->page_format = PAGE_FLOAT64;
+	if(set_page_layout(pfeature_input) == EXIT_FAILURE){
+		session_file_close(&(pfeature_input->session));
+		return EXIT_FAILURE;
+	}
+	if(pfeature_input->buffer_depth < 1){
+		pfeature_input->buffer_depth = 1;
+	}
+	pfeature_input->current_page = 0;
+
+	/*start later in the session, through the index of compressed ones*/
+	if(pfeature_input->replay_start > 0 &&
+	   session_file_seek(&(pfeature_input->session),
+						 (int)(pfeature_input->replay_start*pfeature_input->session.header.frame_rate)) == EXIT_FAILURE){
+		fprintf(stderr, "%s: can't start at %.1f s, the session is shorter\n",
+				pfeature_input->file_path, pfeature_input->replay_start);
+		session_file_close(&(pfeature_input->session));
+		return EXIT_FAILURE;
+	}
+
+	/*one page per frame, the batch interface uses the whole buffer*/
+	pfeature_input->shm_buf = alloc_pages(pfeature_input);
+	if(pfeature_input->shm_buf == NULL){
+		session_file_close(&(pfeature_input->session));
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int file_feat_rd_request(void *param)
+ * @brief request a new sample (do nothing)
+ * @param reference to the feature input
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int file_feat_rd_request(void *param __attribute__((unused))){
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int file_feat_rd_wait_for_request_completed(void *param)
+ * @brief read the next page of the session, as fast as possible on the real
+ *        clock, a frame period later on the simulated one
+ * @param reference to the feature input
+ * @return EXIT_FAILURE at the end of the session, EXIT_SUCCESS otherwise
+ */
+int file_feat_rd_wait_for_request_completed(void *param){
+
+	feature_input_t* pfeature_input = param;
+
+	if(session_file_read_page(&(pfeature_input->session),
+							  (frame_info_t*)PAGE_REF(pfeature_input, 0),
+							  (double*)&(PAGE_REF(pfeature_input, 0)[pfeature_input->feat_offset])) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	app_clock_advance_us((long)(1000000/pfeature_input->session.header.frame_rate));
+	return EXIT_SUCCESS;
+}
+
+/**
+ * frame_info_t* file_feat_rd_frame_info_ref(void *param)
+ * @brief get a handle on the current frame info
+ * @param reference to the feature input
+ * @return pointer to frame info
+ */
+frame_info_t* file_feat_rd_frame_info_ref(void *param){
+
+	feature_input_t* pfeature_input = param;
+	return (frame_info_t*)PAGE_REF(pfeature_input, 0);
+}
+
+/**
+ * double* file_feat_rd_feature_array_ref(void *param)
+ * @brief get a handle on the current feature array
+ * @param reference to the feature input
+ * @return pointer to feature array
+ */
+double* file_feat_rd_feature_array_ref(void *param){
+
+	feature_input_t* pfeature_input = param;
+	return (double*)&(PAGE_REF(pfeature_input, 0)[pfeature_input->feat_offset]);
+}
+
+/**
+ * int file_feat_rd_get_batch(void *param, feature_page_view_t *views, int max_views)
+ * @brief read up to a buffer of pages at once
+ * @param reference to the feature input
+ * @param views(out), views on the pages read
+ * @param max_views, size of views
+ * @return nb of pages read, 0 at the end of the session
+ */
+int file_feat_rd_get_batch(void *param, feature_page_view_t *views, int max_views){
+
+	feature_input_t* pfeature_input = param;
+	char* page;
+	int i;
+
+	for(i=0;i<max_views && i<pfeature_input->buffer_depth;i++){
+
+		page = PAGE_REF(pfeature_input, i);
+		views[i].frame_info = (frame_info_t*)page;
+		views[i].feature_array = (double*)&(page[pfeature_input->feat_offset]);
+
+		if(session_file_read_page(&(pfeature_input->session), views[i].frame_info,
+								  views[i].feature_array) == EXIT_FAILURE){
+			break;
+		}
+		app_clock_advance_us((long)(1000000/pfeature_input->session.header.frame_rate));
+	}
+
+	return i;
+}
+
+/**
+ * int file_feat_rd_cleanup(void *param)
+ * @brief close the session file and free the page
+ * @param reference to the feature input
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int file_feat_rd_cleanup(void *param){
+
+	feature_input_t* pfeature_input = param;
+
+	free(pfeature_input->shm_buf);
+	pfeature_input->shm_buf = NULL;
+
+	return session_file_close(&(pfeature_input->session));
+}
@@ -6,10 +6,17 @@
  * 		  and providing a blocking call to wait for the news sample
  */
 
+#define _GNU_SOURCE /*semtimedop*/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/sem.h>
@@ -18,6 +25,15 @@
 #include "feature_input.h"
 #include "shm_rd_buf.h"
 
+static int attach_sysv_segment(feature_input_t* pfeature_input);
+static int attach_posix_segment(feature_input_t* pfeature_input);
+static int open_posix_segment(feature_input_t* pfeature_input);
+static void detach_segment(feature_input_t* pfeature_input);
+static char segment_replaced(feature_input_t* pfeature_input);
+static int shm_rd_reattach(feature_input_t* pfeature_input);
+static int negotiate_layout(feature_input_t* pfeature_input);
+static void prefault_segment(feature_input_t* pfeature_input);
+
 /**
  * int shm_rd_init(void *param)
  * @brief Setups the shared memory input (memory and semaphores linkage)
@@ -32,20 +48,28 @@ int shm_rd_init(void *param){
 	feature_input_t* pfeature_input = param;
 	
     /*
-     * initialise the shared memory array
+     * initialise the shared memory array, pages then header
      */
-    if ((pfeature_input->shmid = shmget(pfeature_input->shm_key, pfeature_input->buffer_depth*pfeature_input->page_size, IPC_CREAT | 0666)) < 0) {
-        perror("shmget");
-        return EXIT_FAILURE;
-    }
-		
-    /*
-     * Now we attach it to our data space.
-     */
-    if ((pfeature_input->shm_buf = shmat(pfeature_input->shmid, NULL, 0)) == (char *) -1) {
-        perror("shmat");
-        return EXIT_FAILURE;
-    }
+	pfeature_input->shm_size = pfeature_input->pages_offset+
+							   (size_t)pfeature_input->buffer_depth*pfeature_input->page_stride;
+	if(pfeature_input->shm_hugepages){
+		pfeature_input->shm_size = (pfeature_input->shm_size+HUGEPAGE_SIZE-1)/HUGEPAGE_SIZE*HUGEPAGE_SIZE;
+	}
+	
+	if(pfeature_input->shm_backing == SHM_BACKING_POSIX){
+		if(attach_posix_segment(pfeature_input) == EXIT_FAILURE){
+			return EXIT_FAILURE;
+		}
+	}
+	else if(attach_sysv_segment(pfeature_input) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+	
+	if(negotiate_layout(pfeature_input) == EXIT_FAILURE ||
+	   alloc_widened(pfeature_input) == EXIT_FAILURE){
+		shm_rd_cleanup(pfeature_input);
+		return EXIT_FAILURE;
+	}
     
     /*
      * Access the semaphore array.
@@ -61,6 +85,11 @@ int shm_rd_init(void *param){
 	/*set as if the current page was the last, such that the next page read will
 	  be the first one*/
 	pfeature_input->current_page = pfeature_input->buffer_depth-1;
+	pfeature_input->nb_pending = 0;
+	pfeature_input->batch_armed = 0x00;
+	pfeature_input->stalled = 0x00;
+	pfeature_input->nb_stalls = 0;
+	pfeature_input->recovery_ms = 0;
 
 	/*set all semaphores to 0*/
 	for(i=0;i<4;i++){
@@ -99,24 +128,55 @@ int shm_rd_request(void *param){
 
 
 /**
- * int shm_rd_request(void *param)
- * @brief Blocking call, until a sample has arrived
+ * int shm_rd_wait_for_request_completed(void *param)
+ * @brief Blocking call, until a sample has arrived or the producer stayed silent
+ *        for the stall timeout. While the producer is silent, each call looks for
+ *        it again (new semaphore set or segment) and waits a short slice.
  * @param param, reference to the feature input struct
- * @return EXIT_FAILURE for unknown type, EXIT_SUCCESS for known/success
+ * @return EXIT_SUCCESS, FEAT_INPUT_STALLED, EXIT_FAILURE if interrupted
  */
 int shm_rd_wait_for_request_completed(void *param){
 	
 	feature_input_t* pfeature_input = param;
+	struct timespec timeout;
+	long timeout_ms;
+	int res;
+	
+	/*the producer went silent, look for it again*/
+	if(pfeature_input->stalled && shm_rd_reattach(pfeature_input) == EXIT_FAILURE){
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = STALL_RETRY_MS*1000000L;
+		nanosleep(&timeout, NULL);
+		return FEAT_INPUT_STALLED;
+	}
 	
 	/*wait for features to be ready*/
 	pfeature_input->sops->sem_num = PREPROC_OUT_READY; 
 	pfeature_input->sops->sem_op = -1;
 	pfeature_input->sops->sem_flg = 0;	
 	
-	if(semop(pfeature_input->semid, pfeature_input->sops, 1) != 0){
+	if(pfeature_input->stall_timeout <= 0){
+		res = semop(pfeature_input->semid, pfeature_input->sops, 1);
+	}else{
+		timeout_ms = pfeature_input->stalled?STALL_RETRY_MS:(long)(pfeature_input->stall_timeout*1000);
+		timeout.tv_sec = timeout_ms/1000;
+		timeout.tv_nsec = (timeout_ms%1000)*1000000L;
+		res = semtimedop(pfeature_input->semid, pfeature_input->sops, 1, &timeout);
+	}
+	
+	if(res != 0){
+		/*silent, or its semaphore set was removed*/
+		if(pfeature_input->stall_timeout > 0 && (errno == EAGAIN || errno == EIDRM || errno == EINVAL)){
+			return report_input_stall(pfeature_input);
+		}
 		return EXIT_FAILURE;
 	}
 	
+	/*first page after a stall*/
+	if(pfeature_input->stalled){
+		report_input_recovery(pfeature_input);
+	}
+	
 	/*update page id*/
 	pfeature_input->current_page += 1;
 	pfeature_input->current_page %= pfeature_input->buffer_depth;
@@ -134,8 +194,7 @@ frame_info_t* shm_get_frame_info_ref(void *param){
 	
 	feature_input_t* pfeature_input = param;
 	/*compute offset of current page*/
-	int offset = pfeature_input->current_page*pfeature_input->page_size;
-	return (frame_info_t*)&(pfeature_input->shm_buf[offset]);
+	return (frame_info_t*)PAGE_REF(pfeature_input, pfeature_input->current_page);
 }
 
 /**
@@ -147,9 +206,78 @@ frame_info_t* shm_get_frame_info_ref(void *param){
 double* shm_get_feature_array_ref(void *param){
 	
 	feature_input_t* pfeature_input = param;
-	/*compute offset of current page and skip frame info*/
-	int offset = pfeature_input->current_page*pfeature_input->page_size + sizeof(frame_info_t);
-	return (double*)&(pfeature_input->shm_buf[offset]);
+	/*skip frame info and padding, widen float32 features*/
+	return page_features(pfeature_input, pfeature_input->current_page);
+}
+
+
+/**
+ * int shm_rd_get_batch(void *param, feature_page_view_t *views, int max_views)
+ * @brief Non blocking call, hands out all the pages completed since the last call.
+ *        The pages of the previous batch are released to the producer first (on
+ *        the first call, the whole buffer is opened), then the completed pages are
+ *        taken in a single semaphore operation. Not to be mixed with request/wait.
+ * @param param, reference to the feature input struct
+ * @param views(out), views on the completed pages, oldest first
+ * @param max_views, size of views
+ * @return nb of pages handed out, -1 on error
+ */
+int shm_rd_get_batch(void *param, feature_page_view_t *views, int max_views){
+	
+	feature_input_t* pfeature_input = param;
+	struct sembuf sops[2];
+	int nb_release, nb_ready, nb_pages, i;
+	char* page;
+	
+	/*release the pages of the last batch, or open the whole buffer*/
+	nb_release = pfeature_input->batch_armed?pfeature_input->nb_pending:pfeature_input->buffer_depth;
+	if(nb_release > 0){
+		sops[0].sem_num = PREPROC_IN_READY;
+		sops[0].sem_op = nb_release;
+		sops[0].sem_flg = IPC_NOWAIT;
+		sops[1].sem_num = APP_IN_READY;
+		sops[1].sem_op = nb_release;
+		sops[1].sem_flg = IPC_NOWAIT;
+		semop(pfeature_input->semid, sops, 2);
+	}
+	pfeature_input->batch_armed = 0x01;
+	pfeature_input->nb_pending = 0;
+	
+	/*count the completed pages*/
+	nb_ready = semctl(pfeature_input->semid, PREPROC_OUT_READY, GETVAL);
+	if(nb_ready < 0){
+		return -1;
+	}
+	nb_pages = nb_ready;
+	if(nb_pages > max_views){
+		nb_pages = max_views;
+	}
+	if(nb_pages > pfeature_input->buffer_depth){
+		nb_pages = pfeature_input->buffer_depth;
+	}
+	if(nb_pages == 0){
+		return 0;
+	}
+	
+	/*take them all at once*/
+	sops[0].sem_num = PREPROC_OUT_READY;
+	sops[0].sem_op = -nb_pages;
+	sops[0].sem_flg = IPC_NOWAIT;
+	if(semop(pfeature_input->semid, sops, 1) != 0){
+		return 0;
+	}
+	
+	/*pages are filled in order*/
+	for(i=0;i<nb_pages;i++){
+		pfeature_input->current_page += 1;
+		pfeature_input->current_page %= pfeature_input->buffer_depth;
+		page = PAGE_REF(pfeature_input, pfeature_input->current_page);
+		views[i].frame_info = (frame_info_t*)page;
+		views[i].feature_array = page_features(pfeature_input, pfeature_input->current_page);
+	}
+	pfeature_input->nb_pending = nb_pages;
+	
+	return nb_pages;
 }
 
 
@@ -163,8 +291,281 @@ int shm_rd_cleanup(void *param){
 	
 	feature_input_t* pfeature_input = param;
 	
-	/* Detach the shared memory segment. */
-	shmdt(pfeature_input->shm_buf);
+	/* Detach the shared memory segment, the segment is left to the producer */
+	detach_segment(pfeature_input);
+	free(pfeature_input->widened);
+	pfeature_input->widened = NULL;
+	
+	return EXIT_SUCCESS;
+}
+
+
+/**
+ * int attach_sysv_segment(feature_input_t* pfeature_input)
+ * @brief Get and attach the SysV segment (huge pages on request), then
+ *        fault its pages in
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_FAILURE, EXIT_SUCCESS
+ */
+static int attach_sysv_segment(feature_input_t* pfeature_input){
+	
+	int flags = IPC_CREAT | 0666;
+	
+	if(pfeature_input->shm_hugepages){
+		flags |= SHM_HUGETLB;
+	}
+	
+	if ((pfeature_input->shmid = shmget(pfeature_input->shm_key, pfeature_input->shm_size, flags)) < 0) {
+		perror("shmget");
+		return EXIT_FAILURE;
+	}
+	
+	if ((pfeature_input->shm_buf = shmat(pfeature_input->shmid, NULL, 0)) == (char *) -1) {
+		perror("shmat");
+		return EXIT_FAILURE;
+	}
+	
+	/*no populate flag on shmat*/
+	prefault_segment(pfeature_input);
+	
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int attach_posix_segment(feature_input_t* pfeature_input)
+ * @brief Open and map the named POSIX segment, populated at mapping time.
+ *        Huge pages segments are files of the hugetlbfs mount, which is
+ *        how a named segment gets huge pages (MAP_HUGETLB is for anonymous maps)
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_FAILURE, EXIT_SUCCESS
+ */
+static int attach_posix_segment(feature_input_t* pfeature_input){
+	
+	struct stat st;
+	
+	if(pfeature_input->shm_name == NULL || pfeature_input->shm_name[0] == '\0'){
+		fprintf(stderr, "shm: no segment name\n");
+		return EXIT_FAILURE;
+	}
+	
+	if((pfeature_input->shm_fd = open_posix_segment(pfeature_input)) < 0){
+		perror("shm_open");
+		return EXIT_FAILURE;
+	}
+	
+	/*size it if we are first, never shrink the producer's segment*/
+	if(fstat(pfeature_input->shm_fd, &st) != 0 ||
+	   ((size_t)st.st_size < pfeature_input->shm_size &&
+		ftruncate(pfeature_input->shm_fd, pfeature_input->shm_size) != 0)){
+		perror("shm size");
+		close(pfeature_input->shm_fd);
+		return EXIT_FAILURE;
+	}
+	
+	pfeature_input->shm_buf = mmap(NULL, pfeature_input->shm_size, PROT_READ | PROT_WRITE,
+								   MAP_SHARED | MAP_POPULATE, pfeature_input->shm_fd, 0);
+	if(pfeature_input->shm_buf == MAP_FAILED){
+		perror("mmap");
+		close(pfeature_input->shm_fd);
+		return EXIT_FAILURE;
+	}
+	
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int open_posix_segment(feature_input_t* pfeature_input)
+ * @brief Open (or create) the named POSIX segment, on the hugetlbfs mount on request
+ * @param pfeature_input, reference to the feature input struct
+ * @return file descriptor, -1 on failure
+ */
+static int open_posix_segment(feature_input_t* pfeature_input){
+	
+	char path[MAX_SHM_PATH];
+	const char* name = pfeature_input->shm_name;
+	
+	if(pfeature_input->shm_hugepages){
+		snprintf(path, MAX_SHM_PATH, "%s/%s", HUGEPAGE_MOUNT, (name[0]=='/')?name+1:name);
+		return open(path, O_RDWR | O_CREAT, 0666);
+	}
+	return shm_open(name, O_RDWR | O_CREAT, 0666);
+}
+
+/**
+ * void detach_segment(feature_input_t* pfeature_input)
+ * @brief Unmap or detach the segment, if attached
+ * @param pfeature_input, reference to the feature input struct
+ */
+static void detach_segment(feature_input_t* pfeature_input){
+	
+	if(pfeature_input->shm_buf == NULL){
+		return;
+	}
+	
+	if(pfeature_input->shm_backing == SHM_BACKING_POSIX){
+		munmap(pfeature_input->shm_buf, pfeature_input->shm_size);
+		close(pfeature_input->shm_fd);
+	}else{
+		shmdt(pfeature_input->shm_buf);
+	}
+	pfeature_input->shm_buf = NULL;
+}
+
+/**
+ * char segment_replaced(feature_input_t* pfeature_input)
+ * @brief Check if the segment under our key (or name) is not the one we attached
+ * @param pfeature_input, reference to the feature input struct
+ * @return 1 if replaced or removed, 0 otherwise
+ */
+static char segment_replaced(feature_input_t* pfeature_input){
+	
+	struct stat current, attached;
+	int fd;
+	char replaced;
+	
+	if(pfeature_input->shm_buf == NULL){
+		return 0x01;
+	}
+	
+	if(pfeature_input->shm_backing == SHM_BACKING_POSIX){
+		if((fd = open_posix_segment(pfeature_input)) < 0){
+			return 0x01;
+		}
+		replaced = fstat(fd, &current) != 0 || fstat(pfeature_input->shm_fd, &attached) != 0 ||
+				   current.st_ino != attached.st_ino;
+		close(fd);
+		return replaced;
+	}
+	
+	return shmget(pfeature_input->shm_key, 0, 0) != pfeature_input->shmid;
+}
+
+/**
+ * int shm_rd_reattach(feature_input_t* pfeature_input)
+ * @brief Look for the producer after a stall. If it created its semaphore set or
+ *        segment again (restart), attach to the new ones and send our request again,
+ *        the one it had is lost. If they are the same, keep waiting on them.
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_SUCCESS if attached, EXIT_FAILURE if the producer is not back yet
+ */
+static int shm_rd_reattach(feature_input_t* pfeature_input){
+	
+	int semid = semget(pfeature_input->sem_key, NB_SEM, 0);
+	
+	/*no semaphore set yet*/
+	if(semid < 0){
+		return EXIT_FAILURE;
+	}
+	
+	/*same objects, it may only be slow*/
+	if(semid == pfeature_input->semid && !segment_replaced(pfeature_input)){
+		return EXIT_SUCCESS;
+	}
+	
+	detach_segment(pfeature_input);
+	if(pfeature_input->shm_backing == SHM_BACKING_POSIX){
+		if(attach_posix_segment(pfeature_input) == EXIT_FAILURE){
+			pfeature_input->shm_buf = NULL;
+			return EXIT_FAILURE;
+		}
+	}
+	else if(attach_sysv_segment(pfeature_input) == EXIT_FAILURE){
+		pfeature_input->shm_buf = NULL;
+		return EXIT_FAILURE;
+	}
+	if(negotiate_layout(pfeature_input) == EXIT_FAILURE ||
+	   alloc_widened(pfeature_input) == EXIT_FAILURE){
+		detach_segment(pfeature_input);
+		return EXIT_FAILURE;
+	}
+	
+	/*start over from the first page*/
+	pfeature_input->semid = semid;
+	pfeature_input->current_page = pfeature_input->buffer_depth-1;
+	pfeature_input->nb_pending = 0;
+	pfeature_input->batch_armed = 0x00;
+	shm_rd_request(pfeature_input);
+	
+	printf("Attached to the producer again\n");
+	fflush(stdout);
+	
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int negotiate_layout(feature_input_t* pfeature_input)
+ * @brief Aligned layout only. If the producer already described the segment,
+ *        adopt its page geometry and feature type when it holds the same
+ *        vector, otherwise describe ours for the producer to follow.
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_FAILURE on mismatch, EXIT_SUCCESS
+ */
+static int negotiate_layout(feature_input_t* pfeature_input){
+	
+	shm_layout_t* layout = (shm_layout_t*)pfeature_input->shm_buf;
+	int feature_size;
+	
+	if(pfeature_input->layout != LAYOUT_ALIGNED){
+		return EXIT_SUCCESS;
+	}
+	
+	if(__atomic_load_n(&(layout->magic), __ATOMIC_ACQUIRE) == SHM_LAYOUT_MAGIC){
+		
+		/*version 1 producers only write doubles*/
+		feature_size = (layout->version == SHM_LAYOUT_VERSION)?(int)sizeof(double):layout->feature_size;
+		
+		if((layout->version != SHM_LAYOUT_VERSION && layout->version != SHM_LAYOUT_VERSION_FORMAT) ||
+		   (feature_size != sizeof(float) && feature_size != sizeof(double)) ||
+		   layout->nb_features != pfeature_input->nb_features ||
+		   layout->buffer_depth != pfeature_input->buffer_depth ||
+		   layout->feat_offset < (int)sizeof(frame_info_t) ||
+		   layout->feat_offset%feature_size != 0 ||
+		   layout->page_stride < layout->feat_offset+pfeature_input->nb_features*feature_size ||
+		   pfeature_input->pages_offset+(size_t)layout->buffer_depth*layout->page_stride > pfeature_input->shm_size){
+			fprintf(stderr, "shm: segment layout (%i features, %i pages) does not match the configuration\n",
+					layout->nb_features, layout->buffer_depth);
+			return EXIT_FAILURE;
+		}
+		pfeature_input->feat_offset = layout->feat_offset;
+		pfeature_input->page_stride = layout->page_stride;
+		pfeature_input->feature_size = feature_size;
+		pfeature_input->page_size = sizeof(frame_info_t)+pfeature_input->nb_features*feature_size;
+		pfeature_input->page_format = (feature_size == sizeof(float))?PAGE_FLOAT32:PAGE_FLOAT64;
+	}
+	else{
+		/*float64 segments stay readable by version 1 consumers*/
+		layout->version = (pfeature_input->page_format == PAGE_FLOAT32)?SHM_LAYOUT_VERSION_FORMAT:SHM_LAYOUT_VERSION;
+		layout->feature_size = pfeature_input->feature_size;
+		layout->nb_features = pfeature_input->nb_features;
+		layout->buffer_depth = pfeature_input->buffer_depth;
+		layout->feat_offset = pfeature_input->feat_offset;
+		layout->page_stride = pfeature_input->page_stride;
+		/*magic last, the description is complete once it is seen*/
+		__atomic_store_n(&(layout->magic), SHM_LAYOUT_MAGIC, __ATOMIC_RELEASE);
+	}
+	
+	printf("shm layout: %s features at +%i, page stride %i\n",
+		   (pfeature_input->page_format == PAGE_FLOAT32)?"float32":"float64",
+		   pfeature_input->feat_offset, pfeature_input->page_stride);
 	
 	return EXIT_SUCCESS;
 }
+
+/**
+ * void prefault_segment(feature_input_t* pfeature_input)
+ * @brief Touch every page of the segment (read only, the producer may
+ *        already be writing), so the first frames do not fault
+ * @param pfeature_input, reference to the feature input struct
+ */
+static void prefault_segment(feature_input_t* pfeature_input){
+	
+	volatile char* buf = pfeature_input->shm_buf;
+	size_t step = pfeature_input->shm_hugepages?HUGEPAGE_SIZE:(size_t)sysconf(_SC_PAGESIZE);
+	size_t i;
+	char sink = 0;
+	
+	for(i=0;i<pfeature_input->shm_size;i+=step){
+		sink += buf[i];
+	}
+	(void)sink;
+}
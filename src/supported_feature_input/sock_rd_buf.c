@@ -0,0 +1,556 @@
+/**
+ * @file sock_rd_buf.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Feature input reading pages shared by the producer through a Unix socket
+ *        (see sock_rd_buf.h). The pages are in a memfd passed with SCM_RIGHTS and
+ *        the pages requested and completed are counted on two eventfds, so nothing
+ *        is looked up by key and the producer is found by its socket path only.
+ *        The request/wait and batch semantics are the ones of the SHM input.
+ */
+
+#define _GNU_SOURCE /*MSG_CMSG_CLOEXEC*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "feature_structure.h"
+#include "feature_input.h"
+#include "sock_rd_buf.h"
+
+#define SOCK_NO_PRODUCER 2 /*sock_connect, nobody listening on the path*/
+
+static int sock_connect(feature_input_t* pfeature_input);
+static int sock_handshake(feature_input_t* pfeature_input);
+static int adopt_geometry(feature_input_t* pfeature_input, sock_geometry_t* setup);
+static int wait_completed(feature_input_t* pfeature_input, int timeout_ms);
+static void sock_disconnect(feature_input_t* pfeature_input);
+static int sock_rd_reattach(feature_input_t* pfeature_input);
+static void reset_pages(feature_input_t* pfeature_input);
+
+/**
+ * int sock_rd_init(void *param)
+ * @brief connect to the producer and map its pages. A producer not started yet
+ *        is not an error, the first wait looks for it.
+ * @param param, reference to the feature input struct
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int sock_rd_init(void *param){
+
+	feature_input_t* pfeature_input = param;
+	struct sockaddr_un addr;
+	int res;
+
+	pfeature_input->sock_fd = -1;
+	pfeature_input->done_fd = -1;
+	pfeature_input->request_fd = -1;
+	pfeature_input->epoll_fd = -1;
+	pfeature_input->shm_fd = -1;
+	pfeature_input->shm_buf = NULL;
+	pfeature_input->stalled = 0x00;
+	pfeature_input->nb_stalls = 0;
+	pfeature_input->recovery_ms = 0;
+	reset_pages(pfeature_input);
+
+	if(pfeature_input->sock_path == NULL || pfeature_input->sock_path[0] == '\0' ||
+	   strlen(pfeature_input->sock_path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "sock: no producer socket or path too long\n");
+		return EXIT_FAILURE;
+	}
+
+	res = sock_connect(pfeature_input);
+	if(res == SOCK_NO_PRODUCER){
+		printf("No producer on %s yet, waiting for it\n", pfeature_input->sock_path);
+		fflush(stdout);
+		return EXIT_SUCCESS;
+	}
+
+	return res;
+}
+
+/**
+ * int sock_rd_request(void *param)
+ * @brief let the producer fill the next page
+ * @param param, reference to the feature input struct
+ * @return EXIT_FAILURE/EXIT_SUCCESS
+ */
+int sock_rd_request(void *param){
+
+	feature_input_t* pfeature_input = param;
+	uint64_t one = 1;
+
+	/*not connected, a request is sent on connection*/
+	if(pfeature_input->request_fd < 0){
+		return EXIT_SUCCESS;
+	}
+
+	if(write(pfeature_input->request_fd, &one, sizeof(one)) != sizeof(one)){
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int sock_rd_wait_for_request_completed(void *param)
+ * @brief Blocking call, until a page is completed or the producer stayed silent
+ *        for the stall timeout. A producer that hung up (or was never there) is
+ *        connected to again, one attempt per call.
+ * @param param, reference to the feature input struct
+ * @return EXIT_SUCCESS, FEAT_INPUT_STALLED, EXIT_FAILURE if interrupted
+ */
+int sock_rd_wait_for_request_completed(void *param){
+
+	feature_input_t* pfeature_input = param;
+	struct timespec retry = {0, STALL_RETRY_MS*1000000L};
+	int timeout_ms = -1;
+	int res;
+
+	if(pfeature_input->stall_timeout > 0){
+		timeout_ms = pfeature_input->stalled?STALL_RETRY_MS:(int)(pfeature_input->stall_timeout*1000);
+	}
+
+	/*not connected, look for the producer and send our request again*/
+	if(pfeature_input->sock_fd < 0){
+		if(sock_rd_reattach(pfeature_input) == EXIT_FAILURE){
+			nanosleep(&retry, NULL);
+			return report_input_stall(pfeature_input);
+		}
+		sock_rd_request(pfeature_input);
+	}
+
+	res = wait_completed(pfeature_input, timeout_ms);
+	if(res == FEAT_INPUT_STALLED){
+		return report_input_stall(pfeature_input);
+	}
+	if(res != EXIT_SUCCESS){
+		return EXIT_FAILURE;
+	}
+
+	/*first page after a stall*/
+	if(pfeature_input->stalled){
+		report_input_recovery(pfeature_input);
+	}
+
+	/*pages are filled in order*/
+	pfeature_input->nb_ready--;
+	pfeature_input->current_page += 1;
+	pfeature_input->current_page %= pfeature_input->buffer_depth;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * frame_info_t* sock_get_frame_info_ref(void *param)
+ * @brief Call to get a reference to the frame info of the current page
+ * @param param, reference to the feature input struct
+ * @return references to the frame info
+ */
+frame_info_t* sock_get_frame_info_ref(void *param){
+
+	feature_input_t* pfeature_input = param;
+	return (frame_info_t*)PAGE_REF(pfeature_input, pfeature_input->current_page);
+}
+
+/**
+ * double* sock_get_feature_array_ref(void *param)
+ * @brief Call to get a reference to the feature vector of the current page
+ * @param param, reference to the feature input struct
+ * @return reference to the feature vector
+ */
+double* sock_get_feature_array_ref(void *param){
+
+	feature_input_t* pfeature_input = param;
+	/*skip frame info and padding, widen float32 features*/
+	return page_features(pfeature_input, pfeature_input->current_page);
+}
+
+/**
+ * int sock_rd_get_batch(void *param, feature_page_view_t *views, int max_views)
+ * @brief Non blocking call, hands out all the pages completed since the last call.
+ *        The pages of the previous batch are released to the producer first (on
+ *        the first call, the whole buffer is opened). Not to be mixed with request/wait.
+ * @param param, reference to the feature input struct
+ * @param views(out), views on the completed pages, oldest first
+ * @param max_views, size of views
+ * @return nb of pages handed out
+ */
+int sock_rd_get_batch(void *param, feature_page_view_t *views, int max_views){
+
+	feature_input_t* pfeature_input = param;
+	uint64_t nb_release;
+	int nb_pages, i;
+	char* page;
+
+	if(pfeature_input->sock_fd < 0 && sock_rd_reattach(pfeature_input) == EXIT_FAILURE){
+		return 0;
+	}
+
+	/*release the pages of the last batch, or open the whole buffer*/
+	nb_release = pfeature_input->batch_armed?pfeature_input->nb_pending:pfeature_input->buffer_depth;
+	if(nb_release > 0 && write(pfeature_input->request_fd, &nb_release, sizeof(nb_release)) != sizeof(nb_release)){
+		return 0;
+	}
+	pfeature_input->batch_armed = 0x01;
+	pfeature_input->nb_pending = 0;
+
+	if(wait_completed(pfeature_input, 0) != EXIT_SUCCESS){
+		return 0;
+	}
+
+	nb_pages = (pfeature_input->nb_ready < (unsigned long)max_views)?(int)pfeature_input->nb_ready:max_views;
+	if(nb_pages > pfeature_input->buffer_depth){
+		nb_pages = pfeature_input->buffer_depth;
+	}
+
+	for(i=0;i<nb_pages;i++){
+		pfeature_input->current_page += 1;
+		pfeature_input->current_page %= pfeature_input->buffer_depth;
+		page = PAGE_REF(pfeature_input, pfeature_input->current_page);
+		views[i].frame_info = (frame_info_t*)page;
+		views[i].feature_array = page_features(pfeature_input, pfeature_input->current_page);
+	}
+	pfeature_input->nb_ready -= nb_pages;
+	pfeature_input->nb_pending = nb_pages;
+
+	return nb_pages;
+}
+
+/**
+ * int sock_rd_cleanup(void *param)
+ * @brief unmap the pages and close the connection, the producer sees the hang up
+ * @param param, reference to the feature input struct
+ * @return EXIT_SUCCESS
+ */
+int sock_rd_cleanup(void *param){
+
+	feature_input_t* pfeature_input = param;
+
+	sock_disconnect(pfeature_input);
+	free(pfeature_input->widened);
+	pfeature_input->widened = NULL;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int sock_connect(feature_input_t* pfeature_input)
+ * @brief connect to the producer socket, exchange the geometry and map the pages
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_SUCCESS, SOCK_NO_PRODUCER if nobody listens, EXIT_FAILURE otherwise
+ */
+static int sock_connect(feature_input_t* pfeature_input){
+
+	struct sockaddr_un addr;
+	struct timeval timeout = {SOCK_SETUP_TIMEOUT_MS/1000, (SOCK_SETUP_TIMEOUT_MS%1000)*1000};
+	struct epoll_event event;
+
+	if((pfeature_input->sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0){
+		perror("sock socket");
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, pfeature_input->sock_path);
+	if(connect(pfeature_input->sock_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		close(pfeature_input->sock_fd);
+		pfeature_input->sock_fd = -1;
+		return SOCK_NO_PRODUCER;
+	}
+
+	/*a producer that accepts but never answers must not hang the app*/
+	setsockopt(pfeature_input->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	if(sock_handshake(pfeature_input) == EXIT_FAILURE || alloc_widened(pfeature_input) == EXIT_FAILURE){
+		sock_disconnect(pfeature_input);
+		return EXIT_FAILURE;
+	}
+
+	/*the app only reads, the producer may seal the pages against writes*/
+	pfeature_input->shm_buf = mmap(NULL, pfeature_input->shm_size, PROT_READ,
+								   MAP_SHARED | MAP_POPULATE, pfeature_input->shm_fd, 0);
+	if(pfeature_input->shm_buf == MAP_FAILED){
+		perror("sock mmap");
+		pfeature_input->shm_buf = NULL;
+		sock_disconnect(pfeature_input);
+		return EXIT_FAILURE;
+	}
+
+	/*pages completed, and the hang up of the producer*/
+	if((pfeature_input->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+		perror("sock epoll");
+		sock_disconnect(pfeature_input);
+		return EXIT_FAILURE;
+	}
+	event.events = EPOLLIN;
+	event.data.fd = pfeature_input->done_fd;
+	if(epoll_ctl(pfeature_input->epoll_fd, EPOLL_CTL_ADD, pfeature_input->done_fd, &event) != 0){
+		perror("sock epoll");
+		sock_disconnect(pfeature_input);
+		return EXIT_FAILURE;
+	}
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.fd = pfeature_input->sock_fd;
+	if(epoll_ctl(pfeature_input->epoll_fd, EPOLL_CTL_ADD, pfeature_input->sock_fd, &event) != 0){
+		perror("sock epoll");
+		sock_disconnect(pfeature_input);
+		return EXIT_FAILURE;
+	}
+
+	printf("Connected to the producer on %s, %s features at +%i, page stride %i\n", pfeature_input->sock_path,
+		   (pfeature_input->page_format == PAGE_FLOAT32)?"float32":"float64",
+		   pfeature_input->feat_offset, pfeature_input->page_stride);
+	fflush(stdout);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int sock_handshake(feature_input_t* pfeature_input)
+ * @brief send our geometry, receive the producer's with the memfd and the eventfds
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_SUCCESS, EXIT_FAILURE (the descriptors received are kept for sock_disconnect)
+ */
+static int sock_handshake(feature_input_t* pfeature_input){
+
+	sock_geometry_t hello, setup;
+	char control[CMSG_SPACE(SOCK_NB_FDS*sizeof(int))];
+	int fds[SOCK_NB_FDS] = {-1, -1, -1};
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	ssize_t len;
+	int nb_fds, i;
+
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = SOCK_PROTO_MAGIC;
+	hello.version = SOCK_PROTO_VERSION;
+	hello.nb_features = pfeature_input->nb_features;
+	hello.buffer_depth = pfeature_input->buffer_depth;
+	hello.feature_size = pfeature_input->feature_size;
+	hello.feat_offset = pfeature_input->feat_offset;
+	hello.page_stride = pfeature_input->page_stride;
+	hello.pages_offset = pfeature_input->pages_offset;
+	if(send(pfeature_input->sock_fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)){
+		perror("sock hello");
+		return EXIT_FAILURE;
+	}
+
+	iov.iov_base = &setup;
+	iov.iov_len = sizeof(setup);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	len = recvmsg(pfeature_input->sock_fd, &msg, MSG_CMSG_CLOEXEC);
+
+	/*the descriptors are ours whatever the answer, extra ones are closed*/
+	for(cmsg=CMSG_FIRSTHDR(&msg);len>0 && cmsg!=NULL;cmsg=CMSG_NXTHDR(&msg, cmsg)){
+		if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS){
+			continue;
+		}
+		nb_fds = (cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+		for(i=0;i<nb_fds;i++){
+			if(i < SOCK_NB_FDS && fds[i] < 0){
+				memcpy(&(fds[i]), CMSG_DATA(cmsg)+i*sizeof(int), sizeof(int));
+			}else{
+				close(*(int*)(CMSG_DATA(cmsg)+i*sizeof(int)));
+			}
+		}
+	}
+	pfeature_input->shm_fd = fds[SOCK_FD_PAGES];
+	pfeature_input->done_fd = fds[SOCK_FD_DONE];
+	pfeature_input->request_fd = fds[SOCK_FD_REQUEST];
+
+	if(len != sizeof(setup) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))){
+		fprintf(stderr, "sock: no setup from the producer\n");
+		return EXIT_FAILURE;
+	}
+	if(setup.magic != SOCK_PROTO_MAGIC || setup.version != SOCK_PROTO_VERSION){
+		fprintf(stderr, "sock: producer protocol not recognized\n");
+		return EXIT_FAILURE;
+	}
+	if(setup.status != 0){
+		fprintf(stderr, "sock: producer refused the pages: %s\n", strerror(setup.status));
+		return EXIT_FAILURE;
+	}
+	if(fds[SOCK_FD_PAGES] < 0 || fds[SOCK_FD_DONE] < 0 || fds[SOCK_FD_REQUEST] < 0){
+		fprintf(stderr, "sock: descriptors missing from the setup\n");
+		return EXIT_FAILURE;
+	}
+
+	/*the waits read the done counter before sleeping on it*/
+	if(fcntl(pfeature_input->done_fd, F_SETFL, O_NONBLOCK) != 0){
+		perror("sock eventfd");
+		return EXIT_FAILURE;
+	}
+
+	return adopt_geometry(pfeature_input, &setup);
+}
+
+/**
+ * int adopt_geometry(feature_input_t* pfeature_input, sock_geometry_t* setup)
+ * @brief adopt the page geometry and feature type of the producer when it holds
+ *        the same vector and its memfd is large enough for it
+ * @param pfeature_input, reference to the feature input struct
+ * @param setup, geometry of the producer
+ * @return EXIT_FAILURE on mismatch, EXIT_SUCCESS
+ */
+static int adopt_geometry(feature_input_t* pfeature_input, sock_geometry_t* setup){
+
+	struct stat st;
+	size_t size = setup->pages_offset+(size_t)setup->buffer_depth*setup->page_stride;
+
+	if((setup->feature_size != sizeof(float) && setup->feature_size != sizeof(double)) ||
+	   setup->nb_features != pfeature_input->nb_features ||
+	   setup->buffer_depth != pfeature_input->buffer_depth ||
+	   setup->pages_offset < 0 || setup->pages_offset%setup->feature_size != 0 ||
+	   setup->feat_offset < (int)sizeof(frame_info_t) ||
+	   setup->feat_offset%setup->feature_size != 0 ||
+	   setup->page_stride%setup->feature_size != 0 ||
+	   setup->page_stride < setup->feat_offset+pfeature_input->nb_features*setup->feature_size){
+		fprintf(stderr, "sock: producer pages (%i features, %i pages) do not match the configuration\n",
+				setup->nb_features, setup->buffer_depth);
+		return EXIT_FAILURE;
+	}
+
+	if(fstat(pfeature_input->shm_fd, &st) != 0 || (size_t)st.st_size < size){
+		fprintf(stderr, "sock: producer memfd smaller than its pages\n");
+		return EXIT_FAILURE;
+	}
+
+	pfeature_input->shm_size = size;
+	pfeature_input->pages_offset = setup->pages_offset;
+	pfeature_input->feat_offset = setup->feat_offset;
+	pfeature_input->page_stride = setup->page_stride;
+	pfeature_input->feature_size = setup->feature_size;
+	pfeature_input->page_size = sizeof(frame_info_t)+pfeature_input->nb_features*setup->feature_size;
+	pfeature_input->page_format = (setup->feature_size == sizeof(float))?PAGE_FLOAT32:PAGE_FLOAT64;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int wait_completed(feature_input_t* pfeature_input, int timeout_ms)
+ * @brief take the pages completed since the last call, waiting for one up to the
+ *        timeout if there is none. The pages completed before a hang up are still
+ *        handed out, the connection is closed once they are.
+ * @param pfeature_input, reference to the feature input struct (connected)
+ * @param timeout_ms, -1 waits forever, 0 does not wait
+ * @return EXIT_SUCCESS if pages are ready, FEAT_INPUT_STALLED on timeout or hang up,
+ *         EXIT_FAILURE if interrupted
+ */
+static int wait_completed(feature_input_t* pfeature_input, int timeout_ms){
+
+	struct epoll_event events[2];
+	uint64_t count;
+	char hung_up = 0x00;
+	int nb_events, i;
+
+	while(1){
+
+		/*the counter is cleared by the read, it is non blocking*/
+		if(read(pfeature_input->done_fd, &count, sizeof(count)) == sizeof(count)){
+			pfeature_input->nb_ready += count;
+		}
+		if(pfeature_input->nb_ready > 0){
+			return EXIT_SUCCESS;
+		}
+
+		if(hung_up){
+			printf("Producer hung up\n");
+			fflush(stdout);
+			sock_disconnect(pfeature_input);
+			return FEAT_INPUT_STALLED;
+		}
+
+		nb_events = epoll_wait(pfeature_input->epoll_fd, events, 2, timeout_ms);
+		if(nb_events < 0){
+			return EXIT_FAILURE;
+		}
+		if(nb_events == 0){
+			return FEAT_INPUT_STALLED;
+		}
+
+		/*the producer never writes after the setup, anything on the socket is its end*/
+		for(i=0;i<nb_events;i++){
+			if(events[i].data.fd == pfeature_input->sock_fd){
+				hung_up = 0x01;
+			}
+		}
+	}
+}
+
+/**
+ * void sock_disconnect(feature_input_t* pfeature_input)
+ * @brief unmap the pages and close the descriptors that are open
+ * @param pfeature_input, reference to the feature input struct
+ */
+static void sock_disconnect(feature_input_t* pfeature_input){
+
+	if(pfeature_input->shm_buf != NULL){
+		munmap(pfeature_input->shm_buf, pfeature_input->shm_size);
+		pfeature_input->shm_buf = NULL;
+	}
+	if(pfeature_input->epoll_fd >= 0){
+		close(pfeature_input->epoll_fd);
+		pfeature_input->epoll_fd = -1;
+	}
+	if(pfeature_input->shm_fd >= 0){
+		close(pfeature_input->shm_fd);
+		pfeature_input->shm_fd = -1;
+	}
+	if(pfeature_input->done_fd >= 0){
+		close(pfeature_input->done_fd);
+		pfeature_input->done_fd = -1;
+	}
+	if(pfeature_input->request_fd >= 0){
+		close(pfeature_input->request_fd);
+		pfeature_input->request_fd = -1;
+	}
+	if(pfeature_input->sock_fd >= 0){
+		close(pfeature_input->sock_fd);
+		pfeature_input->sock_fd = -1;
+	}
+	pfeature_input->nb_ready = 0;
+}
+
+/**
+ * int sock_rd_reattach(feature_input_t* pfeature_input)
+ * @brief Connect to the producer again after a hang up (or for the first time),
+ *        and start over from the first page. The caller sends its request again.
+ * @param pfeature_input, reference to the feature input struct
+ * @return EXIT_SUCCESS if connected, EXIT_FAILURE if the producer is not there yet
+ */
+static int sock_rd_reattach(feature_input_t* pfeature_input){
+
+	if(sock_connect(pfeature_input) != EXIT_SUCCESS){
+		return EXIT_FAILURE;
+	}
+	reset_pages(pfeature_input);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void reset_pages(feature_input_t* pfeature_input)
+ * @brief set as if the current page was the last, the next page read is the first one
+ * @param pfeature_input, reference to the feature input struct
+ */
+static void reset_pages(feature_input_t* pfeature_input){
+
+	pfeature_input->current_page = pfeature_input->buffer_depth-1;
+	pfeature_input->nb_ready = 0;
+	pfeature_input->nb_pending = 0;
+	pfeature_input->batch_armed = 0x00;
+}
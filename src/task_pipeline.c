@@ -0,0 +1,378 @@
+/**
+ * @file task_pipeline.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief The task loop as three stages connected by SPSC queues (see task_pipeline.h).
+ * The end of the task flows down the queues: the acquire stage stops requesting
+ * frames once the task is over and pushes a last frame, the process stage turns it
+ * into a last sample, the output stage drains the samples up to it. No stage is
+ * left waiting on a queue nobody will fill.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "task_pipeline.h"
+#include "feature_input.h"
+#include "app_clock.h"
+#include "buzzer_output.h"
+
+static void* acquire_stage(void* param);
+static void* process_stage(void* param);
+static char acquire_frame_item(task_pipeline_t* pipeline);
+static char process_frame_item(task_pipeline_t* pipeline);
+static char output_sample_item(task_pipeline_t* pipeline);
+static void record_sample(flight_recorder_t* flight, pipeline_sample_t* sample, struct timespec* tone_time);
+static void publish_sample(live_state_t* live, pipeline_sample_t* sample, int pitch);
+static double interval_ms(struct timespec* from, struct timespec* to);
+
+static const char* queue_names[NB_PIPELINE_QUEUES] = {"acquire->process", "process->output"};
+
+/**
+ * int run_task_pipeline(task_pipeline_t* pipeline)
+ * @brief blocking call, run the task until its duration is reached, the signal
+ * handler stops it or the input fails. The output stage runs on the calling thread.
+ * @param pipeline, task pipeline
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the stages can't be started
+ */
+int run_task_pipeline(task_pipeline_t* pipeline){
+
+	pipeline->queue[PIPELINE_FRAMES].depth = pipeline->depth;
+	pipeline->queue[PIPELINE_FRAMES].slot_size = sizeof(pipeline_frame_t) +
+		pipeline->feature_proc->feature_input->nb_features*sizeof(double);
+	pipeline->queue[PIPELINE_SAMPLES].depth = pipeline->depth;
+	pipeline->queue[PIPELINE_SAMPLES].slot_size = sizeof(pipeline_sample_t);
+
+	if(init_spsc_queue(&(pipeline->queue[PIPELINE_FRAMES])) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+	if(init_spsc_queue(&(pipeline->queue[PIPELINE_SAMPLES])) == EXIT_FAILURE){
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_FRAMES]));
+		return EXIT_FAILURE;
+	}
+	metrics_set_queue(pipeline->metrics, PIPELINE_SAMPLES, &(pipeline->queue[PIPELINE_SAMPLES]));
+	metrics_set_queue(pipeline->metrics, PIPELINE_FRAMES, &(pipeline->queue[PIPELINE_FRAMES]));
+
+	app_clock_now(&(pipeline->task_time));
+	__atomic_store_n(pipeline->task_running, 0x01, __ATOMIC_RELAXED);
+	pipeline->first_feedback = 0x01;
+	init_smoothing_filter(pipeline->filter);
+
+	/*a simulated clock is moved by the input, the stages take turns so the times
+	  seen by the output (task duration) don't depend on how far the acquisition
+	  got ahead*/
+	if(app_clock_type() == APP_CLOCK_SIMULATED){
+		while(acquire_frame_item(pipeline)){
+			process_frame_item(pipeline);
+			output_sample_item(pipeline);
+		}
+		process_frame_item(pipeline);
+		output_sample_item(pipeline);
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_FRAMES]));
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_SAMPLES]));
+		return EXIT_SUCCESS;
+	}
+
+	if(pthread_create(&(pipeline->acquire_thread), NULL, acquire_stage, pipeline) != 0){
+		perror("acquire stage");
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_FRAMES]));
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_SAMPLES]));
+		return EXIT_FAILURE;
+	}
+	if(pthread_create(&(pipeline->process_thread), NULL, process_stage, pipeline) != 0){
+		perror("process stage");
+		/*the acquire stage stops on the flag, its frames are drained here*/
+		__atomic_store_n(pipeline->task_running, 0x00, __ATOMIC_RELAXED);
+		while(((pipeline_frame_t*)spsc_peek(&(pipeline->queue[PIPELINE_FRAMES])))->status != EXIT_FAILURE){
+			spsc_pop(&(pipeline->queue[PIPELINE_FRAMES]));
+		}
+		pthread_join(pipeline->acquire_thread, NULL);
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_FRAMES]));
+		clean_up_spsc_queue(&(pipeline->queue[PIPELINE_SAMPLES]));
+		return EXIT_FAILURE;
+	}
+
+	while(output_sample_item(pipeline));
+
+	pthread_join(pipeline->acquire_thread, NULL);
+	pthread_join(pipeline->process_thread, NULL);
+	clean_up_spsc_queue(&(pipeline->queue[PIPELINE_FRAMES]));
+	clean_up_spsc_queue(&(pipeline->queue[PIPELINE_SAMPLES]));
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void print_pipeline_stats(task_pipeline_t* pipeline)
+ * @brief show the occupancy of the queues on console. A queue often full is
+ * drained by a stage slower than the one feeding it, a queue often empty
+ * waits on the stage feeding it.
+ * @param pipeline, task pipeline (after run)
+ */
+void print_pipeline_stats(task_pipeline_t* pipeline){
+
+	int i;
+	spsc_queue_t* queue;
+
+	for(i=0;i<NB_PIPELINE_QUEUES;i++){
+		queue = &(pipeline->queue[i]);
+		printf("Queue %s: mean %.2f, max %lu of %i slots, %lu full, %lu empty\n",
+			   queue_names[i], spsc_mean_occupancy(queue), queue->max_occupancy, queue->depth,
+			   queue->nb_full, queue->nb_empty);
+	}
+	fflush(stdout);
+}
+
+/**
+ * void* acquire_stage(void* param)
+ * @brief thread requesting the frames, until the task is over or the input fails
+ * @param param, (task_pipeline_t*) task pipeline
+ * @return NULL
+ */
+static void* acquire_stage(void* param){
+
+	while(acquire_frame_item((task_pipeline_t*)param));
+	return NULL;
+}
+
+/**
+ * void* process_stage(void* param)
+ * @brief thread turning the frames into samples, until the last frame
+ * @param param, (task_pipeline_t*) task pipeline
+ * @return NULL
+ */
+static void* process_stage(void* param){
+
+	while(process_frame_item((task_pipeline_t*)param));
+	return NULL;
+}
+
+/**
+ * char acquire_frame_item(task_pipeline_t* pipeline)
+ * @brief request a frame and copy it out of the input, or push the last frame
+ * once the task is over
+ * @param pipeline, task pipeline
+ * @return 1 if more frames follow, 0 after the last one
+ */
+static char acquire_frame_item(task_pipeline_t* pipeline){
+
+	spsc_queue_t* queue = &(pipeline->queue[PIPELINE_FRAMES]);
+	pipeline_frame_t* frame = spsc_claim(queue);
+
+	if(!__atomic_load_n(pipeline->task_running, __ATOMIC_RELAXED)){
+		frame->status = EXIT_FAILURE;
+		spsc_push(queue);
+		return 0x00;
+	}
+
+	app_clock_now(&(frame->request_time));
+	frame->status = copy_next_frame(pipeline->feature_proc, &(frame->frame_info), frame->feature_array);
+	frame->frame_time = pipeline->feature_proc->frame_time;
+	spsc_push(queue);
+
+	/*the input stopped, that was the last frame*/
+	return frame->status != EXIT_FAILURE;
+}
+
+/**
+ * char process_frame_item(task_pipeline_t* pipeline)
+ * @brief normalize a frame, smooth the sample and map it to the pitch scale
+ * @param pipeline, task pipeline
+ * @return 1 if more frames follow, 0 after the last one
+ */
+static char process_frame_item(task_pipeline_t* pipeline){
+
+	feat_proc_t* feature_proc = pipeline->feature_proc;
+	pipeline_frame_t* frame = spsc_peek(&(pipeline->queue[PIPELINE_FRAMES]));
+	pipeline_sample_t* sample = spsc_claim(&(pipeline->queue[PIPELINE_SAMPLES]));
+	struct timespec start;
+	char status = frame->status;
+	int i;
+
+	sample->request_time = frame->request_time;
+	sample->frame_time = frame->frame_time;
+
+	if(status == EXIT_FAILURE){
+		sample->sample_status = SAMPLE_NO_FRAME;
+	}else if(status == FEAT_INPUT_STALLED){
+		sample->sample_status = SAMPLE_STALLED;
+	}else{
+		app_clock_now(&start);
+		sample->sample_status = normalize_frame(feature_proc, &(frame->frame_info), frame->feature_array);
+		metrics_add_latency(pipeline->metrics, STAGE_PROCESS, &start);
+		app_clock_now(&(sample->processed_time));
+
+		/*smooth the sample, using the configured filter, and map it to the pitch scale*/
+		sample->feedback_time = sample->processed_time;
+		sample->smoothed = smooth_sample(pipeline->filter, feature_proc->sample);
+		sample->pitch = get_pitch(pipeline->pitch_map, sample->smoothed);
+		sample->step = pipeline->pitch_map->current_step;
+
+		sample->sample = feature_proc->sample;
+		sample->band_value[0] = feature_proc->band_value[0];
+		sample->band_value[1] = feature_proc->band_value[1];
+		sample->eye_blink = feature_proc->eye_blink;
+		sample->reject_reason = feature_proc->reject_reason;
+	}
+	sample->nb_frames = feature_proc->artifact.nb_frames;
+	sample->nb_rejected = 0;
+	for(i=0;i<NB_ARTIFACT_REASONS;i++){
+		sample->nb_rejected += feature_proc->artifact.counters[i];
+	}
+	sample->nb_held = feature_proc->nb_held;
+	sample->nb_expired = feature_proc->nb_expired;
+
+	spsc_push(&(pipeline->queue[PIPELINE_SAMPLES]));
+	spsc_pop(&(pipeline->queue[PIPELINE_FRAMES]));
+
+	return status != EXIT_FAILURE;
+}
+
+/**
+ * char output_sample_item(task_pipeline_t* pipeline)
+ * @brief update the buzzer and report a sample. Ends the task once its duration
+ * is reached, on any sample (stalled ones included), the samples still queued
+ * are then dropped.
+ * @param pipeline, task pipeline
+ * @return 1 if more samples follow, 0 after the last one
+ */
+static char output_sample_item(task_pipeline_t* pipeline){
+
+	pipeline_sample_t* sample = spsc_peek(&(pipeline->queue[PIPELINE_SAMPLES]));
+	struct timespec tone_time;
+
+	/*no frame to process, the task is over or the input stopped*/
+	if(sample->sample_status == SAMPLE_NO_FRAME){
+		spsc_pop(&(pipeline->queue[PIPELINE_SAMPLES]));
+		return 0x00;
+	}
+	if(!__atomic_load_n(pipeline->task_running, __ATOMIC_RELAXED)){
+		spsc_pop(&(pipeline->queue[PIPELINE_SAMPLES]));
+		return 0x01;
+	}
+
+	/*the producer is silent, no stale tone while the input looks for it*/
+	if(sample->sample_status == SAMPLE_STALLED){
+		mute_buzzer();
+		record_sample(pipeline->flight, sample, &(sample->request_time));
+		publish_sample(pipeline->live, sample, 0);
+	}else{
+
+		/*update the buzzer*/
+		set_buzzer_pitch(sample->pitch);
+		app_clock_now(&tone_time);
+		metrics_add_latency(pipeline->metrics, STAGE_FEEDBACK, &(sample->feedback_time));
+		metrics_set_feedback(pipeline->metrics, sample->smoothed, sample->pitch);
+
+		/*time from the start button to the first frame and the first tone*/
+		if(pipeline->first_feedback){
+			printf("First frame in %.0f ms, first feedback in %.0f ms\n",
+				   interval_ms(pipeline->session_time, &(pipeline->feature_proc->first_frame_time)),
+				   app_clock_elapsed_ms(pipeline->session_time));
+			pipeline->first_feedback = 0x00;
+		}
+
+		/*show sample value on console*/
+		printf("sample value: %i\n", sample->step);
+
+		metrics_add_latency(pipeline->metrics, STAGE_LOOP, &(sample->request_time));
+		record_sample(pipeline->flight, sample, &tone_time);
+		publish_sample(pipeline->live, sample, sample->pitch);
+	}
+
+	/*check if one of the stop conditions is met, the producer may never come back*/
+	if(pipeline->test_duration*1000 < app_clock_elapsed_ms(&(pipeline->task_time))){
+		__atomic_store_n(pipeline->task_running, 0x00, __ATOMIC_RELAXED);
+	}
+
+	spsc_pop(&(pipeline->queue[PIPELINE_SAMPLES]));
+	return 0x01;
+}
+
+/**
+ * void record_sample(flight_recorder_t* flight, pipeline_sample_t* sample, struct timespec* tone_time)
+ * @brief keep a sample in the flight recorder, times are relative to the frame request
+ * @param flight, flight recorder, NULL if disabled
+ * @param sample, sample
+ * @param tone_time, buzzer updated
+ */
+static void record_sample(flight_recorder_t* flight, pipeline_sample_t* sample, struct timespec* tone_time){
+
+	flight_record_t record;
+
+	if(flight == NULL){
+		return;
+	}
+
+	record.start_ns = (uint64_t)sample->request_time.tv_sec*1000000000ULL+sample->request_time.tv_nsec;
+	record.loop_us = app_clock_elapsed_ms(&(sample->request_time))*1000;
+
+	/*a stalled input got no frame*/
+	if(sample->sample_status == SAMPLE_STALLED){
+		record.acquire_us = 0;
+		record.process_us = 0;
+		record.feedback_us = 0;
+		record.band[0] = 0;
+		record.band[1] = 0;
+		record.sample = 0;
+		record.smoothed = 0;
+		record.pitch = 0;
+		record.eye_blink = 0;
+		record.reject_reason = 0;
+	}else{
+		record.acquire_us = interval_ms(&(sample->request_time), &(sample->frame_time))*1000;
+		record.process_us = interval_ms(&(sample->request_time), &(sample->processed_time))*1000;
+		record.feedback_us = interval_ms(&(sample->request_time), tone_time)*1000;
+		record.band[0] = sample->band_value[0];
+		record.band[1] = sample->band_value[1];
+		record.sample = sample->sample;
+		record.smoothed = sample->smoothed;
+		record.pitch = sample->pitch;
+		record.eye_blink = sample->eye_blink;
+		record.reject_reason = sample->reject_reason;
+	}
+	record.sample_status = sample->sample_status;
+
+	flight_record(flight, &record);
+}
+
+/**
+ * void publish_sample(live_state_t* live, pipeline_sample_t* sample, int pitch)
+ * @brief publish a sample as played in the live state
+ * @param live, live state, NULL if disabled
+ * @param sample, sample
+ * @param pitch, buzzer command
+ */
+static void publish_sample(live_state_t* live, pipeline_sample_t* sample, int pitch){
+
+	if(live == NULL){
+		return;
+	}
+
+	live->current.sample_status = sample->sample_status;
+	live->current.pitch = pitch;
+	if(sample->sample_status != SAMPLE_STALLED){
+		live->current.step = sample->step;
+		live->current.sample = sample->sample;
+		live->current.smoothed = sample->smoothed;
+	}
+	live->current.nb_frames = sample->nb_frames;
+	live->current.nb_rejected = sample->nb_rejected;
+	live->current.nb_held = sample->nb_held;
+	live->current.nb_expired = sample->nb_expired;
+	live_publish(live);
+}
+
+/**
+ * double interval_ms(struct timespec* from, struct timespec* to)
+ * @brief time between two instants
+ * @param from, first instant
+ * @param to, second instant
+ * @return interval (ms)
+ */
+static double interval_ms(struct timespec* from, struct timespec* to){
+	return (to->tv_sec-from->tv_sec)*1000.0 + (to->tv_nsec-from->tv_nsec)/1000000.0;
+}
@@ -14,9 +14,19 @@
 #include <stdint.h>
 
 #include "xml.h"
+#include "pitch_map.h"
+#include "smoothing_filter.h"
+#include "session_codec.h"
+#include "feature_input.h"
+#include "app_clock.h"
+#include "spsc_queue.h"
 
 static int get_app_attributes(ezxml_t app_attribute, appconfig_t * app_info);
 static int sanity_check_app_attributes(ezxml_t app_attribute);
+static char get_optional_bool(ezxml_t app_attribute, const char *name, char default_value);
+static int get_optional_int(ezxml_t app_attribute, const char *name, int default_value);
+static double get_optional_double(ezxml_t app_attribute, const char *name, double default_value);
+static void get_optional_string(ezxml_t app_attribute, const char *name, char *value, size_t size);
 
 const char *XML_app_elements[] =
     { "debug", "feature_source", "nb_channels", "window_width", "timeseries", "fft", "power_alpha",
@@ -84,6 +94,12 @@ static int get_app_attributes(ezxml_t app_attribute, appconfig_t * app_info)
 		app_info->feature_source = FAKE_INPUT;
 	} else if (strcmp(tmp->txt, "SHM") == 0) {
 		app_info->feature_source = SHM_INPUT;
+	} else if (strcmp(tmp->txt, "FILE") == 0) {
+		app_info->feature_source = FILE_INPUT;
+	} else if (strcmp(tmp->txt, "BCAST") == 0) {
+		app_info->feature_source = BCAST_INPUT;
+	} else if (strcmp(tmp->txt, "SOCK") == 0) {
+		app_info->feature_source = SOCK_INPUT;
 	} else {
 		app_info->feature_source = 0;
 	}
@@ -205,9 +221,336 @@ static int get_app_attributes(ezxml_t app_attribute, appconfig_t * app_info)
 	}
 	app_info->avg_kernel = atof(tmp->txt);
 
+	/*Optional elements, older config files keep working with the defaults */
+	/*Artifact rejection */
+	app_info->artifact_rejection = get_optional_bool(app_attribute, "artifact_rejection", 1);
+	app_info->sampling_rate = get_optional_double(app_attribute, "sampling_rate", 220.0);
+	app_info->line_freq = get_optional_double(app_attribute, "line_freq", 60.0);
+	app_info->artifact_amplitude_z = get_optional_double(app_attribute, "artifact_amplitude_z", 5.0);
+	app_info->artifact_flat_var = get_optional_double(app_attribute, "artifact_flat_var", 1e-12);
+	app_info->artifact_line_ratio = get_optional_double(app_attribute, "artifact_line_ratio", 0.5);
+	app_info->artifact_muscle_ratio = get_optional_double(app_attribute, "artifact_muscle_ratio", 0.7);
+
+	/*Rejected frames policy */
+	app_info->hold_policy = HOLD_LAST_VALUE;
+	tmp = ezxml_child(app_attribute, "hold_policy");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "HOLD") == 0) {
+			app_info->hold_policy = HOLD_LAST_VALUE;
+		} else if (strcmp(tmp->txt, "DECAY") == 0) {
+			app_info->hold_policy = HOLD_DECAY;
+		} else {
+			printf("appAttributes->hold_policy unknown, HOLD or DECAY\n");
+			return (-1);
+		}
+	}
+	app_info->max_hold_time = get_optional_double(app_attribute, "max_hold_time", 1.5);
+
+	/*Training statistics, median and MAD are robust to the frames past the detectors */
+	app_info->calibration = CALIBRATION_MEAN_STD;
+	tmp = ezxml_child(app_attribute, "calibration");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "MEAN_STD") == 0) {
+			app_info->calibration = CALIBRATION_MEAN_STD;
+		} else if (strcmp(tmp->txt, "MEDIAN_MAD") == 0) {
+			app_info->calibration = CALIBRATION_MEDIAN_MAD;
+		} else {
+			printf("appAttributes->calibration unknown, MEAN_STD or MEDIAN_MAD\n");
+			return (-1);
+		}
+	}
+
+	/*Stored references, a recent one replaces the training by a short refinement */
+	get_optional_string(app_attribute, "calibration_store", app_info->calibration_store, MAX_PATH_LENGTH);
+	get_optional_string(app_attribute, "user_id", app_info->user_id, MAX_CHAR_FIELD_LENGTH);
+	app_info->warm_start_age = get_optional_double(app_attribute, "warm_start_age", 12.0);
+	app_info->refine_set_size = get_optional_int(app_attribute, "refine_set_size", 5);
+	if (app_info->calibration_store[0] != '\0') {
+		/*the store outlives the working directory and holds one reference per user */
+		if (app_info->calibration_store[0] != '/') {
+			printf("appAttributes->calibration_store must be an absolute path\n");
+			return (-1);
+		}
+		if (app_info->user_id[0] == '\0' || strcmp(app_info->user_id, "default") == 0) {
+			printf("appAttributes->user_id must name the user when calibration_store is set\n");
+			return (-1);
+		}
+		if (app_info->refine_set_size < 0 || app_info->refine_set_size > app_info->training_set_size) {
+			printf("appAttributes->refine_set_size must be from 0 to training_set_size\n");
+			return (-1);
+		}
+	}
+
+	/*Band values, the timeseries source needs the timeseries section */
+	app_info->band_source = BAND_SOURCE_FFT;
+	tmp = ezxml_child(app_attribute, "band_source");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "FFT") == 0) {
+			app_info->band_source = BAND_SOURCE_FFT;
+		} else if (strcmp(tmp->txt, "TIMESERIES") == 0) {
+			if (!app_info->timeseries) {
+				printf("appAttributes->band_source TIMESERIES needs the timeseries section\n");
+				return (-1);
+			}
+			app_info->band_source = BAND_SOURCE_TIMESERIES;
+		} else {
+			printf("appAttributes->band_source unknown, FFT or TIMESERIES\n");
+			return (-1);
+		}
+	}
+
+	/*Individual alpha frequency, the default band is 3 bins centred on 10 Hz at 2 Hz per bin */
+	app_info->iaf = get_optional_bool(app_attribute, "iaf", 0);
+	app_info->iaf_min_freq = get_optional_double(app_attribute, "iaf_min_freq", 7.0);
+	app_info->iaf_max_freq = get_optional_double(app_attribute, "iaf_max_freq", 13.0);
+	app_info->iaf_half_width = get_optional_double(app_attribute, "iaf_half_width", 3.0);
+	app_info->iaf_tracking_time = get_optional_double(app_attribute, "iaf_tracking_time", 30.0);
+	if (app_info->iaf && (app_info->iaf_min_freq >= app_info->iaf_max_freq || app_info->iaf_half_width <= 0)) {
+		printf("appAttributes->iaf_min_freq must be below iaf_max_freq and iaf_half_width positive\n");
+		return (-1);
+	}
+
+	/*Pitch mapping */
+	app_info->pitch_scale = PITCH_SCALE_LINEAR;
+	tmp = ezxml_child(app_attribute, "pitch_scale");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "LINEAR") == 0) {
+			app_info->pitch_scale = PITCH_SCALE_LINEAR;
+		} else if (strcmp(tmp->txt, "LOG") == 0) {
+			app_info->pitch_scale = PITCH_SCALE_LOG;
+		} else if (strcmp(tmp->txt, "CHROMATIC") == 0) {
+			app_info->pitch_scale = PITCH_SCALE_CHROMATIC;
+		} else if (strcmp(tmp->txt, "MAJOR") == 0) {
+			app_info->pitch_scale = PITCH_SCALE_MAJOR;
+		} else if (strcmp(tmp->txt, "PENTATONIC") == 0) {
+			app_info->pitch_scale = PITCH_SCALE_PENTATONIC;
+		} else {
+			printf("appAttributes->pitch_scale unknown, LINEAR, LOG, CHROMATIC, MAJOR or PENTATONIC\n");
+			return (-1);
+		}
+	}
+	app_info->pitch_steps = get_optional_int(app_attribute, "pitch_steps", 100);
+	app_info->pitch_z_min = get_optional_double(app_attribute, "pitch_z_min", -0.16);
+	app_info->pitch_z_max = get_optional_double(app_attribute, "pitch_z_max", 4.0);
+	app_info->pitch_freq_min = get_optional_double(app_attribute, "pitch_freq_min", 220.0);
+	app_info->pitch_freq_max = get_optional_double(app_attribute, "pitch_freq_max", 1760.0);
+	app_info->pitch_hysteresis = get_optional_double(app_attribute, "pitch_hysteresis", 0.25);
+
+	/*Smoothing filter, the one-pole uses avg_kernel */
+	app_info->smoothing_filter = SMOOTH_ONE_POLE;
+	tmp = ezxml_child(app_attribute, "smoothing_filter");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "ONE_POLE") == 0) {
+			app_info->smoothing_filter = SMOOTH_ONE_POLE;
+		} else if (strcmp(tmp->txt, "BIQUAD") == 0) {
+			app_info->smoothing_filter = SMOOTH_BIQUAD;
+		} else if (strcmp(tmp->txt, "ONE_EURO") == 0) {
+			app_info->smoothing_filter = SMOOTH_ONE_EURO;
+		} else if (strcmp(tmp->txt, "MEDIAN") == 0) {
+			app_info->smoothing_filter = SMOOTH_MEDIAN;
+		} else {
+			printf("appAttributes->smoothing_filter unknown, ONE_POLE, BIQUAD, ONE_EURO or MEDIAN\n");
+			return (-1);
+		}
+	}
+	app_info->frame_rate = get_optional_double(app_attribute, "frame_rate", 10.0);
+	app_info->smoothing_cutoff = get_optional_double(app_attribute, "smoothing_cutoff", 1.0);
+	app_info->one_euro_min_cutoff = get_optional_double(app_attribute, "one_euro_min_cutoff", 0.5);
+	app_info->one_euro_beta = get_optional_double(app_attribute, "one_euro_beta", 0.1);
+	app_info->one_euro_d_cutoff = get_optional_double(app_attribute, "one_euro_d_cutoff", 1.0);
+	app_info->median_size = get_optional_int(app_attribute, "median_size", 5);
+
+	/*Recorded sessions */
+	get_optional_string(app_attribute, "session_file", app_info->session_file, MAX_PATH_LENGTH);
+	get_optional_string(app_attribute, "record_dir", app_info->record_dir, MAX_PATH_LENGTH);
+	app_info->record_codec = SESSION_RAW;
+	tmp = ezxml_child(app_attribute, "record_format");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "RAW") == 0) {
+			app_info->record_codec = SESSION_RAW;
+		} else if (strcmp(tmp->txt, "LOSSLESS") == 0) {
+			app_info->record_codec = SESSION_LOSSLESS;
+		} else if (strcmp(tmp->txt, "FLOAT32") == 0) {
+			app_info->record_codec = SESSION_FLOAT32;
+		} else {
+			printf("appAttributes->record_format unknown, RAW, LOSSLESS or FLOAT32\n");
+			return (-1);
+		}
+	}
+	app_info->replay_start = get_optional_double(app_attribute, "replay_start", 0.0);
+
+	/*Feature pages and shared segment, packed SysV by default as older producers */
+	app_info->page_layout = LAYOUT_PACKED;
+	tmp = ezxml_child(app_attribute, "page_layout");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "PACKED") == 0) {
+			app_info->page_layout = LAYOUT_PACKED;
+		} else if (strcmp(tmp->txt, "ALIGNED") == 0) {
+			app_info->page_layout = LAYOUT_ALIGNED;
+		} else {
+			printf("appAttributes->page_layout unknown, PACKED or ALIGNED\n");
+			return (-1);
+		}
+	}
+	app_info->page_format = PAGE_FLOAT64;
+	tmp = ezxml_child(app_attribute, "page_format");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "FLOAT64") == 0) {
+			app_info->page_format = PAGE_FLOAT64;
+		} else if (strcmp(tmp->txt, "FLOAT32") == 0) {
+			app_info->page_format = PAGE_FLOAT32;
+		} else {
+			printf("appAttributes->page_format unknown, FLOAT64 or FLOAT32\n");
+			return (-1);
+		}
+	}
+	app_info->shm_backing = SHM_BACKING_SYSV;
+	tmp = ezxml_child(app_attribute, "shm_backing");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "SYSV") == 0) {
+			app_info->shm_backing = SHM_BACKING_SYSV;
+		} else if (strcmp(tmp->txt, "POSIX") == 0) {
+			app_info->shm_backing = SHM_BACKING_POSIX;
+		} else {
+			printf("appAttributes->shm_backing unknown, SYSV or POSIX\n");
+			return (-1);
+		}
+	}
+	get_optional_string(app_attribute, "shm_name", app_info->shm_name, MAX_PATH_LENGTH);
+	if (app_info->shm_name[0] == '\0') {
+		strcpy(app_info->shm_name, "/braintone_features");
+	}
+	get_optional_string(app_attribute, "feature_socket", app_info->feature_socket, MAX_PATH_LENGTH);
+	if (app_info->feature_socket[0] == '\0') {
+		strcpy(app_info->feature_socket, "/tmp/braintone_features.sock");
+	}
+	app_info->shm_hugepages = get_optional_bool(app_attribute, "shm_hugepages", 0);
+	app_info->producer_idle = get_optional_bool(app_attribute, "producer_idle", 1);
+
+	/*Live state page for the displays */
+	app_info->live_state = get_optional_bool(app_attribute, "live_state", 1);
+
+	/*Queues between the task stages */
+	app_info->pipeline_depth = get_optional_int(app_attribute, "pipeline_depth", 8);
+	if (app_info->pipeline_depth < 2 || app_info->pipeline_depth > SPSC_MAX_DEPTH ||
+	    (app_info->pipeline_depth & (app_info->pipeline_depth - 1)) != 0) {
+		printf("appAttributes->pipeline_depth must be a power of 2, from 2 to %i\n", SPSC_MAX_DEPTH);
+		return (-1);
+	}
+
+	/*Config hot reload */
+	app_info->hot_reload = get_optional_bool(app_attribute, "hot_reload", 1);
+
+	/*Clock of the sessions, simulated only on inputs that don't wait on a producer */
+	app_info->clock = APP_CLOCK_REAL;
+	tmp = ezxml_child(app_attribute, "clock");
+	if (tmp != NULL) {
+		if (strcmp(tmp->txt, "REAL") == 0) {
+			app_info->clock = APP_CLOCK_REAL;
+		} else if (strcmp(tmp->txt, "SIMULATED") == 0) {
+			if (app_info->feature_source != FAKE_INPUT && app_info->feature_source != FILE_INPUT) {
+				printf("appAttributes->clock SIMULATED needs a FAKE or FILE feature source\n");
+				return (-1);
+			}
+			app_info->clock = APP_CLOCK_SIMULATED;
+		} else {
+			printf("appAttributes->clock unknown, REAL or SIMULATED\n");
+			return (-1);
+		}
+	}
+
+	/*Startup, producers without readiness handshake are waited for the timeout */
+	app_info->ready_timeout = get_optional_double(app_attribute, "ready_timeout", 2.0);
+	app_info->task_pause = get_optional_double(app_attribute, "task_pause", 0.0);
+
+	/*Producer supervision */
+	app_info->hw_timeout = get_optional_double(app_attribute, "hw_timeout", 0.0);
+	app_info->stall_timeout = get_optional_double(app_attribute, "stall_timeout", 2.0);
+
+	/*Metrics endpoint */
+	get_optional_string(app_attribute, "metrics_socket", app_info->metrics_socket, MAX_PATH_LENGTH);
+
+	/*Flight recorder, dumped on anomalies or SIGUSR2 */
+	app_info->flight_duration = get_optional_double(app_attribute, "flight_duration", 10.0);
+	get_optional_string(app_attribute, "flight_dir", app_info->flight_dir, MAX_PATH_LENGTH);
+	if (app_info->flight_dir[0] == '\0') {
+		strcpy(app_info->flight_dir, "/tmp");
+	}
+	app_info->flight_latency = get_optional_double(app_attribute, "flight_latency", 250.0);
+	app_info->flight_rejections = get_optional_int(app_attribute, "flight_rejections", 20);
+
 	return (0);
 }
 
+/**
+ * get_optional_bool(ezxml_t app_attribute, const char *name, char default_value)
+ * @brief read an optional TRUE/FALSE element
+ * @param app_attribute, reference to xml file
+ * @param name, element name
+ * @param default_value, value used when the element is missing
+ * @return element value
+ */
+static char get_optional_bool(ezxml_t app_attribute, const char *name, char default_value)
+{
+	ezxml_t tmp = ezxml_child(app_attribute, name);
+	if (tmp == NULL) {
+		return default_value;
+	}
+	return (strncmp(tmp->txt, "TRUE", 4) == 0) ? 1 : 0;
+}
+
+/**
+ * get_optional_int(ezxml_t app_attribute, const char *name, int default_value)
+ * @brief read an optional integer element
+ * @param app_attribute, reference to xml file
+ * @param name, element name
+ * @param default_value, value used when the element is missing
+ * @return element value
+ */
+static int get_optional_int(ezxml_t app_attribute, const char *name, int default_value)
+{
+	ezxml_t tmp = ezxml_child(app_attribute, name);
+	if (tmp == NULL) {
+		return default_value;
+	}
+	return atoi(tmp->txt);
+}
+
+/**
+ * get_optional_double(ezxml_t app_attribute, const char *name, double default_value)
+ * @brief read an optional floating point element
+ * @param app_attribute, reference to xml file
+ * @param name, element name
+ * @param default_value, value used when the element is missing
+ * @return element value
+ */
+static double get_optional_double(ezxml_t app_attribute, const char *name, double default_value)
+{
+	ezxml_t tmp = ezxml_child(app_attribute, name);
+	if (tmp == NULL) {
+		return default_value;
+	}
+	return atof(tmp->txt);
+}
+
+/**
+ * get_optional_string(ezxml_t app_attribute, const char *name, char *value, size_t size)
+ * @brief read an optional text element, empty string when missing
+ * @param app_attribute, reference to xml file
+ * @param name, element name
+ * @param (out)value, element text
+ * @param size, size of value
+ */
+static void get_optional_string(ezxml_t app_attribute, const char *name, char *value, size_t size)
+{
+	ezxml_t tmp = ezxml_child(app_attribute, name);
+	value[0] = '\0';
+	if (tmp != NULL && tmp->txt != NULL) {
+		strncpy(value, tmp->txt, size - 1);
+		value[size - 1] = '\0';
+	}
+}
+
 /**
  * XML_exists(char *file)
  * @brief Checks to see if a file exists
@@ -276,14 +619,15 @@ static int parse_menu_XML(char *file, appconfig_t * app_info)
 	// Are app attributes defined?
 	if ((app_attributes = ezxml_child(app_config, "appAttributes")) == NULL) {
 		printf("appAttributes is missing\n");
-		return (-1);
+		err = -1;
 	}
 	// Parse application attributes from XML
-	if (get_app_attributes(app_attributes, app_info) < 0) {
+	else if (get_app_attributes(app_attributes, app_info) < 0) {
 		printf("appAttributes error\n");
-		return (-1);
+		err = -1;
 	}
 
+	// the tree is freed on errors too, a reload parses the file again on every save
 	ezxml_free(app_config);
 	return err;
 }
@@ -302,14 +646,13 @@ appconfig_t *xml_initialize(char *filename)
 		printf("Unable to malloc config structure\n");
 		return NULL;
 	}
-	set_appconfig(config_obj);
 
-	if (XML_exists(filename) < 0) {
-		return NULL;
-	}
-	if (parse_menu_XML(filename, config_obj) < 0) {
+	/*published only once complete, the file may be re-parsed while running */
+	if (XML_exists(filename) < 0 || parse_menu_XML(filename, config_obj) < 0) {
+		free(config_obj);
 		return NULL;
 	}
+	set_appconfig(config_obj);
 
 	return config_obj;
 }
@@ -0,0 +1,222 @@
+/**
+ * @file bcast_bench.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Throughput of the broadcast ring (bcast_ring.c) with 1, 2 and 4 reader
+ * processes. The producer publishes pages as fast as it can, each reader copies
+ * them out and checks they are not torn (all features of a page hold its number).
+ * The pages lost by each reader and the rates are reported. Optionally, the last
+ * reader is slowed down, to show it loses pages without slowing the others.
+ *
+ * usage: bcast_bench [nb_pages] [nb_features] [buffer_depth] [slow_reader_us]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "bcast_ring.h"
+
+#define BENCH_SHM_KEY 7899 /*not the app's ring*/
+#define BENCH_END_MARK 0x02 /*frame info flag of the last page*/
+#define BENCH_READ_TIMEOUT_MS 1000
+
+/*results of a reader, in memory shared with the bench*/
+typedef struct reader_result_s{
+	double seconds;
+	unsigned long nb_read;
+	unsigned long nb_lost;
+	unsigned long nb_torn;
+}reader_result_t;
+
+static int run_bench(int nb_readers, int nb_pages, int nb_features, int buffer_depth, int slow_us);
+static void run_reader(reader_result_t* result, int nb_features, int slow_us);
+static double elapsed_s(struct timespec* from);
+
+/**
+ * main(int argc, char *argv[])
+ * @brief run the bench with 1, 2 and 4 readers
+ * @param argc
+ * @param argv, optional nb of pages, nb of features, ring depth and slow reader delay
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int main(int argc, char *argv[]){
+
+	int nb_pages = (argc > 1)?atoi(argv[1]):200000;
+	int nb_features = (argc > 2)?atoi(argv[2]):220;
+	int buffer_depth = (argc > 3)?atoi(argv[3]):8;
+	int slow_us = (argc > 4)?atoi(argv[4]):0;
+	int nb_readers;
+
+	if(nb_pages < 1 || nb_features < 1){
+		fprintf(stderr, "usage: %s [nb_pages] [nb_features] [buffer_depth] [slow_reader_us]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%i pages of %i features, ring of %i pages%s\n", nb_pages, nb_features, buffer_depth,
+		   slow_us > 0 ? ", last reader slowed down" : "");
+
+	for(nb_readers=1;nb_readers<=4;nb_readers*=2){
+		if(run_bench(nb_readers, nb_pages, nb_features, buffer_depth, slow_us) == EXIT_FAILURE){
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int run_bench(int nb_readers, int nb_pages, int nb_features, int buffer_depth, int slow_us)
+ * @brief create the ring, start the readers, publish the pages and report
+ * @param nb_readers, nb of reader processes
+ * @param nb_pages, nb of pages to publish
+ * @param nb_features, features per page
+ * @param buffer_depth, pages in the ring
+ * @param slow_us, delay of the last reader after each page, 0 for none
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int run_bench(int nb_readers, int nb_pages, int nb_features, int buffer_depth, int slow_us){
+
+	bcast_t producer;
+	reader_result_t* results;
+	struct timespec start;
+	double seconds, page_bytes;
+	frame_info_t* frame_info;
+	double* feature_array;
+	char* page;
+	int i, j, nb_attached;
+
+	producer.shm_key = BENCH_SHM_KEY;
+	producer.nb_features = nb_features;
+	producer.buffer_depth = buffer_depth;
+	if(bcast_create(&producer) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	results = mmap(NULL, nb_readers*sizeof(reader_result_t), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(results == MAP_FAILED){
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	memset(results, 0, nb_readers*sizeof(reader_result_t));
+
+	for(i=0;i<nb_readers;i++){
+		if(fork() == 0){
+			run_reader(&(results[i]), nb_features, (i == nb_readers-1)?slow_us:0);
+			_exit(0);
+		}
+	}
+
+	/*all readers in place before the first page*/
+	do{
+		usleep(1000);
+		for(i=0, nb_attached=0;i<BCAST_MAX_READERS;i++){
+			nb_attached += (__atomic_load_n(&(producer.header->readers[i].pid), __ATOMIC_ACQUIRE) != 0);
+		}
+	}while(nb_attached < nb_readers);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i=0;i<nb_pages;i++){
+		page = bcast_begin_page(&producer);
+		frame_info = (frame_info_t*)page;
+		feature_array = (double*)&(page[producer.feat_offset]);
+		frame_info->eye_blink_detected = (i == nb_pages-1)?BENCH_END_MARK:0x00;
+		for(j=0;j<nb_features;j++){
+			feature_array[j] = i;
+		}
+		bcast_publish_page(&producer);
+	}
+	seconds = elapsed_s(&start);
+
+	for(i=0;i<nb_readers;i++){
+		wait(NULL);
+	}
+
+	page_bytes = sizeof(frame_info_t)+nb_features*sizeof(double);
+	printf("\n%i reader(s): producer %.2f M pages/s (%.0f MB/s)\n", nb_readers,
+		   nb_pages/seconds/1e6, nb_pages*page_bytes/seconds/1e6);
+	for(i=0;i<nb_readers;i++){
+		printf("  reader %i: %lu read, %lu lost (%.1f%%), %lu torn, %.2f M pages/s\n", i,
+			   results[i].nb_read, results[i].nb_lost, 100.0*results[i].nb_lost/nb_pages,
+			   results[i].nb_torn, results[i].seconds > 0 ? results[i].nb_read/results[i].seconds/1e6 : 0);
+	}
+
+	munmap(results, nb_readers*sizeof(reader_result_t));
+	shmctl(producer.shmid, IPC_RMID, NULL);
+	bcast_detach(&producer);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void run_reader(reader_result_t* result, int nb_features, int slow_us)
+ * @brief reader process, read up to the last page and check each one
+ * @param result(out), reader results
+ * @param nb_features, features per page
+ * @param slow_us, delay after each page, 0 for none
+ */
+static void run_reader(reader_result_t* result, int nb_features, int slow_us){
+
+	bcast_t reader;
+	frame_info_t frame_info;
+	double* feature_array = malloc(nb_features*sizeof(double));
+	struct timespec start;
+	char started = 0x00;
+	int j;
+
+	reader.shm_key = BENCH_SHM_KEY;
+	if(feature_array == NULL || bcast_attach(&reader) == EXIT_FAILURE){
+		return;
+	}
+
+	while(bcast_read(&reader, &frame_info, feature_array, BENCH_READ_TIMEOUT_MS) == EXIT_SUCCESS){
+
+		if(!started){
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			started = 0x01;
+		}
+
+		/*a page copied while being written would mix two page numbers*/
+		for(j=1;j<nb_features;j++){
+			if(feature_array[j] != feature_array[0]){
+				result->nb_torn++;
+				break;
+			}
+		}
+
+		if(frame_info.eye_blink_detected == BENCH_END_MARK){
+			break;
+		}
+		if(slow_us > 0){
+			usleep(slow_us);
+		}
+	}
+
+	result->seconds = started ? elapsed_s(&start) : 0;
+	result->nb_read = reader.header->readers[reader.reader].nb_read;
+	result->nb_lost = reader.header->readers[reader.reader].nb_lost;
+
+	bcast_detach(&reader);
+	free(feature_array);
+}
+
+/**
+ * double elapsed_s(struct timespec* from)
+ * @brief time elapsed since an instant (monotonic clock)
+ * @param from, instant
+ * @return elapsed time (s)
+ */
+static double elapsed_s(struct timespec* from){
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec-from->tv_sec)+(now.tv_nsec-from->tv_nsec)/1e9;
+}
@@ -0,0 +1,431 @@
+/**
+ * @file braintone_batch.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Offline analysis of recorded sessions. Every session file (.bts) of a
+ * directory is replayed through the same calibration and task processing as the
+ * app (feature_processing.c, artifact detection and smoothing), and a summary
+ * line per session is written as CSV.
+ *
+ * The files are spread over a pool of worker threads, one per core by default.
+ * Each worker has its own queue and steals from the others once it is empty, so
+ * a few long sessions do not leave the other cores idle.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "feature_input.h"
+#include "feature_processing.h"
+#include "smoothing_filter.h"
+#include "processing_config.h"
+#include "session_file.h"
+#include "xml.h"
+
+/*z-score histogram, for the distribution*/
+#define Z_HIST_MIN -7.0
+#define Z_HIST_STEP 0.1
+#define Z_HIST_BINS 140
+
+/*pages read at once from a session*/
+#define BATCH_MAX_PAGES 64
+
+/*session status*/
+#define SESSION_OK 0
+#define SESSION_UNREADABLE 1
+#define SESSION_SHORT 2 /*ended during calibration*/
+
+typedef struct session_summary_s{
+	int status;
+	unsigned long nb_frames; /*all frames, calibration and task*/
+	unsigned long nb_task_frames;
+	unsigned long nb_rejected;
+	unsigned long rejected[NB_ARTIFACT_REASONS];
+	unsigned long nb_held;
+	unsigned long nb_expired;
+	unsigned long nb_reward; /*task frames with the smoothed sample above baseline*/
+	double mean[2];
+	double std_dev[2];
+	double z_sum;
+	double z_sum_sq;
+	unsigned long nb_z;
+	unsigned long z_hist[Z_HIST_BINS];
+}session_summary_t;
+
+/*queue of session indexes, owned by a worker but open to stealing*/
+typedef struct work_deque_s{
+	pthread_mutex_t lock;
+	int *items;
+	int head; /*next to steal*/
+	int tail; /*one past the next to pop*/
+}work_deque_t;
+
+typedef struct batch_pool_s{
+	int nb_workers;
+	work_deque_t *deques;
+	char **paths;
+	session_summary_t *summaries;
+	appconfig_t *app_config;
+}batch_pool_t;
+
+typedef struct batch_worker_s{
+	batch_pool_t *pool;
+	int id;
+}batch_worker_t;
+
+static int list_sessions(const char *dir, char ***paths);
+static void *batch_worker(void *param);
+static int next_session(batch_pool_t *pool, int id);
+static void process_session(const char *path, appconfig_t *app_config, session_summary_t *summary);
+static double z_quantile(session_summary_t *summary, double q);
+static void write_summary(FILE *csv, const char *path, session_summary_t *summary);
+
+/**
+ * main(int argc, char *argv[])
+ * @brief batch analysis entry point
+ * @param argv - xml config, session directory, output csv, optional nb of threads
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int main(int argc, char *argv[])
+{
+	int i, nb_sessions;
+	FILE *csv;
+	appconfig_t *app_config;
+	batch_pool_t pool;
+	batch_worker_t *workers;
+	pthread_t *threads;
+
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s <config.xml> <session_dir> <output.csv> [nb_threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/*processing parameters are the app ones*/
+	if ((app_config = xml_initialize(argv[1])) == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	if ((nb_sessions = list_sessions(argv[2], &(pool.paths))) <= 0) {
+		fprintf(stderr, "No session found in %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	if ((csv = fopen(argv[3], "w")) == NULL) {
+		perror("fopen");
+		return EXIT_FAILURE;
+	}
+
+	/*one worker per core, unless specified*/
+	pool.nb_workers = (argc > 4) ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (pool.nb_workers < 1) {
+		pool.nb_workers = 1;
+	}
+	if (pool.nb_workers > nb_sessions) {
+		pool.nb_workers = nb_sessions;
+	}
+	pool.app_config = app_config;
+	pool.summaries = calloc(nb_sessions, sizeof(session_summary_t));
+	pool.deques = calloc(pool.nb_workers, sizeof(work_deque_t));
+	workers = calloc(pool.nb_workers, sizeof(batch_worker_t));
+	threads = calloc(pool.nb_workers, sizeof(pthread_t));
+
+	/*deal the sessions round robin, stealing evens out the rest*/
+	for (i = 0; i < pool.nb_workers; i++) {
+		pthread_mutex_init(&(pool.deques[i].lock), NULL);
+		pool.deques[i].items = malloc(nb_sessions * sizeof(int));
+	}
+	for (i = 0; i < nb_sessions; i++) {
+		work_deque_t *deque = &(pool.deques[i % pool.nb_workers]);
+		deque->items[deque->tail++] = i;
+	}
+
+	printf("Processing %i sessions on %i threads\n", nb_sessions, pool.nb_workers);
+	for (i = 0; i < pool.nb_workers; i++) {
+		workers[i].pool = &pool;
+		workers[i].id = i;
+		pthread_create(&(threads[i]), NULL, batch_worker, &(workers[i]));
+	}
+	for (i = 0; i < pool.nb_workers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	/*summaries in directory order*/
+	fprintf(csv, "session,status,frames,task_frames,rejection_rate");
+	for (i = ARTIFACT_NONE + 1; i < NB_ARTIFACT_REASONS; i++) {
+		fprintf(csv, ",rejected_%s", artifact_reason_str(i));
+	}
+	fprintf(csv, ",held,expired,time_in_reward,z_mean,z_std,z_p10,z_p50,z_p90,"
+			"mean_left,mean_right,std_left,std_right\n");
+	for (i = 0; i < nb_sessions; i++) {
+		write_summary(csv, pool.paths[i], &(pool.summaries[i]));
+	}
+	fclose(csv);
+
+	/*clean up*/
+	for (i = 0; i < pool.nb_workers; i++) {
+		pthread_mutex_destroy(&(pool.deques[i].lock));
+		free(pool.deques[i].items);
+	}
+	for (i = 0; i < nb_sessions; i++) {
+		free(pool.paths[i]);
+	}
+	free(pool.paths);
+	free(pool.deques);
+	free(pool.summaries);
+	free(workers);
+	free(threads);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int list_sessions(const char *dir, char ***paths)
+ * @brief list the session files of a directory, sorted by name
+ * @param dir, directory to scan
+ * @param paths(out), allocated array of paths
+ * @return nb of sessions, -1 on error
+ */
+static int list_sessions(const char *dir, char ***paths)
+{
+	struct dirent **entries;
+	int nb_entries, i;
+	int nb_sessions = 0;
+	size_t len, ext_len = strlen(SESSION_FILE_EXT);
+
+	if ((nb_entries = scandir(dir, &entries, NULL, alphasort)) < 0) {
+		perror("scandir");
+		return -1;
+	}
+
+	*paths = malloc((nb_entries + 1) * sizeof(char *));
+	for (i = 0; i < nb_entries; i++) {
+		len = strlen(entries[i]->d_name);
+		if (len > ext_len && strcmp(entries[i]->d_name + len - ext_len, SESSION_FILE_EXT) == 0) {
+			(*paths)[nb_sessions] = malloc(strlen(dir) + len + 2);
+			sprintf((*paths)[nb_sessions], "%s/%s", dir, entries[i]->d_name);
+			nb_sessions++;
+		}
+		free(entries[i]);
+	}
+	free(entries);
+
+	return nb_sessions;
+}
+
+/**
+ * void* batch_worker(void* param)
+ * @brief worker thread, processes sessions until none are left anywhere
+ * @param param, (batch_worker_t*) worker
+ * @return NULL
+ */
+static void *batch_worker(void *param)
+{
+	batch_worker_t *worker = param;
+	batch_pool_t *pool = worker->pool;
+	int session;
+
+	while ((session = next_session(pool, worker->id)) >= 0) {
+		process_session(pool->paths[session], pool->app_config, &(pool->summaries[session]));
+	}
+
+	return NULL;
+}
+
+/**
+ * int next_session(batch_pool_t* pool, int id)
+ * @brief pop the next session from the worker's own queue, or steal the
+ * oldest one of another worker when its own is empty
+ * @param pool, worker pool
+ * @param id, worker id
+ * @return session index, -1 when all queues are empty
+ */
+static int next_session(batch_pool_t *pool, int id)
+{
+	int i, victim;
+	int session = -1;
+	work_deque_t *deque = &(pool->deques[id]);
+
+	/*own queue, newest first*/
+	pthread_mutex_lock(&(deque->lock));
+	if (deque->tail > deque->head) {
+		session = deque->items[--deque->tail];
+	}
+	pthread_mutex_unlock(&(deque->lock));
+
+	/*steal, oldest first*/
+	for (i = 1; i < pool->nb_workers && session < 0; i++) {
+		victim = (id + i) % pool->nb_workers;
+		deque = &(pool->deques[victim]);
+		pthread_mutex_lock(&(deque->lock));
+		if (deque->tail > deque->head) {
+			session = deque->items[deque->head++];
+		}
+		pthread_mutex_unlock(&(deque->lock));
+	}
+
+	return session;
+}
+
+/**
+ * void process_session(const char *path, appconfig_t *app_config, session_summary_t *summary)
+ * @brief replay a session through calibration and task processing
+ * @param path, session file
+ * @param app_config, processing parameters
+ * @param summary(out), session summary
+ */
+static void process_session(const char *path, appconfig_t *app_config, session_summary_t *summary)
+{
+	int i, bin, page, nb_pages;
+	double smoothed;
+	feature_page_view_t views[BATCH_MAX_PAGES];
+	feature_input_t feature_input;
+	feat_proc_t feature_proc;
+	band_power_t band_power;
+	iaf_tracker_t iaf;
+	smoothing_filter_t filter;
+	session_header_t *header;
+	appconfig_t session_config;
+
+	memset(summary, 0, sizeof(session_summary_t));
+	memset(&feature_input, 0, sizeof(feature_input_t));
+	memset(&feature_proc, 0, sizeof(feat_proc_t));
+	memset(&filter, 0, sizeof(smoothing_filter_t));
+
+	/*open the session*/
+	feature_input.file_path = (char *)path;
+	feature_input.buffer_depth = BATCH_MAX_PAGES;
+	feature_input.layout = app_config->page_layout;
+	if (init_feature_input(FILE_INPUT, &feature_input) == EXIT_FAILURE) {
+		summary->status = SESSION_UNREADABLE;
+		return;
+	}
+
+	/*same processing as the app, on the geometry recorded*/
+	header = &(feature_input.session.header);
+	if (app_config->band_source == BAND_SOURCE_TIMESERIES && !(header->sections & SESSION_TIMESERIES)) {
+		summary->status = SESSION_UNREADABLE;
+		TERMINATE_FEAT_INPUT_FC(&feature_input);
+		return;
+	}
+	memcpy(&session_config, app_config, sizeof(appconfig_t));
+	session_config.nb_channels = header->nb_channels;
+	session_config.window_width = header->window_width;
+	session_config.timeseries = (header->sections & SESSION_TIMESERIES) ? 0x01 : 0x00;
+	session_config.sampling_rate = header->sampling_rate;
+	session_config.frame_rate = header->frame_rate;
+
+	configure_feature_processing(&feature_proc, &feature_input, &session_config);
+	feature_proc.verbose = 0x00;
+	memset(&band_power, 0, sizeof(band_power_t));
+	feature_proc.band_power = configure_band_power(&band_power, &session_config);
+	memset(&iaf, 0, sizeof(iaf_tracker_t));
+	feature_proc.iaf = configure_iaf_tracker(&iaf, &session_config);
+
+	if (init_feat_processing(&feature_proc) == EXIT_FAILURE ||
+	    configure_smoothing_filter(&filter, &session_config) == EXIT_FAILURE) {
+		summary->status = SESSION_UNREADABLE;
+		TERMINATE_FEAT_INPUT_FC(&feature_input);
+		return;
+	}
+
+	/*calibration*/
+	if (train_feat_processing(&feature_proc) == EXIT_FAILURE) {
+		summary->status = SESSION_SHORT;
+	} else {
+
+		/*task, until the end of the session, a buffer of pages at a time*/
+		while ((nb_pages = GET_FEAT_BATCH_FC(&feature_input, views, BATCH_MAX_PAGES)) > 0) {
+			for (page = 0; page < nb_pages; page++) {
+
+				normalize_frame(&feature_proc, views[page].frame_info, views[page].feature_array);
+
+				summary->nb_task_frames++;
+				smoothed = smooth_sample(&filter, feature_proc.sample);
+				if (smoothed > 0) {
+					summary->nb_reward++;
+				}
+
+				/*distribution of the valid z-scores*/
+				if (feature_proc.sample_status == SAMPLE_VALID) {
+					summary->z_sum += feature_proc.sample;
+					summary->z_sum_sq += feature_proc.sample * feature_proc.sample;
+					summary->nb_z++;
+					bin = (int)floor((feature_proc.sample - Z_HIST_MIN) / Z_HIST_STEP);
+					bin = (bin < 0) ? 0 : ((bin >= Z_HIST_BINS) ? Z_HIST_BINS - 1 : bin);
+					summary->z_hist[bin]++;
+				}
+			}
+		}
+	}
+
+	/*collect the counters*/
+	summary->nb_frames = feature_proc.artifact.nb_frames;
+	for (i = ARTIFACT_NONE + 1; i < NB_ARTIFACT_REASONS; i++) {
+		summary->rejected[i] = feature_proc.artifact.counters[i];
+		summary->nb_rejected += feature_proc.artifact.counters[i];
+	}
+	summary->nb_held = feature_proc.nb_held;
+	summary->nb_expired = feature_proc.nb_expired;
+	memcpy(summary->mean, feature_proc.mean, sizeof(summary->mean));
+	memcpy(summary->std_dev, feature_proc.std_dev, sizeof(summary->std_dev));
+
+	clean_up_feat_processing(&feature_proc);
+	TERMINATE_FEAT_INPUT_FC(&feature_input);
+}
+
+/**
+ * double z_quantile(session_summary_t *summary, double q)
+ * @brief quantile of the z-score distribution, from the histogram
+ * @param summary, session summary
+ * @param q, quantile (0 to 1)
+ * @return z-score at the quantile (bin center)
+ */
+static double z_quantile(session_summary_t *summary, double q)
+{
+	int bin;
+	unsigned long count = 0;
+	unsigned long target = (unsigned long)ceil(q * summary->nb_z);
+
+	for (bin = 0; bin < Z_HIST_BINS - 1; bin++) {
+		count += summary->z_hist[bin];
+		if (count >= target && count > 0) {
+			break;
+		}
+	}
+	return Z_HIST_MIN + (bin + 0.5) * Z_HIST_STEP;
+}
+
+/**
+ * void write_summary(FILE *csv, const char *path, session_summary_t *summary)
+ * @brief write a session summary line
+ * @param csv, output file
+ * @param path, session file
+ * @param summary, session summary
+ */
+static void write_summary(FILE *csv, const char *path, session_summary_t *summary)
+{
+	int i;
+	double z_mean = 0, z_std = 0;
+	static const char *status_str[] = { "ok", "unreadable", "short" };
+
+	if (summary->nb_z > 0) {
+		z_mean = summary->z_sum / summary->nb_z;
+		z_std = sqrt(fmax(summary->z_sum_sq / summary->nb_z - z_mean * z_mean, 0));
+	}
+
+	fprintf(csv, "%s,%s,%lu,%lu,%.4f", path, status_str[summary->status], summary->nb_frames,
+		summary->nb_task_frames, summary->nb_frames ? (double)summary->nb_rejected / summary->nb_frames : 0);
+	for (i = ARTIFACT_NONE + 1; i < NB_ARTIFACT_REASONS; i++) {
+		fprintf(csv, ",%lu", summary->rejected[i]);
+	}
+	fprintf(csv, ",%lu,%lu,%.4f,%.4f,%.4f,%.2f,%.2f,%.2f,%lf,%lf,%lf,%lf\n",
+		summary->nb_held, summary->nb_expired,
+		summary->nb_task_frames ? (double)summary->nb_reward / summary->nb_task_frames : 0,
+		z_mean, z_std, z_quantile(summary, 0.1), z_quantile(summary, 0.5), z_quantile(summary, 0.9),
+		summary->mean[0], summary->mean[1], summary->std_dev[0], summary->std_dev[1]);
+}
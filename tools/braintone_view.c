@@ -0,0 +1,109 @@
+/**
+ * @file braintone_view.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Console viewer of the live state page (live_state.c), one line per
+ * refresh. It only reads the page, so it can run next to the app on the unit
+ * or on an x86 host replaying sessions, without the hardware libraries.
+ *
+ * usage: braintone_view [refresh_ms] [nb_lines]
+ *        nb_lines 0 (default) runs until interrupted, 1 prints a single snapshot
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "live_state.h"
+
+#define VIEW_HEADER_LINES 20 /*lines between two headers*/
+
+static void print_header(void);
+static void print_snapshot(live_state_t* live, live_snapshot_t* snapshot);
+
+/**
+ * main(int argc, char *argv[])
+ * @brief attach the live state and print it periodically
+ * @param argc
+ * @param argv, optional refresh period (ms) and nb of lines
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int main(int argc, char *argv[]){
+
+	int refresh_ms = (argc > 1)?atoi(argv[1]):500;
+	int nb_lines = (argc > 2)?atoi(argv[2]):0;
+	live_state_t live;
+	live_snapshot_t snapshot;
+	int line;
+
+	if(refresh_ms < 1 || nb_lines < 0){
+		fprintf(stderr, "usage: %s [refresh_ms] [nb_lines]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	live.shm_key = LIVE_SHM_KEY;
+	if(live_attach(&live) == EXIT_FAILURE){
+		fprintf(stderr, "No live state, the app never ran on this host\n");
+		return EXIT_FAILURE;
+	}
+
+	for(line=0;nb_lines==0 || line<nb_lines;line++){
+
+		if(line % VIEW_HEADER_LINES == 0 && nb_lines != 1){
+			print_header();
+		}
+
+		if(live_read(&live, &snapshot) == EXIT_SUCCESS){
+			print_snapshot(&live, &snapshot);
+		}else{
+			printf("(no consistent snapshot)\n");
+		}
+		fflush(stdout);
+
+		if(nb_lines == 0 || line < nb_lines-1){
+			usleep(refresh_ms*1000);
+		}
+	}
+
+	live_detach(&live);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void print_header(void)
+ * @brief names of the columns
+ */
+static void print_header(void){
+	printf("%-9s %4s %9s %8s %8s %6s %5s %7s %7s %6s %6s %17s %17s %7s\n",
+		   "phase", "sess", "training", "sample", "smooth", "pitch", "step",
+		   "frames", "reject", "held", "expir", "mean l/r", "std l/r", "age(s)");
+}
+
+/**
+ * void print_snapshot(live_state_t* live, live_snapshot_t* snapshot)
+ * @brief one line of the state, the age tells a live app from a stale page
+ * @param live, live state (attached)
+ * @param snapshot, snapshot
+ */
+static void print_snapshot(live_state_t* live, live_snapshot_t* snapshot){
+
+	struct timespec now;
+	double age;
+	char training[16];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age = (now.tv_sec+now.tv_nsec/1e9)-snapshot->update_ns/1e9;
+
+	snprintf(training, sizeof(training), "%u/%u", snapshot->train_done, snapshot->train_total);
+	printf("%-9s %4u %9s %8.3f %8.3f %6i %5i %7llu %7llu %6llu %6llu %8.3g/%-8.3g %8.3g/%-8.3g %7.1f%s\n",
+		   live_phase_str(snapshot->phase), snapshot->session, training,
+		   snapshot->sample, snapshot->smoothed, snapshot->pitch, snapshot->step,
+		   (unsigned long long)snapshot->nb_frames, (unsigned long long)snapshot->nb_rejected,
+		   (unsigned long long)snapshot->nb_held, (unsigned long long)snapshot->nb_expired,
+		   snapshot->mean[0], snapshot->mean[1], snapshot->std_dev[0], snapshot->std_dev[1], age,
+		   (snapshot->phase != LIVE_STOPPED && kill(live->page->app_pid, 0) != 0 && errno == ESRCH)?" (app gone)":"");
+}
@@ -0,0 +1,314 @@
+/**
+ * @file float_bench.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Accuracy and cost of the float32 pages (PAGE_FLOAT32). The same synthetic
+ * spectra (1/f background, alpha band modulated over time) go through the app
+ * processing twice: from double pages, and from float32 pages widened by
+ * feature_kernels.c. Calibration, normalization, smoothing and pitch mapping are
+ * those of the app, the differences of each stage are reported, then the cost
+ * of the widening and the bytes a page takes in the segment.
+ *
+ * usage: float_bench [nb_frames] [nb_train_frames]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "feature_structure.h"
+#include "feature_input.h"
+#include "feature_kernels.h"
+#include "feature_processing.h"
+#include "smoothing_filter.h"
+#include "pitch_map.h"
+#include "xml.h"
+
+#define BENCH_NB_CHANNELS 4
+#define BENCH_CHANNEL_WIDTH 55 /*fft bins per channel, as the producer*/
+#define BENCH_NB_FEATURES (BENCH_NB_CHANNELS*BENCH_CHANNEL_WIDTH)
+#define BENCH_FRAME_RATE 10.0 /*Hz*/
+#define BENCH_ALPHA_PERIOD 30.0 /*s, alpha modulation*/
+#define BENCH_WIDEN_PAGES 2000000 /*pages widened for the timing*/
+
+/*one processing path, fed with double or widened pages*/
+typedef struct bench_path_s{
+	feat_proc_t proc;
+	smoothing_filter_t filter;
+	pitch_map_t pitch_map;
+	double sum[2];
+	double sum_sq[2];
+}bench_path_t;
+
+static void init_path(bench_path_t* path);
+static void synthesize_spectrum(unsigned int* seed, double time, double* feature_array);
+static double gaussian(unsigned int* seed);
+static double time_widening(const float* pages, double* out, char vector);
+static double elapsed_s(struct timespec* from);
+
+/**
+ * main(int argc, char *argv[])
+ * @brief run both paths over the same frames and report the differences
+ * @param argc
+ * @param argv, optional nb of frames and nb of calibration frames
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int main(int argc, char *argv[]){
+
+	int nb_frames = (argc > 1)?atoi(argv[1]):20000;
+	int nb_train = (argc > 2)?atoi(argv[2]):300;
+	bench_path_t* paths;
+	frame_info_t frame_info;
+	double doubles[BENCH_NB_FEATURES], widened[BENCH_NB_FEATURES];
+	float singles[BENCH_NB_FEATURES];
+	float* pages;
+	double* out;
+	double max_input = 0, max_band = 0, max_z = 0, max_smoothed = 0;
+	double smoothed[2], scalar_s, vector_s;
+	unsigned long nb_status = 0, nb_pitch = 0, nb_valid = 0;
+	unsigned int seed = 1;
+	int i, j, k, status[2], pitch[2];
+	size_t page_bytes[2];
+
+	if(nb_frames < 1 || nb_train < 2){
+		fprintf(stderr, "usage: %s [nb_frames] [nb_train_frames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/*large, never on the stack*/
+	if((paths = calloc(2, sizeof(bench_path_t))) == NULL){
+		perror("float_bench");
+		return EXIT_FAILURE;
+	}
+	for(k=0;k<2;k++){
+		init_path(&(paths[k]));
+	}
+	memset(&frame_info, 0, sizeof(frame_info_t));
+
+	printf("%i frames (%i to calibrate) of %i features, %s kernels\n",
+		   nb_frames, nb_train, BENCH_NB_FEATURES, feature_kernels_path());
+
+	for(i=0;i<nb_train+nb_frames;i++){
+
+		/*the producer writes the page once, in either format*/
+		synthesize_spectrum(&seed, i/BENCH_FRAME_RATE, doubles);
+		narrow_features(doubles, singles, BENCH_NB_FEATURES);
+		widen_features(singles, widened, BENCH_NB_FEATURES);
+		for(j=0;j<BENCH_NB_FEATURES;j++){
+			if(fabs(widened[j]-doubles[j]) > max_input*fabs(doubles[j])){
+				max_input = fabs(widened[j]-doubles[j])/fabs(doubles[j]);
+			}
+		}
+
+		for(k=0;k<2;k++){
+			status[k] = normalize_frame(&(paths[k].proc), &frame_info, (k == 0)?doubles:widened);
+		}
+
+		/*calibration, band values of the frames as the training does*/
+		if(i < nb_train){
+			for(k=0;k<2;k++){
+				for(j=0;j<2;j++){
+					paths[k].sum[j] += paths[k].proc.band_value[j];
+					paths[k].sum_sq[j] += paths[k].proc.band_value[j]*paths[k].proc.band_value[j];
+				}
+				if(i == nb_train-1){
+					for(j=0;j<2;j++){
+						paths[k].proc.mean[j] = paths[k].sum[j]/nb_train;
+						paths[k].proc.std_dev[j] = sqrt((paths[k].sum_sq[j]-paths[k].sum[j]*paths[k].sum[j]/nb_train)/(nb_train-1));
+					}
+				}
+			}
+			continue;
+		}
+
+		for(j=0;j<2;j++){
+			if(fabs(paths[1].proc.band_value[j]-paths[0].proc.band_value[j]) > max_band*fabs(paths[0].proc.band_value[j])){
+				max_band = fabs(paths[1].proc.band_value[j]-paths[0].proc.band_value[j])/fabs(paths[0].proc.band_value[j]);
+			}
+		}
+
+		if(status[0] != status[1]){
+			nb_status++;
+		}
+		nb_valid += (status[0] == SAMPLE_VALID);
+
+		for(k=0;k<2;k++){
+			smoothed[k] = smooth_sample(&(paths[k].filter), paths[k].proc.sample);
+			pitch[k] = get_pitch(&(paths[k].pitch_map), smoothed[k]);
+		}
+		if(fabs(paths[1].proc.sample-paths[0].proc.sample) > max_z){
+			max_z = fabs(paths[1].proc.sample-paths[0].proc.sample);
+		}
+		if(fabs(smoothed[1]-smoothed[0]) > max_smoothed){
+			max_smoothed = fabs(smoothed[1]-smoothed[0]);
+		}
+		if(pitch[0] != pitch[1]){
+			nb_pitch++;
+		}
+	}
+
+	printf("\naccuracy, float32 pages against double pages\n");
+	printf("  features        max relative error %.2e\n", max_input);
+	printf("  band values     max relative error %.2e\n", max_band);
+	printf("  mean/std        %.9g/%.9g against %.9g/%.9g (left)\n",
+		   paths[1].proc.mean[0], paths[1].proc.std_dev[0], paths[0].proc.mean[0], paths[0].proc.std_dev[0]);
+	printf("  z-score         max difference %.2e\n", max_z);
+	printf("  smoothed        max difference %.2e\n", max_smoothed);
+	printf("  sample status   %lu of %i frames differ (%lu valid)\n", nb_status, nb_frames, nb_valid);
+	printf("  pitch           %lu of %i frames differ\n", nb_pitch, nb_frames);
+
+	/*cost of the widening, on a set of pages larger than the caches*/
+	pages = malloc((size_t)64*BENCH_NB_FEATURES*sizeof(float));
+	out = malloc(BENCH_NB_FEATURES*sizeof(double));
+	if(pages == NULL || out == NULL){
+		perror("float_bench");
+		return EXIT_FAILURE;
+	}
+	for(i=0;i<64;i++){
+		synthesize_spectrum(&seed, i/BENCH_FRAME_RATE, doubles);
+		narrow_features(doubles, &(pages[i*BENCH_NB_FEATURES]), BENCH_NB_FEATURES);
+	}
+	scalar_s = time_widening(pages, out, 0);
+	vector_s = time_widening(pages, out, 1);
+
+	page_bytes[0] = (sizeof(frame_info_t)+PAGE_ALIGNMENT-1)/PAGE_ALIGNMENT*PAGE_ALIGNMENT+
+					(BENCH_NB_FEATURES*sizeof(double)+PAGE_ALIGNMENT-1)/PAGE_ALIGNMENT*PAGE_ALIGNMENT;
+	page_bytes[1] = (sizeof(frame_info_t)+PAGE_ALIGNMENT-1)/PAGE_ALIGNMENT*PAGE_ALIGNMENT+
+					(BENCH_NB_FEATURES*sizeof(float)+PAGE_ALIGNMENT-1)/PAGE_ALIGNMENT*PAGE_ALIGNMENT;
+
+	printf("\ncost\n");
+	printf("  widening        %.1f ns/page %s, %.1f ns/page scalar\n",
+		   vector_s*1e9/BENCH_WIDEN_PAGES, feature_kernels_path(), scalar_s*1e9/BENCH_WIDEN_PAGES);
+	printf("  aligned page    %zu bytes float32, %zu bytes float64\n", page_bytes[1], page_bytes[0]);
+
+	free(pages);
+	free(out);
+	free(paths);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void init_path(bench_path_t* path)
+ * @brief processing as configured in the shipped config: fft band values, one-pole
+ * smoothing and linear pitch map. The calibration pass runs at mean 0 and std 1.
+ * @param path, path to initialize
+ */
+static void init_path(bench_path_t* path){
+
+	path->proc.nb_train_samples = 0;
+	path->proc.artifact.enabled = 0x00;
+	path->proc.artifact.bin_width = 1.0;
+	path->proc.artifact.line_freq = 60.0;
+	path->proc.hold_policy = HOLD_LAST_VALUE;
+	path->proc.max_hold_time = 1.0;
+	path->proc.frame_rate = BENCH_FRAME_RATE;
+	path->proc.calibration = CALIBRATION_MEAN_STD;
+	path->proc.fft_offset = 0;
+	path->proc.mean[0] = path->proc.mean[1] = 0;
+	path->proc.std_dev[0] = path->proc.std_dev[1] = 1;
+	init_feat_processing(&(path->proc));
+
+	path->filter.type = SMOOTH_ONE_POLE;
+	path->filter.frame_rate = BENCH_FRAME_RATE;
+	path->filter.kernel = 5;
+	init_smoothing_filter(&(path->filter));
+
+	path->pitch_map.scale = PITCH_SCALE_LINEAR;
+	path->pitch_map.nb_steps = 100;
+	path->pitch_map.z_min = -0.16;
+	path->pitch_map.z_max = 4;
+	path->pitch_map.freq_min = 220;
+	path->pitch_map.freq_max = 1760;
+	path->pitch_map.hysteresis = 0.25;
+	init_pitch_map(&(path->pitch_map));
+}
+
+/**
+ * void synthesize_spectrum(unsigned int* seed, double time, double* feature_array)
+ * @brief fft section of a frame: 1/f background and an alpha peak (8-12 Hz) that
+ * slowly comes and goes, both with log-normal frame to frame variations
+ * @param seed, random generator state
+ * @param time, time of the frame (s)
+ * @param feature_array(out), BENCH_NB_FEATURES bins
+ */
+static void synthesize_spectrum(unsigned int* seed, double time, double* feature_array){
+
+	double alpha = 1.5+sin(2*M_PI*time/BENCH_ALPHA_PERIOD);
+	double* bins;
+	int i, bin;
+
+	for(i=0;i<BENCH_NB_CHANNELS;i++){
+		bins = &(feature_array[i*BENCH_CHANNEL_WIDTH]);
+		for(bin=0;bin<BENCH_CHANNEL_WIDTH;bin++){
+			bins[bin] = 40.0/(1+bin)*exp(0.3*gaussian(seed));
+			if(bin >= 4 && bin < 7){
+				bins[bin] += 12.0*alpha*exp(0.2*gaussian(seed));
+			}
+		}
+	}
+}
+
+/**
+ * double gaussian(unsigned int* seed)
+ * @brief standard normal value (Box-Muller)
+ * @param seed, random generator state
+ * @return value
+ */
+static double gaussian(unsigned int* seed){
+
+	double u1 = (rand_r(seed)+1.0)/((double)RAND_MAX+2.0);
+	double u2 = (rand_r(seed)+1.0)/((double)RAND_MAX+2.0);
+
+	return sqrt(-2*log(u1))*cos(2*M_PI*u2);
+}
+
+/**
+ * double time_widening(const float* pages, double* out, char vector)
+ * @brief time the widening of BENCH_WIDEN_PAGES pages, cycling over 64 pages
+ * @param pages, 64 float32 pages
+ * @param out(out), widened page
+ * @param vector, 1 for the kernel, 0 for a plain loop
+ * @return seconds
+ */
+static double time_widening(const float* pages, double* out, char vector){
+
+	struct timespec start;
+	const float* page;
+	double check = 0;
+	int i, j;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i=0;i<BENCH_WIDEN_PAGES;i++){
+		page = &(pages[(i%64)*BENCH_NB_FEATURES]);
+		if(vector){
+			widen_features(page, out, BENCH_NB_FEATURES);
+		}else{
+			for(j=0;j<BENCH_NB_FEATURES;j++){
+				out[j] = page[j];
+			}
+		}
+		/*keeps the conversions*/
+		check += out[i%BENCH_NB_FEATURES];
+	}
+
+	if(check < 0){
+		printf("%f\n", check);
+	}
+	return elapsed_s(&start);
+}
+
+/**
+ * double elapsed_s(struct timespec* from)
+ * @brief seconds elapsed since a time
+ * @param from, start time
+ * @return seconds
+ */
+static double elapsed_s(struct timespec* from){
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec-from->tv_sec)+(now.tv_nsec-from->tv_nsec)*1e-9;
+}
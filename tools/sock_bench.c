@@ -0,0 +1,579 @@
+/**
+ * @file sock_bench.c
+ * @author Frederic Simard (fred.simard@atlantsembedded.com)
+ * @date Oct 2016
+ * @brief Test producer of the SOCK feature input (sock_rd_buf.h), and latency of
+ * that input against the SHM input (SysV segment and semaphores). In the bench,
+ * a producer process fills each page as soon as it is requested and stamps it;
+ * the app side is the feature input of the app, used through request/wait. For
+ * each page, the wake up (page stamped to wait returned) and the round trip
+ * (request to wait returned) are measured, then their median, 99th percentile
+ * and maximum are reported for both inputs.
+ *
+ * usage: sock_bench [nb_frames] [nb_features]
+ *        sock_bench produce [socket] [rate_hz]
+ *        The second form serves synthetic pages to the app (feature_source SOCK),
+ *        one app at a time, at rate_hz pages per second (default 10), until interrupted.
+*/
+
+#define _GNU_SOURCE /*memfd_create*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/sem.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "feature_structure.h"
+#include "feature_input.h"
+#include "shm_rd_buf.h"
+#include "sock_rd_buf.h"
+#include "xml.h"
+
+#define BENCH_SHM_KEY 7898 /*not the app's segment*/
+#define BENCH_SEM_KEY 1298
+#define BENCH_SOCK_PATH "/tmp/braintone_sock_bench.sock"
+#define BENCH_BUFFER_DEPTH 2
+#define BENCH_WARMUP 100 /*frames left out of the statistics*/
+#define BENCH_MAX_DEPTH 64 /*deepest buffer the test producer serves*/
+
+/*latencies of one input*/
+typedef struct bench_result_s{
+	double* wake_us; /*page stamped to wait returned*/
+	double* round_trip_us; /*request to wait returned*/
+	int nb_frames;
+}bench_result_t;
+
+static volatile sig_atomic_t producing = 1;
+
+static int run_produce(const char* path, double rate_hz);
+static int bench_shm(bench_result_t* result, int nb_frames, int nb_features);
+static int bench_sock(bench_result_t* result, int nb_frames, int nb_features);
+static int read_frames(feature_input_t* feature_input, bench_result_t* result, int nb_frames);
+static void run_shm_producer(feature_input_t* feature_input, int nb_frames);
+static int listen_socket(const char* path);
+static int serve_app(int client, double rate_hz, int max_frames);
+static void fill_page(char* page, sock_geometry_t* geometry, int frame, double rate_hz);
+static void close_fds(int* fds);
+static void report(const char* name, bench_result_t* result);
+static int compare_double(const void* a, const void* b);
+static double now_us(void);
+static void stop_producing(int sig);
+
+/**
+ * main(int argc, char *argv[])
+ * @brief latency of both inputs, or the test producer
+ * @param argc
+ * @param argv, nb of frames and nb of features, or produce with its socket and rate
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+int main(int argc, char *argv[]){
+
+	bench_result_t shm_result, sock_result;
+	int nb_frames, nb_features;
+
+	if(argc > 1 && strcmp(argv[1], "produce") == 0){
+		return run_produce((argc > 2)?argv[2]:SOCK_DEFAULT_PATH, (argc > 3)?atof(argv[3]):10.0);
+	}
+
+	nb_frames = (argc > 1)?atoi(argv[1]):20000;
+	nb_features = (argc > 2)?atoi(argv[2]):220;
+	if(nb_frames <= BENCH_WARMUP || nb_features < 1){
+		fprintf(stderr, "usage: %s [nb_frames > %i] [nb_features]\n"
+				"       %s produce [socket] [rate_hz]\n", argv[0], BENCH_WARMUP, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	shm_result.wake_us = malloc(2*nb_frames*sizeof(double));
+	sock_result.wake_us = malloc(2*nb_frames*sizeof(double));
+	if(shm_result.wake_us == NULL || sock_result.wake_us == NULL){
+		return EXIT_FAILURE;
+	}
+	shm_result.round_trip_us = &(shm_result.wake_us[nb_frames]);
+	sock_result.round_trip_us = &(sock_result.wake_us[nb_frames]);
+
+	printf("%i frames of %i features, %i pages, one page requested at a time\n",
+		   nb_frames, nb_features, BENCH_BUFFER_DEPTH);
+	fflush(stdout);
+
+	if(bench_shm(&shm_result, nb_frames, nb_features) == EXIT_FAILURE ||
+	   bench_sock(&sock_result, nb_frames, nb_features) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	printf("\n%-5s %28s %28s\n", "input", "wake up (us) med/p99/max", "round trip (us) med/p99/max");
+	report("SHM", &shm_result);
+	report("SOCK", &sock_result);
+
+	free(shm_result.wake_us);
+	free(sock_result.wake_us);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int run_produce(const char* path, double rate_hz)
+ * @brief test producer, serve the apps one after the other until interrupted
+ * @param path, socket path (a stale socket is replaced)
+ * @param rate_hz, pages per second
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int run_produce(const char* path, double rate_hz){
+
+	struct sigaction action;
+	int server, client;
+
+	if(rate_hz <= 0){
+		fprintf(stderr, "produce: rate must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	/*no restart, accept and poll return on the signal*/
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_producing;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if((server = listen_socket(path)) < 0){
+		return EXIT_FAILURE;
+	}
+	printf("Producing on %s at %.1f pages/s\n", path, rate_hz);
+	fflush(stdout);
+
+	while(producing){
+		if((client = accept4(server, NULL, NULL, SOCK_CLOEXEC)) < 0){
+			continue;
+		}
+		printf("App connected\n");
+		fflush(stdout);
+		serve_app(client, rate_hz, 0);
+		close(client);
+		printf("App gone\n");
+		fflush(stdout);
+	}
+
+	close(server);
+	unlink(path);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * int bench_shm(bench_result_t* result, int nb_frames, int nb_features)
+ * @brief latencies of the SHM input, the producer attaches after the app as usual
+ * @param result(out), latencies
+ * @param nb_frames, nb of frames
+ * @param nb_features, features per page
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int bench_shm(bench_result_t* result, int nb_frames, int nb_features){
+
+	feature_input_t feature_input;
+	pid_t producer;
+	int res;
+
+	memset(&feature_input, 0, sizeof(feature_input));
+	feature_input.shm_key = BENCH_SHM_KEY;
+	feature_input.sem_key = BENCH_SEM_KEY;
+	feature_input.layout = LAYOUT_PACKED;
+	feature_input.page_format = PAGE_FLOAT64;
+	feature_input.shm_backing = SHM_BACKING_SYSV;
+	feature_input.stall_timeout = 1.0;
+	feature_input.nb_features = nb_features;
+	feature_input.buffer_depth = BENCH_BUFFER_DEPTH;
+	if(set_page_layout(&feature_input) == EXIT_FAILURE ||
+	   init_feature_input(SHM_INPUT, &feature_input) == EXIT_FAILURE){
+		return EXIT_FAILURE;
+	}
+
+	if((producer = fork()) == 0){
+		run_shm_producer(&feature_input, nb_frames);
+		_exit(0);
+	}
+
+	res = read_frames(&feature_input, result, nb_frames);
+	waitpid(producer, NULL, 0);
+
+	shmctl(feature_input.shmid, IPC_RMID, NULL);
+	semctl(feature_input.semid, 0, IPC_RMID);
+	TERMINATE_FEAT_INPUT_FC(&feature_input);
+	free(feature_input.sops);
+
+	return res;
+}
+
+/**
+ * int bench_sock(bench_result_t* result, int nb_frames, int nb_features)
+ * @brief latencies of the SOCK input, the producer listens before the app connects
+ * @param result(out), latencies
+ * @param nb_frames, nb of frames
+ * @param nb_features, features per page
+ * @return EXIT_SUCCESS, EXIT_FAILURE
+ */
+static int bench_sock(bench_result_t* result, int nb_frames, int nb_features){
+
+	feature_input_t feature_input;
+	pid_t producer;
+	int server, client, res;
+
+	if((server = listen_socket(BENCH_SOCK_PATH)) < 0){
+		return EXIT_FAILURE;
+	}
+
+	if((producer = fork()) == 0){
+		if((client = accept(server, NULL, NULL)) >= 0){
+			serve_app(client, 0, nb_frames);
+			close(client);
+		}
+		_exit(0);
+	}
+	close(server);
+
+	memset(&feature_input, 0, sizeof(feature_input));
+	feature_input.sock_path = BENCH_SOCK_PATH;
+	feature_input.layout = LAYOUT_PACKED;
+	feature_input.page_format = PAGE_FLOAT64;
+	feature_input.stall_timeout = 1.0;
+	feature_input.nb_features = nb_features;
+	feature_input.buffer_depth = BENCH_BUFFER_DEPTH;
+	if(set_page_layout(&feature_input) == EXIT_FAILURE ||
+	   init_feature_input(SOCK_INPUT, &feature_input) == EXIT_FAILURE){
+		kill(producer, SIGTERM);
+		waitpid(producer, NULL, 0);
+		unlink(BENCH_SOCK_PATH);
+		return EXIT_FAILURE;
+	}
+
+	res = read_frames(&feature_input, result, nb_frames);
+
+	TERMINATE_FEAT_INPUT_FC(&feature_input);
+	waitpid(producer, NULL, 0);
+	unlink(BENCH_SOCK_PATH);
+
+	return res;
+}
+
+/**
+ * int read_frames(feature_input_t* feature_input, bench_result_t* result, int nb_frames)
+ * @brief request and wait for each frame as the app does, measure its latencies
+ * @param feature_input, feature input (init done)
+ * @param result(out), latencies
+ * @param nb_frames, nb of frames
+ * @return EXIT_SUCCESS, EXIT_FAILURE if a frame is missing or out of order
+ */
+static int read_frames(feature_input_t* feature_input, bench_result_t* result, int nb_frames){
+
+	double request_us, done_us;
+	double* feature_array;
+	int i;
+
+	for(i=0;i<nb_frames;i++){
+
+		request_us = now_us();
+		REQUEST_FEAT_FC(feature_input);
+		if(WAIT_FEAT_FC(feature_input) != EXIT_SUCCESS){
+			fprintf(stderr, "frame %i missing\n", i);
+			return EXIT_FAILURE;
+		}
+		done_us = now_us();
+
+		/*stamp then frame number*/
+		feature_array = GET_FVECT_INFO_FC(feature_input);
+		if((int)feature_array[1] != i){
+			fprintf(stderr, "frame %i read instead of %i\n", (int)feature_array[1], i);
+			return EXIT_FAILURE;
+		}
+		result->wake_us[i] = done_us-feature_array[0];
+		result->round_trip_us[i] = done_us-request_us;
+	}
+	result->nb_frames = nb_frames;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void run_shm_producer(feature_input_t* feature_input, int nb_frames)
+ * @brief SHM producer process, fill a page each time the app opens one
+ * @param feature_input, feature input of the app (segment and semaphores created)
+ * @param nb_frames, nb of frames
+ */
+static void run_shm_producer(feature_input_t* feature_input, int nb_frames){
+
+	sock_geometry_t geometry;
+	struct sembuf take[2] = {{PREPROC_IN_READY, -1, 0}, {APP_IN_READY, -1, 0}};
+	struct sembuf post = {PREPROC_OUT_READY, 1, 0};
+	int i;
+
+	memset(&geometry, 0, sizeof(geometry));
+	geometry.nb_features = feature_input->nb_features;
+	geometry.feature_size = feature_input->feature_size;
+	geometry.feat_offset = feature_input->feat_offset;
+
+	/*the app mapping is inherited, pages are filled in order*/
+	for(i=0;i<nb_frames;i++){
+		if(semop(feature_input->semid, take, 2) != 0){
+			return;
+		}
+		fill_page(PAGE_REF(feature_input, i%feature_input->buffer_depth), &geometry, i, 0);
+		semop(feature_input->semid, &post, 1);
+	}
+}
+
+/**
+ * int listen_socket(const char* path)
+ * @brief bind the producer socket, a stale one is replaced
+ * @param path, socket path
+ * @return listening socket, -1 on failure
+ */
+static int listen_socket(const char* path){
+
+	struct sockaddr_un addr;
+	int server;
+
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "produce: socket path too long\n");
+		return -1;
+	}
+
+	if((server = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0){
+		perror("produce socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if(bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 1) != 0){
+		perror("produce bind");
+		close(server);
+		return -1;
+	}
+
+	return server;
+}
+
+/**
+ * int serve_app(int client, double rate_hz, int max_frames)
+ * @brief handshake with an app, then fill the pages it requests until it hangs up
+ * @param client, connection to the app
+ * @param rate_hz, pages per second, 0 fills each page as soon as it is requested
+ * @param max_frames, the producer stops after it, 0 for no limit
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the handshake failed
+ */
+static int serve_app(int client, double rate_hz, int max_frames){
+
+	sock_geometry_t geometry;
+	char control[CMSG_SPACE(SOCK_NB_FDS*sizeof(int))];
+	int fds[SOCK_NB_FDS];
+	struct iovec iov = {&geometry, sizeof(geometry)};
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct pollfd pfds[2];
+	struct timespec next;
+	uint64_t credits = 0, count, one = 1;
+	size_t size;
+	char* pages;
+	int frame;
+
+	if(recv(client, &geometry, sizeof(geometry), 0) != sizeof(geometry) ||
+	   geometry.magic != SOCK_PROTO_MAGIC || geometry.version != SOCK_PROTO_VERSION){
+		fprintf(stderr, "produce: hello not recognized\n");
+		return EXIT_FAILURE;
+	}
+
+	/*the test producer writes the app's own geometry*/
+	geometry.status = 0;
+	if(geometry.nb_features < 2 || geometry.buffer_depth < 1 || geometry.buffer_depth > BENCH_MAX_DEPTH ||
+	   (geometry.feature_size != sizeof(float) && geometry.feature_size != sizeof(double)) ||
+	   geometry.pages_offset < 0 || geometry.feat_offset < (int)sizeof(frame_info_t) ||
+	   geometry.page_stride < geometry.feat_offset+geometry.nb_features*geometry.feature_size){
+		geometry.status = EINVAL;
+		send(client, &geometry, sizeof(geometry), MSG_NOSIGNAL);
+		return EXIT_FAILURE;
+	}
+	size = geometry.pages_offset+(size_t)geometry.buffer_depth*geometry.page_stride;
+
+	/*sealed at its size, the app mapping can't be cut under it*/
+	fds[SOCK_FD_PAGES] = memfd_create("braintone_features", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	fds[SOCK_FD_DONE] = eventfd(0, EFD_CLOEXEC);
+	fds[SOCK_FD_REQUEST] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(fds[SOCK_FD_PAGES] < 0 || fds[SOCK_FD_DONE] < 0 || fds[SOCK_FD_REQUEST] < 0 ||
+	   ftruncate(fds[SOCK_FD_PAGES], size) != 0 ||
+	   fcntl(fds[SOCK_FD_PAGES], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 ||
+	   (pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[SOCK_FD_PAGES], 0)) == MAP_FAILED){
+		perror("produce pages");
+		close_fds(fds);
+		return EXIT_FAILURE;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(SOCK_NB_FDS*sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if(sendmsg(client, &msg, MSG_NOSIGNAL) != sizeof(geometry)){
+		perror("produce setup");
+		munmap(pages, size);
+		close_fds(fds);
+		return EXIT_FAILURE;
+	}
+
+	/*the request eventfd and the hang up of the app*/
+	pfds[0].fd = fds[SOCK_FD_REQUEST];
+	pfds[0].events = POLLIN;
+	pfds[1].fd = client;
+	pfds[1].events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for(frame=0;producing && (max_frames == 0 || frame < max_frames);){
+
+		if(credits == 0){
+			if(poll(pfds, 2, -1) <= 0){
+				continue;
+			}
+			if(pfds[1].revents != 0){
+				break;
+			}
+			if(read(fds[SOCK_FD_REQUEST], &count, sizeof(count)) == sizeof(count)){
+				credits += count;
+			}
+			continue;
+		}
+
+		if(rate_hz > 0){
+			next.tv_nsec += (long)(1e9/rate_hz);
+			next.tv_sec += next.tv_nsec/1000000000L;
+			next.tv_nsec %= 1000000000L;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+
+		fill_page(&(pages[geometry.pages_offset+(frame%geometry.buffer_depth)*geometry.page_stride]),
+				  &geometry, frame, rate_hz);
+		if(write(fds[SOCK_FD_DONE], &one, sizeof(one)) != sizeof(one)){
+			break;
+		}
+		credits--;
+		frame++;
+	}
+
+	munmap(pages, size);
+	close_fds(fds);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * void close_fds(int* fds)
+ * @brief close the descriptors of a connection that are open
+ * @param fds, SOCK_NB_FDS descriptors, -1 if not open
+ */
+static void close_fds(int* fds){
+
+	int i;
+
+	for(i=0;i<SOCK_NB_FDS;i++){
+		if(fds[i] >= 0){
+			close(fds[i]);
+		}
+	}
+}
+
+/**
+ * void fill_page(char* page, sock_geometry_t* geometry, int frame, double rate_hz)
+ * @brief write a page. The bench stamps it (first feature) and numbers it (second
+ *        feature); the test producer writes a spectrum with an alpha peak that
+ *        slowly rises and falls, so the app has something to give feedback on.
+ * @param page, page to write
+ * @param geometry, page geometry
+ * @param frame, frame number
+ * @param rate_hz, pages per second of the test producer, 0 in the bench
+ */
+static void fill_page(char* page, sock_geometry_t* geometry, int frame, double rate_hz){
+
+	char* features = &(page[geometry->feat_offset]);
+	double value, time = (rate_hz > 0)?frame/rate_hz:0;
+	int j;
+
+	((frame_info_t*)page)->eye_blink_detected = 0x00;
+
+	for(j=0;j<geometry->nb_features;j++){
+		if(rate_hz <= 0){
+			value = (j == 0)?now_us():(j == 1)?frame:0;
+		}else{
+			/*1/f background, alpha around bin 10 of each 55 bins channel*/
+			value = 1.0/(1+j%55)+(1.5+sin(2*M_PI*time/30.0))*exp(-0.5*pow((j%55-10)/1.5, 2))+
+					0.05*rand()/RAND_MAX;
+		}
+		if(geometry->feature_size == sizeof(float)){
+			((float*)features)[j] = value;
+		}else{
+			((double*)features)[j] = value;
+		}
+	}
+}
+
+/**
+ * void report(const char* name, bench_result_t* result)
+ * @brief median, 99th percentile and maximum of the latencies, warm up left out
+ * @param name, input name
+ * @param result, latencies (sorted in place)
+ */
+static void report(const char* name, bench_result_t* result){
+
+	int nb = result->nb_frames-BENCH_WARMUP;
+	double* wake = &(result->wake_us[BENCH_WARMUP]);
+	double* round_trip = &(result->round_trip_us[BENCH_WARMUP]);
+
+	qsort(wake, nb, sizeof(double), compare_double);
+	qsort(round_trip, nb, sizeof(double), compare_double);
+
+	printf("%-5s %8.1f %8.1f %10.1f %8.1f %8.1f %10.1f\n", name,
+		   wake[nb/2], wake[nb*99/100], wake[nb-1],
+		   round_trip[nb/2], round_trip[nb*99/100], round_trip[nb-1]);
+}
+
+/**
+ * int compare_double(const void* a, const void* b)
+ * @brief qsort order of doubles
+ */
+static int compare_double(const void* a, const void* b){
+	return (*(const double*)a > *(const double*)b)-(*(const double*)a < *(const double*)b);
+}
+
+/**
+ * double now_us(void)
+ * @brief monotonic clock, shared by the processes of the bench
+ * @return time (us)
+ */
+static double now_us(void){
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1e6+now.tv_nsec/1e3;
+}
+
+/**
+ * void stop_producing(int sig)
+ * @brief signal handler of the test producer
+ */
+static void stop_producing(int sig __attribute__((unused))){
+	producing = 0;
+}